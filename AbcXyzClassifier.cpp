@@ -0,0 +1,180 @@
+#include "AbcXyzClassifier.h"
+#include "Tracing.h"
+#include <QtConcurrent>
+#include <QHash>
+#include <QVector>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const double kClassAShare = 0.80;
+const double kClassBShare = 0.95;
+const double kClassXVariation = 0.5;
+const double kClassYVariation = 1.0;
+const int kItemsPerChunk = 256;
+
+struct ItemRange {
+    int begin;
+    int end;
+};
+
+struct Chunk {
+    int firstRange;
+    int lastRange;
+};
+
+struct Partial {
+    QList<AbcXyzRow> rows;
+};
+}
+
+AbcXyzClassifier::AbcXyzClassifier(DatabaseManager *dbManager, ConsumptionRollup *rollup)
+    : dbManager(dbManager), rollup(rollup) {}
+
+bool AbcXyzClassifier::classify(const QString &startDate, const QString &endDate, QList<AbcXyzRow> *rows) {
+    EPI_TRACE_SCOPE("AbcXyzClassifier::classify");
+    if (!rollup->refresh()) {
+        return false;
+    }
+
+    QVariantList bounds;
+    if (!dbManager->executeQuery(
+            "SELECT COALESCE(NULLIF(?, ''), MIN(dia)), COALESCE(NULLIF(?, ''), MAX(dia)) FROM consumo_diario",
+            {startDate, endDate}, true, &bounds) || bounds.isEmpty()) {
+        return false;
+    }
+    const QString start = bounds[0].toList()[0].toString();
+    const QString end = bounds[0].toList()[1].toString().left(10);
+
+    QVariantList items;
+    if (!dbManager->executeQuery("SELECT id, nome, ca, tamanho, preco FROM itens", {}, true, &items)) {
+        return false;
+    }
+
+    QVariantList weekly;
+    int weeks = 1;
+    if (!start.isEmpty()) {
+        QVariantList span;
+        if (!dbManager->executeQuery("SELECT CAST((julianday(?) - julianday(?)) / 7 AS INTEGER) + 1",
+                                     {end, start}, true, &span) || span.isEmpty()) {
+            return false;
+        }
+        weeks = std::max(1, span[0].toList()[0].toInt());
+        if (!dbManager->executeQuery(
+                "SELECT item_id, CAST((julianday(dia) - julianday(?)) / 7 AS INTEGER), retirado - devolvido "
+                "FROM consumo_diario WHERE dia >= ? AND dia <= ? ORDER BY item_id",
+                {start, start, end}, true, &weekly)) {
+            return false;
+        }
+    }
+
+    // Flatten the rollup into plain columns and split it into per-item ranges.
+    const int rowCount = weekly.size();
+    QVector<int> itemIds(rowCount), weekIndex(rowCount), quantities(rowCount);
+    QVector<ItemRange> ranges;
+    for (int i = 0; i < rowCount; ++i) {
+        const QVariantList row = weekly[i].toList();
+        itemIds[i] = row[0].toInt();
+        weekIndex[i] = std::clamp(row[1].toInt(), 0, weeks - 1);
+        quantities[i] = row[2].toInt();
+        if (ranges.isEmpty() || itemIds[ranges.last().begin] != itemIds[i]) {
+            ranges.append({i, i + 1});
+        } else {
+            ranges.last().end = i + 1;
+        }
+    }
+
+    QHash<int, AbcXyzRow> catalog;
+    catalog.reserve(items.size());
+    for (const auto &entry : items) {
+        const QVariantList item = entry.toList();
+        AbcXyzRow row;
+        row.itemId = item[0].toInt();
+        row.nome = item[1].toString();
+        row.ca = item[2].toString();
+        row.tamanho = item[3].toString();
+        row.preco = item[4].toDouble();
+        catalog.insert(row.itemId, row);
+    }
+
+    QVector<Chunk> chunks;
+    for (int first = 0; first < ranges.size(); first += kItemsPerChunk) {
+        chunks.append({first, std::min<int>(first + kItemsPerChunk, ranges.size())});
+    }
+
+    auto map = [&](const Chunk &chunk) {
+        Partial partial;
+        QVector<double> buckets(weeks);
+        for (int r = chunk.firstRange; r < chunk.lastRange; ++r) {
+            const ItemRange &range = ranges[r];
+            auto known = catalog.constFind(itemIds[range.begin]);
+            if (known == catalog.constEnd()) continue;
+
+            std::fill(buckets.begin(), buckets.end(), 0.0);
+            qint64 total = 0;
+            for (int i = range.begin; i < range.end; ++i) {
+                buckets[weekIndex[i]] += quantities[i];
+                total += quantities[i];
+            }
+            const double mean = double(total) / weeks;
+            double variance = 0;
+            for (double bucket : buckets) {
+                variance += (bucket - mean) * (bucket - mean);
+            }
+            variance /= weeks;
+
+            AbcXyzRow row = known.value();
+            row.quantity = std::max<qint64>(0, total);
+            row.value = row.quantity * row.preco;
+            row.variation = mean > 0 ? std::sqrt(variance) / mean : 0;
+            partial.rows.append(row);
+        }
+        return partial;
+    };
+    auto reduce = [](Partial &result, const Partial &partial) {
+        result.rows += partial.rows;
+    };
+    Partial merged = QtConcurrent::blockingMappedReduced<Partial>(chunks, map, reduce, QtConcurrent::UnorderedReduce);
+
+    // Items without consumption in the period still get a class (C/Z).
+    for (const auto &row : merged.rows) {
+        catalog.remove(row.itemId);
+    }
+    for (const auto &row : catalog) {
+        merged.rows.append(row);
+    }
+
+    std::sort(merged.rows.begin(), merged.rows.end(), [](const AbcXyzRow &a, const AbcXyzRow &b) {
+        return a.value != b.value ? a.value > b.value : a.itemId < b.itemId;
+    });
+    double totalValue = 0;
+    for (const auto &row : merged.rows) {
+        totalValue += row.value;
+    }
+
+    double cumulative = 0;
+    for (auto &row : merged.rows) {
+        cumulative += row.value;
+        row.cumulativeShare = totalValue > 0 ? cumulative / totalValue : 1.0;
+        // An item is A while the running share *before* it is under the cut,
+        // so the item that crosses 80% still counts as A.
+        const double before = totalValue > 0 ? (cumulative - row.value) / totalValue : 1.0;
+        if (row.value > 0 && before < kClassAShare) {
+            row.abc = 'A';
+        } else if (row.value > 0 && before < kClassBShare) {
+            row.abc = 'B';
+        } else {
+            row.abc = 'C';
+        }
+        if (row.quantity > 0 && row.variation <= kClassXVariation) {
+            row.xyz = 'X';
+        } else if (row.quantity > 0 && row.variation <= kClassYVariation) {
+            row.xyz = 'Y';
+        } else {
+            row.xyz = 'Z';
+        }
+    }
+
+    *rows = merged.rows;
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef ABCXYZCLASSIFIER_H
+#define ABCXYZCLASSIFIER_H
+
+#include <QChar>
+#include <QList>
+#include <QString>
+#include "DatabaseManager.h"
+#include "ConsumptionRollup.h"
+
+struct AbcXyzRow {
+    int itemId = 0;
+    QString nome;
+    QString ca;
+    QString tamanho;
+    double preco = 0;
+    qint64 quantity = 0;
+    double value = 0;
+    double cumulativeShare = 0;
+    double variation = 0;
+    QChar abc = 'C';
+    QChar xyz = 'Z';
+};
+
+// ABC by consumption value (preco x net withdrawn quantity) and XYZ by the
+// coefficient of variation of weekly demand. The consumo_diario rollup
+// for the period is read once; per-item weekly statistics are computed
+// in chunks on the thread pool and merged with a parallel reduction.
+class AbcXyzClassifier {
+public:
+    AbcXyzClassifier(DatabaseManager *dbManager, ConsumptionRollup *rollup);
+
+    // Empty dates mean the whole history in the rollup.
+    bool classify(const QString &startDate, const QString &endDate, QList<AbcXyzRow> *rows);
+
+private:
+    DatabaseManager *dbManager;
+    ConsumptionRollup *rollup;
+};
+
+#endif // ABCXYZCLASSIFIER_H
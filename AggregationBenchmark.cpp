@@ -0,0 +1,195 @@
+#include "AggregationBenchmark.h"
+#include "AggregationKernels.h"
+#include "Tracing.h"
+#include <QDate>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <sqlite3.h>
+#include <algorithm>
+#include <limits>
+
+namespace {
+const int kItems = 2000;
+const int kCollaborators = 5000;
+const int kCompanies = 20;
+const int kDays = 5 * 365;
+const int kBlockRows = 4096;
+
+struct Case {
+    const char *name;
+    const char *keyColumn;
+    const std::vector<qint32> *keys;
+    qint32 keyLimit;
+    qint32 firstDay;
+    qint32 lastDay;
+    qint32 colaborador;
+};
+
+struct Columns {
+    const qint32 *day;
+    const qint32 *colaborador;
+    const qint32 *quantity;
+    qint64 rows;
+};
+
+Aggregation::Groups runKernel(const Columns &columns, const Case &c, bool direct) {
+    std::vector<qint64> counts(direct ? size_t(c.keyLimit) : 0, 0);
+    std::vector<qint64> sums(direct ? size_t(c.keyLimit) : 0, 0);
+    Aggregation::HashGroups hash;
+    const qint32 *keys = c.keys->data();
+    quint8 mask[kBlockRows];
+    for (qint64 base = 0; base < columns.rows; base += kBlockRows) {
+        const qint64 count = std::min<qint64>(kBlockRows, columns.rows - base);
+        Aggregation::selectRange(columns.day + base, count, c.firstDay, c.lastDay, mask);
+        if (c.colaborador) {
+            Aggregation::andEqual(columns.colaborador + base, count, c.colaborador, mask);
+        }
+        Aggregation::andLess(columns.quantity + base, count, 0, mask);
+        if (direct) {
+            Aggregation::groupDirect(keys + base, columns.quantity + base, mask, count, c.keyLimit, counts.data(),
+                                     sums.data());
+        } else {
+            hash.add(keys + base, columns.quantity + base, mask, count);
+        }
+    }
+    return direct ? Aggregation::collectDirect(counts.data(), sums.data(), c.keyLimit) : hash.result();
+}
+
+bool runSql(sqlite3 *db, const QString &sql, const Case &c, Aggregation::Groups *groups, QString *error) {
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.toUtf8().constData(), -1, &stmt, nullptr) != SQLITE_OK) {
+        *error = QString::fromUtf8(sqlite3_errmsg(db));
+        return false;
+    }
+    sqlite3_bind_int(stmt, 1, c.firstDay);
+    sqlite3_bind_int(stmt, 2, c.lastDay);
+    if (c.colaborador) {
+        sqlite3_bind_int(stmt, 3, c.colaborador);
+    }
+    *groups = Aggregation::Groups();
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        groups->keys.append(sqlite3_column_int(stmt, 0));
+        groups->counts.append(sqlite3_column_int64(stmt, 1));
+        groups->sums.append(sqlite3_column_int64(stmt, 2));
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        *error = QString::fromUtf8(sqlite3_errmsg(db));
+        return false;
+    }
+    return true;
+}
+
+bool sameGroups(const Aggregation::Groups &a, const Aggregation::Groups &b) {
+    return a.keys == b.keys && a.counts == b.counts && a.sums == b.sums;
+}
+
+template <typename Fn>
+double bestOf(int repeats, Fn fn) {
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repeats; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        fn();
+        best = std::min(best, timer.nsecsElapsed() / 1e6);
+    }
+    return best;
+}
+}
+
+AggregationBenchmark::AggregationBenchmark(qint64 rows, quint32 seed)
+    : rows(rows), seed(seed), generateMs(0), loadMs(0) {}
+
+void AggregationBenchmark::generate() {
+    EPI_TRACE_SCOPE("AggregationBenchmark::generate");
+    QElapsedTimer timer;
+    timer.start();
+    QRandomGenerator random(seed);
+    const qint32 firstDay = qint32(QDate(2021, 1, 1).toJulianDay());
+    for (auto *column : {&day, &item, &colaborador, &empresa, &quantity}) {
+        column->resize(size_t(rows));
+    }
+    for (qint64 r = 0; r < rows; ++r) {
+        // Squaring a uniform draw makes low item ids far more popular,
+        // like a few EPIs (gloves, masks) dominating withdrawals.
+        const double u = random.generateDouble();
+        item[size_t(r)] = 1 + std::min(kItems - 1, int(kItems * u * u));
+        colaborador[size_t(r)] = 1 + int(random.bounded(kCollaborators));
+        empresa[size_t(r)] = 1 + colaborador[size_t(r)] % kCompanies;
+        day[size_t(r)] = firstDay + int(random.bounded(kDays));
+        quantity[size_t(r)] = random.bounded(10) == 0 ? 1 + int(random.bounded(3)) : -(1 + int(random.bounded(5)));
+    }
+    generateMs = timer.elapsed();
+}
+
+bool AggregationBenchmark::run(QList<BenchmarkCase> *cases, QString *error) {
+    EPI_TRACE_SCOPE("AggregationBenchmark::run");
+    generate();
+
+    QElapsedTimer timer;
+    timer.start();
+    sqlite3 *db = nullptr;
+    if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+        *error = db ? QString::fromUtf8(sqlite3_errmsg(db)) : QString("sem memória");
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_stmt *insert = nullptr;
+    bool ok = sqlite3_exec(db,
+                           "CREATE TABLE fatos (dia INTEGER, item_id INTEGER, colaborador_id INTEGER, "
+                           "empresa_id INTEGER, quantidade INTEGER); BEGIN",
+                           nullptr, nullptr, nullptr) == SQLITE_OK &&
+              sqlite3_prepare_v2(db, "INSERT INTO fatos VALUES (?, ?, ?, ?, ?)", -1, &insert, nullptr) == SQLITE_OK;
+    for (qint64 r = 0; ok && r < rows; ++r) {
+        sqlite3_bind_int(insert, 1, day[size_t(r)]);
+        sqlite3_bind_int(insert, 2, item[size_t(r)]);
+        sqlite3_bind_int(insert, 3, colaborador[size_t(r)]);
+        sqlite3_bind_int(insert, 4, empresa[size_t(r)]);
+        sqlite3_bind_int(insert, 5, quantity[size_t(r)]);
+        ok = sqlite3_step(insert) == SQLITE_DONE;
+        sqlite3_reset(insert);
+    }
+    sqlite3_finalize(insert);
+    ok = ok && sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!ok) {
+        *error = QString::fromUtf8(sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return false;
+    }
+    loadMs = timer.elapsed();
+
+    const qint32 lastDay = qint32(QDate(2021, 1, 1).toJulianDay()) + kDays - 1;
+    const qint32 noLimit = std::numeric_limits<qint32>::max();
+    const Case benchCases[] = {
+        {"Retiradas por EPI no último ano", "item_id", &item, kItems + 1, lastDay - 364, lastDay, 0},
+        {"Retiradas por EPI de um colaborador", "item_id", &item, kItems + 1, 0, noLimit, 17},
+        {"Retiradas por colaborador em 3 meses", "colaborador_id", &colaborador, kCollaborators + 1, lastDay - 89,
+         lastDay, 0},
+        {"Retiradas por empresa, todo o período", "empresa_id", &empresa, kCompanies + 1, 0, noLimit, 0},
+    };
+    const Columns columns{day.data(), colaborador.data(), quantity.data(), rows};
+    for (const Case &c : benchCases) {
+        BenchmarkCase result;
+        result.name = c.name;
+        result.sql = QString("SELECT %1, COUNT(*), SUM(quantidade) FROM fatos "
+                             "WHERE dia BETWEEN ? AND ? AND quantidade < 0%2 GROUP BY %1 ORDER BY %1")
+                         .arg(c.keyColumn, c.colaborador ? " AND colaborador_id = ?" : "");
+        Aggregation::Groups fromSql, direct, hashed;
+        QString sqlError;
+        bool sqlOk = true;
+        result.sqliteMs = bestOf(kRepeats, [&] { sqlOk = sqlOk && runSql(db, result.sql, c, &fromSql, &sqlError); });
+        if (!sqlOk) {
+            *error = sqlError;
+            sqlite3_close(db);
+            return false;
+        }
+        result.directMs = bestOf(kRepeats, [&] { direct = runKernel(columns, c, true); });
+        result.hashMs = bestOf(kRepeats, [&] { hashed = runKernel(columns, c, false); });
+        result.groups = int(fromSql.keys.size());
+        result.matches = sameGroups(fromSql, direct) && sameGroups(fromSql, hashed);
+        cases->append(result);
+    }
+    sqlite3_close(db);
+    return true;
+}
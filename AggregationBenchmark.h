@@ -0,0 +1,48 @@
+#ifndef AGGREGATIONBENCHMARK_H
+#define AGGREGATIONBENCHMARK_H
+
+#include <QList>
+#include <QString>
+#include <vector>
+
+struct BenchmarkCase {
+    QString name;
+    QString sql;
+    int groups = 0;
+    double sqliteMs = 0;
+    double directMs = 0;
+    double hashMs = 0;
+    bool matches = false;
+};
+
+// Times the Aggregation kernels against the equivalent SQLite GROUP BY on
+// a synthetic movement set: skewed item popularity, a few thousand
+// collaborators in twenty companies, five years of days, one withdrawal
+// in ten returned. The same rows are loaded into an in-memory SQLite
+// table and into columns, every case runs both ways, and the results are
+// compared group by group. Each timing is the best of kRepeats runs.
+class AggregationBenchmark {
+public:
+    static const int kRepeats = 5;
+
+    explicit AggregationBenchmark(qint64 rows, quint32 seed = 42);
+
+    bool run(QList<BenchmarkCase> *cases, QString *error);
+    qint64 generationMs() const { return generateMs; }
+    qint64 sqliteLoadMs() const { return loadMs; }
+
+private:
+    void generate();
+
+    qint64 rows;
+    quint32 seed;
+    qint64 generateMs;
+    qint64 loadMs;
+    std::vector<qint32> day;
+    std::vector<qint32> item;
+    std::vector<qint32> colaborador;
+    std::vector<qint32> empresa;
+    std::vector<qint32> quantity;
+};
+
+#endif // AGGREGATIONBENCHMARK_H
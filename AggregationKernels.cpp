@@ -0,0 +1,211 @@
+#include "AggregationKernels.h"
+#include <algorithm>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EPI_AGGREGATION_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace Aggregation {
+
+namespace {
+enum class Op { Range, Equal, Less, Greater };
+
+template <Op op>
+inline bool accept(qint32 value, qint32 a, qint32 b) {
+    if constexpr (op == Op::Range) {
+        return value >= a && value <= b;
+    } else if constexpr (op == Op::Equal) {
+        return value == a;
+    } else if constexpr (op == Op::Less) {
+        return value < a;
+    } else {
+        return value > a;
+    }
+}
+
+#ifdef EPI_AGGREGATION_SSE2
+template <Op op>
+inline __m128i accept4(__m128i v, __m128i a, __m128i b) {
+    if constexpr (op == Op::Range) {
+        const __m128i outside = _mm_or_si128(_mm_cmplt_epi32(v, a), _mm_cmpgt_epi32(v, b));
+        return _mm_xor_si128(outside, _mm_set1_epi32(-1));
+    } else if constexpr (op == Op::Equal) {
+        return _mm_cmpeq_epi32(v, a);
+    } else if constexpr (op == Op::Less) {
+        return _mm_cmplt_epi32(v, a);
+    } else {
+        return _mm_cmpgt_epi32(v, a);
+    }
+}
+#endif
+
+// Writes (narrow = false) or ANDs into (narrow = true) the mask, 16 rows
+// per step: four 4-lane compares packed down to 16 mask bytes.
+template <Op op, bool narrow>
+void compare(const qint32 *values, qint64 count, qint32 a, qint32 b, quint8 *mask) {
+    qint64 i = 0;
+#ifdef EPI_AGGREGATION_SSE2
+    const __m128i va = _mm_set1_epi32(a);
+    const __m128i vb = _mm_set1_epi32(b);
+    const __m128i one = _mm_set1_epi8(1);
+    for (; i + 16 <= count; i += 16) {
+        const __m128i *in = reinterpret_cast<const __m128i *>(values + i);
+        const __m128i lanes0 = accept4<op>(_mm_loadu_si128(in), va, vb);
+        const __m128i lanes1 = accept4<op>(_mm_loadu_si128(in + 1), va, vb);
+        const __m128i lanes2 = accept4<op>(_mm_loadu_si128(in + 2), va, vb);
+        const __m128i lanes3 = accept4<op>(_mm_loadu_si128(in + 3), va, vb);
+        const __m128i bytes =
+            _mm_packs_epi16(_mm_packs_epi32(lanes0, lanes1), _mm_packs_epi32(lanes2, lanes3));
+        __m128i *out = reinterpret_cast<__m128i *>(mask + i);
+        const __m128i base = narrow ? _mm_loadu_si128(out) : one;
+        _mm_storeu_si128(out, _mm_and_si128(bytes, base));
+    }
+#endif
+    for (; i < count; ++i) {
+        const quint8 selected = quint8(accept<op>(values[i], a, b));
+        mask[i] = narrow ? quint8(mask[i] & selected) : selected;
+    }
+}
+}
+
+void selectRange(const qint32 *values, qint64 count, qint32 low, qint32 high, quint8 *mask) {
+    compare<Op::Range, false>(values, count, low, high, mask);
+}
+
+void andEqual(const qint32 *values, qint64 count, qint32 key, quint8 *mask) {
+    compare<Op::Equal, true>(values, count, key, 0, mask);
+}
+
+void andLess(const qint32 *values, qint64 count, qint32 bound, quint8 *mask) {
+    compare<Op::Less, true>(values, count, bound, 0, mask);
+}
+
+void andGreater(const qint32 *values, qint64 count, qint32 bound, quint8 *mask) {
+    compare<Op::Greater, true>(values, count, bound, 0, mask);
+}
+
+void andLookup(const qint32 *values, qint64 count, const quint8 *allowed, qint32 allowedSize, quint8 *mask) {
+    for (qint64 i = 0; i < count; ++i) {
+        const qint32 v = values[i];
+        mask[i] &= quint8(v >= 0 && v < allowedSize && allowed[v]);
+    }
+}
+
+void gather(const qint32 *index, qint64 count, const qint32 *table, qint32 tableSize, qint32 *out) {
+    for (qint64 i = 0; i < count; ++i) {
+        const qint32 v = index[i];
+        out[i] = v >= 0 && v < tableSize ? table[v] : 0;
+    }
+}
+
+qint64 countSelected(const quint8 *mask, qint64 count) {
+    return std::accumulate(mask, mask + count, qint64(0));
+}
+
+void groupDirect(const qint32 *keys, const qint32 *values, const quint8 *mask, qint64 count, qint32 keyLimit,
+                 qint64 *counts, qint64 *sums) {
+    for (qint64 i = 0; i < count; ++i) {
+        const qint32 key = keys[i];
+        // One unsigned compare covers both negative and too-large keys.
+        if (!mask[i] || quint32(key) >= quint32(keyLimit)) continue;
+        counts[key] += 1;
+        sums[key] += values[i];
+    }
+}
+
+Groups collectDirect(const qint64 *counts, const qint64 *sums, qint32 keyLimit) {
+    Groups groups;
+    for (qint32 key = 0; key < keyLimit; ++key) {
+        if (counts[key]) {
+            groups.keys.append(key);
+            groups.counts.append(counts[key]);
+            groups.sums.append(sums[key]);
+        }
+    }
+    return groups;
+}
+
+HashGroups::HashGroups(int expectedKeys) : shift(32), used(0) {
+    int capacity = 16;
+    while (capacity < expectedKeys * 2) {
+        capacity *= 2;
+    }
+    for (int c = capacity; c > 1; c /= 2) {
+        --shift;
+    }
+    slotKeys.resize(capacity);
+    slotCounts.fill(0, capacity);
+    slotSums.fill(0, capacity);
+    occupied.fill(0, capacity);
+}
+
+int HashGroups::slotFor(qint32 key) const {
+    // Fibonacci hashing: the top bits of key * 2^32/phi.
+    const int capacityMask = int(slotKeys.size()) - 1;
+    int slot = int((quint32(key) * 2654435769u) >> shift);
+    while (occupied[slot] && slotKeys[slot] != key) {
+        slot = (slot + 1) & capacityMask;
+    }
+    return slot;
+}
+
+void HashGroups::grow() {
+    const QVector<qint32> oldKeys = slotKeys;
+    const QVector<qint64> oldCounts = slotCounts;
+    const QVector<qint64> oldSums = slotSums;
+    const QVector<quint8> oldOccupied = occupied;
+    const int capacity = int(oldKeys.size()) * 2;
+    --shift;
+    slotKeys.fill(0, capacity);
+    slotCounts.fill(0, capacity);
+    slotSums.fill(0, capacity);
+    occupied.fill(0, capacity);
+    for (int i = 0; i < oldKeys.size(); ++i) {
+        if (!oldOccupied[i]) continue;
+        const int slot = slotFor(oldKeys[i]);
+        occupied[slot] = 1;
+        slotKeys[slot] = oldKeys[i];
+        slotCounts[slot] = oldCounts[i];
+        slotSums[slot] = oldSums[i];
+    }
+}
+
+void HashGroups::add(const qint32 *keys, const qint32 *values, const quint8 *mask, qint64 count) {
+    for (qint64 i = 0; i < count; ++i) {
+        if (!mask[i]) continue;
+        int slot = slotFor(keys[i]);
+        if (!occupied[slot]) {
+            if ((used + 1) * 2 > slotKeys.size()) {
+                grow();
+                slot = slotFor(keys[i]);
+            }
+            occupied[slot] = 1;
+            slotKeys[slot] = keys[i];
+            ++used;
+        }
+        slotCounts[slot] += 1;
+        slotSums[slot] += values[i];
+    }
+}
+
+Groups HashGroups::result() const {
+    QVector<int> occupiedSlots;
+    occupiedSlots.reserve(used);
+    for (int i = 0; i < slotKeys.size(); ++i) {
+        if (occupied[i]) {
+            occupiedSlots.append(i);
+        }
+    }
+    std::sort(occupiedSlots.begin(), occupiedSlots.end(), [this](int a, int b) { return slotKeys[a] < slotKeys[b]; });
+    Groups groups;
+    for (int slot : occupiedSlots) {
+        groups.keys.append(slotKeys[slot]);
+        groups.counts.append(slotCounts[slot]);
+        groups.sums.append(slotSums[slot]);
+    }
+    return groups;
+}
+
+}
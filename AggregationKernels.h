@@ -0,0 +1,75 @@
+#ifndef AGGREGATIONKERNELS_H
+#define AGGREGATIONKERNELS_H
+
+#include <QVector>
+#include <QtGlobal>
+
+// Filter-then-group-by-sum over in-memory int32 columns, for reports that
+// would otherwise run a GROUP BY over SQLite rows. A filter writes or
+// narrows a selection mask, one byte per row (1 = selected); the range and
+// comparison filters use SSE2 on x86 and plain loops the compiler can
+// vectorize elsewhere. Group-by then adds each selected row's value into
+// its key's slot: directly indexed arrays for dense ids (items,
+// collaborators, companies), an open-addressing table for anything else.
+//
+// Kernels work on any slice of the columns, so callers can stream long
+// columns through a small mask block that stays in cache.
+namespace Aggregation {
+
+// Keys up to this bound are grouped through direct-indexed arrays.
+const qint32 kDirectKeyLimit = 1 << 22;
+
+// mask[i] = low <= values[i] <= high
+void selectRange(const qint32 *values, qint64 count, qint32 low, qint32 high, quint8 *mask);
+// mask[i] &= values[i] == key
+void andEqual(const qint32 *values, qint64 count, qint32 key, quint8 *mask);
+// mask[i] &= values[i] < bound, or > bound
+void andLess(const qint32 *values, qint64 count, qint32 bound, quint8 *mask);
+void andGreater(const qint32 *values, qint64 count, qint32 bound, quint8 *mask);
+// mask[i] &= allowed[values[i]], out-of-range values are rejected.
+void andLookup(const qint32 *values, qint64 count, const quint8 *allowed, qint32 allowedSize, quint8 *mask);
+// out[i] = table[index[i]], 0 when out of range.
+void gather(const qint32 *index, qint64 count, const qint32 *table, qint32 tableSize, qint32 *out);
+qint64 countSelected(const quint8 *mask, qint64 count);
+
+// counts[k] += 1 and sums[k] += values[i] for each selected row with key
+// k in [0, keyLimit); other keys are skipped. The arrays hold keyLimit
+// entries and accumulate across calls.
+void groupDirect(const qint32 *keys, const qint32 *values, const quint8 *mask, qint64 count, qint32 keyLimit,
+                 qint64 *counts, qint64 *sums);
+
+struct Groups {
+    QVector<qint32> keys;
+    QVector<qint64> counts;
+    QVector<qint64> sums;
+};
+
+// Non-empty slots of direct-indexed arrays, in key order.
+Groups collectDirect(const qint64 *counts, const qint64 *sums, qint32 keyLimit);
+
+// Group-by for sparse or unbounded keys: linear probing over power-of-two
+// slot arrays, grown at half load.
+class HashGroups {
+public:
+    explicit HashGroups(int expectedKeys = 1024);
+
+    void add(const qint32 *keys, const qint32 *values, const quint8 *mask, qint64 count);
+    int size() const { return used; }
+    // In key order, like collectDirect().
+    Groups result() const;
+
+private:
+    void grow();
+    int slotFor(qint32 key) const;
+
+    QVector<qint32> slotKeys;
+    QVector<qint64> slotCounts;
+    QVector<qint64> slotSums;
+    QVector<quint8> occupied;
+    int shift;
+    int used;
+};
+
+}
+
+#endif // AGGREGATIONKERNELS_H
@@ -0,0 +1,296 @@
+#include "AnalyticsCache.h"
+#include "AggregationKernels.h"
+#include "ArchiveManager.h"
+#include "Tracing.h"
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+#include <limits>
+
+namespace {
+const quint32 kFileMagic = 0x45504943; // "EPIC"
+const quint32 kFileVersion = 1;
+const qint64 kChunkSize = 50000;
+// Rows are filtered a block at a time so the selection masks stay in L1.
+const int kBlockRows = 4096;
+// Earliest movement date the archives can hold.
+const char *const kAllHistory = "0001-01-01";
+
+bool writeColumn(QDataStream &out, const std::vector<qint32> &column) {
+    const qint64 bytes = qint64(column.size()) * qint64(sizeof(qint32));
+    return out.writeRawData(reinterpret_cast<const char *>(column.data()), int(bytes)) == bytes;
+}
+
+bool readColumn(QDataStream &in, std::vector<qint32> &column, qint64 rows) {
+    column.resize(size_t(rows));
+    const qint64 bytes = rows * qint64(sizeof(qint32));
+    return in.readRawData(reinterpret_cast<char *>(column.data()), int(bytes)) == bytes;
+}
+}
+
+AnalyticsCache::AnalyticsCache(DatabaseManager *dbManager, ArchiveManager *archiveManager, const QString &cacheFile)
+    : dbManager(dbManager), archiveManager(archiveManager), cacheFile(cacheFile), loaded(false), watermark(0),
+      unsavedRows(0), maxItem(0), maxColaborador(0), maxEmpresa(0), maxCategory(0) {}
+
+void AnalyticsCache::clear() {
+    for (auto *column : {&day, &item, &colaborador, &empresa, &quantity}) {
+        column->clear();
+        column->shrink_to_fit();
+    }
+    watermark = 0;
+    unsavedRows = 0;
+    maxItem = maxColaborador = maxEmpresa = 0;
+    loaded = true;
+}
+
+qint64 AnalyticsCache::memoryUsage() const {
+    qint64 bytes = 0;
+    for (const auto *column : {&day, &item, &colaborador, &empresa, &quantity, &itemCategory}) {
+        bytes += qint64(column->capacity()) * qint64(sizeof(qint32));
+    }
+    return bytes;
+}
+
+void AnalyticsCache::append(const FactRow &row) {
+    day.push_back(row.day);
+    item.push_back(row.itemId);
+    colaborador.push_back(row.colaboradorId);
+    empresa.push_back(row.empresaId);
+    quantity.push_back(row.quantidade);
+    maxItem = std::max(maxItem, row.itemId);
+    maxColaborador = std::max(maxColaborador, row.colaboradorId);
+    maxEmpresa = std::max(maxEmpresa, row.empresaId);
+}
+
+bool AnalyticsCache::refresh() {
+    EPI_TRACE_SCOPE("AnalyticsCache::refresh");
+    if (!loaded) {
+        loaded = true;
+        if (!load()) {
+            clear();
+        }
+    }
+
+    QVariantList categories;
+    if (!dbManager->executeQuery("SELECT id, COALESCE(categoria_id, 0) FROM itens", {}, true, &categories)) {
+        return false;
+    }
+    itemCategory.assign(1, 0);
+    maxCategory = 0;
+    for (const auto &entry : categories) {
+        const QVariantList row = entry.toList();
+        const int id = row[0].toInt();
+        if (id < 0) continue;
+        if (size_t(id) >= itemCategory.size()) {
+            itemCategory.resize(size_t(id) + 1, 0);
+        }
+        itemCategory[size_t(id)] = row[1].toInt();
+        maxCategory = std::max(maxCategory, qint32(row[1].toInt()));
+    }
+
+    // The first load also reads the archived years; every later movement
+    // is in the hot table.
+    const QString source = watermark == 0 ? archiveManager->movementsSource(kAllHistory) : QString("movimentacoes");
+    if (watermark == 0 && !archiveManager->missingYears().isEmpty()) {
+        // Building without them would leave those years out for good.
+        qDebug() << "Analytics Cache Error: archives unavailable for" << archiveManager->missingYears();
+        return false;
+    }
+    QVariantList bounds;
+    if (!dbManager->executeQuery(QString("SELECT MAX(id) FROM %1").arg(source), {}, true, &bounds) || bounds.isEmpty()) {
+        return false;
+    }
+    const qint64 maxId = bounds[0].toList()[0].toLongLong();
+    const QString sql = QString("SELECT %1 FROM %2 m LEFT JOIN usuarios u ON u.id = m.colaborador_id "
+                                "WHERE m.id > ? AND m.id <= ? AND m.colaborador_id IS NOT NULL "
+                                "AND m.motivo IN ('Retirada por colaborador', 'Devolução por colaborador')")
+                            .arg(TypedQuery::selectList<FactRow>(), source);
+    while (watermark < maxId) {
+        const qint64 upper = std::min(watermark + kChunkSize, maxId);
+        QList<FactRow> rows;
+        if (!dbManager->fetch(sql, {watermark, upper}, &rows)) {
+            return false;
+        }
+        for (const FactRow &row : rows) {
+            append(row);
+        }
+        unsavedRows += rows.size();
+        watermark = upper;
+    }
+    if (unsavedRows >= kSaveEveryRows) {
+        save();
+    }
+    return true;
+}
+
+QVector<FactTotals> AnalyticsCache::aggregate(const FactFilter &filter, GroupBy groupBy) const {
+    EPI_TRACE_SCOPE("AnalyticsCache::aggregate");
+    const qint32 first = filter.start.isValid() ? qint32(filter.start.toJulianDay()) : std::numeric_limits<qint32>::min();
+    const qint32 last = filter.end.isValid() ? qint32(filter.end.toJulianDay()) : std::numeric_limits<qint32>::max();
+    const qint32 categoryCount = qint32(itemCategory.size());
+    std::vector<quint8> allowed;
+    if (filter.categoriaId) {
+        allowed.resize(itemCategory.size());
+        for (size_t id = 0; id < itemCategory.size(); ++id) {
+            allowed[id] = quint8(itemCategory[id] == filter.categoriaId);
+        }
+    }
+
+    const qint32 maxKey = groupBy == ByItem ? maxItem
+                        : groupBy == ByColaborador ? maxColaborador
+                        : groupBy == ByEmpresa ? maxEmpresa
+                        : maxCategory;
+    const qint32 *keys = groupBy == ByColaborador ? colaborador.data()
+                       : groupBy == ByEmpresa ? empresa.data()
+                       : item.data();
+    const bool direct = maxKey < Aggregation::kDirectKeyLimit;
+    const qint32 keyLimit = direct ? maxKey + 1 : 0;
+    std::vector<qint64> withdrawals(size_t(keyLimit), 0), withdrawnSums(size_t(keyLimit), 0);
+    std::vector<qint64> returns(size_t(keyLimit), 0), returnedSums(size_t(keyLimit), 0);
+    Aggregation::HashGroups withdrawalGroups, returnGroups;
+
+    const qint64 rows = rowCount();
+    quint8 selected[kBlockRows];
+    quint8 withdrawal[kBlockRows];
+    qint32 categoryKeys[kBlockRows];
+    for (qint64 base = 0; base < rows; base += kBlockRows) {
+        const qint64 count = std::min<qint64>(kBlockRows, rows - base);
+        Aggregation::selectRange(day.data() + base, count, first, last, selected);
+        if (filter.colaboradorId) {
+            Aggregation::andEqual(colaborador.data() + base, count, filter.colaboradorId, selected);
+        }
+        if (filter.empresaId) {
+            Aggregation::andEqual(empresa.data() + base, count, filter.empresaId, selected);
+        }
+        if (filter.categoriaId) {
+            Aggregation::andLookup(item.data() + base, count, allowed.data(), categoryCount, selected);
+        }
+        const qint32 *blockKeys = keys + base;
+        if (groupBy == ByCategoria) {
+            Aggregation::gather(item.data() + base, count, itemCategory.data(), categoryCount, categoryKeys);
+            blockKeys = categoryKeys;
+        }
+        // Withdrawals are the negative quantities, returns the positive.
+        std::copy(selected, selected + count, withdrawal);
+        Aggregation::andLess(quantity.data() + base, count, 0, withdrawal);
+        Aggregation::andGreater(quantity.data() + base, count, 0, selected);
+        if (direct) {
+            Aggregation::groupDirect(blockKeys, quantity.data() + base, withdrawal, count, keyLimit,
+                                     withdrawals.data(), withdrawnSums.data());
+            Aggregation::groupDirect(blockKeys, quantity.data() + base, selected, count, keyLimit, returns.data(),
+                                     returnedSums.data());
+        } else {
+            withdrawalGroups.add(blockKeys, quantity.data() + base, withdrawal, count);
+            returnGroups.add(blockKeys, quantity.data() + base, selected, count);
+        }
+    }
+
+    const Aggregation::Groups taken = direct ? Aggregation::collectDirect(withdrawals.data(), withdrawnSums.data(), keyLimit)
+                                             : withdrawalGroups.result();
+    const Aggregation::Groups given = direct ? Aggregation::collectDirect(returns.data(), returnedSums.data(), keyLimit)
+                                             : returnGroups.result();
+    // Both are in key order: merge.
+    QVector<FactTotals> totals;
+    int t = 0, g = 0;
+    while (t < taken.keys.size() || g < given.keys.size()) {
+        const bool fromTaken = g >= given.keys.size() || (t < taken.keys.size() && taken.keys[t] <= given.keys[g]);
+        const qint32 key = fromTaken ? taken.keys[t] : given.keys[g];
+        FactTotals total;
+        total.key = key;
+        if (t < taken.keys.size() && taken.keys[t] == key) {
+            total.withdrawals = taken.counts[t];
+            total.withdrawn = -taken.sums[t];
+            ++t;
+        }
+        if (g < given.keys.size() && given.keys[g] == key) {
+            total.returned = given.sums[g];
+            ++g;
+        }
+        totals.append(total);
+    }
+    return totals;
+}
+
+QString AnalyticsCache::siteId() {
+    QVariantList result;
+    if (!dbManager->executeQuery("SELECT site FROM sync_site WHERE id = 1", {}, true, &result) || result.isEmpty()) {
+        return QString();
+    }
+    return result[0].toList()[0].toString();
+}
+
+qint64 AnalyticsCache::movementSequence() {
+    QVariantList result;
+    if (!dbManager->executeQuery("SELECT seq FROM sqlite_sequence WHERE name = 'movimentacoes'", {}, true, &result) ||
+        result.isEmpty()) {
+        return 0;
+    }
+    return result[0].toList()[0].toLongLong();
+}
+
+bool AnalyticsCache::load() {
+    EPI_TRACE_SCOPE("AnalyticsCache::load");
+    if (cacheFile.isEmpty()) {
+        return false;
+    }
+    QFile file(cacheFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream in(&file);
+    quint32 magic = 0, version = 0;
+    quint8 littleEndian = 0;
+    QString site;
+    qint64 fileWatermark = 0, rows = 0;
+    in >> magic >> version >> littleEndian >> site >> fileWatermark >> rows;
+    if (in.status() != QDataStream::Ok || magic != kFileMagic || version != kFileVersion ||
+        littleEndian != quint8(Q_BYTE_ORDER == Q_LITTLE_ENDIAN) || rows < 0 ||
+        rows * qint64(5 * sizeof(qint32)) > file.size()) {
+        return false;
+    }
+    // Another site's file, or a database restored to before the file was
+    // written: rebuild.
+    if (site != siteId() || fileWatermark > movementSequence()) {
+        qDebug() << "Analytics Cache: discarding" << cacheFile;
+        return false;
+    }
+    for (auto *column : {&day, &item, &colaborador, &empresa, &quantity}) {
+        if (!readColumn(in, *column, rows)) {
+            return false;
+        }
+    }
+    watermark = fileWatermark;
+    unsavedRows = 0;
+    maxItem = item.empty() ? 0 : *std::max_element(item.begin(), item.end());
+    maxColaborador = colaborador.empty() ? 0 : *std::max_element(colaborador.begin(), colaborador.end());
+    maxEmpresa = empresa.empty() ? 0 : *std::max_element(empresa.begin(), empresa.end());
+    return true;
+}
+
+bool AnalyticsCache::save() {
+    EPI_TRACE_SCOPE("AnalyticsCache::save");
+    if (cacheFile.isEmpty()) {
+        return false;
+    }
+    QSaveFile file(cacheFile);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Analytics Cache Error: could not write" << cacheFile;
+        return false;
+    }
+    QDataStream out(&file);
+    out << kFileMagic << kFileVersion << quint8(Q_BYTE_ORDER == Q_LITTLE_ENDIAN) << siteId() << watermark << rowCount();
+    for (const auto *column : {&day, &item, &colaborador, &empresa, &quantity}) {
+        if (!writeColumn(out, *column)) {
+            file.cancelWriting();
+            return false;
+        }
+    }
+    if (!file.commit()) {
+        qDebug() << "Analytics Cache Error: could not write" << cacheFile;
+        return false;
+    }
+    unsavedRows = 0;
+    return true;
+}
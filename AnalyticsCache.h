@@ -0,0 +1,109 @@
+#ifndef ANALYTICSCACHE_H
+#define ANALYTICSCACHE_H
+
+#include <QDate>
+#include <QString>
+#include <QVector>
+#include <vector>
+#include "DatabaseManager.h"
+#include "TypedQuery.h"
+
+class ArchiveManager;
+
+// A collaborator movement as cached: day is a Julian day number, empresa
+// is the collaborator's company when the movement was loaded.
+struct FactRow {
+    qint32 day = 0;
+    qint32 itemId = 0;
+    qint32 colaboradorId = 0;
+    qint32 empresaId = 0;
+    qint32 quantidade = 0;
+};
+
+// Zero or invalid fields do not filter.
+struct FactFilter {
+    QDate start;
+    QDate end;
+    int colaboradorId = 0;
+    int empresaId = 0;
+    int categoriaId = 0;
+};
+
+struct FactTotals {
+    int key = 0;
+    qint64 withdrawals = 0;
+    qint64 withdrawn = 0;
+    qint64 returned = 0;
+};
+
+// In-memory column store of collaborator withdrawals and returns for the
+// Relatórios tab. Each fact column is a flat array of 32-bit integers, so
+// a filtered aggregate runs the Aggregation kernels over the few columns
+// it needs: no row decoding, no text, no SQLite. Archived years are
+// loaded once; after that refresh() only reads movements past the
+// watermark, which is safe because movimentacoes ids are AUTOINCREMENT
+// and movements are never edited.
+//
+// With a cacheFile the columns are also kept on disk as raw arrays and
+// reloaded at startup, so a restart does not rescan history. The file
+// records the site and watermark it was built from and is discarded when
+// they no longer match the database (a restore, another site's file).
+class AnalyticsCache {
+public:
+    enum GroupBy { ByItem, ByColaborador, ByEmpresa, ByCategoria };
+    static const int kSaveEveryRows = 10000;
+
+    AnalyticsCache(DatabaseManager *dbManager, ArchiveManager *archiveManager, const QString &cacheFile = QString());
+
+    bool refresh();
+    // Drops everything; the next refresh() rebuilds from scratch.
+    void clear();
+
+    qint64 rowCount() const { return qint64(day.size()); }
+    qint64 memoryUsage() const;
+
+    // Groups with no selected movement are left out.
+    QVector<FactTotals> aggregate(const FactFilter &filter, GroupBy groupBy) const;
+
+private:
+    void append(const FactRow &row);
+    bool load();
+    bool save();
+    QString siteId();
+    qint64 movementSequence();
+
+    DatabaseManager *dbManager;
+    ArchiveManager *archiveManager;
+    QString cacheFile;
+    bool loaded;
+    qint64 watermark;
+    qint64 unsavedRows;
+    std::vector<qint32> day;
+    std::vector<qint32> item;
+    std::vector<qint32> colaborador;
+    std::vector<qint32> empresa;
+    std::vector<qint32> quantity;
+    // Dimension: category of each item, indexed by item id.
+    std::vector<qint32> itemCategory;
+    qint32 maxItem;
+    qint32 maxColaborador;
+    qint32 maxEmpresa;
+    qint32 maxCategory;
+};
+
+namespace TypedQuery {
+
+template <>
+struct RowMapping<FactRow> {
+    static constexpr const char *source = "movimentacoes m LEFT JOIN usuarios u ON u.id = m.colaborador_id";
+    static constexpr auto columns = std::make_tuple(
+        column("CAST(julianday(substr(m.data, 1, 10)) + 0.5 AS INTEGER)", &FactRow::day),
+        column("m.item_id", &FactRow::itemId),
+        column("m.colaborador_id", &FactRow::colaboradorId),
+        column("COALESCE(u.empresa_id, 0)", &FactRow::empresaId),
+        column("m.alteracao_quantidade", &FactRow::quantidade));
+};
+
+}
+
+#endif // ANALYTICSCACHE_H
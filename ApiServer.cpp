@@ -0,0 +1,449 @@
+#include "ApiServer.h"
+#include "CompanyCostReport.h"
+#include "DatabaseManager.h"
+#include "RowTypes.h"
+#include "StockService.h"
+#include "Tracing.h"
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTcpSocket>
+#include <QThread>
+#include <QThreadStorage>
+#include <QUrl>
+
+namespace {
+const quint64 kNoSequence = ~quint64(0);
+const int kMaxHeaderBytes = 16 * 1024;
+const int kDefaultValidDays = 180;
+// audit_logs.user_id for commits made through the API.
+const int kApiOperatorId = 0;
+
+ApiResponse jsonResponse(int status, const QJsonObject &object) {
+    return {status, QJsonDocument(object).toJson(QJsonDocument::Compact)};
+}
+
+ApiResponse errorResponse(int status, const QString &message) {
+    return jsonResponse(status, {{"erro", message}});
+}
+
+QJsonObject itemJson(const ItemRow &item) {
+    return {{"id", item.id},
+            {"nome", item.nome},
+            {"ca", item.ca},
+            {"tamanho", item.tamanho},
+            {"marca", item.marca},
+            {"categoria", item.categoria},
+            {"quantidade", item.quantidade},
+            {"preco", item.preco},
+            {"estoque_minimo", item.estoqueMinimo},
+            {"fornecedor", item.fornecedor}};
+}
+
+ApiResponse itemList(const QString &key, const QList<ItemRow> &items) {
+    QJsonArray array;
+    for (const ItemRow &item : items) {
+        array.append(itemJson(item));
+    }
+    return jsonResponse(200, {{key, array}});
+}
+
+const char *reasonPhrase(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "Internal Server Error";
+    }
+}
+
+bool sameToken(const QByteArray &a, const QByteArray &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    char diff = 0;
+    for (int i = 0; i < a.size(); ++i) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+// One connection per pool thread, created on its first request and closed
+// when the thread ends.
+DatabaseManager *workerDatabase(const QString &databaseFile) {
+    static QThreadStorage<DatabaseManager *> databases;
+    if (!databases.hasLocalData()) {
+        databases.setLocalData(
+            new DatabaseManager(databaseFile, QString("api-%1").arg(quintptr(QThread::currentThreadId()))));
+    }
+    return databases.localData();
+}
+}
+
+ApiHandler::ApiHandler(DatabaseManager *dbManager) : dbManager(dbManager) {}
+
+ApiResponse ApiHandler::handle(const ApiRequest &request) {
+    EPI_TRACE_SCOPE("ApiHandler::handle");
+    const QStringList parts = request.path.split('/', Qt::SkipEmptyParts);
+    if (parts.size() < 2 || parts[0] != "api") {
+        return errorResponse(404, "Rota não encontrada");
+    }
+    const QString &resource = parts[1];
+    const bool get = request.method == "GET";
+
+    if (resource == "retiradas" || resource == "devolucoes") {
+        if (parts.size() != 2) return errorResponse(404, "Rota não encontrada");
+        if (request.method != "POST") return errorResponse(405, "Use POST");
+        return commit(request, resource == "retiradas");
+    }
+    if (!get) {
+        return errorResponse(405, "Use GET");
+    }
+
+    bool ok = false;
+    if (resource == "itens") {
+        if (parts.size() == 2) return items(request);
+        const int id = parts[2].toInt(&ok);
+        if (parts.size() == 3 && ok) return item(id);
+    } else if (resource == "colaboradores") {
+        const int id = parts.size() == 4 ? parts[2].toInt(&ok) : 0;
+        if (ok && parts[3] == "saldo") return balance(id);
+    } else if (resource == "relatorios" && parts.size() == 3) {
+        if (parts[2] == "estoque-baixo") return lowStock();
+        if (parts[2] == "inventario") return inventory();
+        if (parts[2] == "custos-empresa") return companyCosts(request);
+    }
+    return errorResponse(404, "Rota não encontrada");
+}
+
+ApiResponse ApiHandler::items(const ApiRequest &request) {
+    const QString ca = request.query.queryItemValue("ca", QUrl::FullyDecoded);
+    const QString search = request.query.queryItemValue("busca", QUrl::FullyDecoded);
+    QList<ItemRow> rows;
+    bool ok;
+    if (!ca.isEmpty()) {
+        ok = dbManager->select("WHERE i.ca = ? ORDER BY i.tamanho", {ca}, &rows);
+    } else if (!search.isEmpty()) {
+        ok = dbManager->select("WHERE i.nome LIKE ? OR i.ca = ? ORDER BY i.nome LIMIT 100",
+                               {"%" + search + "%", search}, &rows);
+    } else {
+        ok = dbManager->select("ORDER BY i.nome LIMIT 100", {}, &rows);
+    }
+    return ok ? itemList("itens", rows) : errorResponse(500, "Falha ao consultar EPIs");
+}
+
+ApiResponse ApiHandler::item(int id) {
+    QList<ItemRow> rows;
+    if (!dbManager->select("WHERE i.id = ?", {id}, &rows)) {
+        return errorResponse(500, "Falha ao consultar EPI");
+    }
+    return rows.isEmpty() ? errorResponse(404, "EPI não encontrado") : jsonResponse(200, itemJson(rows.first()));
+}
+
+ApiResponse ApiHandler::balance(int colaboradorId) {
+    QList<BalanceRow> rows;
+    StockService service(dbManager);
+    if (!service.balance(colaboradorId, &rows)) {
+        return errorResponse(500, "Falha ao consultar saldo");
+    }
+    QJsonArray array;
+    for (const BalanceRow &row : rows) {
+        array.append(QJsonObject{{"item_id", row.itemId},
+                                 {"nome", row.nome},
+                                 {"ca", row.ca},
+                                 {"tamanho", row.tamanho},
+                                 {"quantidade", row.quantidade}});
+    }
+    return jsonResponse(200, {{"colaborador_id", colaboradorId}, {"itens", array}});
+}
+
+ApiResponse ApiHandler::commit(const ApiRequest &request, bool withdrawal) {
+    QJsonParseError parseError;
+    const QJsonObject body = QJsonDocument::fromJson(request.body, &parseError).object();
+    if (parseError.error != QJsonParseError::NoError) {
+        return errorResponse(400, "JSON inválido: " + parseError.errorString());
+    }
+    const int colaboradorId = body.value("colaborador_id").toInt();
+    const QJsonArray entries = body.value("itens").toArray();
+    if (colaboradorId <= 0 || entries.isEmpty()) {
+        return errorResponse(400, "Informe colaborador_id e itens");
+    }
+    QList<StockLine> lines;
+    for (const QJsonValue &entry : entries) {
+        const QJsonObject object = entry.toObject();
+        lines.append({object.value("item_id").toInt(), object.value("quantidade").toInt(),
+                      object.value("validade_dias").toInt(kDefaultValidDays)});
+    }
+
+    StockService service(dbManager);
+    if (!service.verifyCollaborator(colaboradorId, body.value("senha").toString())) {
+        return errorResponse(403, "Senha incorreta");
+    }
+    QString error;
+    const bool ok = withdrawal ? service.withdraw(colaboradorId, lines, kApiOperatorId, QString(), &error)
+                               : service.returnItems(colaboradorId, lines, kApiOperatorId, &error);
+    if (!ok) {
+        return errorResponse(409, error);
+    }
+    return jsonResponse(201, {{"ok", true}, {"itens", int(lines.size())}});
+}
+
+ApiResponse ApiHandler::lowStock() {
+    QList<ItemRow> rows;
+    if (!dbManager->select("WHERE i.quantidade <= i.estoque_minimo ORDER BY i.quantidade", {}, &rows)) {
+        return errorResponse(500, "Falha ao gerar relatório");
+    }
+    return itemList("itens", rows);
+}
+
+ApiResponse ApiHandler::inventory() {
+    QList<ItemRow> rows;
+    if (!dbManager->select("ORDER BY i.nome", {}, &rows)) {
+        return errorResponse(500, "Falha ao gerar relatório");
+    }
+    return itemList("itens", rows);
+}
+
+ApiResponse ApiHandler::companyCosts(const ApiRequest &request) {
+    QList<CostRow> rows;
+    CompanyCostReport report(dbManager);
+    if (!report.companies(request.query.queryItemValue("inicio"), request.query.queryItemValue("fim"), &rows)) {
+        return errorResponse(500, "Falha ao gerar relatório");
+    }
+    QJsonArray array;
+    for (const CostRow &row : rows) {
+        array.append(QJsonObject{{"empresa_id", row.id},
+                                 {"nome", row.nome},
+                                 {"cnpj", row.detalhe},
+                                 {"quantidade", row.quantidade},
+                                 {"valor", row.valor}});
+    }
+    return jsonResponse(200, {{"empresas", array}});
+}
+
+ApiServer::ApiServer(const ApiServerOptions &options, QObject *parent)
+    : QObject(parent), options(options), nextConnectionId(0), inFlight(0) {
+    pool.setMaxThreadCount(options.workers);
+    // Idle workers keep their thread, and with it their connection.
+    pool.setExpiryTimeout(-1);
+    connect(&server, &QTcpServer::newConnection, this, &ApiServer::onNewConnection);
+}
+
+ApiServer::~ApiServer() {
+    server.close();
+    pool.waitForDone();
+    for (Connection *connection : std::as_const(connections)) {
+        delete connection;
+    }
+}
+
+bool ApiServer::listen(QString *error) {
+    if (options.token.isEmpty() && !options.address.isLoopback()) {
+        *error = "Defina um token de acesso para aceitar conexões fora do localhost";
+        return false;
+    }
+    if (!server.listen(options.address, options.port)) {
+        *error = server.errorString();
+        return false;
+    }
+    return true;
+}
+
+void ApiServer::onNewConnection() {
+    while (QTcpSocket *socket = server.nextPendingConnection()) {
+        Connection *connection = new Connection;
+        connection->id = ++nextConnectionId;
+        connection->socket = socket;
+        connection->idleTimer = new QTimer(socket);
+        connection->idleTimer->setSingleShot(true);
+        connection->idleTimer->setInterval(options.keepAliveMs);
+        connections.insert(connection->id, connection);
+
+        const quint64 id = connection->id;
+        connect(socket, &QTcpSocket::readyRead, this, [this, id] {
+            if (Connection *c = connections.value(id)) {
+                c->idleTimer->start();
+                readRequests(c);
+            }
+        });
+        // Queued, so a connection never disappears under a running call.
+        connect(socket, &QTcpSocket::disconnected, this, [this, id] {
+            if (Connection *c = connections.value(id)) closeConnection(c);
+        }, Qt::QueuedConnection);
+        connect(connection->idleTimer, &QTimer::timeout, this, [this, id] {
+            Connection *c = connections.value(id);
+            if (!c) return;
+            if (c->running > 0 || !c->waiting.isEmpty() || !c->ready.isEmpty()) {
+                c->idleTimer->start();
+            } else {
+                c->socket->disconnectFromHost();
+            }
+        });
+        connection->idleTimer->start();
+    }
+}
+
+void ApiServer::readRequests(Connection *connection) {
+    connection->buffer += connection->socket->readAll();
+    bool parsed = true;
+    while (parsed) {
+        parsed = false;
+        while (connection->closeAfter == kNoSequence &&
+               connection->nextSequence - connection->nextToSend < quint64(options.maxPipelined) &&
+               parseRequest(connection)) {
+            parsed = true;
+        }
+        // Rejections are answered in place and may free pipeline slots.
+        dispatch(connection);
+        flush(connection);
+    }
+}
+
+bool ApiServer::parseRequest(Connection *connection) {
+    QByteArray &buffer = connection->buffer;
+    const int headerEnd = buffer.indexOf("\r\n\r\n");
+    if (headerEnd < 0) {
+        if (buffer.size() > kMaxHeaderBytes) {
+            connection->closeAfter = connection->nextSequence;
+            queueResponse(connection, connection->nextSequence++, errorResponse(431, "Cabeçalho muito grande"));
+            buffer.clear();
+        }
+        return false;
+    }
+
+    const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+    const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+    ApiRequest request;
+    QByteArray version;
+    if (requestLine.size() == 3) {
+        request.method = requestLine[0];
+        version = requestLine[2];
+        const QUrl url(QString::fromLatin1(requestLine[1]));
+        request.path = url.path();
+        request.query = QUrlQuery(url);
+    }
+    for (int i = 1; i < lines.size(); ++i) {
+        const int colon = lines[i].indexOf(':');
+        if (colon > 0) {
+            request.headers.insert(lines[i].left(colon).trimmed().toLower(), lines[i].mid(colon + 1).trimmed());
+        }
+    }
+
+    const quint64 sequence = connection->nextSequence;
+    auto reject = [&](int status, const QString &message) {
+        connection->closeAfter = sequence;
+        queueResponse(connection, connection->nextSequence++, errorResponse(status, message));
+        buffer.clear();
+        return true;
+    };
+    if (request.method.isEmpty() || !version.startsWith("HTTP/1.")) {
+        return reject(400, "Requisição inválida");
+    }
+    if (request.headers.contains("transfer-encoding")) {
+        return reject(501, "Transfer-Encoding não suportado; envie Content-Length");
+    }
+    bool lengthOk = true;
+    const int length = request.headers.value("content-length", "0").toInt(&lengthOk);
+    if (!lengthOk || length < 0) {
+        return reject(400, "Content-Length inválido");
+    }
+    if (length > options.maxRequestBytes) {
+        return reject(413, "Requisição muito grande");
+    }
+    if (buffer.size() < headerEnd + 4 + length) {
+        return false;
+    }
+    request.body = buffer.mid(headerEnd + 4, length);
+    buffer.remove(0, headerEnd + 4 + length);
+
+    const QByteArray connectionHeader = request.headers.value("connection").toLower();
+    if (connectionHeader == "close" || (version == "HTTP/1.0" && connectionHeader != "keep-alive")) {
+        connection->closeAfter = sequence;
+    }
+    connection->waiting.enqueue({connection->nextSequence++, request});
+    return true;
+}
+
+void ApiServer::dispatch(Connection *connection) {
+    while (!connection->waiting.isEmpty() && !connection->writeRunning) {
+        const bool write = connection->waiting.head().second.method != "GET";
+        if (write && connection->running > 0) {
+            break;
+        }
+        const QPair<quint64, ApiRequest> next = connection->waiting.dequeue();
+        const quint64 sequence = next.first;
+        const ApiRequest &request = next.second;
+
+        if (!options.token.isEmpty() &&
+            !sameToken(request.headers.value("authorization"), "Bearer " + options.token)) {
+            queueResponse(connection, sequence, errorResponse(401, "Token de acesso inválido"));
+            continue;
+        }
+        if (inFlight >= options.maxQueued) {
+            queueResponse(connection, sequence, errorResponse(503, "Servidor ocupado, tente novamente"));
+            continue;
+        }
+
+        ++inFlight;
+        ++connection->running;
+        connection->writeRunning = write;
+        const quint64 id = connection->id;
+        const QString databaseFile = options.databaseFile;
+        pool.start([this, id, sequence, request, databaseFile] {
+            ApiHandler handler(workerDatabase(databaseFile));
+            const ApiResponse response = handler.handle(request);
+            QMetaObject::invokeMethod(this, [this, id, sequence, response] { deliver(id, sequence, response); },
+                                      Qt::QueuedConnection);
+        });
+    }
+}
+
+void ApiServer::deliver(quint64 connectionId, quint64 sequence, const ApiResponse &response) {
+    --inFlight;
+    Connection *connection = connections.value(connectionId);
+    if (!connection) {
+        return;
+    }
+    --connection->running;
+    connection->writeRunning = false;
+    queueResponse(connection, sequence, response);
+    readRequests(connection);
+}
+
+void ApiServer::queueResponse(Connection *connection, quint64 sequence, const ApiResponse &response) {
+    const bool close = sequence >= connection->closeAfter;
+    QByteArray out = "HTTP/1.1 " + QByteArray::number(response.status) + ' ' + reasonPhrase(response.status) + "\r\n";
+    out += "Content-Type: application/json; charset=utf-8\r\n";
+    out += "Content-Length: " + QByteArray::number(response.body.size()) + "\r\n";
+    out += close ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+    out += response.body;
+    connection->ready.insert(sequence, out);
+}
+
+void ApiServer::flush(Connection *connection) {
+    auto it = connection->ready.find(connection->nextToSend);
+    while (it != connection->ready.end() && it.key() == connection->nextToSend) {
+        connection->socket->write(it.value());
+        it = connection->ready.erase(it);
+        if (connection->nextToSend++ == connection->closeAfter) {
+            connection->socket->disconnectFromHost();
+            return;
+        }
+    }
+}
+
+void ApiServer::closeConnection(Connection *connection) {
+    connections.remove(connection->id);
+    connection->socket->deleteLater();
+    delete connection;
+}
@@ -0,0 +1,121 @@
+#ifndef APISERVER_H
+#define APISERVER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QHostAddress>
+#include <QMap>
+#include <QObject>
+#include <QQueue>
+#include <QString>
+#include <QTcpServer>
+#include <QThreadPool>
+#include <QTimer>
+#include <QUrlQuery>
+
+class DatabaseManager;
+class QTcpSocket;
+
+struct ApiRequest {
+    QByteArray method;
+    QString path;
+    QUrlQuery query;
+    QHash<QByteArray, QByteArray> headers;  // names lower-cased
+    QByteArray body;
+};
+
+struct ApiResponse {
+    int status = 200;
+    QByteArray body;  // JSON
+};
+
+// Routes one request against a database connection. Independent of the
+// socket layer, so it can be driven directly from a local client.
+//
+//   GET  /api/itens?busca=&ca=          item lookup
+//   GET  /api/itens/<id>
+//   GET  /api/colaboradores/<id>/saldo  items the collaborator still holds
+//   POST /api/retiradas                 {"colaborador_id", "senha", "itens": [{"item_id", "quantidade", "validade_dias"}]}
+//   POST /api/devolucoes                {"colaborador_id", "senha", "itens": [{"item_id", "quantidade"}]}
+//   GET  /api/relatorios/estoque-baixo
+//   GET  /api/relatorios/inventario
+//   GET  /api/relatorios/custos-empresa?inicio=&fim=
+class ApiHandler {
+public:
+    explicit ApiHandler(DatabaseManager *dbManager);
+    ApiResponse handle(const ApiRequest &request);
+
+private:
+    ApiResponse items(const ApiRequest &request);
+    ApiResponse item(int id);
+    ApiResponse balance(int colaboradorId);
+    ApiResponse commit(const ApiRequest &request, bool withdrawal);
+    ApiResponse lowStock();
+    ApiResponse inventory();
+    ApiResponse companyCosts(const ApiRequest &request);
+
+    DatabaseManager *dbManager;
+};
+
+struct ApiServerOptions {
+    QString databaseFile;
+    QHostAddress address = QHostAddress::LocalHost;
+    quint16 port = 8080;
+    QByteArray token;              // required as "Authorization: Bearer" when set
+    int workers = 4;
+    int maxQueued = 64;            // requests in flight before answering 503
+    int maxPipelined = 16;         // parsed but unanswered requests per connection
+    int keepAliveMs = 15000;
+    int maxRequestBytes = 1024 * 1024;
+};
+
+// HTTP/1.1 front end for ApiHandler. Sockets live on the server's thread;
+// handlers run on a bounded pool whose threads each keep their own
+// DatabaseManager connection. Connections are kept alive and may pipeline:
+// reads on one connection run concurrently, a write waits for everything
+// before it and holds back what follows, and responses always go out in
+// request order.
+class ApiServer : public QObject {
+    Q_OBJECT
+public:
+    explicit ApiServer(const ApiServerOptions &options, QObject *parent = nullptr);
+    ~ApiServer() override;
+
+    bool listen(QString *error);
+    quint16 serverPort() const { return server.serverPort(); }
+
+private slots:
+    void onNewConnection();
+
+private:
+    struct Connection {
+        quint64 id = 0;
+        QTcpSocket *socket = nullptr;
+        QTimer *idleTimer = nullptr;
+        QByteArray buffer;
+        QQueue<QPair<quint64, ApiRequest>> waiting;
+        QMap<quint64, QByteArray> ready;
+        quint64 nextSequence = 0;
+        quint64 nextToSend = 0;
+        quint64 closeAfter = ~quint64(0);
+        int running = 0;
+        bool writeRunning = false;
+    };
+
+    void readRequests(Connection *connection);
+    bool parseRequest(Connection *connection);
+    void dispatch(Connection *connection);
+    void deliver(quint64 connectionId, quint64 sequence, const ApiResponse &response);
+    void queueResponse(Connection *connection, quint64 sequence, const ApiResponse &response);
+    void flush(Connection *connection);
+    void closeConnection(Connection *connection);
+
+    ApiServerOptions options;
+    QTcpServer server;
+    QThreadPool pool;
+    QHash<quint64, Connection *> connections;
+    quint64 nextConnectionId;
+    int inFlight;
+};
+
+#endif // APISERVER_H
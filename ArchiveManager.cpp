@@ -0,0 +1,272 @@
+#include "ArchiveManager.h"
+#include "CompanyCostReport.h"
+#include "ConsumptionRollup.h"
+#include "ExpirationTracker.h"
+#include "Tracing.h"
+#include <QDate>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+#include <QDebug>
+#include <limits>
+
+namespace {
+const int kChunkSize = 5000;
+const char *const kMovementColumns = "id, item_id, alteracao_quantidade, data, motivo, colaborador_id, expiration_date";
+const char *const kAuditColumns = "id, user_id, action, details, timestamp";
+
+QString schemaName(int year) {
+    return QString("arq_%1").arg(year);
+}
+}
+
+ArchiveManager::ArchiveManager(DatabaseManager *dbManager, const QString &archiveDir)
+    : dbManager(dbManager), archiveDir(archiveDir) {}
+
+QString ArchiveManager::archivePath(int year) {
+    // Archived years are found where they were written, so a snapshot
+    // opened from another folder still reads the live archive files.
+    QVariantList result;
+    if (dbManager->executeQuery("SELECT caminho FROM arquivos WHERE ano = ?", {year}, true, &result) &&
+        !result.isEmpty()) {
+        const QString recorded = result[0].toList()[0].toString();
+        if (!recorded.isEmpty() && QFileInfo::exists(recorded)) {
+            return recorded;
+        }
+    }
+    return QDir(archiveDir).filePath(QString("epi-%1.db").arg(year));
+}
+
+bool ArchiveManager::attach(int year) {
+    if (attachedYears.contains(year)) return true;
+    const QString path = archivePath(year);
+    if (!QFileInfo::exists(path) && (dbManager->isSnapshot() || !QDir().mkpath(archiveDir))) {
+        return false;
+    }
+
+    const QString schema = schemaName(year);
+    if (!dbManager->executeQuery(QString("ATTACH DATABASE ? AS %1").arg(schema), {path})) {
+        return false;
+    }
+    const QStringList queries = {
+        QString("CREATE TABLE IF NOT EXISTS %1.movimentacoes ("
+                "id INTEGER PRIMARY KEY, "
+                "item_id INTEGER, "
+                "alteracao_quantidade INTEGER, "
+                "data TEXT, "
+                "motivo TEXT, "
+                "colaborador_id INTEGER, "
+                "expiration_date TEXT)").arg(schema),
+        QString("CREATE TABLE IF NOT EXISTS %1.audit_logs ("
+                "id INTEGER PRIMARY KEY, "
+                "user_id INTEGER, "
+                "action TEXT, "
+                "details TEXT, "
+                "timestamp TEXT)").arg(schema),
+        QString("CREATE INDEX IF NOT EXISTS %1.idx_movimentacoes_data ON movimentacoes(data)").arg(schema),
+        QString("CREATE INDEX IF NOT EXISTS %1.idx_movimentacoes_colaborador_data ON movimentacoes(colaborador_id, data)").arg(schema)
+    };
+    for (const auto &query : queries) {
+        if (!dbManager->executeQuery(query)) {
+            dbManager->executeQuery(QString("DETACH DATABASE %1").arg(schema));
+            return false;
+        }
+    }
+    attachedYears.insert(year);
+    return true;
+}
+
+void ArchiveManager::detach(int year) {
+    if (attachedYears.remove(year)) {
+        dbManager->executeQuery(QString("DETACH DATABASE %1").arg(schemaName(year)));
+    }
+}
+
+bool ArchiveManager::archiveBefore(int beforeYear, QString *error,
+                                   const std::function<void(int year, qint64 moved)> &progress) {
+    EPI_TRACE_SCOPE("ArchiveManager::archiveBefore");
+    if (beforeYear > QDate::currentDate().year()) {
+        if (error) *error = "Só é possível arquivar anos já encerrados.";
+        return false;
+    }
+
+    QVariantList years;
+    if (!dbManager->executeQuery(
+            "SELECT DISTINCT CAST(substr(data, 1, 4) AS INTEGER) FROM movimentacoes WHERE data < ? "
+            "UNION SELECT DISTINCT CAST(substr(timestamp, 1, 4) AS INTEGER) FROM audit_logs WHERE timestamp < ? "
+            "ORDER BY 1",
+            {QString("%1-01-01").arg(beforeYear), QString("%1-01-01").arg(beforeYear)}, true, &years)) {
+        if (error) *error = "Falha ao listar os períodos a arquivar.";
+        return false;
+    }
+    for (const auto &entry : years) {
+        const int year = entry.toList()[0].toInt();
+        if (year <= 0) continue;
+        if (!archiveYear(year, error, progress)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ArchiveManager::catchUpRollups(qint64 *foldedId) {
+    // Every incremental report must have folded a movement before it leaves
+    // movimentacoes, or it is lost to them for good.
+    QVariantList result;
+    if (!ConsumptionRollup(dbManager).refresh() || !ExpirationTracker(dbManager).sync() ||
+        !CompanyCostReport(dbManager).refresh() ||
+        !dbManager->executeQuery(
+            "SELECT MIN(COALESCE(w.ultimo_id, 0)) FROM (SELECT 'consumo_diario' AS nome "
+            "UNION ALL SELECT 'vencimentos' UNION ALL SELECT 'consumo_empresa') n "
+            "LEFT JOIN controle_incremental w ON w.nome = n.nome",
+            {}, true, &result) ||
+        result.isEmpty()) {
+        return false;
+    }
+    *foldedId = result[0].toList()[0].toLongLong();
+    return true;
+}
+
+bool ArchiveManager::archiveYear(int year, QString *error, const std::function<void(int year, qint64 moved)> &progress) {
+    qint64 foldedId = 0;
+    if (!catchUpRollups(&foldedId)) {
+        if (error) *error = "Falha ao atualizar os relatórios incrementais antes de arquivar.";
+        return false;
+    }
+
+    // Keep a query-time attachment if there was one; otherwise attach only
+    // for the duration of the move.
+    const bool wasAttached = attachedYears.contains(year);
+    if (!attach(year)) {
+        if (error) *error = QString("Falha ao abrir o arquivo de %1.").arg(year);
+        return false;
+    }
+
+    qint64 moved = 0;
+    const bool ok =
+        moveChunks(year, "movimentacoes", "data", kMovementColumns, true, foldedId, &moved, progress) &&
+        moveChunks(year, "audit_logs", "timestamp", kAuditColumns, false, std::numeric_limits<qint64>::max(), &moved,
+                   progress);
+    if (ok) {
+        const QString schema = schemaName(year);
+        dbManager->executeQuery(
+            QString("INSERT OR REPLACE INTO arquivos (ano, caminho, movimentacoes, audit_logs, arquivado_em) "
+                    "VALUES (?, ?, (SELECT COUNT(*) FROM %1.movimentacoes), (SELECT COUNT(*) FROM %1.audit_logs), ?)").arg(schema),
+            {year, QFileInfo(archivePath(year)).absoluteFilePath(), QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss")});
+    } else if (error) {
+        *error = QString("Falha ao arquivar o ano de %1.").arg(year);
+    }
+    if (!wasAttached) {
+        detach(year);
+    }
+    return ok;
+}
+
+bool ArchiveManager::moveChunks(int year, const QString &table, const QString &dateColumn, const QString &columns,
+                                bool carryBalances, qint64 maxId, qint64 *moved,
+                                const std::function<void(int year, qint64 moved)> &progress) {
+    const QString schema = schemaName(year);
+    const QString from = QString("%1-01-01").arg(year);
+    const QString to = QString("%1-01-01").arg(year + 1);
+    const QString range = QString("id BETWEEN ? AND ? AND %1 >= ? AND %1 < ?").arg(dateColumn);
+
+    // One date-index lookup finds where the year starts; after that each
+    // chunk walks the primary key from the last id moved, so no chunk
+    // rescans or sorts the rest of the year. The '+' keeps the planner on
+    // the primary key.
+    QVariantList first;
+    if (!dbManager->executeQuery(
+            QString("SELECT MIN(id) FROM main.%1 WHERE %2 >= ? AND %2 < ?").arg(table, dateColumn),
+            {from, to}, true, &first) || first.isEmpty()) {
+        return false;
+    }
+    if (first[0].toList()[0].isNull()) {
+        return true;
+    }
+    qint64 lastId = first[0].toList()[0].toLongLong() - 1;
+
+    for (;;) {
+        QVariantList ids;
+        if (!dbManager->executeQuery(
+                QString("SELECT MIN(id), MAX(id), COUNT(*) FROM (SELECT id FROM main.%1 "
+                        "WHERE id > ? AND id <= ? AND +%2 >= ? AND +%2 < ? ORDER BY id LIMIT ?)")
+                    .arg(table, dateColumn),
+                {lastId, maxId, from, to, kChunkSize}, true, &ids) || ids.isEmpty()) {
+            return false;
+        }
+        const QVariantList bounds = ids[0].toList();
+        if (bounds[0].isNull()) {
+            return true;
+        }
+        const QVariantList params{bounds[0], bounds[1], from, to};
+
+        if (!dbManager->beginTransaction()) {
+            return false;
+        }
+        bool ok = dbManager->executeQuery(
+            QString("INSERT OR IGNORE INTO %1.%2 (%3) SELECT %3 FROM main.%2 WHERE %4").arg(schema, table, columns, range),
+            params);
+        if (ok && carryBalances) {
+            ok = dbManager->executeQuery(
+                QString("INSERT INTO saldos_arquivados (colaborador_id, item_id, quantidade) "
+                        "SELECT colaborador_id, item_id, SUM(alteracao_quantidade) FROM main.movimentacoes "
+                        "WHERE %1 AND colaborador_id IS NOT NULL GROUP BY colaborador_id, item_id "
+                        "ON CONFLICT(colaborador_id, item_id) DO UPDATE SET quantidade = quantidade + excluded.quantidade").arg(range),
+                params);
+        }
+        if (ok) {
+            ok = dbManager->executeQuery(QString("DELETE FROM main.%1 WHERE %2").arg(table, range), params);
+        }
+        if (!ok) {
+            dbManager->rollbackTransaction();
+            return false;
+        }
+        if (!dbManager->commitTransaction()) {
+            return false;
+        }
+
+        lastId = bounds[1].toLongLong();
+        *moved += bounds[2].toLongLong();
+        if (progress) {
+            progress(year, *moved);
+        }
+    }
+}
+
+QList<int> ArchiveManager::archivedYears() {
+    QList<int> years;
+    QVariantList result;
+    if (dbManager->executeQuery("SELECT ano FROM arquivos ORDER BY ano", {}, true, &result)) {
+        for (const auto &entry : result) {
+            years.append(entry.toList()[0].toInt());
+        }
+    }
+    return years;
+}
+
+QString ArchiveManager::hotHorizon() {
+    const QList<int> years = archivedYears();
+    return years.isEmpty() ? QString() : QString("%1-01-01").arg(years.last() + 1);
+}
+
+QString ArchiveManager::movementsSource(const QString &startDate) {
+    missing.clear();
+    const QString horizon = hotHorizon();
+    if (startDate.isEmpty() || horizon.isEmpty() || startDate >= horizon) {
+        return "movimentacoes";
+    }
+
+    const int firstYear = startDate.left(4).toInt();
+    QStringList parts{QString("SELECT %1 FROM main.movimentacoes").arg(kMovementColumns)};
+    for (int year : archivedYears()) {
+        if (year < firstYear) continue;
+        if (!attach(year)) {
+            qDebug() << "Archive Attach Error: year" << year << archivePath(year);
+            missing.append(year);
+            continue;
+        }
+        parts << QString("SELECT %1 FROM %2.movimentacoes").arg(kMovementColumns, schemaName(year));
+    }
+    return "(" + parts.join(" UNION ALL ") + ")";
+}
@@ -0,0 +1,58 @@
+#ifndef ARCHIVEMANAGER_H
+#define ARCHIVEMANAGER_H
+
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <functional>
+#include "DatabaseManager.h"
+
+// Moves closed years of movimentacoes and audit_logs into per-year archive
+// files (arquivo/epi-YYYY.db) attached to the main connection. Rows move in
+// short id-range transactions so counters are never locked out for long.
+// The net quantity each collaborator still holds from archived movements is
+// folded into saldos_arquivados in the same transaction, keeping return
+// balances correct without the archived rows. The incremental report
+// tables are caught up first, and movements none of them has folded yet
+// stay where they are.
+//
+// Progress is reported through the callback only; the caller decides how
+// to keep its UI alive.
+//
+// Reports read the hot tables only; movementsSource() unions the archives
+// when a report explicitly asks for a start date before the hot horizon.
+// Archives are opened from arquivos.caminho, so a snapshot reads the live
+// archive files; a year whose file cannot be attached is left out and
+// listed by missingYears() for the caller to report.
+class ArchiveManager {
+public:
+    ArchiveManager(DatabaseManager *dbManager, const QString &archiveDir);
+
+    // Archives every complete year before beforeYear.
+    bool archiveBefore(int beforeYear, QString *error = nullptr,
+                       const std::function<void(int year, qint64 moved)> &progress = nullptr);
+    QList<int> archivedYears();
+    QString hotHorizon();
+    QString movementsSource(const QString &startDate);
+    // Years the last movementsSource() call could not attach.
+    QList<int> missingYears() const { return missing; }
+    QString directory() const { return archiveDir; }
+
+private:
+    bool catchUpRollups(qint64 *foldedId);
+    bool archiveYear(int year, QString *error, const std::function<void(int year, qint64 moved)> &progress);
+    // Moves rows of year with id <= maxId.
+    bool moveChunks(int year, const QString &table, const QString &dateColumn, const QString &columns,
+                    bool carryBalances, qint64 maxId, qint64 *moved,
+                    const std::function<void(int year, qint64 moved)> &progress);
+    bool attach(int year);
+    void detach(int year);
+    QString archivePath(int year);
+
+    DatabaseManager *dbManager;
+    QString archiveDir;
+    QSet<int> attachedYears;
+    QList<int> missing;
+};
+
+#endif // ARCHIVEMANAGER_H
@@ -0,0 +1,158 @@
+#include "BackupManager.h"
+#include "Tracing.h"
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QDebug>
+#include <sqlite3.h>
+
+namespace {
+// After this many restarts (the source changed under the copy) the rest is
+// copied in one step so a busy counter cannot starve the backup.
+const int kMaxRestarts = 3;
+const int kBusyTimeoutMs = 5000;
+
+QString sqliteError(sqlite3 *handle) {
+    return handle ? QString::fromUtf8(sqlite3_errmsg(handle)) : QString("sem memória");
+}
+}
+
+BackupManager::BackupManager(const QString &databaseFile, const QString &backupDir)
+    : databaseFile(databaseFile), backupDir(backupDir), retention(10), pagesPerStep(64), stepPauseMs(10) {}
+
+BackupResult BackupManager::createSnapshot(const std::function<void(int remaining, int total)> &progress) const {
+    EPI_TRACE_SCOPE("BackupManager::createSnapshot");
+    BackupResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!QDir().mkpath(backupDir)) {
+        result.error = QString("Não foi possível criar o diretório %1").arg(backupDir);
+        return result;
+    }
+    const QString stamp = QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss");
+    const QString finalPath = QDir(backupDir).filePath(QString("epi-%1.db").arg(stamp));
+    const QString partPath = finalPath + ".part";
+    QFile::remove(partPath);
+
+    sqlite3 *source = nullptr;
+    sqlite3 *target = nullptr;
+    if (sqlite3_open_v2(QFile::encodeName(databaseFile).constData(), &source, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        result.error = sqliteError(source);
+        sqlite3_close(source);
+        return result;
+    }
+    sqlite3_busy_timeout(source, kBusyTimeoutMs);
+    if (sqlite3_open_v2(QFile::encodeName(partPath).constData(), &target,
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+        result.error = sqliteError(target);
+        sqlite3_close(target);
+        sqlite3_close(source);
+        return result;
+    }
+
+    sqlite3_backup *backup = sqlite3_backup_init(target, "main", source, "main");
+    if (!backup) {
+        result.error = sqliteError(target);
+        sqlite3_close(target);
+        sqlite3_close(source);
+        return result;
+    }
+
+    int step = pagesPerStep;
+    int restarts = 0;
+    int lastRemaining = -1;
+    int rc;
+    do {
+        rc = sqlite3_backup_step(backup, step);
+        const int remaining = sqlite3_backup_remaining(backup);
+        const int total = sqlite3_backup_pagecount(backup);
+        if (lastRemaining >= 0 && remaining > lastRemaining && ++restarts >= kMaxRestarts) {
+            step = -1;
+        }
+        lastRemaining = remaining;
+        if (progress) {
+            progress(remaining, total);
+        }
+        if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+            // Releases the read lock between steps so writers are never held up.
+            sqlite3_sleep(stepPauseMs);
+        }
+    } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+
+    result.pages = sqlite3_backup_pagecount(backup);
+    sqlite3_backup_finish(backup);
+    if (rc != SQLITE_DONE) {
+        result.error = sqliteError(target);
+    }
+    sqlite3_close(target);
+    sqlite3_close(source);
+
+    if (rc != SQLITE_DONE) {
+        QFile::remove(partPath);
+        return result;
+    }
+    if (!verify(partPath, &result.error)) {
+        QFile::remove(partPath);
+        return result;
+    }
+    if (!QFile::rename(partPath, finalPath)) {
+        result.error = QString("Não foi possível renomear %1").arg(partPath);
+        QFile::remove(partPath);
+        return result;
+    }
+
+    applyRetention();
+    result.ok = true;
+    result.path = finalPath;
+    result.elapsedMs = timer.elapsed();
+    return result;
+}
+
+bool BackupManager::verify(const QString &path, QString *error) const {
+    EPI_TRACE_SCOPE("BackupManager::verify");
+    sqlite3 *handle = nullptr;
+    if (sqlite3_open_v2(QFile::encodeName(path).constData(), &handle, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        if (error) *error = sqliteError(handle);
+        sqlite3_close(handle);
+        return false;
+    }
+
+    sqlite3_stmt *statement = nullptr;
+    QStringList problems;
+    if (sqlite3_prepare_v2(handle, "PRAGMA integrity_check", -1, &statement, nullptr) == SQLITE_OK) {
+        while (sqlite3_step(statement) == SQLITE_ROW) {
+            const QString line = QString::fromUtf8(reinterpret_cast<const char *>(sqlite3_column_text(statement, 0)));
+            if (line != "ok") {
+                problems << line;
+            }
+        }
+    } else {
+        problems << sqliteError(handle);
+    }
+    sqlite3_finalize(statement);
+    sqlite3_close(handle);
+
+    if (!problems.isEmpty()) {
+        qDebug() << "Backup Integrity Error:" << path << problems;
+        if (error) *error = problems.join("; ");
+        return false;
+    }
+    return true;
+}
+
+QStringList BackupManager::snapshots() const {
+    // The timestamp in the name sorts chronologically; newest first.
+    return QDir(backupDir).entryList({"epi-*.db"}, QDir::Files, QDir::Name | QDir::Reversed);
+}
+
+void BackupManager::applyRetention() const {
+    if (retention <= 0) return;
+    const QStringList names = snapshots();
+    for (int i = retention; i < names.size(); ++i) {
+        if (!QFile::remove(QDir(backupDir).filePath(names[i]))) {
+            qDebug() << "Backup Retention Error: could not remove" << names[i];
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef BACKUPMANAGER_H
+#define BACKUPMANAGER_H
+
+#include <QString>
+#include <QStringList>
+#include <functional>
+
+struct BackupResult {
+    bool ok = false;
+    QString path;
+    QString error;
+    int pages = 0;
+    qint64 elapsedMs = 0;
+};
+
+// Online snapshots of epi.db through the SQLite backup API. Pages are
+// copied a few at a time from a separate read-only connection, sleeping
+// between steps so counters keep writing while the copy runs. The copy is
+// written to a .part file, checked with PRAGMA integrity_check and only
+// then renamed to epi-yyyyMMdd-hhmmss.db; older snapshots beyond the
+// retention count are removed.
+//
+// Safe to run on a worker thread: it never touches the Qt connection.
+class BackupManager {
+public:
+    BackupManager(const QString &databaseFile, const QString &backupDir);
+
+    void setRetention(int count) { retention = count; }
+    void setPagesPerStep(int pages) { pagesPerStep = pages; }
+    void setStepPauseMs(int ms) { stepPauseMs = ms; }
+
+    BackupResult createSnapshot(const std::function<void(int remaining, int total)> &progress = nullptr) const;
+    bool verify(const QString &path, QString *error = nullptr) const;
+    QStringList snapshots() const;
+    void applyRetention() const;
+
+private:
+    QString databaseFile;
+    QString backupDir;
+    int retention;
+    int pagesPerStep;
+    int stepPauseMs;
+};
+
+#endif // BACKUPMANAGER_H
@@ -0,0 +1,19 @@
+#include <QTextStream>
+#include "HeadlessCommands.h"
+
+// epi-cli: the headless commands without the widget stack, for servers
+// and scheduled tasks.
+int main(int argc, char *argv[]) {
+    if (!Headless::isCommand(argc, argv)) {
+        QTextStream(stderr) << "Uso: epi-cli <comando> [opções]\n"
+                               "  --backup [pasta]\n"
+                               "  --archive <ano>\n"
+                               "  --report-pack [AAAA-MM]\n"
+                               "  --api [porta] [--api-bind <endereço>] [--api-workers <n>]\n"
+                               "  --sync-status | --sync-export <site> | --sync-import <arquivo>\n"
+                               "  --sync-serve [porta] [--sync-bind <endereço>] | --sync-with <host:porta>\n"
+                               "  --bench-aggregation [movimentações]\n";
+        return 1;
+    }
+    return Headless::exec(argc, argv);
+}
@@ -0,0 +1,196 @@
+#include "ColumnarResult.h"
+#include <QSqlQuery>
+#include <QVariant>
+#include <sqlite3.h>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace {
+const qsizetype kMaxBlock = 4 * 1024 * 1024;
+}
+
+ResultArena::ResultArena(qsizetype initialBlock)
+    : cursor(nullptr), limit(nullptr), initialBlock(initialBlock), nextBlock(initialBlock), reservedBytes(0) {}
+
+void *ResultArena::allocate(qsizetype size, qsizetype align) {
+    auto aligned = [align](char *p) {
+        return reinterpret_cast<char *>((reinterpret_cast<quintptr>(p) + align - 1) & ~quintptr(align - 1));
+    };
+    char *start = cursor ? aligned(cursor) : nullptr;
+    if (!start || start + size > limit) {
+        // Blocks double up to kMaxBlock so large results need few of them.
+        const qsizetype blockSize = std::max(nextBlock, size + align);
+        blocks.emplace_back(new char[blockSize]);
+        cursor = blocks.back().get();
+        limit = cursor + blockSize;
+        reservedBytes += blockSize;
+        nextBlock = std::min(nextBlock * 2, kMaxBlock);
+        start = aligned(cursor);
+    }
+    cursor = start + size;
+    return start;
+}
+
+void ResultArena::release() {
+    blocks.clear();
+    cursor = limit = nullptr;
+    nextBlock = initialBlock;
+    reservedBytes = 0;
+}
+
+void ColumnarResult::clear() {
+    columns.clear();
+    rows = 0;
+    cellArena.release();
+    textArena.release();
+}
+
+void ColumnarResult::reset(int columnCount) {
+    clear();
+    columns.resize(columnCount);
+}
+
+void ColumnarResult::appendRow(sqlite3_stmt *stmt) {
+    const int slot = rows % kSegmentRows;
+    for (int col = 0; col < columns.size(); ++col) {
+        if (slot == 0) {
+            columns[col].append(static_cast<Cell *>(cellArena.allocate(sizeof(Cell) * kSegmentRows, alignof(Cell))));
+        }
+        Cell &cell = columns[col].last()[slot];
+        cell.length = 0;
+        switch (sqlite3_column_type(stmt, col)) {
+        case SQLITE_INTEGER:
+            cell.type = Integer;
+            cell.integer = sqlite3_column_int64(stmt, col);
+            break;
+        case SQLITE_FLOAT:
+            cell.type = Real;
+            cell.real = sqlite3_column_double(stmt, col);
+            break;
+        case SQLITE_NULL:
+            cell.type = Null;
+            cell.integer = 0;
+            break;
+        default: {
+            const char *text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, col));
+            const int length = sqlite3_column_bytes(stmt, col);
+            char *copy = static_cast<char *>(textArena.allocate(length, 1));
+            memcpy(copy, text, size_t(length));
+            cell.type = Text;
+            cell.text = copy;
+            cell.length = quint32(length);
+            break;
+        }
+        }
+    }
+    ++rows;
+}
+
+void ColumnarResult::appendRow(const QSqlQuery &query) {
+    const int slot = rows % kSegmentRows;
+    for (int col = 0; col < columns.size(); ++col) {
+        if (slot == 0) {
+            columns[col].append(static_cast<Cell *>(cellArena.allocate(sizeof(Cell) * kSegmentRows, alignof(Cell))));
+        }
+        Cell &cell = columns[col].last()[slot];
+        cell.length = 0;
+        const QVariant value = query.value(col);
+        if (value.isNull()) {
+            cell.type = Null;
+            cell.integer = 0;
+            continue;
+        }
+        switch (value.typeId()) {
+        case QMetaType::Int:
+        case QMetaType::LongLong:
+            cell.type = Integer;
+            cell.integer = value.toLongLong();
+            break;
+        case QMetaType::Double:
+            cell.type = Real;
+            cell.real = value.toDouble();
+            break;
+        default: {
+            const QByteArray text = value.typeId() == QMetaType::QByteArray ? value.toByteArray()
+                                                                             : value.toString().toUtf8();
+            char *copy = static_cast<char *>(textArena.allocate(text.size(), 1));
+            memcpy(copy, text.constData(), size_t(text.size()));
+            cell.type = Text;
+            cell.text = copy;
+            cell.length = quint32(text.size());
+            break;
+        }
+        }
+    }
+    ++rows;
+}
+
+qint64 ColumnarResult::integer(int row, int col) const {
+    const Cell &c = cell(row, col);
+    switch (c.type) {
+    case Integer: return c.integer;
+    case Real: return qint64(c.real);
+    case Text: return QByteArray::fromRawData(c.text, c.length).toLongLong();
+    default: return 0;
+    }
+}
+
+double ColumnarResult::real(int row, int col) const {
+    const Cell &c = cell(row, col);
+    switch (c.type) {
+    case Integer: return double(c.integer);
+    case Real: return c.real;
+    case Text: return QByteArray::fromRawData(c.text, c.length).toDouble();
+    default: return 0;
+    }
+}
+
+QUtf8StringView ColumnarResult::text(int row, int col) const {
+    const Cell &c = cell(row, col);
+    return c.type == Text ? QUtf8StringView(c.text, c.length) : QUtf8StringView();
+}
+
+void ColumnarResult::appendTo(QByteArray &out, int row, int col) const {
+    const Cell &c = cell(row, col);
+    // Numbers are formatted on the stack; only out itself ever grows.
+    char digits[32];
+    switch (c.type) {
+    case Integer:
+        out.append(digits, std::to_chars(digits, digits + sizeof(digits), c.integer).ptr - digits);
+        break;
+    case Real:
+        out.append(digits, std::to_chars(digits, digits + sizeof(digits), c.real, std::chars_format::general, 15).ptr -
+                               digits);
+        break;
+    case Text:
+        out.append(c.text, c.length);
+        break;
+    default:
+        break;
+    }
+}
+
+void ColumnarResult::appendCsv(QByteArray &out, int row, int col) const {
+    const Cell &c = cell(row, col);
+    if (c.type != Text) {
+        appendTo(out, row, col);
+        return;
+    }
+    out += '"';
+    for (quint32 i = 0; i < c.length; ++i) {
+        if (c.text[i] == '"') out += '"';
+        out += c.text[i];
+    }
+    out += '"';
+}
+
+QString ColumnarResult::string(int row, int col) const {
+    const Cell &c = cell(row, col);
+    switch (c.type) {
+    case Integer: return QString::number(c.integer);
+    case Real: return QString::number(c.real, 'g', 15);
+    case Text: return QString::fromUtf8(c.text, c.length);
+    default: return QString();
+    }
+}
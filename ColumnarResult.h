@@ -0,0 +1,93 @@
+#ifndef COLUMNARRESULT_H
+#define COLUMNARRESULT_H
+
+#include <QByteArray>
+#include <QString>
+#include <QUtf8StringView>
+#include <QVector>
+#include <memory>
+#include <vector>
+
+struct sqlite3_stmt;
+class QSqlQuery;
+
+// Bump allocator: memory is handed out from large blocks and only ever
+// returned all at once.
+class ResultArena {
+public:
+    explicit ResultArena(qsizetype initialBlock = 64 * 1024);
+
+    void *allocate(qsizetype size, qsizetype align);
+    void release();
+    qsizetype reserved() const { return reservedBytes; }
+    int blockCount() const { return int(blocks.size()); }
+
+private:
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *cursor;
+    char *limit;
+    qsizetype initialBlock;
+    qsizetype nextBlock;
+    qsizetype reservedBytes;
+};
+
+// Query result stored by column for the report and export paths. Cells are
+// fixed-size slots in per-column segments; text is copied once into a
+// separate arena and exposed as UTF-8 views, so a result of any size costs
+// a handful of block allocations and is freed in one go by clear() or the
+// destructor. Views stay valid until then.
+class ColumnarResult {
+public:
+    enum CellType : quint8 { Null, Integer, Real, Text };
+
+    ColumnarResult() = default;
+    ColumnarResult(const ColumnarResult &) = delete;
+    ColumnarResult &operator=(const ColumnarResult &) = delete;
+
+    int rowCount() const { return rows; }
+    int columnCount() const { return int(columns.size()); }
+
+    CellType type(int row, int col) const { return cell(row, col).type; }
+    bool isNull(int row, int col) const { return cell(row, col).type == Null; }
+    qint64 integer(int row, int col) const;
+    double real(int row, int col) const;
+    QUtf8StringView text(int row, int col) const;
+
+    // Numbers are formatted as the QVariant path would have shown them.
+    void appendTo(QByteArray &out, int row, int col) const;
+    // Same, with text quoted for CSV.
+    void appendCsv(QByteArray &out, int row, int col) const;
+    QString string(int row, int col) const;
+
+    void clear();
+    qsizetype memoryUsage() const { return cellArena.reserved() + textArena.reserved(); }
+    int allocationCount() const { return cellArena.blockCount() + textArena.blockCount(); }
+
+private:
+    friend class DatabaseManager;
+
+    struct Cell {
+        union {
+            qint64 integer;
+            double real;
+            const char *text;
+        };
+        quint32 length;
+        CellType type;
+    };
+    static const int kSegmentRows = 1024;
+
+    const Cell &cell(int row, int col) const {
+        return columns[col][row / kSegmentRows][row % kSegmentRows];
+    }
+    void reset(int columnCount);
+    void appendRow(sqlite3_stmt *stmt);
+    void appendRow(const QSqlQuery &query);
+
+    ResultArena cellArena;
+    ResultArena textArena{256 * 1024};
+    QVector<QVector<Cell *>> columns;
+    int rows = 0;
+};
+
+#endif // COLUMNARRESULT_H
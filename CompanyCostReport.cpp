@@ -0,0 +1,190 @@
+#include "CompanyCostReport.h"
+#include "ColumnarResult.h"
+#include "Tracing.h"
+#include <QFile>
+#include <algorithm>
+
+namespace {
+const char *const kWatermarkName = "consumo_empresa";
+const qint64 kChunkSize = 50000;
+const char *const kWatermarkSql =
+    "SELECT COALESCE((SELECT ultimo_id FROM controle_incremental WHERE nome = ?), 0)";
+// Moves the watermark only from the value the chunk was read against.
+const char *const kAdvanceSql =
+    "INSERT INTO controle_incremental (nome, ultimo_id) VALUES (?, ?) "
+    "ON CONFLICT(nome) DO UPDATE SET ultimo_id = excluded.ultimo_id "
+    "WHERE COALESCE(controle_incremental.ultimo_id, 0) = ? RETURNING ultimo_id";
+
+// Range conditions only for the bounds given, so the dia/data indexes apply.
+QString periodFilter(const QString &column, const QString &start, const QString &end, QVariantList *params) {
+    QString filter;
+    if (!start.isEmpty()) {
+        filter += QString(" AND %1 >= ?").arg(column);
+        params->append(start);
+    }
+    if (!end.isEmpty()) {
+        filter += QString(" AND %1 < date(?, '+1 day')").arg(column);
+        params->append(end);
+    }
+    return filter;
+}
+}
+
+CompanyCostReport::CompanyCostReport(DatabaseManager *dbManager) : dbManager(dbManager) {}
+
+bool CompanyCostReport::refresh() {
+    EPI_TRACE_SCOPE("CompanyCostReport::refresh");
+    QVariantList state;
+    if (!dbManager->executeQuery(
+            "SELECT (SELECT ultimo_id FROM controle_incremental WHERE nome=?), (SELECT MAX(id) FROM movimentacoes)",
+            {kWatermarkName}, true, &state) || state.isEmpty()) {
+        return false;
+    }
+    // Unlocked read only to skip the write lock when there is nothing to
+    // fold, which also keeps read-only connections working.
+    const QVariantList bounds = state[0].toList();
+    const qint64 maxId = bounds[1].toLongLong();
+    if (bounds[0].toLongLong() >= maxId) {
+        return true;
+    }
+
+    while (true) {
+        if (!dbManager->beginImmediateTransaction()) {
+            return false;
+        }
+        // Another connection may have folded chunks meanwhile; under the
+        // write lock this read is the one the upserts build on.
+        QVariantList current;
+        if (!dbManager->executeQuery(kWatermarkSql, {kWatermarkName}, true, &current) || current.isEmpty()) {
+            dbManager->rollbackTransaction();
+            return false;
+        }
+        const qint64 watermark = current[0].toList()[0].toLongLong();
+        if (watermark >= maxId) {
+            dbManager->rollbackTransaction();
+            return true;
+        }
+        const qint64 upper = std::min(watermark + kChunkSize, maxId);
+        QVariantList advanced;
+        const bool ok =
+            dbManager->executeQuery(
+                "INSERT INTO consumo_empresa (empresa_id, dia, item_id, quantidade, valor) "
+                "SELECT COALESCE(u.empresa_id, 0), substr(m.data, 1, 10), m.item_id, "
+                "SUM(-m.alteracao_quantidade), SUM(-m.alteracao_quantidade * COALESCE(i.preco, 0)) "
+                "FROM movimentacoes m "
+                "LEFT JOIN usuarios u ON m.colaborador_id = u.id "
+                "LEFT JOIN itens i ON m.item_id = i.id "
+                "WHERE m.id > ? AND m.id <= ? "
+                "AND m.motivo IN ('Retirada por colaborador', 'Devolução por colaborador') "
+                "GROUP BY 1, 2, 3 "
+                "ON CONFLICT(empresa_id, dia, item_id) DO UPDATE SET "
+                "quantidade = quantidade + excluded.quantidade, valor = valor + excluded.valor",
+                {watermark, upper}) &&
+            dbManager->executeQuery(kAdvanceSql, {kWatermarkName, upper, watermark}, true, &advanced) &&
+            !advanced.isEmpty();
+        if (!ok) {
+            dbManager->rollbackTransaction();
+            return false;
+        }
+        if (!dbManager->commitTransaction()) {
+            return false;
+        }
+    }
+}
+
+bool CompanyCostReport::companies(const QString &start, const QString &end, QList<CostRow> *rows) {
+    EPI_TRACE_SCOPE("CompanyCostReport::companies");
+    if (!refresh()) {
+        return false;
+    }
+    QVariantList params;
+    const QString period = periodFilter("ce.dia", start, end, &params);
+    return dbManager->fetch(
+        "SELECT ce.empresa_id, COALESCE(e.nome, 'Sem empresa'), COALESCE(e.cnpj, ''), "
+        "SUM(ce.quantidade), SUM(ce.valor) "
+        "FROM consumo_empresa ce LEFT JOIN empresas e ON e.id = ce.empresa_id "
+        "WHERE 1 = 1" + period + " GROUP BY ce.empresa_id ORDER BY 5 DESC",
+        params, rows);
+}
+
+bool CompanyCostReport::categories(int empresaId, const QString &start, const QString &end, QList<CostRow> *rows) {
+    QVariantList params{empresaId};
+    const QString period = periodFilter("ce.dia", start, end, &params);
+    return dbManager->fetch(
+        "SELECT COALESCE(i.categoria_id, 0), COALESCE(c.nome, 'Sem categoria'), '', "
+        "SUM(ce.quantidade), SUM(ce.valor) "
+        "FROM consumo_empresa ce "
+        "LEFT JOIN itens i ON i.id = ce.item_id "
+        "LEFT JOIN categorias c ON c.id = i.categoria_id "
+        "WHERE ce.empresa_id = ?" + period + " GROUP BY 1 ORDER BY 5 DESC",
+        params, rows);
+}
+
+bool CompanyCostReport::items(int empresaId, int categoriaId, const QString &start, const QString &end,
+                              QList<CostRow> *rows) {
+    QVariantList params{empresaId, categoriaId};
+    const QString period = periodFilter("ce.dia", start, end, &params);
+    return dbManager->fetch(
+        "SELECT ce.item_id, COALESCE(i.nome, ''), "
+        "TRIM(COALESCE(i.ca, '') || ' ' || COALESCE(i.tamanho, '')), "
+        "SUM(ce.quantidade), SUM(ce.valor) "
+        "FROM consumo_empresa ce LEFT JOIN itens i ON i.id = ce.item_id "
+        "WHERE ce.empresa_id = ? AND COALESCE(i.categoria_id, 0) = ?" + period +
+        " GROUP BY ce.item_id ORDER BY 5 DESC",
+        params, rows);
+}
+
+bool CompanyCostReport::collaborators(int empresaId, int itemId, const QString &start, const QString &end,
+                                      QList<CostRow> *rows) {
+    // Current company membership and preco; the rollup keeps the split and
+    // values as of the refresh that folded each movement.
+    QVariantList params;
+    const QString period = periodFilter("m.data", start, end, &params);
+    params << empresaId << itemId;
+    return dbManager->fetch(
+        "SELECT u.id, u.nome_completo, COALESCE(u.matricula, ''), "
+        "SUM(-m.alteracao_quantidade), SUM(-m.alteracao_quantidade * COALESCE(i.preco, 0)) "
+        "FROM usuarios u "
+        "JOIN movimentacoes m ON m.colaborador_id = u.id" + period + " "
+        "LEFT JOIN itens i ON i.id = m.item_id "
+        "WHERE COALESCE(u.empresa_id, 0) = ? AND m.item_id = ? "
+        "AND m.motivo IN ('Retirada por colaborador', 'Devolução por colaborador') "
+        "GROUP BY u.id ORDER BY 5 DESC",
+        params, rows);
+}
+
+bool CompanyCostReport::exportCsv(const QString &fileName, const QString &start, const QString &end) {
+    EPI_TRACE_SCOPE("CompanyCostReport::exportCsv");
+    if (!refresh()) {
+        return false;
+    }
+    QVariantList params;
+    const QString period = periodFilter("ce.dia", start, end, &params);
+    ColumnarResult result;
+    if (!dbManager->fetchColumnar(
+            QString("SELECT COALESCE(e.nome, 'Sem empresa'), COALESCE(e.cnpj, ''), COALESCE(c.nome, 'Sem categoria'), "
+                    "COALESCE(i.nome, ''), COALESCE(i.ca, ''), COALESCE(i.tamanho, ''), "
+                    "SUM(ce.quantidade), ROUND(SUM(ce.valor), 2) "
+                    "FROM consumo_empresa ce "
+                    "LEFT JOIN empresas e ON e.id = ce.empresa_id "
+                    "LEFT JOIN itens i ON i.id = ce.item_id "
+                    "LEFT JOIN categorias c ON c.id = i.categoria_id "
+                    "WHERE 1 = 1%1 GROUP BY ce.empresa_id, ce.item_id ORDER BY 1, 3, 4").arg(period),
+            params, &result)) {
+        return false;
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+    QByteArray out = "Empresa,CNPJ,Categoria,EPI,CA,Tamanho,Quantidade,Valor\n";
+    for (int row = 0; row < result.rowCount(); ++row) {
+        for (int col = 0; col < result.columnCount(); ++col) {
+            if (col > 0) out += ',';
+            result.appendCsv(out, row, col);
+        }
+        out += '\n';
+    }
+    return file.write(out) == out.size();
+}
@@ -0,0 +1,60 @@
+#ifndef COMPANYCOSTREPORT_H
+#define COMPANYCOSTREPORT_H
+
+#include <QList>
+#include <QString>
+#include "RowTypes.h"
+
+struct CostRow {
+    int id = 0;
+    QString nome;
+    QString detalhe;
+    qint64 quantidade = 0;
+    double valor = 0;
+};
+
+// Withdrawal cost per contractor company, kept in the consumo_empresa
+// rollup by day, company and item. Company and value are both taken when
+// the movement is folded in: the collaborator's empresa then, and quantity
+// times the item's preco then; returns credit both back. Every report
+// refreshes first, so that is normally the first report after the
+// withdrawal. Like consumo_diario, only movements past the watermark are
+// read, so monthly billing never scans history.
+//
+// Drill-down goes company -> category -> item -> collaborator; the last
+// level reads movimentacoes through the collaborator/date index.
+class CompanyCostReport {
+public:
+    explicit CompanyCostReport(DatabaseManager *dbManager);
+
+    bool refresh();
+
+    // Dates are yyyy-MM-dd, inclusive; empty means unbounded.
+    bool companies(const QString &start, const QString &end, QList<CostRow> *rows);
+    bool categories(int empresaId, const QString &start, const QString &end, QList<CostRow> *rows);
+    bool items(int empresaId, int categoriaId, const QString &start, const QString &end, QList<CostRow> *rows);
+    bool collaborators(int empresaId, int itemId, const QString &start, const QString &end, QList<CostRow> *rows);
+
+    // Flat company/category/item breakdown for billing spreadsheets.
+    bool exportCsv(const QString &fileName, const QString &start, const QString &end);
+
+private:
+    DatabaseManager *dbManager;
+};
+
+namespace TypedQuery {
+
+template <>
+struct RowMapping<CostRow> {
+    static constexpr const char *source = "consumo_empresa ce";
+    static constexpr auto columns = std::make_tuple(
+        column("id", &CostRow::id),
+        column("nome", &CostRow::nome),
+        column("detalhe", &CostRow::detalhe),
+        column("quantidade", &CostRow::quantidade),
+        column("valor", &CostRow::valor));
+};
+
+}
+
+#endif // COMPANYCOSTREPORT_H
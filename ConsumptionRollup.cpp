@@ -0,0 +1,89 @@
+#include "ConsumptionRollup.h"
+#include "Tracing.h"
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+const char *const kWatermarkName = "consumo_diario";
+const qint64 kChunkSize = 50000;
+const char *const kWatermarkSql =
+    "SELECT COALESCE((SELECT ultimo_id FROM controle_incremental WHERE nome = ?), 0)";
+// Moves the watermark only from the value the chunk was read against.
+const char *const kAdvanceSql =
+    "INSERT INTO controle_incremental (nome, ultimo_id) VALUES (?, ?) "
+    "ON CONFLICT(nome) DO UPDATE SET ultimo_id = excluded.ultimo_id "
+    "WHERE COALESCE(controle_incremental.ultimo_id, 0) = ? RETURNING ultimo_id";
+}
+
+ConsumptionRollup::ConsumptionRollup(DatabaseManager *dbManager) : dbManager(dbManager) {}
+
+bool ConsumptionRollup::refresh(QSet<int> *touchedItems) {
+    EPI_TRACE_SCOPE("ConsumptionRollup::refresh");
+    QVariantList state;
+    if (!dbManager->executeQuery(
+            "SELECT (SELECT ultimo_id FROM controle_incremental WHERE nome=?), (SELECT MAX(id) FROM movimentacoes)",
+            {kWatermarkName}, true, &state) || state.isEmpty()) {
+        return false;
+    }
+    // Nothing to fold: return without taking the write lock, as read-only
+    // connections cannot.
+    const QVariantList bounds = state[0].toList();
+    const qint64 maxId = bounds[1].toLongLong();
+    if (bounds[0].toLongLong() >= maxId) {
+        return true;
+    }
+
+    while (true) {
+        if (!dbManager->beginImmediateTransaction()) {
+            return false;
+        }
+        // Re-read under the write lock: a concurrent refresh may already
+        // have folded past the unlocked read above.
+        QVariantList current;
+        if (!dbManager->executeQuery(kWatermarkSql, {kWatermarkName}, true, &current) || current.isEmpty()) {
+            dbManager->rollbackTransaction();
+            return false;
+        }
+        const qint64 watermark = current[0].toList()[0].toLongLong();
+        if (watermark >= maxId) {
+            dbManager->rollbackTransaction();
+            return true;
+        }
+        const qint64 upper = std::min(watermark + kChunkSize, maxId);
+
+        QVariantList items;
+        if (touchedItems &&
+            !dbManager->executeQuery(
+                "SELECT DISTINCT item_id FROM movimentacoes WHERE id > ? AND id <= ? "
+                "AND motivo IN ('Retirada por colaborador', 'Devolução por colaborador')",
+                {watermark, upper}, true, &items)) {
+            dbManager->rollbackTransaction();
+            return false;
+        }
+        QVariantList advanced;
+        const bool ok =
+            dbManager->executeQuery(
+                "INSERT INTO consumo_diario (item_id, dia, retirado, devolvido) "
+                "SELECT item_id, substr(data, 1, 10), "
+                "SUM(CASE WHEN alteracao_quantidade < 0 THEN -alteracao_quantidade ELSE 0 END), "
+                "SUM(CASE WHEN alteracao_quantidade > 0 THEN alteracao_quantidade ELSE 0 END) "
+                "FROM movimentacoes WHERE id > ? AND id <= ? "
+                "AND motivo IN ('Retirada por colaborador', 'Devolução por colaborador') "
+                "GROUP BY item_id, substr(data, 1, 10) "
+                "ON CONFLICT(item_id, dia) DO UPDATE SET "
+                "retirado = retirado + excluded.retirado, devolvido = devolvido + excluded.devolvido",
+                {watermark, upper}) &&
+            dbManager->executeQuery(kAdvanceSql, {kWatermarkName, upper, watermark}, true, &advanced) &&
+            !advanced.isEmpty();
+        if (!ok) {
+            dbManager->rollbackTransaction();
+            return false;
+        }
+        if (!dbManager->commitTransaction()) {
+            return false;
+        }
+        for (const auto &item : items) {
+            touchedItems->insert(item.toList()[0].toInt());
+        }
+    }
+}
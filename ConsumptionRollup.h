@@ -0,0 +1,23 @@
+#ifndef CONSUMPTIONROLLUP_H
+#define CONSUMPTIONROLLUP_H
+
+#include <QSet>
+#include "DatabaseManager.h"
+
+// Folds collaborator withdrawals and returns into consumo_diario, one row
+// per item and day. Only movements past the stored watermark are read, in
+// id-range chunks, so a refresh costs what was added since the last one.
+// Each chunk re-reads the watermark under BEGIN IMMEDIATE, so connections
+// refreshing at the same time never fold the same range twice.
+class ConsumptionRollup {
+public:
+    explicit ConsumptionRollup(DatabaseManager *dbManager);
+
+    // Reports the items whose daily totals changed through touchedItems.
+    bool refresh(QSet<int> *touchedItems = nullptr);
+
+private:
+    DatabaseManager *dbManager;
+};
+
+#endif // CONSUMPTIONROLLUP_H
@@ -0,0 +1,180 @@
+#include "CredentialService.h"
+#include "Tracing.h"
+#include <QCryptographicHash>
+#include <QFutureWatcher>
+#include <QMessageAuthenticationCode>
+#include <QPasswordDigestor>
+#include <QRandomGenerator>
+#include <QtConcurrent>
+
+namespace {
+const char *const kScheme = "pbkdf2-sha256";
+const int kSaltBytes = 16;
+const int kKeyBytes = 32;
+
+QByteArray randomBytes(int size) {
+    QByteArray bytes(size, Qt::Uninitialized);
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32 *>(bytes.data()), size / int(sizeof(quint32)));
+    return bytes;
+}
+}
+
+CredentialService::CredentialService(DatabaseManager *dbManager)
+    : dbManager(dbManager), processKey(randomBytes(kKeyBytes)) {}
+
+QString CredentialService::hashPassword(const QString &password) {
+    EPI_TRACE_SCOPE("CredentialService::hashPassword");
+    const QByteArray salt = randomBytes(kSaltBytes);
+    const QByteArray key =
+        QPasswordDigestor::deriveKeyPbkdf2(QCryptographicHash::Sha256, password.toUtf8(), salt, kIterations, kKeyBytes);
+    return QString("%1$%2$%3$%4")
+        .arg(kScheme)
+        .arg(kIterations)
+        .arg(QString::fromLatin1(salt.toBase64()), QString::fromLatin1(key.toBase64()));
+}
+
+bool CredentialService::matches(const QString &stored, const QString &password) {
+    return check(parse(stored), password);
+}
+
+bool CredentialService::isLegacy(const QString &stored) {
+    return parse(stored).legacy;
+}
+
+CredentialService::Params CredentialService::parse(const QString &stored) {
+    Params params;
+    const QStringList parts = stored.split('$');
+    if (parts.size() == 4 && parts[0] == kScheme) {
+        params.iterations = parts[1].toInt();
+        params.salt = QByteArray::fromBase64(parts[2].toLatin1());
+        params.key = QByteArray::fromBase64(parts[3].toLatin1());
+        params.valid = params.iterations > 0 && !params.salt.isEmpty() && params.key.size() == kKeyBytes;
+    } else if (stored.size() == 64) {
+        params.key = QByteArray::fromHex(stored.toLatin1());
+        params.legacy = true;
+        params.valid = params.key.size() == 32;
+    }
+    return params;
+}
+
+bool CredentialService::check(const Params &params, const QString &password) {
+    EPI_TRACE_SCOPE("CredentialService::check");
+    if (!params.valid) {
+        return false;
+    }
+    if (params.legacy) {
+        return equalBytes(QCryptographicHash::hash(password.toUtf8(), QCryptographicHash::Sha256), params.key);
+    }
+    return equalBytes(QPasswordDigestor::deriveKeyPbkdf2(QCryptographicHash::Sha256, password.toUtf8(), params.salt,
+                                                          params.iterations, quint64(params.key.size())),
+                      params.key);
+}
+
+bool CredentialService::equalBytes(const QByteArray &a, const QByteArray &b) {
+    // Compares every byte so the time taken says nothing about where a
+    // mismatch is.
+    if (a.size() != b.size()) {
+        return false;
+    }
+    char diff = 0;
+    for (int i = 0; i < a.size(); ++i) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+QByteArray CredentialService::proof(const QString &stored, const QString &password) const {
+    return QMessageAuthenticationCode::hash(stored.toUtf8() + '\0' + password.toUtf8(), processKey,
+                                            QCryptographicHash::Sha256);
+}
+
+void CredentialService::verify(int userId, const QString &password, QObject *context, std::function<void(bool)> done) {
+    QVariantList result;
+    if (!dbManager->executeQuery("SELECT senha FROM usuarios WHERE id = ?", {userId}, true, &result) ||
+        result.isEmpty()) {
+        done(false);
+        return;
+    }
+    run(userId, result[0].toList()[0].toString(), password, context, done);
+}
+
+void CredentialService::login(const QString &username, const QString &password, QObject *context,
+                              std::function<void(bool, int, int)> done) {
+    QVariantList result;
+    if (!dbManager->executeQuery("SELECT id, level, senha FROM usuarios WHERE nome_usuario = ? ORDER BY id LIMIT 1",
+                                 {username}, true, &result) ||
+        result.isEmpty()) {
+        done(false, -1, -1);
+        return;
+    }
+    const QVariantList user = result[0].toList();
+    const int userId = user[0].toInt();
+    const int level = user[1].toInt();
+    run(userId, user[2].toString(), password, context, [done, userId, level](bool ok) {
+        done(ok, ok ? userId : -1, ok ? level : -1);
+    });
+}
+
+void CredentialService::forget(int userId) {
+    if (userId) {
+        params.remove(remembered.value(userId).stored);
+        remembered.remove(userId);
+    } else {
+        params.clear();
+        remembered.clear();
+    }
+}
+
+void CredentialService::run(int userId, const QString &stored, const QString &password, QObject *context,
+                            std::function<void(bool)> done) {
+    EPI_TRACE_SCOPE("CredentialService::run");
+    auto hit = remembered.constFind(userId);
+    if (hit != remembered.constEnd()) {
+        if (hit->stored == stored && hit->until > QDateTime::currentDateTime() &&
+            equalBytes(hit->proof, proof(stored, password))) {
+            done(true);
+            return;
+        }
+        remembered.remove(userId);
+    }
+    if (!params.contains(stored)) {
+        if (params.size() >= kMaxParsedRecords) {
+            params.clear();
+        }
+        params.insert(stored, parse(stored));
+    }
+    const Params parsed = params.value(stored);
+
+    auto *watcher = new QFutureWatcher<Outcome>(context);
+    QObject::connect(watcher, &QFutureWatcher<Outcome>::finished, context,
+                     [this, watcher, userId, stored, password, done] {
+        const Outcome outcome = watcher->result();
+        watcher->deleteLater();
+        if (!outcome.ok) {
+            done(false);
+            return;
+        }
+        QString current = stored;
+        QVariantList upgraded;
+        // Only replaces the record that was verified, in case it changed
+        // while the KDF ran.
+        if (!outcome.upgraded.isEmpty() &&
+            dbManager->executeQuery("UPDATE usuarios SET senha = ? WHERE id = ? AND senha = ? RETURNING id",
+                                    {outcome.upgraded, userId, stored}, true, &upgraded) &&
+            !upgraded.isEmpty()) {
+            current = outcome.upgraded;
+            params.remove(stored);
+        }
+        remembered.insert(userId, {current, proof(current, password),
+                                   QDateTime::currentDateTime().addSecs(kCacheMinutes * 60)});
+        done(true);
+    });
+    watcher->setFuture(QtConcurrent::run([parsed, password] {
+        Outcome outcome;
+        outcome.ok = check(parsed, password);
+        if (outcome.ok && parsed.legacy) {
+            outcome.upgraded = hashPassword(password);
+        }
+        return outcome;
+    }));
+}
@@ -0,0 +1,77 @@
+#ifndef CREDENTIALSERVICE_H
+#define CREDENTIALSERVICE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <functional>
+#include "DatabaseManager.h"
+
+// Password records in usuarios.senha are
+//   pbkdf2-sha256$<iterations>$<salt base64>$<key base64>
+// Older records are an unsalted SHA-256 hex digest; they still verify and
+// are rewritten in the new format the first time they do.
+//
+// The KDF is deliberately slow, so the GUI never runs it itself: verify()
+// reads the stored record (one primary-key lookup), runs the KDF on the
+// thread pool and calls back on the context object's thread. Parsed
+// records are cached by their text, and a successful verification is
+// remembered for kCacheMinutes as an HMAC under a per-process key, so a
+// collaborator confirming several batches in a row pays the KDF once. A
+// changed record in the database invalidates both; forget() drops a
+// deleted user's, and at most kMaxParsedRecords parsed records are kept.
+class CredentialService {
+public:
+    static const int kIterations = 100000;
+    static const int kCacheMinutes = 10;
+
+    explicit CredentialService(DatabaseManager *dbManager);
+
+    // Blocking primitives, for worker threads and the API server.
+    static QString hashPassword(const QString &password);
+    static bool matches(const QString &stored, const QString &password);
+    static bool isLegacy(const QString &stored);
+
+    void verify(int userId, const QString &password, QObject *context, std::function<void(bool)> done);
+    // Looks the user up by nome_usuario; userId and level are -1 on failure.
+    void login(const QString &username, const QString &password, QObject *context,
+               std::function<void(bool ok, int userId, int level)> done);
+    // userId 0 forgets every remembered verification.
+    void forget(int userId = 0);
+
+private:
+    static const int kMaxParsedRecords = 256;
+
+    struct Params {
+        int iterations = 0;
+        QByteArray salt;
+        QByteArray key;
+        bool legacy = false;
+        bool valid = false;
+    };
+    struct Remembered {
+        QString stored;
+        QByteArray proof;
+        QDateTime until;
+    };
+    struct Outcome {
+        bool ok = false;
+        QString upgraded;
+    };
+
+    static Params parse(const QString &stored);
+    static bool check(const Params &params, const QString &password);
+    static bool equalBytes(const QByteArray &a, const QByteArray &b);
+    QByteArray proof(const QString &stored, const QString &password) const;
+    void run(int userId, const QString &stored, const QString &password, QObject *context,
+             std::function<void(bool)> done);
+
+    DatabaseManager *dbManager;
+    QByteArray processKey;
+    QHash<QString, Params> params;
+    QHash<int, Remembered> remembered;
+};
+
+#endif // CREDENTIALSERVICE_H
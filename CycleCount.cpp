@@ -0,0 +1,336 @@
+#include "CycleCount.h"
+#include "Tracing.h"
+#include <QFile>
+#include <QRegularExpression>
+#include <QTextStream>
+
+namespace {
+const char *const kMomentFormat = "yyyy-MM-dd hh:mm:ss";
+}
+
+CycleCount::CycleCount(DatabaseManager *dbManager)
+    : dbManager(dbManager), open(false), startMark(0), counted(0) {}
+
+qint64 CycleCount::ledgerPosition() {
+    QVariantList result;
+    if (!dbManager->executeQuery("SELECT COALESCE(MAX(id), 0) FROM estoque_ledger", {}, true, &result) ||
+        result.isEmpty()) {
+        return -1;
+    }
+    return result[0].toList()[0].toLongLong();
+}
+
+bool CycleCount::start(int categoriaId, QString *error) {
+    EPI_TRACE_SCOPE("CycleCount::start");
+    cancel();
+    // Quantities and ledger position must come from the same snapshot of
+    // the database, or a commit in between would be counted twice.
+    if (!dbManager->beginTransaction()) {
+        *error = "Falha ao iniciar transação";
+        return false;
+    }
+    QList<InventoryRow> items;
+    const qint64 mark = ledgerPosition();
+    const bool ok = mark >= 0 && (categoriaId
+                                      ? dbManager->select("WHERE i.categoria_id = ? ORDER BY i.nome, i.tamanho",
+                                                          {categoriaId}, &items)
+                                      : dbManager->select("ORDER BY i.nome, i.tamanho", {}, &items));
+    dbManager->commitTransaction();
+    if (!ok) {
+        *error = "Falha ao ler o estoque esperado";
+        return false;
+    }
+    if (items.isEmpty()) {
+        *error = "Nenhum EPI no escopo da contagem";
+        return false;
+    }
+
+    lines.reserve(items.size());
+    byItem.reserve(items.size());
+    for (const InventoryRow &row : items) {
+        const int index = lines.size();
+        Line line;
+        line.item = row;
+        lines.append(line);
+        byItem.insert(row.itemId, index);
+        if (!row.ca.trimmed().isEmpty()) {
+            byCode[row.ca.trimmed().toUpper()].append(index);
+        }
+        byCode[QString("EPI-%1").arg(row.itemId)].append(index);
+    }
+    startMark = mark;
+    started = QDateTime::currentDateTime();
+    open = true;
+    return true;
+}
+
+void CycleCount::cancel() {
+    open = false;
+    started = QDateTime();
+    startMark = 0;
+    counted = 0;
+    lines.clear();
+    byItem.clear();
+    byCode.clear();
+}
+
+int CycleCount::resolve(const QString &code, QString *message) const {
+    const auto it = byCode.constFind(code.trimmed().toUpper());
+    if (it == byCode.constEnd()) {
+        *message = QString("Código %1 fora do escopo da contagem").arg(code);
+        return -1;
+    }
+    // A CA shared by several sizes is only accepted once one of them has
+    // been counted by label; the count then goes to that size.
+    const QList<int> &candidates = it.value();
+    if (candidates.size() == 1) {
+        return candidates.first();
+    }
+    int chosen = -1;
+    for (int index : candidates) {
+        if (lines[index].isCounted) {
+            if (chosen >= 0) {
+                chosen = -1;
+                break;
+            }
+            chosen = index;
+        }
+    }
+    if (chosen < 0) {
+        *message = QString("CA %1 possui %2 tamanhos; leia a etiqueta EPI do tamanho contado")
+                       .arg(code).arg(candidates.size());
+    }
+    return chosen;
+}
+
+void CycleCount::record(int index, int quantity, qint64 mark) {
+    Line &line = lines[index];
+    if (!line.isCounted) {
+        line.isCounted = true;
+        ++counted;
+    }
+    line.contado += quantity;
+    line.mark = mark;
+}
+
+bool CycleCount::addCount(const QString &code, int quantity, int *itemId, QString *message) {
+    if (!open) {
+        *message = "Nenhuma contagem em andamento";
+        return false;
+    }
+    const int index = resolve(code, message);
+    if (index < 0) {
+        return false;
+    }
+    const Line &line = lines[index];
+    if (line.contado + quantity < 0) {
+        *message = QString("Contagem de '%1' ficaria negativa").arg(line.item.nome);
+        return false;
+    }
+    const qint64 mark = ledgerPosition();
+    if (mark < 0) {
+        *message = "Falha ao consultar o histórico de estoque";
+        return false;
+    }
+    record(index, quantity, mark);
+    *itemId = line.item.itemId;
+    *message = QString("%1 (Tamanho: %2) — %3 contados")
+                   .arg(line.item.nome, line.item.tamanho.isEmpty() ? "N/A" : line.item.tamanho)
+                   .arg(line.contado);
+    return true;
+}
+
+int CycleCount::importCsv(const QString &fileName, QStringList *errors) {
+    EPI_TRACE_SCOPE("CycleCount::importCsv");
+    if (!open) {
+        errors->append("Nenhuma contagem em andamento");
+        return 0;
+    }
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        errors->append(QString("Não foi possível abrir %1").arg(fileName));
+        return 0;
+    }
+    const qint64 mark = ledgerPosition();
+    if (mark < 0) {
+        errors->append("Falha ao consultar o histórico de estoque");
+        return 0;
+    }
+
+    static const QRegularExpression separator("[;,\\t]");
+    QTextStream in(&file);
+    int lineNumber = 0;
+    int applied = 0;
+    QString message;
+    while (!in.atEnd()) {
+        const QString text = in.readLine().trimmed();
+        ++lineNumber;
+        if (text.isEmpty()) continue;
+        const QStringList fields = text.split(separator);
+        bool ok = false;
+        const int quantity = fields.size() >= 2 ? fields[1].trimmed().toInt(&ok) : 0;
+        if (!ok) {
+            if (lineNumber > 1) {
+                errors->append(QString("Linha %1: quantidade inválida").arg(lineNumber));
+            }
+            continue;
+        }
+        const int index = resolve(fields[0], &message);
+        if (index < 0) {
+            errors->append(QString("Linha %1: %2").arg(lineNumber).arg(message));
+            continue;
+        }
+        if (quantity < 0 || lines[index].contado + quantity < 0) {
+            errors->append(QString("Linha %1: quantidade negativa").arg(lineNumber));
+            continue;
+        }
+        // Several lines for one item are several bins: they add up.
+        record(index, quantity, mark);
+        ++applied;
+    }
+    return applied;
+}
+
+QList<int> CycleCount::countedItems() const {
+    QList<int> items;
+    items.reserve(counted);
+    for (const Line &line : lines) {
+        if (line.isCounted) {
+            items.append(line.item.itemId);
+        }
+    }
+    return items;
+}
+
+bool CycleCount::item(int itemId, CountVariance *row) const {
+    const auto it = byItem.constFind(itemId);
+    if (it == byItem.constEnd()) {
+        return false;
+    }
+    const Line &line = lines[it.value()];
+    row->itemId = itemId;
+    row->nome = line.item.nome;
+    row->ca = line.item.ca;
+    row->tamanho = line.item.tamanho;
+    row->esperado = int(line.item.quantidade);
+    row->moved = 0;
+    row->contado = line.contado;
+    row->variacao = line.isCounted ? line.contado - row->esperado : 0;
+    return true;
+}
+
+bool CycleCount::variances(QList<CountVariance> *rows, QString *error) {
+    EPI_TRACE_SCOPE("CycleCount::variances");
+    rows->clear();
+    if (!open) {
+        *error = "Nenhuma contagem em andamento";
+        return false;
+    }
+    // One pass over what changed since the snapshot; entries after an
+    // item's count happened after it was on the shelf and do not count.
+    QVariantList changes;
+    if (!dbManager->executeQuery("SELECT id, item_id, delta FROM estoque_ledger WHERE id > ? ORDER BY id",
+                                 {startMark}, true, &changes)) {
+        *error = "Falha ao consultar o histórico de estoque";
+        return false;
+    }
+    QVector<int> moved(lines.size(), 0);
+    for (const QVariant &entry : changes) {
+        const QVariantList change = entry.toList();
+        const auto it = byItem.constFind(change[1].toInt());
+        if (it == byItem.constEnd()) continue;
+        const Line &line = lines[it.value()];
+        if (line.isCounted && change[0].toLongLong() <= line.mark) {
+            moved[it.value()] += change[2].toInt();
+        }
+    }
+
+    rows->reserve(counted);
+    for (int index = 0; index < lines.size(); ++index) {
+        const Line &line = lines[index];
+        if (!line.isCounted) continue;
+        CountVariance row;
+        row.itemId = line.item.itemId;
+        row.nome = line.item.nome;
+        row.ca = line.item.ca;
+        row.tamanho = line.item.tamanho;
+        row.esperado = int(line.item.quantidade);
+        row.moved = moved[index];
+        row.contado = line.contado;
+        row.variacao = line.contado - row.esperado - row.moved;
+        rows->append(row);
+    }
+    return true;
+}
+
+bool CycleCount::post(int operatorId, int *adjusted, QString *error) {
+    EPI_TRACE_SCOPE("CycleCount::post");
+    *adjusted = 0;
+    QList<CountVariance> rows;
+    if (!variances(&rows, error)) {
+        return false;
+    }
+    QVariantList pairs;
+    int units = 0;
+    for (const CountVariance &row : rows) {
+        if (row.variacao != 0) {
+            pairs << row.itemId << row.variacao;
+            units += qAbs(row.variacao);
+        }
+    }
+    const QString motivo = QString("Contagem cíclica de %1").arg(started.toString("dd/MM/yyyy hh:mm"));
+    if (pairs.isEmpty()) {
+        cancel();
+        return true;
+    }
+
+    if (!dbManager->executeQuery(
+            "CREATE TEMP TABLE IF NOT EXISTS contagem_variacoes (item_id INTEGER PRIMARY KEY, delta INTEGER NOT NULL)")) {
+        *error = "Falha ao preparar o lançamento";
+        return false;
+    }
+    if (!dbManager->beginTransaction()) {
+        *error = "Falha ao iniciar transação";
+        return false;
+    }
+    auto fail = [this, error](const QString &message) {
+        dbManager->rollbackTransaction();
+        *error = message;
+        return false;
+    };
+
+    if (!dbManager->executeQuery("DELETE FROM contagem_variacoes")) {
+        return fail("Falha ao preparar o lançamento");
+    }
+    if (!dbManager->insertRows("contagem_variacoes", {"item_id", "delta"}, pairs)) {
+        return fail("Falha ao registrar as diferenças");
+    }
+
+    const QString now = QDateTime::currentDateTime().toString(kMomentFormat);
+    QVariantList updated;
+    if (!dbManager->executeQuery(
+            "UPDATE itens SET quantidade = COALESCE(quantidade, 0) + "
+            "(SELECT v.delta FROM contagem_variacoes v WHERE v.item_id = itens.id) "
+            "WHERE id IN (SELECT item_id FROM contagem_variacoes) RETURNING id",
+            {}, true, &updated) ||
+        !dbManager->executeQuery(
+            "INSERT INTO movimentacoes (item_id, alteracao_quantidade, data, motivo, colaborador_id, expiration_date) "
+            "SELECT v.item_id, v.delta, ?, ?, NULL, '' FROM contagem_variacoes v JOIN itens i ON i.id = v.item_id",
+            {now, motivo}) ||
+        !dbManager->executeQuery(
+            "INSERT INTO audit_logs (user_id, action, details, timestamp) VALUES (?, ?, ?, ?)",
+            {operatorId, "post_cycle_count",
+             QString("%1: %2 de %3 EPIs contados ajustados, %4 unidades de diferença")
+                 .arg(motivo).arg(updated.size()).arg(rows.size()).arg(units),
+             now}) ||
+        !dbManager->executeQuery("DELETE FROM contagem_variacoes")) {
+        return fail("Falha ao lançar os ajustes da contagem");
+    }
+    if (!dbManager->commitTransaction()) {
+        *error = "Falha ao gravar os ajustes da contagem";
+        return false;
+    }
+    *adjusted = updated.size();
+    cancel();
+    return true;
+}
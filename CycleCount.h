@@ -0,0 +1,91 @@
+#ifndef CYCLECOUNT_H
+#define CYCLECOUNT_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "DatabaseManager.h"
+#include "StockLedger.h"
+
+// One counted item. moved is the net stock change between the session
+// snapshot and the moment the item was counted, so the variance is
+// measured against what should have been on the shelf at that moment.
+struct CountVariance {
+    int itemId = 0;
+    QString nome;
+    QString ca;
+    QString tamanho;
+    int esperado = 0;
+    int moved = 0;
+    int contado = 0;
+    int variacao = 0;
+};
+
+// Physical count session. start() reads the expected quantities and the
+// estoque_ledger position in one read transaction; counts then
+// accumulate in memory, by scan (CA or EPI-<id> label) or CSV, without
+// touching the database. post() looks up the ledger entries recorded
+// since the snapshot once, works out each variance in memory and applies
+// them all in one transaction: the variances go into a temporary table
+// and a handful of set-based statements adjust itens and write the
+// movimentacoes, whatever the number of items.
+//
+// A variance is added to the current stock rather than overwriting it,
+// so withdrawals committed while counting are kept. Items not counted
+// are left alone.
+class CycleCount {
+public:
+    explicit CycleCount(DatabaseManager *dbManager);
+
+    // categoriaId 0 counts every item.
+    bool start(int categoriaId, QString *error);
+    void cancel();
+    bool isOpen() const { return open; }
+    QDateTime startedAt() const { return started; }
+    int itemCount() const { return lines.size(); }
+    int countedCount() const { return counted; }
+
+    // Adds quantity (may be negative, to undo a misread) to the item the
+    // code resolves to; *itemId receives it.
+    bool addCount(const QString &code, int quantity, int *itemId, QString *message);
+    // Lines are "codigo;quantidade" (',' or tab also separate); a header
+    // line and blank lines are skipped. Returns the number of lines
+    // applied; unusable lines are described in errors.
+    int importCsv(const QString &fileName, QStringList *errors);
+
+    QList<int> countedItems() const;
+    // Counted minus the snapshot, without movements made since.
+    bool item(int itemId, CountVariance *line) const;
+    // Counted items only, with movements since the snapshot applied.
+    bool variances(QList<CountVariance> *rows, QString *error);
+    // *adjusted receives the number of items whose stock changed. Closes
+    // the session on success.
+    bool post(int operatorId, int *adjusted, QString *error);
+
+private:
+    struct Line {
+        InventoryRow item;
+        int contado = 0;
+        bool isCounted = false;
+        // Ledger position when the item was last counted.
+        qint64 mark = 0;
+    };
+
+    qint64 ledgerPosition();
+    int resolve(const QString &code, QString *message) const;
+    void record(int index, int quantity, qint64 mark);
+
+    DatabaseManager *dbManager;
+    bool open;
+    QDateTime started;
+    qint64 startMark;
+    int counted;
+    QVector<Line> lines;
+    QHash<int, int> byItem;
+    QHash<QString, QList<int>> byCode;
+};
+
+#endif // CYCLECOUNT_H
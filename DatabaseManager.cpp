@@ -1,22 +1,97 @@
 #include "DatabaseManager.h"
+#include "Tracing.h"
+#include "ColumnarResult.h"
 #include <QSqlError>
 #include <QCryptographicHash>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QUrl>
+#include <QTextStream>
+#include <QSqlRecord>
+#include <QRegularExpression>
+#include <QSqlDriver>
+#include <QUuid>
+#include <sqlite3.h>
+#include <algorithm>
 
-DatabaseManager::DatabaseManager(const QString &db_name) {
-    db = QSqlDatabase::addDatabase("QSQLITE");
-    db.setDatabaseName(db_name);
+namespace {
+const int kMaxSlowLogEntries = 200;
+// Typed statements are cached by SQL text; keyset pages and report filters
+// build that text, so the cache is emptied when it reaches this size.
+const int kMaxTypedStatements = 64;
+// Same for the per-text lookups (normalized form, mutated table): archive
+// unions and date filters keep producing new text, so they are emptied
+// when they reach this size.
+const int kMaxSqlCacheEntries = 256;
+
+QString formatMs(qint64 ns) {
+    return QString::number(ns / 1e6, 'f', 2);
+}
+}
+
+DatabaseManager::DatabaseManager(const QString &db_name, const QString &connectionName, OpenMode mode)
+    : fileName(db_name), connectionName(connectionName), mode(mode), rawDb(nullptr), slowQueryThresholdMs(100) {
+    db = connectionName.isEmpty() ? QSqlDatabase::addDatabase("QSQLITE")
+                                  : QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    if (mode == OpenMode::Snapshot) {
+        db.setDatabaseName(QUrl::fromLocalFile(QFileInfo(db_name).absoluteFilePath()).toString() +
+                           "?mode=ro&immutable=1");
+        db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_OPEN_URI");
+    } else {
+        db.setDatabaseName(db_name);
+        if (mode == OpenMode::ReadOnly) {
+            db.setConnectOptions("QSQLITE_OPEN_READONLY");
+        }
+    }
     if (!db.open()) {
         qDebug() << "Database Error:" << db.lastError().text();
         return;
     }
-    initDatabase();
+    if (mode == OpenMode::Snapshot) {
+        // Map the whole file: reads are served from the page cache without
+        // copying pages into SQLite's own cache.
+        QSqlQuery pragma(db);
+        if (!pragma.exec(QString("PRAGMA mmap_size = %1").arg(QFileInfo(db_name).size())) ||
+            !pragma.exec("PRAGMA query_only = 1")) {
+            qDebug() << "Snapshot Setup Error:" << pragma.lastError().text();
+        }
+    }
+    // Typed reads run on the driver's own connection so they share its
+    // transactions and attached archives. Calling the SQLite linked here on
+    // that handle is only sound when the driver was built against the same
+    // library (Qt with -system-sqlite); Qt's bundled SQLite, as shipped on
+    // Windows, is a different copy, and typed reads then go through QtSql.
+    const QVariant handle = db.driver()->handle();
+    QSqlQuery probe(db);
+    if (handle.isValid() && qstrcmp(handle.typeName(), "sqlite3*") == 0 &&
+        probe.exec("SELECT sqlite_source_id()") && probe.next()) {
+        if (probe.value(0).toString() == QLatin1String(sqlite3_sourceid())) {
+            rawDb = *static_cast<sqlite3 *const *>(handle.constData());
+        } else {
+            qDebug() << "SQLite Mismatch: driver" << probe.value(0).toString() << "linked" << sqlite3_sourceid()
+                     << "- typed reads go through QtSql";
+        }
+    }
+    probe.finish();
+    if (mode == OpenMode::ReadWrite) {
+        initDatabase();
+    }
 }
 
 DatabaseManager::~DatabaseManager() {
+    for (sqlite3_stmt *stmt : std::as_const(typedStatements)) {
+        sqlite3_finalize(stmt);
+    }
     if (db.isOpen()) {
         db.close();
     }
+    if (!connectionName.isEmpty()) {
+        db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(connectionName);
+    }
 }
 
 void DatabaseManager::initDatabase() {
@@ -72,16 +147,142 @@ void DatabaseManager::initDatabase() {
         "FOREIGN KEY (user_id) REFERENCES usuarios (id))",
         "CREATE INDEX IF NOT EXISTS idx_itens_nome ON itens(nome)",
         "CREATE INDEX IF NOT EXISTS idx_itens_ca ON itens(ca)",
-        "CREATE INDEX IF NOT EXISTS idx_movimentacoes_data ON movimentacoes(data)"
+        "CREATE INDEX IF NOT EXISTS idx_movimentacoes_data ON movimentacoes(data)",
+        "CREATE INDEX IF NOT EXISTS idx_movimentacoes_colaborador_data ON movimentacoes(colaborador_id, data)",
+        "CREATE INDEX IF NOT EXISTS idx_movimentacoes_expiration ON movimentacoes(expiration_date)",
+        "CREATE INDEX IF NOT EXISTS idx_movimentacoes_motivo_data ON movimentacoes(motivo, data)",
+        "CREATE INDEX IF NOT EXISTS idx_movimentacoes_motivo_expiration ON movimentacoes(motivo, expiration_date)",
+        "CREATE TABLE IF NOT EXISTS controle_incremental ("
+        "nome TEXT PRIMARY KEY, "
+        "ultimo_id INTEGER)",
+        "CREATE TABLE IF NOT EXISTS vencimentos_pendentes ("
+        "movimentacao_id INTEGER PRIMARY KEY, "
+        "colaborador_id INTEGER, "
+        "item_id INTEGER, "
+        "quantidade_restante INTEGER, "
+        "expiration_date TEXT, "
+        "data_entrega TEXT, "
+        "FOREIGN KEY (movimentacao_id) REFERENCES movimentacoes (id))",
+        "CREATE INDEX IF NOT EXISTS idx_vencimentos_data ON vencimentos_pendentes(expiration_date)",
+        "CREATE INDEX IF NOT EXISTS idx_vencimentos_colab_item ON vencimentos_pendentes(colaborador_id, item_id, expiration_date)",
+        "CREATE TABLE IF NOT EXISTS consumo_diario ("
+        "item_id INTEGER, "
+        "dia TEXT, "
+        "retirado INTEGER, "
+        "devolvido INTEGER, "
+        "PRIMARY KEY (item_id, dia)) WITHOUT ROWID",
+        "CREATE INDEX IF NOT EXISTS idx_consumo_diario_dia ON consumo_diario(dia)",
+        "CREATE TABLE IF NOT EXISTS arquivos ("
+        "ano INTEGER PRIMARY KEY, "
+        "caminho TEXT, "
+        "movimentacoes INTEGER, "
+        "audit_logs INTEGER, "
+        "arquivado_em TEXT)",
+        "CREATE TABLE IF NOT EXISTS saldos_arquivados ("
+        "colaborador_id INTEGER, "
+        "item_id INTEGER, "
+        "quantidade INTEGER, "
+        "PRIMARY KEY (colaborador_id, item_id)) WITHOUT ROWID",
+        "CREATE INDEX IF NOT EXISTS idx_audit_logs_timestamp ON audit_logs(timestamp)",
+        "CREATE TABLE IF NOT EXISTS consumo_empresa ("
+        "empresa_id INTEGER, "
+        "dia TEXT, "
+        "item_id INTEGER, "
+        "quantidade INTEGER, "
+        "valor REAL, "
+        "PRIMARY KEY (empresa_id, dia, item_id)) WITHOUT ROWID",
+        "CREATE INDEX IF NOT EXISTS idx_consumo_empresa_dia ON consumo_empresa(dia)",
+        "CREATE INDEX IF NOT EXISTS idx_usuarios_empresa ON usuarios(empresa_id)",
+        "CREATE TABLE IF NOT EXISTS reservas ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "item_id INTEGER, "
+        "quantidade INTEGER, "
+        "dono TEXT, "
+        "expira_em TEXT, "
+        "FOREIGN KEY (item_id) REFERENCES itens (id))",
+        "CREATE INDEX IF NOT EXISTS idx_reservas_item ON reservas(item_id, expira_em)",
+        "CREATE INDEX IF NOT EXISTS idx_reservas_dono ON reservas(dono)",
+        "CREATE INDEX IF NOT EXISTS idx_reservas_expira ON reservas(expira_em)",
+        "CREATE TABLE IF NOT EXISTS estoque_ledger ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "item_id INTEGER NOT NULL, "
+        "data TEXT NOT NULL, "
+        "delta INTEGER NOT NULL, "
+        "saldo INTEGER NOT NULL)",
+        "CREATE INDEX IF NOT EXISTS idx_estoque_ledger_item ON estoque_ledger(item_id, id)",
+        "CREATE TRIGGER IF NOT EXISTS estoque_ledger_imutavel_upd BEFORE UPDATE ON estoque_ledger BEGIN "
+        "SELECT RAISE(ABORT, 'estoque_ledger aceita apenas inclusões'); END",
+        "CREATE TRIGGER IF NOT EXISTS estoque_ledger_imutavel_del BEFORE DELETE ON estoque_ledger BEGIN "
+        "SELECT RAISE(ABORT, 'estoque_ledger aceita apenas inclusões'); END",
+        "CREATE TRIGGER IF NOT EXISTS ledger_itens_ins AFTER INSERT ON itens "
+        "WHEN COALESCE(NEW.quantidade, 0) <> 0 BEGIN "
+        "INSERT INTO estoque_ledger (item_id, data, delta, saldo) "
+        "VALUES (NEW.id, datetime('now', 'localtime'), NEW.quantidade, NEW.quantidade); END",
+        "CREATE TRIGGER IF NOT EXISTS ledger_itens_upd AFTER UPDATE OF quantidade ON itens "
+        "WHEN COALESCE(NEW.quantidade, 0) <> COALESCE(OLD.quantidade, 0) BEGIN "
+        "INSERT INTO estoque_ledger (item_id, data, delta, saldo) "
+        "VALUES (NEW.id, datetime('now', 'localtime'), COALESCE(NEW.quantidade, 0) - COALESCE(OLD.quantidade, 0), "
+        "COALESCE(NEW.quantidade, 0)); END",
+        "CREATE TRIGGER IF NOT EXISTS ledger_itens_del AFTER DELETE ON itens "
+        "WHEN COALESCE(OLD.quantidade, 0) <> 0 BEGIN "
+        "INSERT INTO estoque_ledger (item_id, data, delta, saldo) "
+        "VALUES (OLD.id, datetime('now', 'localtime'), -OLD.quantidade, 0); END",
+        "CREATE TABLE IF NOT EXISTS estoque_snapshots ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "momento TEXT NOT NULL, "
+        "ultimo_ledger_id INTEGER NOT NULL)",
+        "CREATE INDEX IF NOT EXISTS idx_estoque_snapshots_momento ON estoque_snapshots(momento)",
+        "CREATE TABLE IF NOT EXISTS estoque_snapshot_itens ("
+        "snapshot_id INTEGER, "
+        "item_id INTEGER, "
+        "quantidade INTEGER, "
+        "PRIMARY KEY (snapshot_id, item_id)) WITHOUT ROWID",
+        "CREATE TABLE IF NOT EXISTS pedidos_compra ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "fornecedor TEXT NOT NULL, "
+        "criado_em TEXT NOT NULL, "
+        "usuario_id INTEGER, "
+        "status TEXT NOT NULL DEFAULT 'aberto')",
+        "CREATE INDEX IF NOT EXISTS idx_pedidos_compra_status ON pedidos_compra(status, fornecedor)",
+        "CREATE TABLE IF NOT EXISTS pedido_compra_itens ("
+        "pedido_id INTEGER NOT NULL, "
+        "item_id INTEGER NOT NULL, "
+        "quantidade INTEGER NOT NULL, "
+        "custo_unitario REAL NOT NULL, "
+        "recebido INTEGER NOT NULL DEFAULT 0, "
+        "PRIMARY KEY (pedido_id, item_id)) WITHOUT ROWID",
+        "CREATE TABLE IF NOT EXISTS recebimentos ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "pedido_id INTEGER NOT NULL, "
+        "nota_fiscal TEXT, "
+        "data TEXT NOT NULL, "
+        "usuario_id INTEGER)",
+        "CREATE INDEX IF NOT EXISTS idx_recebimentos_pedido ON recebimentos(pedido_id)",
+        "CREATE TABLE IF NOT EXISTS recebimento_itens ("
+        "recebimento_id INTEGER NOT NULL, "
+        "item_id INTEGER NOT NULL, "
+        "quantidade INTEGER NOT NULL, "
+        "custo_unitario REAL NOT NULL, "
+        "PRIMARY KEY (recebimento_id, item_id)) WITHOUT ROWID"
     };
 
-    QSqlQuery query;
+    QSqlQuery query(db);
     for (const auto &q : queries) {
         if (!query.exec(q)) {
             qDebug() << "Database Init Error:" << query.lastError().text();
         }
     }
 
+    // Lots tracked before data_entrega existed take it from their movement,
+    // while it is still in movimentacoes.
+    if (!db.record("vencimentos_pendentes").contains("data_entrega")) {
+        if (!query.exec("ALTER TABLE vencimentos_pendentes ADD COLUMN data_entrega TEXT") ||
+            !query.exec("UPDATE vencimentos_pendentes SET data_entrega = "
+                        "(SELECT m.data FROM movimentacoes m WHERE m.id = vencimentos_pendentes.movimentacao_id)")) {
+            qDebug() << "Database Migration Error:" << query.lastError().text();
+        }
+    }
+
     // Insert default admin user
     QString adminPassword = QString(QCryptographicHash::hash("admin", QCryptographicHash::Sha256).toHex());
     query.prepare("INSERT OR IGNORE INTO usuarios (id, nome_usuario, senha, level, nome_completo, matricula, cpf, empresa_id) "
@@ -100,29 +301,514 @@ void DatabaseManager::initDatabase() {
             qDebug() << "Category Insert Error:" << query.lastError().text();
         }
     }
+
+    initSync(query);
+}
+
+void DatabaseManager::initSync(QSqlQuery &query) {
+    // Change log for site replication (SyncManager). Existing rows are
+    // logged once when the log is first created, before the triggers, so
+    // the first batch carries the whole site and later ones only changes.
+    const bool firstRun = !db.tables().contains("sync_log");
+    const QStringList tables = {
+        "CREATE TABLE IF NOT EXISTS sync_site ("
+        "id INTEGER PRIMARY KEY CHECK (id = 1), "
+        "site TEXT NOT NULL)",
+        "CREATE TABLE IF NOT EXISTS sync_log ("
+        "seq INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "tabela TEXT NOT NULL, "
+        "row_id INTEGER NOT NULL, "
+        "op TEXT NOT NULL, "
+        "delta INTEGER NOT NULL DEFAULT 0, "
+        "origem TEXT, "
+        "origem_seq INTEGER)",
+        "CREATE TABLE IF NOT EXISTS sync_ids ("
+        "tabela TEXT, "
+        "origem TEXT, "
+        "origem_id INTEGER, "
+        "local_id INTEGER, "
+        "criado INTEGER NOT NULL DEFAULT 0, "
+        "PRIMARY KEY (tabela, origem, origem_id)) WITHOUT ROWID",
+        "CREATE INDEX IF NOT EXISTS idx_sync_ids_local ON sync_ids(tabela, local_id) WHERE criado = 1",
+        "CREATE TABLE IF NOT EXISTS sync_pares ("
+        "par TEXT PRIMARY KEY, "
+        "enviado INTEGER NOT NULL DEFAULT 0, "
+        "recebido INTEGER NOT NULL DEFAULT 0, "
+        "sincronizado_em TEXT)",
+        "CREATE TABLE IF NOT EXISTS sync_recebidos ("
+        "origem TEXT PRIMARY KEY, "
+        "ultimo_seq INTEGER NOT NULL)",
+        "CREATE TABLE IF NOT EXISTS sync_conflitos ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "data TEXT, "
+        "tabela TEXT, "
+        "origem TEXT, "
+        "origem_id INTEGER, "
+        "descricao TEXT)"
+    };
+    for (const auto &q : tables) {
+        if (!query.exec(q)) {
+            qDebug() << "Database Init Error:" << query.lastError().text();
+        }
+    }
+
+    query.prepare("INSERT OR IGNORE INTO sync_site (id, site) VALUES (1, ?)");
+    query.addBindValue(QUuid::createUuid().toString(QUuid::WithoutBraces));
+    if (!query.exec()) {
+        qDebug() << "Sync Site Error:" << query.lastError().text();
+    }
+    if (!db.record("sync_pares").contains("recebido") &&
+        !query.exec("ALTER TABLE sync_pares ADD COLUMN recebido INTEGER NOT NULL DEFAULT 0")) {
+        qDebug() << "Database Migration Error:" << query.lastError().text();
+    }
+    // Existing stock is not a delta: peers that create these items copy
+    // the quantity, and peers that already hold them keep their own.
+    if (firstRun) {
+        const QStringList seed = {
+            "INSERT INTO sync_log (tabela, row_id, op, delta) SELECT 'usuarios', id, 'I', 0 FROM usuarios",
+            "INSERT INTO sync_log (tabela, row_id, op, delta) SELECT 'itens', id, 'I', 0 FROM itens",
+            "INSERT INTO sync_log (tabela, row_id, op, delta) SELECT 'movimentacoes', id, 'I', 0 FROM movimentacoes"
+        };
+        for (const auto &q : seed) {
+            if (!query.exec(q)) {
+                qDebug() << "Sync Seed Error:" << query.lastError().text();
+            }
+        }
+    }
+
+    // Movements only ever get inserted (archiving deletes stay local);
+    // item updates log the stock delta so concurrent sites merge by sum.
+    const QStringList triggers = {
+        "CREATE TRIGGER IF NOT EXISTS sync_itens_ins AFTER INSERT ON itens BEGIN "
+        "INSERT INTO sync_log (tabela, row_id, op, delta) VALUES ('itens', NEW.id, 'I', COALESCE(NEW.quantidade, 0)); END",
+        "CREATE TRIGGER IF NOT EXISTS sync_itens_upd AFTER UPDATE ON itens BEGIN "
+        "INSERT INTO sync_log (tabela, row_id, op, delta) "
+        "VALUES ('itens', NEW.id, 'U', COALESCE(NEW.quantidade, 0) - COALESCE(OLD.quantidade, 0)); END",
+        "CREATE TRIGGER IF NOT EXISTS sync_itens_del AFTER DELETE ON itens BEGIN "
+        "INSERT INTO sync_log (tabela, row_id, op) VALUES ('itens', OLD.id, 'D'); END",
+        "CREATE TRIGGER IF NOT EXISTS sync_usuarios_ins AFTER INSERT ON usuarios BEGIN "
+        "INSERT INTO sync_log (tabela, row_id, op) VALUES ('usuarios', NEW.id, 'I'); END",
+        "CREATE TRIGGER IF NOT EXISTS sync_usuarios_upd AFTER UPDATE ON usuarios BEGIN "
+        "INSERT INTO sync_log (tabela, row_id, op) VALUES ('usuarios', NEW.id, 'U'); END",
+        "CREATE TRIGGER IF NOT EXISTS sync_usuarios_del AFTER DELETE ON usuarios BEGIN "
+        "INSERT INTO sync_log (tabela, row_id, op) VALUES ('usuarios', OLD.id, 'D'); END",
+        "CREATE TRIGGER IF NOT EXISTS sync_movimentacoes_ins AFTER INSERT ON movimentacoes BEGIN "
+        "INSERT INTO sync_log (tabela, row_id, op) VALUES ('movimentacoes', NEW.id, 'I'); END"
+    };
+    for (const auto &q : triggers) {
+        if (!query.exec(q)) {
+            qDebug() << "Database Init Error:" << query.lastError().text();
+        }
+    }
 }
 
 bool DatabaseManager::executeQuery(const QString &queryStr, const QVariantList &params, bool fetch, QVariantList *result) {
-    QSqlQuery query;
+    EPI_TRACE_SCOPE("DatabaseManager::executeQuery");
+    QElapsedTimer timer;
+    timer.start();
+    QSqlQuery query(db);
     query.prepare(queryStr);
     for (int i = 0; i < params.size(); ++i) {
         query.bindValue(i, params[i]);
     }
+    const qint64 prepareNs = timer.nsecsElapsed();
 
     if (!query.exec()) {
         qDebug() << "Query Error:" << query.lastError().text();
+        recordQuery(queryStr, params, prepareNs, timer.nsecsElapsed() - prepareNs, 0, 0, false);
         return false;
     }
+    const qint64 execNs = timer.nsecsElapsed() - prepareNs;
 
+    int rows = 0;
     if (fetch && result) {
         result->clear();
+        const int columns = query.record().count();
         while (query.next()) {
             QVariantList row;
-            for (int i = 0; i < query.record().count(); ++i) {
+            row.reserve(columns);
+            for (int i = 0; i < columns; ++i) {
                 row.append(query.value(i));
             }
-            result->append(row);
+            result->append(QVariant(row));
         }
+        rows = result->size();
+    }
+    recordQuery(queryStr, params, prepareNs, execNs, timer.nsecsElapsed() - prepareNs - execNs, rows, true);
+    if (!changeListeners.isEmpty()) {
+        notifyChange(queryStr);
     }
     return true;
 }
+
+bool DatabaseManager::insertRows(const QString &table, const QStringList &columns, const QVariantList &values) {
+    EPI_TRACE_SCOPE("DatabaseManager::insertRows");
+    // 999 is the lowest SQLITE_MAX_VARIABLE_NUMBER any build may have.
+    const int width = columns.size();
+    const int rowsPerStatement = qMax(1, 999 / width);
+    const QString row = "(" + QStringList(width, "?").join(", ") + ")";
+    const QString prefix = QString("INSERT INTO %1 (%2) VALUES ").arg(table, columns.join(", "));
+    const QString fullStatement = prefix + QStringList(rowsPerStatement, row).join(", ");
+    for (int first = 0; first < values.size(); first += rowsPerStatement * width) {
+        const QVariantList chunk = values.mid(first, rowsPerStatement * width);
+        const int rows = chunk.size() / width;
+        if (!executeQuery(rows == rowsPerStatement ? fullStatement : prefix + QStringList(rows, row).join(", "),
+                          chunk)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DatabaseManager::execForwardOnly(QSqlQuery &query, const QString &queryStr, const QVariantList &params,
+                                      int columns, qint64 *prepareNs, qint64 *execNs) {
+    QElapsedTimer timer;
+    timer.start();
+    query.setForwardOnly(true);
+    query.prepare(queryStr);
+    for (int i = 0; i < params.size(); ++i) {
+        query.bindValue(i, params[i]);
+    }
+    *prepareNs = timer.nsecsElapsed();
+    const bool ok = query.exec();
+    *execNs = timer.nsecsElapsed() - *prepareNs;
+    if (!ok) {
+        qDebug() << "Query Error:" << query.lastError().text();
+    } else if (columns >= 0 && query.record().count() != columns) {
+        qDebug() << "Query Error: expected" << columns << "columns, statement returns" << query.record().count();
+    } else {
+        return true;
+    }
+    recordQuery(queryStr, params, *prepareNs, *execNs, 0, 0, false);
+    return false;
+}
+
+sqlite3_stmt *DatabaseManager::prepareTyped(const QString &queryStr, const QVariantList &params, int columns) {
+    sqlite3_stmt *stmt = typedStatements.value(queryStr);
+    if (!stmt) {
+        if (typedStatements.size() >= kMaxTypedStatements) {
+            // No typed statement is live between calls, so all can go.
+            for (sqlite3_stmt *cached : std::as_const(typedStatements)) {
+                sqlite3_finalize(cached);
+            }
+            typedStatements.clear();
+        }
+        const QByteArray sql = queryStr.toUtf8();
+        if (sqlite3_prepare_v3(rawDb, sql.constData(), int(sql.size()), SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK) {
+            qDebug() << "Query Error:" << sqlite3_errmsg(rawDb);
+            sqlite3_finalize(stmt);
+            return nullptr;
+        }
+        if (columns >= 0 && sqlite3_column_count(stmt) != columns) {
+            qDebug() << "Query Error: expected" << columns << "columns, statement returns" << sqlite3_column_count(stmt);
+            sqlite3_finalize(stmt);
+            return nullptr;
+        }
+        typedStatements.insert(queryStr, stmt);
+    }
+
+    for (int i = 0; i < params.size(); ++i) {
+        const QVariant &param = params[i];
+        int rc;
+        if (param.isNull()) {
+            rc = sqlite3_bind_null(stmt, i + 1);
+        } else {
+            switch (param.typeId()) {
+            case QMetaType::Int:
+            case QMetaType::UInt:
+            case QMetaType::LongLong:
+            case QMetaType::ULongLong:
+            case QMetaType::Bool:
+                rc = sqlite3_bind_int64(stmt, i + 1, param.toLongLong());
+                break;
+            case QMetaType::Double:
+                rc = sqlite3_bind_double(stmt, i + 1, param.toDouble());
+                break;
+            default: {
+                const QByteArray text = param.toString().toUtf8();
+                rc = sqlite3_bind_text(stmt, i + 1, text.constData(), int(text.size()), SQLITE_TRANSIENT);
+                break;
+            }
+            }
+        }
+        if (rc != SQLITE_OK) {
+            qDebug() << "Query Error:" << sqlite3_errmsg(rawDb);
+            sqlite3_clear_bindings(stmt);
+            return nullptr;
+        }
+    }
+    return stmt;
+}
+
+bool DatabaseManager::fetchColumnar(const QString &queryStr, const QVariantList &params, ColumnarResult *result) {
+    EPI_TRACE_SCOPE("DatabaseManager::fetchColumnar");
+    if (!rawDb) {
+        QSqlQuery query(db);
+        qint64 prepareNs = 0;
+        qint64 execNs = 0;
+        if (!execForwardOnly(query, queryStr, params, -1, &prepareNs, &execNs)) {
+            return false;
+        }
+        QElapsedTimer fetchTimer;
+        fetchTimer.start();
+        result->reset(query.record().count());
+        while (query.next()) {
+            result->appendRow(query);
+        }
+        recordQuery(queryStr, params, prepareNs, execNs, fetchTimer.nsecsElapsed(), result->rowCount(), true);
+        return true;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    sqlite3_stmt *stmt = prepareTyped(queryStr, params, -1);
+    const qint64 prepareNs = timer.nsecsElapsed();
+    if (!stmt) {
+        recordQuery(queryStr, params, prepareNs, 0, 0, 0, false);
+        return false;
+    }
+
+    result->reset(sqlite3_column_count(stmt));
+    int rc = sqlite3_step(stmt);
+    const qint64 execNs = timer.nsecsElapsed() - prepareNs;
+    while (rc == SQLITE_ROW) {
+        result->appendRow(stmt);
+        rc = sqlite3_step(stmt);
+    }
+    return finishTyped(stmt, rc, queryStr, params, prepareNs, execNs,
+                       timer.nsecsElapsed() - prepareNs - execNs, result->rowCount());
+}
+
+bool DatabaseManager::finishTyped(sqlite3_stmt *stmt, int rc, const QString &queryStr, const QVariantList &params,
+                                  qint64 prepareNs, qint64 execNs, qint64 fetchNs, int rows) {
+    const bool ok = rc == SQLITE_DONE;
+    if (!ok) {
+        qDebug() << "Query Error:" << sqlite3_errmsg(rawDb);
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    recordQuery(queryStr, params, prepareNs, execNs, fetchNs, rows, ok);
+    return ok;
+}
+
+void DatabaseManager::addChangeListener(const std::function<void(const QString &table)> &listener) {
+    changeListeners.append(listener);
+}
+
+void DatabaseManager::notifyChange(const QString &queryStr) {
+    static const QRegularExpression mutation(
+        "^\\s*(?:INSERT(?:\\s+OR\\s+\\w+)?\\s+INTO|REPLACE\\s+INTO|UPDATE(?:\\s+OR\\s+\\w+)?|DELETE\\s+FROM)\\s+(\\w+)",
+        QRegularExpression::CaseInsensitiveOption);
+    auto cached = mutatedTableCache.constFind(queryStr);
+    if (cached == mutatedTableCache.constEnd()) {
+        if (mutatedTableCache.size() >= kMaxSqlCacheEntries) {
+            mutatedTableCache.clear();
+        }
+        const QRegularExpressionMatch match = mutation.match(queryStr);
+        cached = mutatedTableCache.insert(queryStr, match.hasMatch() ? match.captured(1).toLower() : QString());
+    }
+    if (cached.value().isEmpty()) return;
+    for (const auto &listener : changeListeners) {
+        listener(cached.value());
+    }
+}
+
+qint64 DatabaseManager::dataVersion() {
+    // Changes committed by other connections (another counter sharing the
+    // file) bump data_version; our own writes do not.
+    QSqlQuery query(db);
+    if (!query.exec("PRAGMA data_version") || !query.next()) {
+        return -1;
+    }
+    return query.value(0).toLongLong();
+}
+
+bool DatabaseManager::beginTransaction() {
+    if (!db.transaction()) {
+        qDebug() << "Transaction Error:" << db.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::beginImmediateTransaction() {
+    QSqlQuery query(db);
+    if (!query.exec("BEGIN IMMEDIATE")) {
+        qDebug() << "Transaction Error:" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::commitTransaction() {
+    if (!db.commit()) {
+        qDebug() << "Commit Error:" << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+void DatabaseManager::rollbackTransaction() {
+    if (!db.rollback()) {
+        qDebug() << "Rollback Error:" << db.lastError().text();
+    }
+}
+
+void DatabaseManager::recordQuery(const QString &queryStr, const QVariantList &params, qint64 prepareNs, qint64 execNs, qint64 fetchNs, int rows, bool ok) {
+    auto cached = normalizedCache.constFind(queryStr);
+    if (cached == normalizedCache.constEnd()) {
+        if (normalizedCache.size() >= kMaxSqlCacheEntries) {
+            normalizedCache.clear();
+        }
+        cached = normalizedCache.insert(queryStr, normalizeSql(queryStr));
+    }
+    const QString &sql = cached.value();
+    const qint64 totalNs = prepareNs + execNs + fetchNs;
+
+    QueryStats &entry = stats[sql];
+    entry.sql = sql;
+    entry.calls++;
+    entry.rows += rows;
+    entry.prepareNs += prepareNs;
+    entry.execNs += execNs;
+    entry.fetchNs += fetchNs;
+    entry.totalNs += totalNs;
+    entry.maxNs = std::max(entry.maxNs, totalNs);
+    if (!ok) {
+        entry.errors++;
+    }
+
+    if (slowQueryThresholdMs >= 0 && totalNs >= qint64(slowQueryThresholdMs) * 1000000) {
+        SlowQuery slow;
+        slow.timestamp = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+        slow.sql = sql;
+        slow.params = redactParams(params);
+        slow.totalNs = totalNs;
+        slow.rows = rows;
+        qWarning() << "Slow Query:" << formatMs(totalNs) << "ms"
+                   << "(prepare" << formatMs(prepareNs) << "exec" << formatMs(execNs) << "fetch" << formatMs(fetchNs) << ")"
+                   << rows << "rows" << sql << slow.params;
+        if (slowLog.size() >= kMaxSlowLogEntries) {
+            slowLog.removeFirst();
+        }
+        slowLog.append(slow);
+    }
+}
+
+QString DatabaseManager::normalizeSql(const QString &sql) {
+    QString out;
+    out.reserve(sql.size());
+    bool pendingSpace = false;
+    for (int i = 0; i < sql.size(); ++i) {
+        const QChar c = sql[i];
+        if (c.isSpace()) {
+            pendingSpace = !out.isEmpty();
+            continue;
+        }
+        if (pendingSpace) {
+            out += ' ';
+            pendingSpace = false;
+        }
+        if (c == '\'') {
+            ++i;
+            while (i < sql.size()) {
+                if (sql[i] == '\'') {
+                    if (i + 1 < sql.size() && sql[i + 1] == '\'') {
+                        i += 2;
+                        continue;
+                    }
+                    break;
+                }
+                ++i;
+            }
+            out += '?';
+        } else if (c.isDigit() && (out.isEmpty() || !(out.back().isLetterOrNumber() || out.back() == '_'))) {
+            while (i + 1 < sql.size() && (sql[i + 1].isDigit() || sql[i + 1] == '.')) {
+                ++i;
+            }
+            out += '?';
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+QString DatabaseManager::redactParams(const QVariantList &params) {
+    QStringList parts;
+    for (const auto &param : params) {
+        if (param.isNull()) {
+            parts << "NULL";
+        } else if (param.typeId() == QMetaType::QString) {
+            parts << QString("<texto:%1>").arg(param.toString().size());
+        } else {
+            parts << QString("<%1>").arg(param.typeName());
+        }
+    }
+    return "[" + parts.join(", ") + "]";
+}
+
+QList<QueryStats> DatabaseManager::queryStats() const {
+    QList<QueryStats> list = stats.values();
+    std::sort(list.begin(), list.end(), [](const QueryStats &a, const QueryStats &b) {
+        return a.totalNs > b.totalNs;
+    });
+    return list;
+}
+
+QString DatabaseManager::queryStatsReport() const {
+    QString report = "<h2>Estatísticas de Consultas</h2>";
+    report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
+    report += "<tr><th>SQL</th><th>Chamadas</th><th>Erros</th><th>Linhas</th><th>Total (ms)</th><th>Média (ms)</th><th>Máx (ms)</th><th>Preparo (ms)</th><th>Execução (ms)</th><th>Leitura (ms)</th></tr>";
+    for (const auto &entry : queryStats()) {
+        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td><td>%5</td><td>%6</td><td>%7</td><td>%8</td><td>%9</td><td>%10</td></tr>")
+                     .arg(entry.sql.toHtmlEscaped(), QString::number(entry.calls), QString::number(entry.errors),
+                          QString::number(entry.rows), formatMs(entry.totalNs), formatMs(entry.totalNs / std::max<qint64>(entry.calls, 1)),
+                          formatMs(entry.maxNs), formatMs(entry.prepareNs), formatMs(entry.execNs))
+                     .arg(formatMs(entry.fetchNs));
+    }
+    report += "</table>";
+
+    report += QString("<h3>Consultas Lentas (limite: %1 ms)</h3>").arg(slowQueryThresholdMs);
+    report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
+    report += "<tr><th>Data</th><th>Tempo (ms)</th><th>Linhas</th><th>SQL</th><th>Parâmetros</th></tr>";
+    for (auto it = slowLog.crbegin(); it != slowLog.crend(); ++it) {
+        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td><td>%5</td></tr>")
+                     .arg(it->timestamp, formatMs(it->totalNs), QString::number(it->rows),
+                          it->sql.toHtmlEscaped(), it->params.toHtmlEscaped());
+    }
+    report += "</table>";
+    return report;
+}
+
+bool DatabaseManager::dumpQueryStats(const QString &fileName) const {
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qDebug() << "Query Stats Dump Error:" << file.errorString();
+        return false;
+    }
+
+    QTextStream out(&file);
+    out << "SQL,Chamadas,Erros,Linhas,Total (ms),Máx (ms),Preparo (ms),Execução (ms),Leitura (ms)\n";
+    for (const auto &entry : queryStats()) {
+        QString sql = entry.sql;
+        out << QString("\"%1\",%2,%3,%4,%5,%6,%7,%8,%9\n")
+               .arg(sql.replace('"', "\"\""), QString::number(entry.calls), QString::number(entry.errors),
+                    QString::number(entry.rows), formatMs(entry.totalNs), formatMs(entry.maxNs),
+                    formatMs(entry.prepareNs), formatMs(entry.execNs), formatMs(entry.fetchNs));
+    }
+    out << "\nData,Tempo (ms),Linhas,SQL,Parâmetros\n";
+    for (const auto &slow : slowLog) {
+        QString sql = slow.sql;
+        out << QString("%1,%2,%3,\"%4\",\"%5\"\n")
+               .arg(slow.timestamp, formatMs(slow.totalNs), QString::number(slow.rows),
+                    sql.replace('"', "\"\""), slow.params);
+    }
+    file.close();
+    return true;
+}
+
+void DatabaseManager::resetQueryStats() {
+    stats.clear();
+    slowLog.clear();
+}
@@ -4,17 +4,119 @@
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QString>
+#include <QStringList>
 #include <QVariant>
+#include <QHash>
+#include <QList>
+#include <functional>
+
+struct sqlite3;
+struct sqlite3_stmt;
+class ColumnarResult;
+
+// Aggregated timings for one normalized statement (literals replaced by '?').
+struct QueryStats {
+    QString sql;
+    qint64 calls = 0;
+    qint64 errors = 0;
+    qint64 rows = 0;
+    qint64 prepareNs = 0;
+    qint64 execNs = 0;
+    qint64 fetchNs = 0;
+    qint64 totalNs = 0;
+    qint64 maxNs = 0;
+};
+
+struct SlowQuery {
+    QString timestamp;
+    QString sql;
+    QString params;
+    qint64 totalNs = 0;
+    int rows = 0;
+};
 
 class DatabaseManager {
 public:
-    explicit DatabaseManager(const QString &db_name = "epi.db");
+    // ReadOnly skips schema setup. Snapshot is for a file nobody writes
+    // to: it is opened immutable (no locks, no change checks), memory
+    // mapped and with query_only set.
+    enum class OpenMode { ReadWrite, ReadOnly, Snapshot };
+
+    // A non-empty connectionName opens a separate connection, usable from a
+    // worker thread that owns this manager.
+    explicit DatabaseManager(const QString &db_name = "epi.db", const QString &connectionName = QString(),
+                             OpenMode mode = OpenMode::ReadWrite);
     ~DatabaseManager();
     bool executeQuery(const QString &queryStr, const QVariantList &params = QVariantList(), bool fetch = false, QVariantList *result = nullptr);
+    // Bulk insert: values holds columns.size() values per row, row after
+    // row, and goes out as multi-row INSERTs of as many rows as the
+    // statement parameter limit allows.
+    bool insertRows(const QString &table, const QStringList &columns, const QVariantList &values);
+
+    // Typed reads, defined in TypedQuery.h: rows are decoded straight from
+    // the statement into Row through its RowMapping, without QVariant
+    // (through a forward-only QSqlQuery when the driver's SQLite is not the
+    // library linked here).
+    // select() prepends "SELECT <mapped columns> FROM <mapped source>" to
+    // clause; fetch() takes a full query whose columns follow the mapping.
+    template <typename Row>
+    bool select(const QString &clause, const QVariantList &params, QList<Row> *rows);
+    template <typename Row>
+    bool fetch(const QString &queryStr, const QVariantList &params, QList<Row> *rows);
+    // Bulk reads for reports and exports: any column shape, stored in
+    // result's arenas instead of per-cell QVariants.
+    bool fetchColumnar(const QString &queryStr, const QVariantList &params, ColumnarResult *result);
+
+    bool beginTransaction();
+    // BEGIN IMMEDIATE: takes the write lock up front, so what the
+    // transaction reads cannot change before it writes.
+    bool beginImmediateTransaction();
+    bool commitTransaction();
+    void rollbackTransaction();
+    QString databaseFile() const { return fileName; }
+    bool isSnapshot() const { return mode == OpenMode::Snapshot; }
+
+    void setSlowQueryThreshold(int ms) { slowQueryThresholdMs = ms; }
+    int slowQueryThreshold() const { return slowQueryThresholdMs; }
+    QList<QueryStats> queryStats() const;
+    QList<SlowQuery> slowQueries() const { return slowLog; }
+    QString queryStatsReport() const;
+    bool dumpQueryStats(const QString &fileName) const;
+    void resetQueryStats();
+    static QString normalizeSql(const QString &sql);
+
+    // Listeners are called with the table name after each successful
+    // INSERT/UPDATE/DELETE issued through this manager.
+    void addChangeListener(const std::function<void(const QString &table)> &listener);
+    qint64 dataVersion();
 
 private:
     void initDatabase();
+    void initSync(QSqlQuery &query);
+    void recordQuery(const QString &queryStr, const QVariantList &params, qint64 prepareNs, qint64 execNs, qint64 fetchNs, int rows, bool ok);
+    static QString redactParams(const QVariantList &params);
+    void notifyChange(const QString &queryStr);
+    // Fallback for typed reads when rawDb is not usable; columns < 0 skips
+    // the column count check. Failures are recorded.
+    bool execForwardOnly(QSqlQuery &query, const QString &queryStr, const QVariantList &params, int columns,
+                         qint64 *prepareNs, qint64 *execNs);
+    sqlite3_stmt *prepareTyped(const QString &queryStr, const QVariantList &params, int columns);
+    bool finishTyped(sqlite3_stmt *stmt, int rc, const QString &queryStr, const QVariantList &params,
+                     qint64 prepareNs, qint64 execNs, qint64 fetchNs, int rows);
     QSqlDatabase db;
+    QString fileName;
+    QString connectionName;
+    OpenMode mode;
+    // Null unless the driver runs on the SQLite linked into this program.
+    sqlite3 *rawDb;
+    QHash<QString, sqlite3_stmt *> typedStatements;
+
+    QHash<QString, QString> normalizedCache;
+    QHash<QString, QueryStats> stats;
+    QList<SlowQuery> slowLog;
+    QHash<QString, QString> mutatedTableCache;
+    QList<std::function<void(const QString &)>> changeListeners;
+    int slowQueryThresholdMs;
 };
 
 #endif // DATABASEMANAGER_H
@@ -0,0 +1,169 @@
+#include "DemandForecaster.h"
+#include "Tracing.h"
+#include <QtConcurrent>
+#include <QStringList>
+#include <QDebug>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+// Beyond this many changed items a full refit is cheaper than an IN list.
+const int kMaxIncrementalItems = 500;
+}
+
+DemandForecaster::DemandForecaster(DatabaseManager *dbManager, ConsumptionRollup *rollup)
+    : dbManager(dbManager), rollup(rollup) {}
+
+bool DemandForecaster::refresh(const ForecastParams &newParams) {
+    EPI_TRACE_SCOPE("DemandForecaster::refresh");
+    QSet<int> touched;
+    if (!rollup->refresh(&touched)) {
+        return false;
+    }
+
+    const QDate today = QDate::currentDate();
+    const bool all = modelDate != today || params != newParams || touched.size() > kMaxIncrementalItems;
+    params = newParams;
+    if (all || !touched.isEmpty()) {
+        if (!fitModels(touched, all)) {
+            return false;
+        }
+    }
+    modelDate = today;
+
+    QVariantList items;
+    if (!dbManager->executeQuery(
+            "SELECT id, nome, ca, tamanho, quantidade, estoque_minimo FROM itens ORDER BY nome, tamanho",
+            {}, true, &items)) {
+        return false;
+    }
+
+    const int firstWeekday = today.addDays(1).dayOfWeek() - 1;
+    results.clear();
+    results.reserve(items.size());
+    for (const auto &entry : items) {
+        const QVariantList item = entry.toList();
+        ItemForecast forecast;
+        forecast.itemId = item[0].toInt();
+        forecast.nome = item[1].toString();
+        forecast.ca = item[2].toString();
+        forecast.tamanho = item[3].toString();
+        forecast.quantidade = item[4].toInt();
+        forecast.estoqueMinimo = item[5].toInt();
+
+        auto model = models.constFind(forecast.itemId);
+        if (model != models.constEnd()) {
+            double leadDemand = 0;
+            for (int day = 0; day < params.leadTimeDays; ++day) {
+                leadDemand += model->level * model->seasonal[(firstWeekday + day) % 7];
+            }
+            double reviewDemand = 0;
+            for (int day = params.leadTimeDays; day < params.leadTimeDays + params.reviewDays; ++day) {
+                reviewDemand += model->level * model->seasonal[(firstWeekday + day) % 7];
+            }
+            forecast.dailyRate = model->level;
+            forecast.dailyStdDev = model->sigma;
+            forecast.leadTimeDemand = leadDemand;
+            forecast.reorderPoint = leadDemand + params.serviceZ * model->sigma * std::sqrt(double(params.leadTimeDays));
+            if (forecast.quantidade <= forecast.reorderPoint) {
+                forecast.suggestedOrder = std::max(0, int(std::ceil(forecast.reorderPoint + reviewDemand - forecast.quantidade)));
+            }
+        }
+        results.append(forecast);
+    }
+    return true;
+}
+
+bool DemandForecaster::fitModels(const QSet<int> &items, bool all) {
+    const QDate start = QDate::currentDate().addDays(-params.historyDays);
+    QString query = "SELECT item_id, CAST(julianday(dia) - julianday(?) AS INTEGER), retirado - devolvido "
+                    "FROM consumo_diario WHERE dia >= ?";
+    QVariantList queryParams{start.toString("yyyy-MM-dd"), start.toString("yyyy-MM-dd")};
+    if (!all) {
+        QStringList placeholders;
+        for (int itemId : items) {
+            placeholders << "?";
+            queryParams << itemId;
+        }
+        query += " AND item_id IN (" + placeholders.join(", ") + ")";
+    }
+    query += " ORDER BY item_id";
+
+    QVariantList rows;
+    if (!dbManager->executeQuery(query, queryParams, true, &rows)) {
+        return false;
+    }
+
+    QVector<Job> jobs;
+    for (const auto &entry : rows) {
+        const QVariantList row = entry.toList();
+        const int itemId = row[0].toInt();
+        const int day = row[1].toInt();
+        if (jobs.isEmpty() || jobs.last().itemId != itemId) {
+            Job job;
+            job.itemId = itemId;
+            job.series = QVector<float>(params.historyDays, 0.0f);
+            jobs.append(job);
+        }
+        if (day >= 0 && day < params.historyDays) {
+            jobs.last().series[day] += row[2].toFloat();
+        }
+    }
+
+    const int startWeekday = start.dayOfWeek() - 1;
+    const ForecastParams fitParams = params;
+    QtConcurrent::blockingMap(jobs, [startWeekday, fitParams](Job &job) {
+        job.model = fitModel(job.series, startWeekday, fitParams);
+    });
+
+    if (all) {
+        models.clear();
+    } else {
+        for (int itemId : items) {
+            models.remove(itemId);
+        }
+    }
+    for (const auto &job : jobs) {
+        models.insert(job.itemId, job.model);
+    }
+    return true;
+}
+
+DemandForecaster::Model DemandForecaster::fitModel(const QVector<float> &series, int startWeekday, const ForecastParams &params) {
+    Model model;
+    const int n = series.size();
+    if (n == 0) {
+        return model;
+    }
+
+    double total = 0;
+    double byWeekday[7] = {};
+    int daysPerWeekday[7] = {};
+    for (int i = 0; i < n; ++i) {
+        const int weekday = (startWeekday + i) % 7;
+        total += series[i];
+        byWeekday[weekday] += series[i];
+        daysPerWeekday[weekday]++;
+    }
+    const double mean = total / n;
+    for (int weekday = 0; weekday < 7; ++weekday) {
+        model.seasonal[weekday] = (mean > 0 && daysPerWeekday[weekday] > 0)
+                                      ? (byWeekday[weekday] / daysPerWeekday[weekday]) / mean
+                                      : 1.0;
+    }
+
+    double level = mean;
+    double squaredError = 0;
+    for (int i = 0; i < n; ++i) {
+        const double seasonal = model.seasonal[(startWeekday + i) % 7];
+        const double error = series[i] - level * seasonal;
+        squaredError += error * error;
+        // Weekdays that never see demand carry no information about the level.
+        if (seasonal > 0) {
+            level = params.alpha * (series[i] / seasonal) + (1 - params.alpha) * level;
+        }
+    }
+    model.level = std::max(0.0, level);
+    model.sigma = std::sqrt(squaredError / n);
+    return model;
+}
@@ -0,0 +1,78 @@
+#ifndef DEMANDFORECASTER_H
+#define DEMANDFORECASTER_H
+
+#include <QDate>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVector>
+#include "DatabaseManager.h"
+#include "ConsumptionRollup.h"
+
+struct ForecastParams {
+    int historyDays = 84;
+    double alpha = 0.3;
+    int leadTimeDays = 7;
+    int reviewDays = 14;
+    double serviceZ = 1.65;
+
+    bool operator==(const ForecastParams &other) const {
+        return historyDays == other.historyDays && alpha == other.alpha && leadTimeDays == other.leadTimeDays &&
+               reviewDays == other.reviewDays && serviceZ == other.serviceZ;
+    }
+    bool operator!=(const ForecastParams &other) const { return !(*this == other); }
+};
+
+struct ItemForecast {
+    int itemId = 0;
+    QString nome;
+    QString ca;
+    QString tamanho;
+    int quantidade = 0;
+    int estoqueMinimo = 0;
+    double dailyRate = 0;
+    double dailyStdDev = 0;
+    double leadTimeDemand = 0;
+    double reorderPoint = 0;
+    int suggestedOrder = 0;
+};
+
+// Per-item consumption forecast over the consumo_diario rollup: exponential
+// smoothing of the deseasonalized daily series with weekday seasonal
+// indices. Reorder point is lead-time demand plus a safety stock of
+// z * sigma * sqrt(lead time); the suggested order tops stock up to the
+// reorder point plus one review period of demand.
+//
+// Fitted models are cached. Within the same day only the items whose
+// rollup rows changed are refitted; fitting runs in parallel across items.
+class DemandForecaster {
+public:
+    DemandForecaster(DatabaseManager *dbManager, ConsumptionRollup *rollup);
+
+    bool refresh(const ForecastParams &params = ForecastParams());
+    const QList<ItemForecast> &forecasts() const { return results; }
+
+private:
+    struct Model {
+        double level = 0;
+        double sigma = 0;
+        double seasonal[7] = {1, 1, 1, 1, 1, 1, 1};
+    };
+    struct Job {
+        int itemId = 0;
+        QVector<float> series;
+        Model model;
+    };
+
+    bool fitModels(const QSet<int> &items, bool all);
+    static Model fitModel(const QVector<float> &series, int startWeekday, const ForecastParams &params);
+
+    DatabaseManager *dbManager;
+    ConsumptionRollup *rollup;
+    QHash<int, Model> models;
+    QDate modelDate;
+    ForecastParams params;
+    QList<ItemForecast> results;
+};
+
+#endif // DEMANDFORECASTER_H
@@ -1,8 +1,15 @@
 #include "EPIApp.h"
+#include "Tracing.h"
+#include "BackupManager.h"
+#include "RowTypes.h"
+#include "ColumnarResult.h"
+#include "ReportPack.h"
+#include <QApplication>
 #include <QMessageBox>
 #include <QFileDialog>
 #include <QInputDialog>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QCompleter>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
@@ -10,15 +17,151 @@
 #include <QGroupBox>
 #include <QLabel>
 #include <QHeaderView>
+#include <QTreeWidget>
 #include <QChart>
 #include <QBarSeries>
 #include <QBarSet>
 #include <QValueAxis>
+#include <QBarCategoryAxis>
 #include <QPdfWriter>
 #include <QPainter>
 #include <QDir>
+#include <QFileInfo>
+#include <QScrollBar>
+#include <QSignalBlocker>
+#include <QRegularExpression>
+#include <QUuid>
+#include <QTimer>
+#include <QDialog>
+#include <QTextDocument>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <iterator>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const int kDeliveredPageSize = 200;
+const int kExpirationPanelRows = 200;
+const int kDashboardFrameMs = 250;
+const int kDataVersionPollTicks = 4;
+
+// Builds an empty bar chart once; later refreshes go through updateBarChart.
+QtCharts::QChart *createBarChart(const QString &title, const QString &setName, const QString &axisTitle,
+                                 QtCharts::QBarSet **set, QtCharts::QBarCategoryAxis **axisX, QtCharts::QValueAxis **axisY) {
+    QtCharts::QBarSeries *series = new QtCharts::QBarSeries;
+    *set = new QtCharts::QBarSet(setName);
+    series->append(*set);
+    QtCharts::QChart *chart = new QtCharts::QChart;
+    chart->addSeries(series);
+    chart->setTitle(title);
+    *axisY = new QtCharts::QValueAxis;
+    (*axisY)->setTitleText(axisTitle);
+    chart->addAxis(*axisY, Qt::AlignLeft);
+    series->attachAxis(*axisY);
+    *axisX = new QtCharts::QBarCategoryAxis;
+    chart->addAxis(*axisX, Qt::AlignBottom);
+    series->attachAxis(*axisX);
+    return chart;
+}
+
+// Rewrites the bar values in place, touching only bars that changed.
+void updateBarChart(QtCharts::QBarSet *set, QtCharts::QBarCategoryAxis *axisX, QtCharts::QValueAxis *axisY,
+                    const QStringList &labels, const QList<qreal> &values) {
+    const int common = std::min<int>(set->count(), values.size());
+    for (int i = 0; i < common; ++i) {
+        if (set->at(i) != values[i]) {
+            set->replace(i, values[i]);
+        }
+    }
+    if (set->count() > values.size()) {
+        set->remove(values.size(), set->count() - values.size());
+    }
+    for (int i = common; i < values.size(); ++i) {
+        set->append(values[i]);
+    }
+    if (axisX->categories() != labels) {
+        axisX->setCategories(labels);
+    }
+    const qreal max = values.isEmpty() ? 0 : *std::max_element(values.begin(), values.end());
+    axisY->setRange(0, std::max<qreal>(max * 1.1, 1));
+}
+
+const char *const kInventorySql =
+    "SELECT i.nome, i.ca, i.tamanho, i.quantidade, i.estoque_minimo, i.preco, i.fornecedor, c.nome, i.data_adicao "
+    "FROM itens i LEFT JOIN categorias c ON i.categoria_id = c.id";
+const char *const kLowStockSql =
+    "SELECT i.nome, i.ca, i.tamanho, i.quantidade, i.estoque_minimo, c.nome "
+    "FROM itens i LEFT JOIN categorias c ON i.categoria_id = c.id "
+    "WHERE i.quantidade <= i.estoque_minimo";
+const qsizetype kExportFlushBytes = 64 * 1024;
+
+// One <tr> per row, every column in query order.
+void appendHtmlRows(QByteArray &html, const ColumnarResult &result) {
+    html.reserve(html.size() + qsizetype(result.rowCount()) * result.columnCount() * 24);
+    for (int row = 0; row < result.rowCount(); ++row) {
+        html += "<tr>";
+        for (int col = 0; col < result.columnCount(); ++col) {
+            html += "<td>";
+            result.appendTo(html, row, col);
+            html += "</td>";
+        }
+        html += "</tr>";
+    }
+}
+
+void appendCsvRow(QByteArray &out, const ColumnarResult &result, int row) {
+    for (int col = 0; col < result.columnCount(); ++col) {
+        if (col > 0) out += ',';
+        result.appendCsv(out, row, col);
+    }
+    out += '\n';
+}
 
-EPIApp::EPIApp(QWidget *parent) : QMainWindow(parent), dbManager(new DatabaseManager), currentUserId(-1), currentUserLevel(-1) {
+void fillItemRow(QTableWidget *table, int row, const ItemRow &item) {
+    const QStringList cells = {
+        QString::number(item.id), item.nome, item.ca, item.tamanho, item.marca, item.categoria,
+        QString::number(item.quantidade), QString::number(item.preco), QString::number(item.estoqueMinimo),
+        item.fornecedor, item.dataAdicao
+    };
+    for (int col = 0; col < cells.size(); ++col) {
+        table->setItem(row, col, new QTableWidgetItem(cells[col]));
+    }
+    if (item.quantidade <= item.estoqueMinimo) {
+        table->item(row, 6)->setBackground(QColor(255, 200, 200));
+    }
+}
+
+// Only columns backed by a (motivo, column) index can order a keyset page
+// without scanning and sorting the whole filter; the others are null.
+const char *const kDeliveredSortKeys[] = {
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    "m.data",
+    "m.expiration_date"
+};
+}
+
+EPIApp::EPIApp(const QString &snapshotFile, QWidget *parent)
+    : QMainWindow(parent),
+      dbManager(snapshotFile.isEmpty()
+                    ? new DatabaseManager
+                    : new DatabaseManager(snapshotFile, QString(), DatabaseManager::OpenMode::Snapshot)), expirationTracker(new ExpirationTracker(dbManager)),
+      consumptionRollup(new ConsumptionRollup(dbManager)), demandForecaster(new DemandForecaster(dbManager, consumptionRollup)),
+      abcXyzClassifier(new AbcXyzClassifier(dbManager, consumptionRollup)),
+      archiveManager(new ArchiveManager(dbManager, QFileInfo(dbManager->databaseFile()).absoluteDir().filePath("arquivo"))),
+      companyCostReport(new CompanyCostReport(dbManager)), stockService(new StockService(dbManager)),
+      credentialService(new CredentialService(dbManager)),
+      stockLedger(new StockLedger(dbManager)),
+      analyticsCache(new AnalyticsCache(dbManager, archiveManager, dbManager->databaseFile() + ".analitico")),
+      cycleCount(new CycleCount(dbManager)), purchaseService(new PurchaseService(dbManager)),
+      reservationOwner(QString("balcao-%1").arg(QUuid::createUuid().toString(QUuid::WithoutBraces))),
+      currentUserId(-1), currentUserLevel(-1), scanLookupDirty(true), verifyingCredentials(false), addingUser(false), archivingData(false), readOnlyMode(!snapshotFile.isEmpty()),
+      deliveredSortColumn(5), deliveredSortOrder(Qt::DescendingOrder), deliveredHasMore(false), deliveredGeneration(0),
+      dashboardDirty(true), dashboardTicks(0), lastDataVersion(-1) {
     setStyleSheet(
         "QWidget { background-color: #f5f5f5; font-family: 'Segoe UI'; }"
         "QLineEdit, QComboBox, QSpinBox, QDoubleSpinBox { padding: 8px; border: 2px solid #ddd; border-radius: 5px; background-color: white; font-size: 14px; }"
@@ -37,7 +180,7 @@ EPIApp::EPIApp(QWidget *parent) : QMainWindow(parent), dbManager(new DatabaseMan
         "QLabel { font-size: 14px; }"
     );
 
-    LoginDialog loginDialog(dbManager);
+    LoginDialog loginDialog(credentialService);
     if (loginDialog.exec() != QDialog::Accepted) {
         exit(0);
     }
@@ -48,6 +191,7 @@ EPIApp::EPIApp(QWidget *parent) : QMainWindow(parent), dbManager(new DatabaseMan
 }
 
 void EPIApp::setupUi() {
+    EPI_TRACE_SCOPE("EPIApp::setupUi");
     setWindowTitle("Sistema Avançado de Gerenciamento de EPI");
     resize(1200, 800);
 
@@ -56,8 +200,14 @@ void EPIApp::setupUi() {
     centralWidget->addTab(createManagementTab(), "Colaboradores");
     centralWidget->addTab(createDashboardTab(), "Painel");
     centralWidget->addTab(createItemsTab(), "Itens");
-    centralWidget->addTab(createWithdrawalTab(), "Retirada");
-    centralWidget->addTab(createReturnTab(), "Devolução");
+    QWidget *cycleCountTab = createCycleCountTab();
+    centralWidget->addTab(cycleCountTab, "Contagem");
+    QWidget *purchasesTab = createPurchasesTab();
+    centralWidget->addTab(purchasesTab, "Compras");
+    QWidget *withdrawalTab = createWithdrawalTab();
+    QWidget *returnTab = createReturnTab();
+    centralWidget->addTab(withdrawalTab, "Retirada");
+    centralWidget->addTab(returnTab, "Devolução");
     centralWidget->addTab(createDeliveredTab(), "EPIs Entregues");
     centralWidget->addTab(createCategoriesTab(), "Categorias");
     centralWidget->addTab(createEmpresasTab(), "Empresas");
@@ -65,7 +215,17 @@ void EPIApp::setupUi() {
     centralWidget->addTab(createAboutTab(), "Sobre");
 
     createToolbar();
-    statusBar()->showMessage("Pronto! Sistema desenvolvido por Danilo Hollanders de Moura.");
+    if (readOnlyMode) {
+        const QString snapshotName = QFileInfo(dbManager->databaseFile()).fileName();
+        setWindowTitle(windowTitle() + QString(" - Somente Leitura (%1)").arg(snapshotName));
+        centralWidget->setTabEnabled(centralWidget->indexOf(withdrawalTab), false);
+        centralWidget->setTabEnabled(centralWidget->indexOf(returnTab), false);
+        centralWidget->setTabEnabled(centralWidget->indexOf(cycleCountTab), false);
+        centralWidget->setTabEnabled(centralWidget->indexOf(purchasesTab), false);
+        statusBar()->showMessage(QString("Modo somente leitura: relatórios do instantâneo %1.").arg(snapshotName));
+    } else {
+        statusBar()->showMessage("Pronto! Sistema desenvolvido por Danilo Hollanders de Moura.");
+    }
     refreshAllData();
 }
 
@@ -129,34 +289,123 @@ QWidget* EPIApp::createDashboardTab() {
     QWidget *widget = new QWidget;
     QVBoxLayout *layout = new QVBoxLayout(widget);
 
+    QHBoxLayout *summaryLayout = new QHBoxLayout;
+    todayWithdrawalsLabel = new QLabel;
+    todayWithdrawalsLabel->setStyleSheet("font-size: 16px; font-weight: bold; color: #2196F3;");
+    lowStockLabel = new QLabel;
+    lowStockLabel->setStyleSheet("font-size: 16px; font-weight: bold; color: #f44336;");
+    summaryLayout->addWidget(todayWithdrawalsLabel);
+    summaryLayout->addStretch();
+    summaryLayout->addWidget(lowStockLabel);
+    layout->addLayout(summaryLayout);
+
     chartView = new QtCharts::QChartView;
-    QVariantList items;
-    dbManager->executeQuery(
-        "SELECT nome, quantidade FROM itens WHERE quantidade > 0 ORDER BY quantidade DESC LIMIT 10",
-        {}, true, &items);
-    QtCharts::QBarSeries *series = new QtCharts::QBarSeries;
-    Qt DitCharts::QBarSet *set = new QtCharts::QBarSet("Quantidade");
-    for (const auto &item : items) {
-        set->append(item[1].toInt());
+    chartView->setChart(createBarChart("Níveis de Estoque de EPIs", "Quantidade", "Quantidade",
+                                       &stockSet, &stockAxisX, &stockAxisY));
+    layout->addWidget(chartView);
+
+    QGroupBox *expirationGroup = new QGroupBox("Vencimentos");
+    QVBoxLayout *expirationLayout = new QVBoxLayout;
+    QHBoxLayout *expirationHeader = new QHBoxLayout;
+    expirationSummary = new QLabel;
+    expirationDays = new QSpinBox;
+    expirationDays->setRange(1, 365);
+    expirationDays->setValue(30);
+    expirationDays->setSuffix(" dias");
+    connect(expirationDays, QOverload<int>::of(&QSpinBox::valueChanged), this, &EPIApp::updateExpirationPanel);
+    expirationHeader->addWidget(expirationSummary);
+    expirationHeader->addStretch();
+    expirationHeader->addWidget(new QLabel("Vencendo em:"));
+    expirationHeader->addWidget(expirationDays);
+
+    expirationTable = new QTableWidget(0, 8);
+    expirationTable->setHorizontalHeaderLabels({"Situação", "Colaborador", "Nome EPI", "CA", "Tamanho", "Quantidade", "Data Entrega", "Data Vencimento"});
+    expirationTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    expirationTable->setAlternatingRowColors(true);
+    expirationLayout->addLayout(expirationHeader);
+    expirationLayout->addWidget(expirationTable);
+    expirationGroup->setLayout(expirationLayout);
+    layout->addWidget(expirationGroup);
+
+    // Mutations issued by this window mark the dashboard dirty right away;
+    // commits from other counters are picked up through data_version.
+    dbManager->addChangeListener([this](const QString &table) {
+        if (table == "itens" || table == "movimentacoes") {
+            markDashboardDirty();
+        }
+        if (table == "itens") {
+            scanLookupDirty = true;
+        }
+    });
+    dashboardTimer = new QTimer(this);
+    dashboardTimer->setInterval(kDashboardFrameMs);
+    connect(dashboardTimer, &QTimer::timeout, this, &EPIApp::onDashboardTick);
+    dashboardTimer->start();
+    if (readOnlyMode) {
+        return widget;
+    }
+    // Keep the pending list's reservations alive while it is being worked on.
+    QTimer *reservationTimer = new QTimer(this);
+    reservationTimer->setInterval(StockService::kReservationMinutes * 60 * 1000 / 3);
+    connect(reservationTimer, &QTimer::timeout, this, [this] {
+        if (!pendingWithdrawals.isEmpty()) {
+            stockService->renew(reservationOwner);
+        }
+    });
+    reservationTimer->start();
+    stockLedger->snapshotIfDue();
+    QTimer *snapshotTimer = new QTimer(this);
+    snapshotTimer->setInterval(60 * 60 * 1000);
+    connect(snapshotTimer, &QTimer::timeout, this, [this] { stockLedger->snapshotIfDue(); });
+    snapshotTimer->start();
+    return widget;
+}
+
+void EPIApp::markDashboardDirty() {
+    dashboardDirty = true;
+}
+
+void EPIApp::onDashboardTick() {
+    if (!dashboardDirty && ++dashboardTicks >= kDataVersionPollTicks) {
+        dashboardTicks = 0;
+        const qint64 version = dbManager->dataVersion();
+        if (version != lastDataVersion) {
+            lastDataVersion = version;
+            dashboardDirty = true;
+        }
     }
-    QtCharts::QChart *chart = new QtCharts::QChart;
-    chart->addSeries(series);
-    chart->setTitle("Níveis de Estoque de EPIs");
-    QtCharts::QValueAxis *axisY = new QtCharts::QValueAxis;
-    axisY->setTitleText("Quantidade");
-    chart->addAxis(axisY, Qt::AlignLeft);
-    series->attachAxis(axisY);
-    QStringList categories;
+    if (dashboardDirty) {
+        updateDashboard();
+    }
+}
+
+void EPIApp::updateDashboard() {
+    EPI_TRACE_SCOPE("EPIApp::updateDashboard");
+    dashboardDirty = false;
+
+    QList<ItemRow> items;
+    dbManager->select("WHERE i.quantidade > 0 ORDER BY i.quantidade DESC LIMIT 10", {}, &items);
+    QStringList labels;
+    QList<qreal> values;
     for (const auto &item : items) {
-        categories.append(item[0].toString());
+        labels << (item.tamanho.isEmpty() ? item.nome : QString("%1 (%2)").arg(item.nome, item.tamanho));
+        values << item.quantidade;
     }
-    QtCharts::QBarCategoryAxis *axisX = new QtCharts::QBarCategoryAxis;
-    axisX->append(categories);
-    chart->addAxis(axisX, Qt::AlignBottom);
-    series->attachAxis(axisX);
-    chartView->setChart(chart);
-    layout->addWidget(chartView);
-    return widget;
+    updateBarChart(stockSet, stockAxisX, stockAxisY, labels, values);
+
+    QVariantList summary;
+    if (dbManager->executeQuery(
+            "SELECT "
+            "(SELECT COUNT(*) FROM movimentacoes WHERE data >= ? AND alteracao_quantidade < 0 AND motivo = 'Retirada por colaborador'), "
+            "(SELECT COALESCE(-SUM(alteracao_quantidade), 0) FROM movimentacoes WHERE data >= ? AND alteracao_quantidade < 0 AND motivo = 'Retirada por colaborador'), "
+            "(SELECT COUNT(*) FROM itens WHERE quantidade <= estoque_minimo)",
+            {QDate::currentDate().toString("yyyy-MM-dd"), QDate::currentDate().toString("yyyy-MM-dd")}, true, &summary) && !summary.isEmpty()) {
+        const QVariantList row = summary[0].toList();
+        todayWithdrawalsLabel->setText(QString("Retiradas hoje: %1 (%2 unidades)").arg(row[0].toInt()).arg(row[1].toInt()));
+        lowStockLabel->setText(QString("Itens com estoque baixo: %1").arg(row[2].toInt()));
+    }
+
+    updateExpirationPanel();
 }
 
 QWidget* EPIApp::createItemsTab() {
@@ -257,7 +506,19 @@ QWidget* EPIApp::createWithdrawalTab() {
     movValidDays->setMaximum(3650);
     movValidDays->setValue(180);
 
+    scanModeCheck = new QCheckBox("Modo Leitor (código de barras)");
+    scanModeCheck->setToolTip("Cada leitura de CA ou etiqueta EPI-<id> adiciona uma unidade à lista, sem confirmação por item");
+    connect(scanModeCheck, &QCheckBox::toggled, this, &EPIApp::onScanModeToggled);
+    scanInput = new QLineEdit;
+    scanInput->setPlaceholderText("Leia o código de barras do CA ou da etiqueta...");
+    scanInput->setEnabled(false);
+    connect(scanInput, &QLineEdit::returnPressed, this, &EPIApp::onScanSubmitted);
+    scanStatus = new QLabel;
+
     movLayout->addRow("Colaborador:", colaboradorCombo);
+    movLayout->addRow(scanModeCheck);
+    movLayout->addRow("Leitura:", scanInput);
+    movLayout->addRow(scanStatus);
     movLayout->addRow("Pesquisar EPI/CA:", movName);
     movLayout->addRow("Tamanho:", movSize);
     movLayout->addRow("CA:", movCa);
@@ -317,6 +578,119 @@ QWidget* EPIApp::createReturnTab() {
     return widget;
 }
 
+QWidget* EPIApp::createCycleCountTab() {
+    QWidget *widget = new QWidget;
+    QVBoxLayout *layout = new QVBoxLayout(widget);
+
+    QGroupBox *countGroup = new QGroupBox("Contagem Cíclica");
+    QFormLayout *countLayout = new QFormLayout;
+    countCategory = new QComboBox;
+    countCategory->addItem("Todas as Categorias", 0);
+    QHBoxLayout *sessionLayout = new QHBoxLayout;
+    QPushButton *countStartBtn = new QPushButton("Iniciar Contagem");
+    countStartBtn->setToolTip("Registrar o estoque esperado dos EPIs da categoria e começar a contar");
+    connect(countStartBtn, &QPushButton::clicked, this, &EPIApp::startCycleCount);
+    QPushButton *cancelBtn = new QPushButton("Descartar Contagem");
+    cancelBtn->setProperty("delete", true);
+    connect(cancelBtn, &QPushButton::clicked, this, &EPIApp::cancelCycleCount);
+    sessionLayout->addWidget(countCategory);
+    sessionLayout->addWidget(countStartBtn);
+    sessionLayout->addWidget(cancelBtn);
+    countLayout->addRow("Categoria:", sessionLayout);
+
+    countScanInput = new QLineEdit;
+    countScanInput->setPlaceholderText("Leia o CA ou a etiqueta EPI-<id> de cada unidade contada...");
+    countScanInput->setEnabled(false);
+    connect(countScanInput, &QLineEdit::returnPressed, this, &EPIApp::onCountScanSubmitted);
+    countQuantity = new QSpinBox;
+    countQuantity->setRange(-9999, 99999);
+    countQuantity->setValue(1);
+    countQuantity->setToolTip("Unidades somadas a cada leitura; use um valor negativo para corrigir uma leitura");
+    QHBoxLayout *scanLayout = new QHBoxLayout;
+    scanLayout->addWidget(countScanInput);
+    scanLayout->addWidget(new QLabel("Qtd. por leitura:"));
+    scanLayout->addWidget(countQuantity);
+    countLayout->addRow("Leitura:", scanLayout);
+    countStatus = new QLabel;
+    countLayout->addRow(countStatus);
+
+    countTable = new QTableWidget(0, 7);
+    countTable->setHorizontalHeaderLabels({"ID", "Nome", "CA", "Tamanho", "Esperado", "Contado", "Diferença"});
+    countTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    countTable->setAlternatingRowColors(true);
+    countTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    countLayout->addRow(countTable);
+    countSummary = new QLabel;
+    countLayout->addRow(countSummary);
+    updateCountSummary();
+
+    QHBoxLayout *btnLayout = new QHBoxLayout;
+    QPushButton *importBtn = new QPushButton("Importar CSV");
+    importBtn->setToolTip("Somar contagens de um arquivo com linhas codigo;quantidade");
+    connect(importBtn, &QPushButton::clicked, this, &EPIApp::importCycleCountCsv);
+    QPushButton *postBtn = new QPushButton("Lançar Ajustes");
+    postBtn->setToolTip("Ajustar o estoque de todos os EPIs contados em uma única operação");
+    connect(postBtn, &QPushButton::clicked, this, &EPIApp::postCycleCount);
+    btnLayout->addWidget(importBtn);
+    btnLayout->addWidget(postBtn);
+    countLayout->addRow(btnLayout);
+
+    countGroup->setLayout(countLayout);
+    layout->addWidget(countGroup);
+    return widget;
+}
+
+QWidget* EPIApp::createPurchasesTab() {
+    QWidget *widget = new QWidget;
+    QVBoxLayout *layout = new QVBoxLayout(widget);
+
+    QGroupBox *orderGroup = new QGroupBox("Novo Pedido de Compra");
+    QFormLayout *orderLayout = new QFormLayout;
+    purchaseSupplier = new QComboBox;
+    purchaseSupplier->setEditable(true);
+    purchaseSupplier->setInsertPolicy(QComboBox::NoInsert);
+    connect(purchaseSupplier, &QComboBox::currentTextChanged, this, &EPIApp::onPurchaseSupplierChanged);
+    orderLayout->addRow("Fornecedor:", purchaseSupplier);
+    purchaseDraftTable = new QTableWidget(0, 8);
+    purchaseDraftTable->setHorizontalHeaderLabels({"ID", "Nome", "CA", "Tamanho", "Estoque", "Mínimo", "Quantidade", "Custo Unitário"});
+    purchaseDraftTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    purchaseDraftTable->setToolTip("EPIs do fornecedor; a quantidade sugerida repõe o estoque mínimo");
+    orderLayout->addRow(purchaseDraftTable);
+    QPushButton *createOrderBtn = new QPushButton("Criar Pedido");
+    connect(createOrderBtn, &QPushButton::clicked, this, &EPIApp::createPurchaseOrder);
+    orderLayout->addRow(createOrderBtn);
+    orderGroup->setLayout(orderLayout);
+
+    QGroupBox *receiptGroup = new QGroupBox("Recebimento");
+    QFormLayout *receiptLayout = new QFormLayout;
+    receiptOrderCombo = new QComboBox;
+    receiptOrderCombo->addItem("Selecionar Pedido", 0);
+    connect(receiptOrderCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &EPIApp::onReceiptOrderSelected);
+    receiptLayout->addRow("Pedido:", receiptOrderCombo);
+    receiptTable = new QTableWidget(0, 8);
+    receiptTable->setHorizontalHeaderLabels({"ID", "Nome", "CA", "Tamanho", "Pedido", "Recebido", "Receber", "Custo Unitário"});
+    receiptTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    receiptLayout->addRow(receiptTable);
+    receiptInvoice = new QLineEdit;
+    receiptInvoice->setPlaceholderText("Número da nota fiscal");
+    receiptLayout->addRow("Nota Fiscal:", receiptInvoice);
+    QHBoxLayout *btnLayout = new QHBoxLayout;
+    QPushButton *receiveBtn = new QPushButton("Confirmar Recebimento");
+    receiveBtn->setToolTip("Dar entrada de todas as linhas no estoque em uma única operação");
+    connect(receiveBtn, &QPushButton::clicked, this, &EPIApp::receivePurchaseOrder);
+    QPushButton *cancelOrderBtn = new QPushButton("Cancelar Pedido");
+    cancelOrderBtn->setProperty("delete", true);
+    connect(cancelOrderBtn, &QPushButton::clicked, this, &EPIApp::cancelPurchaseOrder);
+    btnLayout->addWidget(receiveBtn);
+    btnLayout->addWidget(cancelOrderBtn);
+    receiptLayout->addRow(btnLayout);
+    receiptGroup->setLayout(receiptLayout);
+
+    layout->addWidget(orderGroup);
+    layout->addWidget(receiptGroup);
+    return widget;
+}
+
 QWidget* EPIApp::createDeliveredTab() {
     QWidget *widget = new QWidget;
     QVBoxLayout *layout = new QVBoxLayout(widget);
@@ -346,9 +720,17 @@ QWidget* EPIApp::createDeliveredTab() {
     filterGroup->setLayout(filterLayout);
     layout->addWidget(filterGroup);
 
+    deliveredCountLabel = new QLabel;
+    layout->addWidget(deliveredCountLabel);
+
     deliveredTable = new QTableWidget(0, 7);
     deliveredTable->setHorizontalHeaderLabels({"Colaborador", "Nome EPI", "CA", "Tamanho", "Quantidade", "Data Entrega", "Data Vencimento"});
     deliveredTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    deliveredTable->horizontalHeader()->setSectionsClickable(true);
+    deliveredTable->horizontalHeader()->setSortIndicatorShown(true);
+    deliveredTable->horizontalHeader()->setSortIndicator(deliveredSortColumn, deliveredSortOrder);
+    connect(deliveredTable->horizontalHeader(), &QHeaderView::sortIndicatorChanged, this, &EPIApp::onDeliveredSortChanged);
+    connect(deliveredTable->verticalScrollBar(), &QScrollBar::valueChanged, this, &EPIApp::onDeliveredScrolled);
     layout->addWidget(deliveredTable);
     return widget;
 }
@@ -445,6 +827,10 @@ QWidget* EPIApp::createReportsTab() {
     timeFilter->setCurrentText("Todos os Períodos");
     collabFilter = new QComboBox;
     collabFilter->addItem("Selecionar Colaborador", 0);
+    reportCategoryFilter = new QComboBox;
+    reportCategoryFilter->addItem("Todas as Categorias", 0);
+    countCategory->clear();
+    countCategory->addItem("Todas as Categorias", 0);
     startDate = new QLineEdit;
     startDate->setPlaceholderText("Início (AAAA-MM-DD)");
     endDate = new QLineEdit;
@@ -453,6 +839,8 @@ QWidget* EPIApp::createReportsTab() {
     filterLayout->addWidget(timeFilter);
     filterLayout->addWidget(new QLabel("Colaborador:"));
     filterLayout->addWidget(collabFilter);
+    filterLayout->addWidget(new QLabel("Categoria:"));
+    filterLayout->addWidget(reportCategoryFilter);
     filterLayout->addWidget(new QLabel("Início:"));
     filterLayout->addWidget(startDate);
     filterLayout->addWidget(new QLabel("Fim:"));
@@ -469,7 +857,15 @@ QWidget* EPIApp::createReportsTab() {
         {"Relatório de Estoque Baixo", &EPIApp::generateLowStockReport, "Gerar relatório de EPIs com estoque baixo"},
         {"Relatório Completo de EPIs", &EPIApp::generateInventoryReport, "Gerar relatório completo do estoque de EPIs"},
         {"Relatório por Categoria", &EPIApp::generateCategoryReport, "Gerar relatório por categoria de EPIs"},
-        {"Gráfico de EPIs Mais Usados", &EPIApp::showMostUsedGraph, "Exibir gráfico dos EPIs mais retirados"}
+        {"Gráfico de EPIs Mais Usados", &EPIApp::showMostUsedGraph, "Exibir gráfico dos EPIs mais retirados"},
+        {"Consumo Filtrado", &EPIApp::generateConsumptionReport, "Retiradas e devoluções por EPI no período, colaborador e categoria selecionados"},
+        {"Relatório de Vencimentos", &EPIApp::generateExpirationReport, "Gerar relatório de EPIs vencidos e a vencer"},
+        {"Previsão de Reposição", &EPIApp::generateForecastReport, "Calcular ponto de pedido e sugestão de compra a partir do consumo"},
+        {"Classificação ABC/XYZ", &EPIApp::generateAbcXyzReport, "Classificar EPIs por valor de consumo (ABC) e variabilidade da demanda (XYZ)"},
+        {"Estoque em Data", &EPIApp::generateInventoryAtDate, "Consultar o estoque de cada EPI em uma data e hora passadas"},
+        {"Custos por Empresa", &EPIApp::generateCompanyCostReport, "Consumo e custo de EPIs por empresa, com detalhamento e exportação"},
+        {"Pacote Mensal", &EPIApp::generateReportPack, "Gerar todos os relatórios gerenciais do mês em HTML, PDF e CSV"},
+        {"Exportar Relatório", &EPIApp::exportReport, "Exportar o relatório exibido para HTML ou PDF"}
     };
     for (const auto &btn : buttons) {
         QPushButton *button = new QPushButton(btn.text);
@@ -480,9 +876,15 @@ QWidget* EPIApp::createReportsTab() {
 
     reportDisplay = new QTextEdit;
     reportDisplay->setReadOnly(true);
+    mostUsedChartView = new QtCharts::QChartView;
+    mostUsedChartView->setChart(createBarChart("EPIs Mais Retirados", "Retiradas", "Número de Retiradas",
+                                               &mostUsedSet, &mostUsedAxisX, &mostUsedAxisY));
+    mostUsedChartView->setMinimumHeight(300);
+    mostUsedChartView->hide();
     layout->addLayout(filterLayout);
     layout->addLayout(reportLayout);
     layout->addWidget(reportDisplay);
+    layout->addWidget(mostUsedChartView);
     return widget;
 }
 
@@ -533,19 +935,31 @@ void EPIApp::createToolbar() {
         {"Atualizar", "Atualizar todos os dados", &EPIApp::refreshAllData},
         {"Exportar CSV", "Exportar dados de EPIs para CSV", &EPIApp::exportToCsv},
         {"Exportar PDF", "Exportar dados de EPIs para PDF", &EPIApp::exportToPdf},
+        {"Backup", "Criar uma cópia de segurança do banco de dados sem interromper o uso", &EPIApp::createBackup},
+        {"Arquivar", "Mover anos encerrados de movimentações e auditoria para arquivos anuais", &EPIApp::archiveOldData},
+        {"Diagnóstico", "Exibir estatísticas de desempenho das consultas", &EPIApp::showDiagnostics},
         {"Sair", "Sair do sistema", &EPIApp::logout}
     };
-    for (int i = 0; i < 4; ++i) {
+    const int actionCount = int(std::size(actions));
+    for (int i = 0; i < actionCount; ++i) {
         QAction *action = new QAction(actions[i].text, this);
         action->setToolTip(actions[i].tooltip);
         connect(action, &QAction::triggered, this, actions[i].slot);
         toolbar->addAction(action);
-        if (i < 3) {
+        if (i < actionCount - 1) {
             toolbar->addSeparator();
         }
     }
 }
 
+bool EPIApp::checkWritable(const QString &action) {
+    if (readOnlyMode) {
+        QMessageBox::warning(this, "Somente Leitura", QString("Não é possível %1 em um instantâneo somente leitura!").arg(action));
+        return false;
+    }
+    return true;
+}
+
 bool EPIApp::checkAdmin(const QString &action) {
     if (currentUserLevel != 3) {
         QMessageBox::warning(this, "Erro", QString("Apenas administradores podem %1!").arg(action));
@@ -555,7 +969,9 @@ bool EPIApp::checkAdmin(const QString &action) {
 }
 
 void EPIApp::addUser() {
+    if (!checkWritable("adicionar usuários")) return;
     if (!checkAdmin("adicionar usuários")) return;
+    if (addingUser) return;
 
     QString nomeCompleto = userNomeCompleto->text();
     QString matricula = userMatricula->text();
@@ -573,22 +989,35 @@ void EPIApp::addUser() {
         return;
     }
 
-    QString hashedSenha = QString(QCryptographicHash::hash(senha.toUtf8(), QCryptographicHash::Sha256).toHex());
-    if (dbManager->executeQuery(
-            "INSERT INTO usuarios (nome_usuario, senha, level, nome_completo, matricula, cpf, empresa_id) "
-            "VALUES (?, ?, ?, ?, ?, ?, ?)",
-            {matricula, hashedSenha, level, nomeCompleto, matricula, cpf, empresaId})) {
-        clearUserForm();
-        loadUsers();
-        loadColaboradores();
-        logAudit("add_user", QString("Adicionou usuário '%1' (Matrícula: %2, Empresa ID: %3)").arg(nomeCompleto, matricula, QString::number(empresaId)));
-        QMessageBox::information(this, "Sucesso", QString("Usuário '%1' adicionado com sucesso!").arg(nomeCompleto));
-    } else {
-        QMessageBox::critical(this, "Erro", "Falha ao adicionar usuário. Verifique matrícula/CPF.");
-    }
+    // The KDF is deliberately slow; hash on the pool like
+    // CredentialService::verify() and insert once it is back.
+    addingUser = true;
+    statusBar()->showMessage("Adicionando usuário...");
+    auto *watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcher<QString>::finished, this,
+            [this, watcher, nomeCompleto, matricula, cpf, level, empresaId] {
+        const QString hashedSenha = watcher->result();
+        watcher->deleteLater();
+        addingUser = false;
+        statusBar()->clearMessage();
+        if (dbManager->executeQuery(
+                "INSERT INTO usuarios (nome_usuario, senha, level, nome_completo, matricula, cpf, empresa_id) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?)",
+                {matricula, hashedSenha, level, nomeCompleto, matricula, cpf, empresaId})) {
+            clearUserForm();
+            loadUsers();
+            loadColaboradores();
+            logAudit("add_user", QString("Adicionou usuário '%1' (Matrícula: %2, Empresa ID: %3)").arg(nomeCompleto, matricula, QString::number(empresaId)));
+            QMessageBox::information(this, "Sucesso", QString("Usuário '%1' adicionado com sucesso!").arg(nomeCompleto));
+        } else {
+            QMessageBox::critical(this, "Erro", "Falha ao adicionar usuário. Verifique matrícula/CPF.");
+        }
+    });
+    watcher->setFuture(QtConcurrent::run([senha] { return CredentialService::hashPassword(senha); }));
 }
 
 void EPIApp::deleteUser() {
+    if (!checkWritable("deletar usuários")) return;
     if (!checkAdmin("deletar usuários")) return;
 
     int currentRow = usersTable->currentRow();
@@ -611,6 +1040,7 @@ void EPIApp::deleteUser() {
     }
 
     if (dbManager->executeQuery("DELETE FROM usuarios WHERE id=?", {userId})) {
+        credentialService->forget(userId.toInt());
         loadUsers();
         loadColaboradores();
         logAudit("delete_user", QString("Deletou usuário '%1' (Matrícula: %2)").arg(nomeCompleto, matricula));
@@ -621,6 +1051,7 @@ void EPIApp::deleteUser() {
 }
 
 void EPIApp::addItem() {
+    if (!checkWritable("adicionar EPIs")) return;
     if (currentUserLevel != 2 && currentUserLevel != 3) {
         QMessageBox::warning(this, "Erro", "Apenas almoxarifes ou administradores podem adicionar EPIs!");
         return;
@@ -654,6 +1085,7 @@ void EPIApp::addItem() {
 }
 
 void EPIApp::updateItem() {
+    if (!checkWritable("atualizar EPIs")) return;
     if (currentUserLevel != 2 && currentUserLevel != 3) {
         QMessageBox::warning(this, "Erro", "Apenas almoxarifes ou administradores podem atualizar EPIs!");
         return;
@@ -677,10 +1109,22 @@ void EPIApp::updateItem() {
         return;
     }
 
-    if (dbManager->executeQuery(
-            "UPDATE itens SET nome=?, ca=?, tamanho=?, marca=?, categoria_id=?, quantidade=?, preco=?, estoque_minimo=?, fornecedor=? WHERE id=?",
-            {itemNameText, itemCa->text(), itemSize->text(), itemBrand->text(), categoryId,
-             itemQuantity->value(), itemPrice->value(), itemMinStock->value(), itemSupplier->text(), itemId})) {
+    // A changed quantity is a stock adjustment: it goes through the
+    // movement log like any other change, in the same transaction.
+    bool updated = dbManager->beginTransaction();
+    if (updated) {
+        updated = dbManager->executeQuery(
+                      "UPDATE itens SET nome=?, ca=?, tamanho=?, marca=?, categoria_id=?, preco=?, estoque_minimo=?, fornecedor=? WHERE id=?",
+                      {itemNameText, itemCa->text(), itemSize->text(), itemBrand->text(), categoryId,
+                       itemPrice->value(), itemMinStock->value(), itemSupplier->text(), itemId}) &&
+                  stockService->adjustTo(itemId.toInt(), itemQuantity->value(), "Ajuste de estoque");
+        if (updated) {
+            updated = dbManager->commitTransaction();
+        } else {
+            dbManager->rollbackTransaction();
+        }
+    }
+    if (updated) {
         clearItemForm();
         loadItems();
         updateCompleters();
@@ -692,6 +1136,7 @@ void EPIApp::updateItem() {
 }
 
 void EPIApp::deleteItem() {
+    if (!checkWritable("deletar EPIs")) return;
     if (currentUserLevel != 2 && currentUserLevel != 3) {
         QMessageBox::warning(this, "Erro", "Apenas almoxarifes ou administradores podem deletar EPIs!");
         return;
@@ -721,6 +1166,7 @@ void EPIApp::deleteItem() {
 }
 
 void EPIApp::addCategory() {
+    if (!checkWritable("adicionar categorias")) return;
     if (!checkAdmin("adicionar categorias")) return;
 
     QString categoryNameText = categoryName->text();
@@ -747,6 +1193,7 @@ void EPIApp::addCategory() {
 }
 
 void EPIApp::updateCategory() {
+    if (!checkWritable("atualizar categorias")) return;
     if (!checkAdmin("atualizar categorias")) return;
 
     QListWidgetItem *currentItem = categoriesList->currentItem();
@@ -780,6 +1227,7 @@ void EPIApp::updateCategory() {
 }
 
 void EPIApp::deleteCategory() {
+    if (!checkWritable("deletar categorias")) return;
     if (!checkAdmin("deletar categorias")) return;
 
     QListWidgetItem *currentItem = categoriesList->currentItem();
@@ -806,6 +1254,7 @@ void EPIApp::deleteCategory() {
 }
 
 void EPIApp::addEmpresa() {
+    if (!checkWritable("adicionar empresas")) return;
     if (!checkAdmin("adicionar empresas")) return;
 
     QString nome = empresaNome->text();
@@ -834,6 +1283,7 @@ void EPIApp::addEmpresa() {
 }
 
 void EPIApp::updateEmpresa() {
+    if (!checkWritable("atualizar empresas")) return;
     if (!checkAdmin("atualizar empresas")) return;
 
     QListWidgetItem *currentItem = empresasList->currentItem();
@@ -869,6 +1319,7 @@ void EPIApp::updateEmpresa() {
 }
 
 void EPIApp::deleteEmpresa() {
+    if (!checkWritable("deletar empresas")) return;
     if (!checkAdmin("deletar empresas")) return;
 
     QList
@@ -897,33 +1348,23 @@ WidgetItem *currentItem = empresasList->currentItem();
 }
 
 void EPIApp::filterItems() {
+    EPI_TRACE_SCOPE("EPIApp::filterItems");
     QString searchText = searchInput->text().toLower();
     QString category = categoryFilter->currentText();
-    QVariantList items;
-    dbManager->executeQuery(
-        "SELECT i.id, i.nome, i.ca, i.tamanho, i.marca, c.nome, i.quantidade, i.preco, i.estoque_minimo, i.fornecedor, i.data_adicao "
-        "FROM itens i LEFT JOIN categorias c ON i.categoria_id = c.id", {}, true, &items);
+    QList<ItemRow> items;
+    dbManager->select("", {}, &items);
 
-    QList<QVariantList> filteredItems;
+    QList<ItemRow> filteredItems;
     for (const auto &item : items) {
-        QString nome = item[1].toString().toLower();
-        QString ca = item[2].toString().toLower();
-        QString cat = item[5].toString();
-        if ((searchText.isEmpty() || nome.contains(searchText) || ca.contains(searchText)) &&
-            (category == "Todas as Categorias" || cat == category)) {
+        if ((searchText.isEmpty() || item.nome.toLower().contains(searchText) || item.ca.toLower().contains(searchText)) &&
+            (category == "Todas as Categorias" || item.categoria == category)) {
             filteredItems.append(item);
         }
     }
 
     itemsTable->setRowCount(filteredItems.size());
     for (int row = 0; row < filteredItems.size(); ++row) {
-        const auto &item = filteredItems[row];
-        for (int col = 0; col < item.size(); ++col) {
-            itemsTable->setItem(row, col, new QTableWidgetItem(item[col].toString()));
-            if (col == 6 && item[6].toInt() <= item[8].toInt()) {
-                itemsTable->item(row, col)->setBackground(QColor(255, 200, 200));
-            }
-        }
+        fillItemRow(itemsTable, row, filteredItems[row]);
     }
 }
 
@@ -932,25 +1373,27 @@ void EPIApp::loadItemDetails() {
     if (currentRow < 0) return;
 
     QString itemId = itemsTable->item(currentRow, 0)->text();
-    QVariantList item;
-    dbManager->executeQuery(
-        "SELECT nome, ca, tamanho, marca, categoria_id, quantidade, preco, estoque_minimo, fornecedor "
-        "FROM itens WHERE id=?", {itemId}, true, &item);
-    if (!item.isEmpty()) {
-        itemName->setText(item[0].toString());
-        itemCa->setText(item[1].toString());
-        itemSize->setText(item[2].toString());
-        itemBrand->setText(item[3].toString());
-        int index = itemCategory->findData(item[4]);
+    QList<ItemRow> items;
+    dbManager->select("WHERE i.id=?", {itemId}, &items);
+    if (!items.isEmpty()) {
+        const ItemRow &item = items.first();
+        itemName->setText(item.nome);
+        itemCa->setText(item.ca);
+        itemSize->setText(item.tamanho);
+        itemBrand->setText(item.marca);
+        int index = itemCategory->findData(item.categoriaId);
         itemCategory->setCurrentIndex(index >= 0 ? index : 0);
-        itemQuantity->setValue(item[5].toInt());
-        itemPrice->setValue(item[6].toDouble());
-        itemMinStock->setValue(item[7].toInt());
-        itemSupplier->setText(item[8].toString());
+        itemQuantity->setValue(item.quantidade);
+        itemPrice->setValue(item.preco);
+        itemMinStock->setValue(item.estoqueMinimo);
+        itemSupplier->setText(item.fornecedor);
     }
 }
 
 void EPIApp::onColaboradorSelected() {
+    if (!pendingWithdrawals.isEmpty()) {
+        stockService->release(reservationOwner);
+    }
     pendingWithdrawals.clear();
     pendingTable->setRowCount(0);
     movName->clear();
@@ -970,7 +1413,7 @@ void EPIApp::onMovNameChanged(const QString &text) {
             "SELECT DISTINCT tamanho FROM itens WHERE (nome = ? OR ca = ?) AND quantidade > 0 AND tamanho IS NOT NULL ORDER BY tamanho",
             {text, text}, true, &sizes);
         for (const auto &size : sizes) {
-            movSize->addItem(size[0].toString());
+            movSize->addItem(size.toList()[0].toString());
         }
     }
 }
@@ -984,18 +1427,17 @@ void EPIApp::onMovSizeSelected() {
     }
 
     QString itemNameText = movName->text();
-    QVariantList item;
-    dbManager->executeQuery(
-        "SELECT i.ca, c.nome FROM itens i LEFT JOIN categorias c ON i.categoria_id = c.id "
-        "WHERE (i.nome=? OR i.ca=?) AND i.tamanho=?", {itemNameText, itemNameText, size}, true, &item);
-    if (!item.isEmpty()) {
-        movCa->setText(item[0].toString());
-        int index = movCategory->findText(item[1].toString());
+    QList<ItemRow> items;
+    dbManager->select("WHERE (i.nome=? OR i.ca=?) AND i.tamanho=?", {itemNameText, itemNameText, size}, &items);
+    if (!items.isEmpty()) {
+        movCa->setText(items.first().ca);
+        int index = movCategory->findText(items.first().categoria);
         movCategory->setCurrentIndex(index >= 0 ? index : 0);
     }
 }
 
 void EPIApp::addToPending() {
+    if (!checkWritable("registrar retiradas")) return;
     if (currentUserLevel != 2 && currentUserLevel != 3) {
         QMessageBox::warning(this, "Erro", "Apenas almoxarifes ou administradores podem registrar retiradas!");
         return;
@@ -1012,20 +1454,20 @@ void EPIApp::addToPending() {
         return;
     }
 
-    QVariantList item;
-    QString query = "SELECT id, nome, ca, tamanho, quantidade FROM itens WHERE (nome=? OR ca=?)";
-    if (!size.isEmpty()) query += " AND tamanho=?";
-    dbManager->executeQuery(query, size.isEmpty() ? QVariantList{itemNameText, itemNameText} : QVariantList{itemNameText, itemNameText, size}, true, &item);
-    if (item.isEmpty()) {
+    QList<ItemRow> items;
+    QString clause = "WHERE (i.nome=? OR i.ca=?)";
+    if (!size.isEmpty()) clause += " AND i.tamanho=?";
+    dbManager->select(clause, size.isEmpty() ? QVariantList{itemNameText, itemNameText} : QVariantList{itemNameText, itemNameText, size}, &items);
+    if (items.isEmpty()) {
         QMessageBox::warning(this, "Erro", "EPI não encontrado!");
         return;
     }
 
-    int itemId = item[0].toInt();
-    QString name = item[1].toString();
-    QString ca = item[2].toString();
-    QString itemSize = item[3].toString();
-    int availableQty = item[4].toInt();
+    int itemId = items.first().id;
+    QString name = items.first().nome;
+    QString ca = items.first().ca;
+    QString itemSize = items.first().tamanho;
+    int availableQty = stockService->available(itemId, reservationOwner);
     if (qty > availableQty) {
         QMessageBox::warning(this, "Erro", QString("Quantidade solicitada (%1) excede o estoque disponível (%2)!").arg(qty).arg(availableQty));
         return;
@@ -1034,12 +1476,473 @@ void EPIApp::addToPending() {
     if (!confirmAction(QString("Adicionar retirada de %1 '%2' (Tamanho: %3)?").arg(qty).arg(name).arg(itemSize.isEmpty() ? "N/A" : itemSize))) {
         return;
     }
+    // Another counter may have taken the stock while the dialog was open.
+    if (!stockService->reserve(reservationOwner, itemId, qty, &availableQty)) {
+        QMessageBox::warning(this, "Erro", QString("Quantidade solicitada (%1) excede o estoque disponível (%2)!").arg(qty).arg(availableQty));
+        return;
+    }
 
     pendingWithdrawals.append({itemId, name, ca, itemSize, qty, validDays});
     updatePendingTable();
     logAudit("add_pending_withdrawal", QString("Adicionou retirada pendente: %1 '%2' (Tamanho: %3)").arg(qty).arg(name).arg(itemSize.isEmpty() ? "N/A" : itemSize));
 }
 
+void EPIApp::onScanModeToggled(bool enabled) {
+    scanInput->setEnabled(enabled);
+    movName->setEnabled(!enabled);
+    movSize->setEnabled(!enabled);
+    movWithdrawQty->setEnabled(!enabled);
+    scanStatus->clear();
+    if (enabled) {
+        scanInput->setFocus();
+    }
+}
+
+void EPIApp::rebuildScanLookup() {
+    scanItems.clear();
+    scanLookup.clear();
+    QList<ItemRow> items;
+    if (!dbManager->select("WHERE i.quantidade > 0", {}, &items)) {
+        return;
+    }
+    scanItems.reserve(items.size());
+    for (const ItemRow &item : items) {
+        const int index = scanItems.size();
+        scanItems.append(item);
+        if (!item.ca.trimmed().isEmpty()) {
+            scanLookup[item.ca.trimmed().toUpper()].append(index);
+        }
+        scanLookup[QString("EPI-%1").arg(item.id)].append(index);
+    }
+    scanLookupDirty = false;
+}
+
+bool EPIApp::addScannedCode(const QString &code, QString *message) {
+    const auto it = scanLookup.constFind(code.toUpper());
+    if (it == scanLookup.constEnd()) {
+        *message = QString("Código %1 não encontrado ou sem estoque").arg(code);
+        return false;
+    }
+
+    // A CA shared by several sizes resolves to the size already in the
+    // batch; otherwise the item label has to be read instead.
+    const QList<int> &candidates = it.value();
+    int pendingRow = -1;
+    const ItemRow *item = nullptr;
+    for (int index : candidates) {
+        for (int row = 0; row < pendingWithdrawals.size(); ++row) {
+            if (pendingWithdrawals[row][0].toInt() == scanItems[index].id) {
+                pendingRow = row;
+                item = &scanItems[index];
+                break;
+            }
+        }
+        if (item) break;
+    }
+    if (!item) {
+        if (candidates.size() > 1) {
+            *message = QString("CA %1 possui %2 tamanhos; leia a etiqueta EPI do tamanho desejado").arg(code).arg(candidates.size());
+            return false;
+        }
+        item = &scanItems[candidates.first()];
+    }
+
+    const int pendingQty = pendingRow >= 0 ? pendingWithdrawals[pendingRow][4].toInt() : 0;
+    int available = 0;
+    if (!stockService->reserve(reservationOwner, item->id, 1, &available)) {
+        *message = QString("Estoque de '%1' esgotado (%2 disponíveis)").arg(item->nome).arg(available);
+        return false;
+    }
+    if (pendingRow >= 0) {
+        pendingWithdrawals[pendingRow][4] = pendingQty + 1;
+        pendingTable->item(pendingRow, 3)->setText(QString::number(pendingQty + 1));
+    } else {
+        pendingWithdrawals.append({item->id, item->nome, item->ca, item->tamanho, 1, movValidDays->value()});
+        updatePendingTable();
+    }
+    *message = QString("%1 (Tamanho: %2) — %3 na lista")
+                   .arg(item->nome, item->tamanho.isEmpty() ? "N/A" : item->tamanho)
+                   .arg(pendingQty + 1);
+    return true;
+}
+
+void EPIApp::onScanSubmitted() {
+    if (!checkWritable("registrar retiradas")) return;
+    if (currentUserLevel != 2 && currentUserLevel != 3) {
+        scanStatus->setText("Apenas almoxarifes ou administradores podem registrar retiradas!");
+        return;
+    }
+    if (!colaboradorCombo->currentData().toInt()) {
+        scanStatus->setText("Selecione um colaborador antes de ler os códigos");
+        QApplication::beep();
+        return;
+    }
+    if (scanLookupDirty) {
+        rebuildScanLookup();
+    }
+
+    // A wedge burst may arrive as several codes before the Enter.
+    const QStringList codes = scanInput->text().split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+    scanInput->clear();
+    QString message;
+    QString failure;
+    for (const QString &code : codes) {
+        if (!addScannedCode(code, &message) && failure.isEmpty()) {
+            failure = message;
+        }
+    }
+    const bool ok = failure.isEmpty();
+    if (!ok) message = failure;
+    if (!codes.isEmpty()) {
+        scanStatus->setStyleSheet(ok ? "color: #2e7d32;" : "color: #c62828;");
+        scanStatus->setText(message);
+        if (!ok) QApplication::beep();
+    }
+    scanInput->setFocus();
+}
+
+void EPIApp::startCycleCount() {
+    if (!checkWritable("contar estoque")) return;
+    if (currentUserLevel != 2 && currentUserLevel != 3) {
+        QMessageBox::warning(this, "Erro", "Apenas almoxarifes ou administradores podem contar estoque!");
+        return;
+    }
+    if (cycleCount->countedCount() > 0 &&
+        !confirmAction(QString("Descartar a contagem em andamento (%1 EPIs contados)?").arg(cycleCount->countedCount()))) {
+        return;
+    }
+    QString error;
+    if (!cycleCount->start(countCategory->currentData().toInt(), &error)) {
+        QMessageBox::critical(this, "Erro", error);
+        return;
+    }
+    countTable->setRowCount(0);
+    countRows.clear();
+    countScanInput->setEnabled(true);
+    countStatus->setStyleSheet("");
+    countStatus->setText(QString("Contagem iniciada em %1 com %2 EPIs")
+                             .arg(cycleCount->startedAt().toString("dd/MM/yyyy hh:mm")).arg(cycleCount->itemCount()));
+    updateCountSummary();
+    logAudit("start_cycle_count", QString("Iniciou contagem cíclica (%1, %2 EPIs)")
+                                      .arg(countCategory->currentText()).arg(cycleCount->itemCount()));
+    countScanInput->setFocus();
+}
+
+void EPIApp::cancelCycleCount() {
+    if (!cycleCount->isOpen()) return;
+    if (!confirmAction(QString("Descartar a contagem em andamento (%1 EPIs contados)?").arg(cycleCount->countedCount()))) {
+        return;
+    }
+    cycleCount->cancel();
+    countTable->setRowCount(0);
+    countRows.clear();
+    countScanInput->setEnabled(false);
+    countStatus->clear();
+    updateCountSummary();
+    logAudit("cancel_cycle_count", "Descartou contagem cíclica");
+}
+
+void EPIApp::onCountScanSubmitted() {
+    // A wedge burst may arrive as several codes before the Enter.
+    const QStringList codes = countScanInput->text().split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+    countScanInput->clear();
+    QString message;
+    QString failure;
+    for (const QString &code : codes) {
+        int itemId = 0;
+        if (cycleCount->addCount(code, countQuantity->value(), &itemId, &message)) {
+            CountVariance line;
+            cycleCount->item(itemId, &line);
+            setCountRow(line);
+        } else if (failure.isEmpty()) {
+            failure = message;
+        }
+    }
+    const bool ok = failure.isEmpty();
+    if (!ok) message = failure;
+    if (!codes.isEmpty()) {
+        countStatus->setStyleSheet(ok ? "color: #2e7d32;" : "color: #c62828;");
+        countStatus->setText(message);
+        if (!ok) QApplication::beep();
+        updateCountSummary();
+    }
+    countScanInput->setFocus();
+}
+
+void EPIApp::importCycleCountCsv() {
+    if (!cycleCount->isOpen()) {
+        QMessageBox::warning(this, "Erro", "Inicie uma contagem antes de importar!");
+        return;
+    }
+    const QString fileName = QFileDialog::getOpenFileName(this, "Importar Contagem", "", "CSV Files (*.csv *.txt)");
+    if (fileName.isEmpty()) return;
+
+    QStringList errors;
+    const int applied = cycleCount->importCsv(fileName, &errors);
+    countTable->setUpdatesEnabled(false);
+    for (int itemId : cycleCount->countedItems()) {
+        CountVariance line;
+        cycleCount->item(itemId, &line);
+        setCountRow(line);
+    }
+    countTable->setUpdatesEnabled(true);
+    updateCountSummary();
+    logAudit("import_cycle_count", QString("Importou %1 linhas de contagem de %2").arg(applied).arg(fileName));
+    if (errors.isEmpty()) {
+        QMessageBox::information(this, "Sucesso", QString("%1 linhas importadas.").arg(applied));
+    } else {
+        QMessageBox::warning(this, "Importação parcial",
+                             QString("%1 linhas importadas, %2 ignoradas:\n%3")
+                                 .arg(applied).arg(errors.size()).arg(errors.mid(0, 20).join("\n")));
+    }
+}
+
+void EPIApp::postCycleCount() {
+    if (!checkWritable("lançar ajustes de contagem")) return;
+    if (currentUserLevel != 2 && currentUserLevel != 3) {
+        QMessageBox::warning(this, "Erro", "Apenas almoxarifes ou administradores podem lançar ajustes!");
+        return;
+    }
+    if (!cycleCount->isOpen() || cycleCount->countedCount() == 0) {
+        QMessageBox::warning(this, "Erro", "Nenhum EPI contado!");
+        return;
+    }
+
+    // Final variances account for movements made while counting; show
+    // them before asking.
+    QList<CountVariance> lines;
+    QString error;
+    if (!cycleCount->variances(&lines, &error)) {
+        QMessageBox::critical(this, "Erro", error);
+        return;
+    }
+    int changed = 0;
+    int surplus = 0;
+    int shortage = 0;
+    countTable->setUpdatesEnabled(false);
+    for (const CountVariance &line : lines) {
+        setCountRow(line);
+        if (line.variacao > 0) surplus += line.variacao;
+        if (line.variacao < 0) shortage -= line.variacao;
+        if (line.variacao != 0) ++changed;
+    }
+    countTable->setUpdatesEnabled(true);
+    if (!confirmAction(QString("Lançar ajustes de %1 dos %2 EPIs contados (+%3 / -%4 unidades)?\n"
+                               "EPIs não contados não serão alterados.")
+                           .arg(changed).arg(lines.size()).arg(surplus).arg(shortage))) {
+        return;
+    }
+
+    int adjusted = 0;
+    if (!cycleCount->post(currentUserId, &adjusted, &error)) {
+        QMessageBox::critical(this, "Erro", error);
+        return;
+    }
+    countTable->setRowCount(0);
+    countRows.clear();
+    countScanInput->setEnabled(false);
+    countStatus->clear();
+    updateCountSummary();
+    loadItems();
+    updateCompleters();
+    QMessageBox::information(this, "Sucesso", QString("Contagem lançada: %1 EPIs ajustados.").arg(adjusted));
+}
+
+void EPIApp::setCountRow(const CountVariance &line) {
+    auto it = countRows.constFind(line.itemId);
+    int row;
+    if (it == countRows.constEnd()) {
+        row = countTable->rowCount();
+        countTable->insertRow(row);
+        countRows.insert(line.itemId, row);
+        countTable->setItem(row, 0, new QTableWidgetItem(QString::number(line.itemId)));
+        countTable->setItem(row, 1, new QTableWidgetItem(line.nome));
+        countTable->setItem(row, 2, new QTableWidgetItem(line.ca));
+        countTable->setItem(row, 3, new QTableWidgetItem(line.tamanho));
+        for (int col = 4; col < 7; ++col) {
+            countTable->setItem(row, col, new QTableWidgetItem);
+        }
+    } else {
+        row = it.value();
+    }
+    countTable->item(row, 4)->setText(line.moved ? QString("%1 (%2%3 desde o início)")
+                                                       .arg(line.esperado + line.moved)
+                                                       .arg(line.moved > 0 ? "+" : "")
+                                                       .arg(line.moved)
+                                                 : QString::number(line.esperado));
+    countTable->item(row, 5)->setText(QString::number(line.contado));
+    QTableWidgetItem *variance = countTable->item(row, 6);
+    variance->setText(line.variacao > 0 ? QString("+%1").arg(line.variacao) : QString::number(line.variacao));
+    variance->setData(Qt::ForegroundRole, line.variacao ? QVariant(QColor(line.variacao < 0 ? "#c62828" : "#2e7d32"))
+                                                        : QVariant());
+}
+
+void EPIApp::updateCountSummary() {
+    if (!cycleCount->isOpen()) {
+        countSummary->setText("Nenhuma contagem em andamento.");
+        return;
+    }
+    countSummary->setText(QString("%1 de %2 EPIs contados").arg(cycleCount->countedCount()).arg(cycleCount->itemCount()));
+}
+
+void EPIApp::onPurchaseSupplierChanged() {
+    const QString supplier = purchaseSupplier->currentText().trimmed();
+    QList<ItemRow> items;
+    if (!supplier.isEmpty()) {
+        dbManager->select("WHERE TRIM(i.fornecedor) = ? ORDER BY i.nome, i.tamanho", {supplier}, &items);
+    }
+    purchaseDraftTable->setUpdatesEnabled(false);
+    purchaseDraftTable->setRowCount(items.size());
+    for (int row = 0; row < items.size(); ++row) {
+        const ItemRow &item = items[row];
+        purchaseDraftTable->setItem(row, 0, new QTableWidgetItem(QString::number(item.id)));
+        purchaseDraftTable->setItem(row, 1, new QTableWidgetItem(item.nome));
+        purchaseDraftTable->setItem(row, 2, new QTableWidgetItem(item.ca));
+        purchaseDraftTable->setItem(row, 3, new QTableWidgetItem(item.tamanho));
+        purchaseDraftTable->setItem(row, 4, new QTableWidgetItem(QString::number(item.quantidade)));
+        purchaseDraftTable->setItem(row, 5, new QTableWidgetItem(QString::number(item.estoqueMinimo)));
+        QSpinBox *qty = new QSpinBox;
+        qty->setRange(0, 999999);
+        qty->setValue(qMax(0, item.estoqueMinimo - item.quantidade));
+        purchaseDraftTable->setCellWidget(row, 6, qty);
+        QDoubleSpinBox *cost = new QDoubleSpinBox;
+        cost->setRange(0, 999999);
+        cost->setPrefix("R$ ");
+        cost->setValue(item.preco);
+        purchaseDraftTable->setCellWidget(row, 7, cost);
+    }
+    purchaseDraftTable->setUpdatesEnabled(true);
+}
+
+void EPIApp::createPurchaseOrder() {
+    if (!checkWritable("criar pedidos de compra")) return;
+    if (currentUserLevel != 2 && currentUserLevel != 3) {
+        QMessageBox::warning(this, "Erro", "Apenas almoxarifes ou administradores podem criar pedidos de compra!");
+        return;
+    }
+    const QString supplier = purchaseSupplier->currentText().trimmed();
+    QList<PurchaseLine> lines;
+    int units = 0;
+    for (int row = 0; row < purchaseDraftTable->rowCount(); ++row) {
+        QSpinBox *qty = qobject_cast<QSpinBox*>(purchaseDraftTable->cellWidget(row, 6));
+        QDoubleSpinBox *cost = qobject_cast<QDoubleSpinBox*>(purchaseDraftTable->cellWidget(row, 7));
+        if (qty && cost && qty->value() > 0) {
+            lines.append({purchaseDraftTable->item(row, 0)->text().toInt(), qty->value(), cost->value()});
+            units += qty->value();
+        }
+    }
+    if (supplier.isEmpty() || lines.isEmpty()) {
+        QMessageBox::warning(this, "Erro", "Selecione o fornecedor e informe ao menos uma quantidade!");
+        return;
+    }
+    if (!confirmAction(QString("Criar pedido para '%1' com %2 itens (%3 unidades)?").arg(supplier).arg(lines.size()).arg(units))) {
+        return;
+    }
+
+    int orderId = 0;
+    QString error;
+    if (!purchaseService->createOrder(supplier, lines, currentUserId, &orderId, &error)) {
+        QMessageBox::critical(this, "Erro", error);
+        return;
+    }
+    onPurchaseSupplierChanged();
+    loadOpenOrders();
+    QMessageBox::information(this, "Sucesso", QString("Pedido #%1 criado com sucesso!").arg(orderId));
+}
+
+void EPIApp::onReceiptOrderSelected() {
+    const int orderId = receiptOrderCombo->currentData().toInt();
+    QList<OrderLineRow> lines;
+    if (orderId) {
+        purchaseService->orderLines(orderId, &lines);
+    }
+    receiptTable->setUpdatesEnabled(false);
+    receiptTable->setRowCount(lines.size());
+    for (int row = 0; row < lines.size(); ++row) {
+        const OrderLineRow &line = lines[row];
+        const int left = qMax(0, line.quantidade - line.recebido);
+        receiptTable->setItem(row, 0, new QTableWidgetItem(QString::number(line.itemId)));
+        receiptTable->setItem(row, 1, new QTableWidgetItem(line.nome));
+        receiptTable->setItem(row, 2, new QTableWidgetItem(line.ca));
+        receiptTable->setItem(row, 3, new QTableWidgetItem(line.tamanho));
+        receiptTable->setItem(row, 4, new QTableWidgetItem(QString::number(line.quantidade)));
+        receiptTable->setItem(row, 5, new QTableWidgetItem(QString::number(line.recebido)));
+        QSpinBox *qty = new QSpinBox;
+        qty->setRange(0, left);
+        qty->setValue(left);
+        receiptTable->setCellWidget(row, 6, qty);
+        QDoubleSpinBox *cost = new QDoubleSpinBox;
+        cost->setRange(0, 999999);
+        cost->setPrefix("R$ ");
+        cost->setValue(line.custoUnitario);
+        receiptTable->setCellWidget(row, 7, cost);
+    }
+    receiptTable->setUpdatesEnabled(true);
+    receiptInvoice->clear();
+}
+
+void EPIApp::receivePurchaseOrder() {
+    if (!checkWritable("receber mercadorias")) return;
+    if (currentUserLevel != 2 && currentUserLevel != 3) {
+        QMessageBox::warning(this, "Erro", "Apenas almoxarifes ou administradores podem receber mercadorias!");
+        return;
+    }
+    const int orderId = receiptOrderCombo->currentData().toInt();
+    QList<PurchaseLine> lines;
+    int units = 0;
+    for (int row = 0; row < receiptTable->rowCount(); ++row) {
+        QSpinBox *qty = qobject_cast<QSpinBox*>(receiptTable->cellWidget(row, 6));
+        QDoubleSpinBox *cost = qobject_cast<QDoubleSpinBox*>(receiptTable->cellWidget(row, 7));
+        if (qty && cost && qty->value() > 0) {
+            lines.append({receiptTable->item(row, 0)->text().toInt(), qty->value(), cost->value()});
+            units += qty->value();
+        }
+    }
+    if (!orderId || lines.isEmpty()) {
+        QMessageBox::warning(this, "Erro", "Selecione um pedido e informe as quantidades recebidas!");
+        return;
+    }
+    if (!confirmAction(QString("Dar entrada de %1 itens (%2 unidades) do pedido #%3?").arg(lines.size()).arg(units).arg(orderId))) {
+        return;
+    }
+
+    int receiptId = 0;
+    QString error;
+    if (!purchaseService->receive(orderId, receiptInvoice->text(), lines, currentUserId, &receiptId, &units, &error)) {
+        QMessageBox::critical(this, "Erro", error);
+        return;
+    }
+    // Dependent views are refreshed once for the whole receipt.
+    loadItems();
+    updateCompleters();
+    onPurchaseSupplierChanged();
+    loadOpenOrders();
+    QMessageBox::information(this, "Sucesso", QString("Recebimento #%1 registrado: %2 unidades em estoque.").arg(receiptId).arg(units));
+}
+
+void EPIApp::cancelPurchaseOrder() {
+    if (!checkWritable("cancelar pedidos de compra")) return;
+    if (currentUserLevel != 2 && currentUserLevel != 3) {
+        QMessageBox::warning(this, "Erro", "Apenas almoxarifes ou administradores podem cancelar pedidos de compra!");
+        return;
+    }
+    const int orderId = receiptOrderCombo->currentData().toInt();
+    if (!orderId) {
+        QMessageBox::warning(this, "Erro", "Selecione um pedido para cancelar!");
+        return;
+    }
+    if (!confirmAction(QString("Cancelar o pedido #%1? O que já foi recebido permanece em estoque.").arg(orderId))) {
+        return;
+    }
+    QString error;
+    if (!purchaseService->cancelOrder(orderId, currentUserId, &error)) {
+        QMessageBox::critical(this, "Erro", error);
+        return;
+    }
+    loadOpenOrders();
+    QMessageBox::information(this, "Sucesso", QString("Pedido #%1 cancelado.").arg(orderId));
+}
+
 void EPIApp::updatePendingTable() {
     pendingTable->setRowCount(pendingWithdrawals.size());
     for (int row = 0; row < pendingWithdrawals.size(); ++row) {
@@ -1059,12 +1962,15 @@ void EPIApp::removePending(int row) {
     if (!confirmAction(QString("Remover retirada pendente: %1?").arg(pendingWithdrawals[row][1].toString()))) {
         return;
     }
+    stockService->release(reservationOwner, pendingWithdrawals[row][0].toInt());
     pendingWithdrawals.removeAt(row);
     updatePendingTable();
     logAudit("remove_pending_withdrawal", QString("Removeu retirada pendente: %1").arg(row));
 }
 
 void EPIApp::confirmPending() {
+    if (!checkWritable("confirmar retiradas")) return;
+    if (verifyingCredentials) return;
     if (pendingWithdrawals.isEmpty()) {
         QMessageBox::warning(this, "Erro", "Nenhuma retirada pendente para confirmar!");
         return;
@@ -1075,48 +1981,42 @@ void EPIApp::confirmPending() {
     QString password = QInputDialog::getText(this, "Verificação de Senha", "Digite a senha do colaborador:", QLineEdit::Password, &ok);
     if (!ok) return;
 
-    QString hashedPassword = QString(QCryptographicHash::hash(password.toUtf8(), QCryptographicHash::Sha256).toHex());
-    QVariantList result;
-    if (!dbManager->executeQuery(
-            "SELECT id FROM usuarios WHERE id=? AND senha=?", {colaboradorId, hashedPassword}, true, &result)) {
-        QMessageBox::warning(this, "Erro", "Senha incorreta!");
-        return;
-    }
-    if (result.isEmpty()) {
-        QMessageBox::warning(this, "Erro", "Senha incorreta!");
-        return;
-    }
+    verifyingCredentials = true;
+    statusBar()->showMessage("Verificando senha...");
+    credentialService->verify(colaboradorId, password, this, [this, colaboradorId](bool verified) {
+        verifyingCredentials = false;
+        statusBar()->clearMessage();
+        if (!verified) {
+            QMessageBox::warning(this, "Erro", "Senha incorreta!");
+            return;
+        }
+        // The list or the collaborator may have changed while the check ran.
+        if (pendingWithdrawals.isEmpty() || colaboradorCombo->currentData().toInt() != colaboradorId) {
+            return;
+        }
+        commitPending(colaboradorId);
+    });
+}
 
+void EPIApp::commitPending(int colaboradorId) {
     if (!confirmAction("Confirmar todas as retiradas pendentes?")) {
         return;
     }
 
+    QList<StockLine> lines;
     for (const auto &item : pendingWithdrawals) {
-        int itemId = item[0].toInt();
-        QString name = item[1].toString();
-        QString size = item[3].toString();
-        int qty = item[4].toInt();
-        int validDays = item[5].toInt();
-        if (dbManager->executeQuery(
-                "UPDATE itens SET quantidade = quantidade - ? WHERE id=?", {qty, itemId})) {
-            QString expiration = QDateTime::currentDateTime().addDays(validDays).toString("yyyy-MM-dd");
-            dbManager->executeQuery(
-                "INSERT INTO movimentacoes (item_id, alteracao_quantidade, data, motivo, colaborador_id, expiration_date) "
-                "VALUES (?, ?, ?, ?, ?, ?)",
-                {itemId, -qty, QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss"),
-                 "Retirada por colaborador", colaboradorId, expiration});
-            logAudit("confirm_withdrawal", QString("Confirmou retirada: %1 '%2' (Tamanho: %3)").arg(qty).arg(name).arg(size.isEmpty() ? "N/A" : size));
-        } else {
-            QMessageBox::critical(this, "Erro", QString("Falha ao confirmar retirada de '%1'!").arg(name));
-            return;
-        }
+        lines.append({item[0].toInt(), item[4].toInt(), item[5].toInt()});
+    }
+    QString error;
+    if (!stockService->withdraw(colaboradorId, lines, currentUserId, reservationOwner, &error)) {
+        QMessageBox::critical(this, "Erro", QString("Nenhuma retirada foi registrada: %1!").arg(error));
+        return;
     }
 
     pendingWithdrawals.clear();
     pendingTable->setRowCount(0);
     loadItems();
     updateCompleters();
-    // Note: updateDashboard() is not implemented here; see note below
     QMessageBox::information(this, "Sucesso", "Todas as retiradas foram confirmadas com sucesso!");
 }
 
@@ -1127,23 +2027,19 @@ void EPIApp::onReturnColabSelected() {
         return;
     }
 
-    QVariantList withdrawn;
-    dbManager->executeQuery(
-        "SELECT i.id, i.nome, i.ca, i.tamanho, -SUM(m.alteracao_quantidade) as qty_owed "
-        "FROM movimentacoes m JOIN itens i ON m.item_id = i.id "
-        "WHERE m.colaborador_id = ? GROUP BY i.id HAVING SUM(m.alteracao_quantidade) < 0",
-        {colabId}, true, &withdrawn);
+    QList<BalanceRow> withdrawn;
+    stockService->balance(colabId, &withdrawn);
     withdrawnTable->setRowCount(withdrawn.size());
     for (int row = 0; row < withdrawn.size(); ++row) {
-        const auto &item = withdrawn[row];
-        withdrawnTable->setItem(row, 0, new QTableWidgetItem(item[0].toString()));
-        withdrawnTable->setItem(row, 1, new QTableWidgetItem(item[1].toString()));
-        withdrawnTable->setItem(row, 2, new QTableWidgetItem(item[2].toString()));
-        withdrawnTable->setItem(row, 3, new QTableWidgetItem(item[3].toString()));
-        withdrawnTable->setItem(row, 4, new QTableWidgetItem(item[4].toString()));
+        const BalanceRow &item = withdrawn[row];
+        withdrawnTable->setItem(row, 0, new QTableWidgetItem(QString::number(item.itemId)));
+        withdrawnTable->setItem(row, 1, new QTableWidgetItem(item.nome));
+        withdrawnTable->setItem(row, 2, new QTableWidgetItem(item.ca));
+        withdrawnTable->setItem(row, 3, new QTableWidgetItem(item.tamanho));
+        withdrawnTable->setItem(row, 4, new QTableWidgetItem(QString::number(item.quantidade)));
         QSpinBox *qtyReturn = new QSpinBox;
         qtyReturn->setMinimum(0);
-        qtyReturn->setMaximum(item[4].toInt());
+        qtyReturn->setMaximum(item.quantidade);
         withdrawnTable->setCellWidget(row, 5, qtyReturn);
     }
 
@@ -1152,6 +2048,7 @@ void EPIApp::onReturnColabSelected() {
 }
 
 void EPIApp::addReturnsToPending() {
+    if (!checkWritable("registrar devoluções")) return;
     for (int row = 0; row < withdrawnTable->rowCount(); ++row) {
         QSpinBox *qtyReturn = qobject_cast<QSpinBox*>(withdrawnTable->cellWidget(row, 5));
         if (qtyReturn && qtyReturn->value() > 0) {
@@ -1191,6 +2088,8 @@ void EPIApp::removeReturnPending(int row) {
 }
 
 void EPIApp::confirmReturns() {
+    if (!checkWritable("confirmar devoluções")) return;
+    if (verifyingCredentials) return;
     if (pendingReturns.isEmpty()) {
         QMessageBox::warning(this, "Erro", "Nenhuma devolução pendente para confirmar!");
         return;
@@ -1201,39 +2100,36 @@ void EPIApp::confirmReturns() {
     QString password = QInputDialog::getText(this, "Verificação de Senha", "Digite a senha do colaborador:", QLineEdit::Password, &ok);
     if (!ok) return;
 
-    QString hashedPassword = QString(QCryptographicHash::hash(password.toUtf8(), QCryptographicHash::Sha256).toHex());
-    QVariantList result;
-    if (!dbManager->executeQuery(
-            "SELECT id FROM usuarios WHERE id=? AND senha=?", {colaboradorId, hashedPassword}, true, &result)) {
-        QMessageBox::warning(this, "Erro", "Senha incorreta!");
-        return;
-    }
-    if (result.isEmpty()) {
-        QMessageBox::warning(this, "Erro", "Senha incorreta!");
-        return;
-    }
+    verifyingCredentials = true;
+    statusBar()->showMessage("Verificando senha...");
+    credentialService->verify(colaboradorId, password, this, [this, colaboradorId](bool verified) {
+        verifyingCredentials = false;
+        statusBar()->clearMessage();
+        if (!verified) {
+            QMessageBox::warning(this, "Erro", "Senha incorreta!");
+            return;
+        }
+        // The list or the collaborator may have changed while the check ran.
+        if (pendingReturns.isEmpty() || returnColabCombo->currentData().toInt() != colaboradorId) {
+            return;
+        }
+        commitReturns(colaboradorId);
+    });
+}
 
+void EPIApp::commitReturns(int colaboradorId) {
     if (!confirmAction("Confirmar todas as devoluções pendentes?")) {
         return;
     }
 
+    QList<StockLine> lines;
     for (const auto &item : pendingReturns) {
-        int itemId = item[0].toInt();
-        QString name = item[1].toString();
-        QString size = item[3].toString();
-        int qty = item[4].toInt();
-        if (dbManager->executeQuery(
-                "UPDATE itens SET quantidade = quantidade + ? WHERE id=?", {qty, itemId})) {
-            dbManager->executeQuery(
-                "INSERT INTO movimentacoes (item_id, alteracao_quantidade, data, motivo, colaborador_id, expiration_date) "
-                "VALUES (?, ?, ?, ?, ?, ?)",
-                {itemId, qty, QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss"),
-                 "Devolução por colaborador", colaboradorId, ""});
-            logAudit("confirm_return", QString("Confirmou devolução: %1 '%2' (Tamanho: %3)").arg(qty).arg(name).arg(size.isEmpty() ? "N/A" : size));
-        } else {
-            QMessageBox::critical(this, "Erro", QString("Falha ao confirmar devolução de '%1'!").arg(name));
-            return;
-        }
+        lines.append({item[0].toInt(), item[4].toInt(), 0});
+    }
+    QString error;
+    if (!stockService->returnItems(colaboradorId, lines, currentUserId, &error)) {
+        QMessageBox::critical(this, "Erro", QString("Nenhuma devolução foi registrada: %1!").arg(error));
+        return;
     }
 
     pendingReturns.clear();
@@ -1245,112 +2141,226 @@ void EPIApp::confirmReturns() {
 }
 
 void EPIApp::loadDelivered() {
+    EPI_TRACE_SCOPE("EPIApp::loadDelivered");
     QString colabId = deliveredColab->currentData().toString();
     QString startDel = deliveredStartDel->text();
     QString endDel = deliveredEndDel->text();
     QString startExp = deliveredStartExp->text();
     QString endExp = deliveredEndExp->text();
 
-    QString query = "SELECT u.nome_completo, i.nome, i.ca, i.tamanho, -m.alteracao_quantidade, m.data, m.expiration_date "
-                    "FROM movimentacoes m "
-                    "JOIN itens i ON m.item_id = i.id "
-                    "JOIN usuarios u ON m.colaborador_id = u.id "
-                    "WHERE m.alteracao_quantidade < 0";
-    QVariantList params;
+    deliveredStartDate = startDel;
+    deliveredSource = archiveManager->movementsSource(startDel);
+    const QList<int> missingYears = archiveManager->missingYears();
+    if (!missingYears.isEmpty()) {
+        QStringList years;
+        for (int year : missingYears) {
+            years << QString::number(year);
+        }
+        statusBar()->showMessage(QString("Arquivos de %1 indisponíveis: entregas desses anos não listadas.")
+                                     .arg(years.join(", ")), 10000);
+    }
+    deliveredFilterSql = "WHERE m.motivo = 'Retirada por colaborador'";
+    deliveredFilterParams.clear();
     if (colabId != "0") {
-        query += " AND m.colaborador_id = ?";
-        params.append(colabId);
+        deliveredFilterSql += " AND m.colaborador_id = ?";
+        deliveredFilterParams.append(colabId);
     }
     if (!startDel.isEmpty()) {
-        query += " AND m.data >= ?";
-        params.append(startDel);
+        deliveredFilterSql += " AND m.data >= ?";
+        deliveredFilterParams.append(startDel);
     }
     if (!endDel.isEmpty()) {
-        query += " AND m.data <= ?";
-        params.append(endDel);
+        deliveredFilterSql += " AND m.data <= ?";
+        deliveredFilterParams.append(endDel);
     }
     if (!startExp.isEmpty()) {
-        query += " AND m.expiration_date >= ?";
-        params.append(startExp);
+        deliveredFilterSql += " AND m.expiration_date >= ?";
+        deliveredFilterParams.append(startExp);
     }
     if (!endExp.isEmpty()) {
-        query += " AND m.expiration_date <= ?";
-        params.append(endExp);
+        deliveredFilterSql += " AND m.expiration_date <= ?";
+        deliveredFilterParams.append(endExp);
+    }
+
+    ++deliveredGeneration;
+    deliveredLastSortKey.clear();
+    deliveredLastId.clear();
+    deliveredHasMore = true;
+    deliveredTable->setRowCount(0);
+    deliveredCountLabel->setText("Contando registros...");
+    fetchMoreDelivered();
+    countDelivered();
+}
+
+void EPIApp::fetchMoreDelivered() {
+    if (!deliveredHasMore) return;
+    EPI_TRACE_SCOPE("EPIApp::fetchMoreDelivered");
+
+    const QString sortKey = kDeliveredSortKeys[deliveredSortColumn];
+    const QString direction = deliveredSortOrder == Qt::AscendingOrder ? "ASC" : "DESC";
+    QString query = "SELECT " + TypedQuery::selectList<MovementRow>() + " "
+                    "FROM " + deliveredSource + " m "
+                    "LEFT JOIN itens i ON m.item_id = i.id "
+                    "LEFT JOIN usuarios u ON m.colaborador_id = u.id "
+                    + deliveredFilterSql;
+    QVariantList params = deliveredFilterParams;
+    if (deliveredLastId.isValid()) {
+        query += QString(" AND (%1, m.id) %2 (?, ?)").arg(sortKey, deliveredSortOrder == Qt::AscendingOrder ? ">" : "<");
+        params << deliveredLastSortKey << deliveredLastId;
+    }
+    query += QString(" ORDER BY %1 %2, m.id %2 LIMIT %3").arg(sortKey, direction).arg(kDeliveredPageSize);
+
+    QList<MovementRow> result;
+    if (!dbManager->fetch(query, params, &result)) {
+        deliveredHasMore = false;
+        QMessageBox::critical(this, "Erro", "Falha ao carregar EPIs entregues!");
+        return;
     }
 
-    QVariantList result;
-    if (dbManager->executeQuery(query, params, true, &result)) {
-        deliveredTable->setRowCount(result.size());
-        for (int row = 0; row < result.size(); ++row) {
-            const auto &item = result[row];
-            for (int col = 0; col < item.size(); ++col) {
-                deliveredTable->setItem(row, col, new QTableWidgetItem(item[col].toString()));
-            }
+    deliveredHasMore = result.size() == kDeliveredPageSize;
+    const int firstRow = deliveredTable->rowCount();
+    deliveredTable->setRowCount(firstRow + result.size());
+    QStringList cells;
+    for (int row = 0; row < result.size(); ++row) {
+        const MovementRow &movement = result[row];
+        cells = {movement.colaborador, movement.item, movement.ca, movement.tamanho,
+                 QString::number(-movement.alteracaoQuantidade), movement.data, movement.expirationDate};
+        for (int col = 0; col < cells.size(); ++col) {
+            deliveredTable->setItem(firstRow + row, col, new QTableWidgetItem(cells[col]));
         }
-    } else {
-        QMessageBox::critical(this, "Erro", "Falha ao carregar EPIs entregues!");
+    }
+    if (!result.isEmpty()) {
+        deliveredLastSortKey = deliveredSortColumn == 5 ? result.last().data : result.last().expirationDate;
+        deliveredLastId = result.last().id;
+    }
+}
+
+void EPIApp::countDelivered() {
+    // The total is an aggregate over the whole filter: it runs on the thread
+    // pool with its own connection (and its own archive attachments), and is
+    // dropped if the filter changed in the meantime.
+    const int generation = deliveredGeneration;
+    const QString databaseFile = dbManager->databaseFile();
+    const DatabaseManager::OpenMode mode =
+        dbManager->isSnapshot() ? DatabaseManager::OpenMode::Snapshot : DatabaseManager::OpenMode::ReadOnly;
+    const QString archiveDir = archiveManager->directory();
+    const QString startDel = deliveredStartDate;
+    const QString filterSql = deliveredFilterSql;
+    const QVariantList params = deliveredFilterParams;
+
+    auto *watcher = new QFutureWatcher<qint64>(this);
+    connect(watcher, &QFutureWatcher<qint64>::finished, this, [this, watcher, generation] {
+        const qint64 total = watcher->result();
+        watcher->deleteLater();
+        if (generation != deliveredGeneration) return;
+        if (total >= 0) {
+            deliveredCountLabel->setText(QString("Total de registros: %1").arg(total));
+        } else {
+            deliveredCountLabel->clear();
+        }
+    });
+    watcher->setFuture(QtConcurrent::run([databaseFile, mode, archiveDir, startDel, filterSql, params, generation] {
+        EPI_TRACE_SCOPE("EPIApp::countDelivered");
+        DatabaseManager reader(databaseFile, QString("entregues-total-%1").arg(generation), mode);
+        ArchiveManager archives(&reader, archiveDir);
+        QVariantList result;
+        if (!reader.executeQuery("SELECT COUNT(*) FROM " + archives.movementsSource(startDel) + " m " + filterSql,
+                                 params, true, &result) || result.isEmpty()) {
+            return qint64(-1);
+        }
+        return result[0].toList()[0].toLongLong();
+    }));
+}
+
+void EPIApp::onDeliveredSortChanged(int column, Qt::SortOrder order) {
+    if (column < 0 || column >= int(std::size(kDeliveredSortKeys)) || !kDeliveredSortKeys[column]) {
+        QSignalBlocker blocker(deliveredTable->horizontalHeader());
+        deliveredTable->horizontalHeader()->setSortIndicator(deliveredSortColumn, deliveredSortOrder);
+        statusBar()->showMessage("Ordenação disponível apenas por data de entrega ou de vencimento", 5000);
+        return;
+    }
+    deliveredSortColumn = column;
+    deliveredSortOrder = order;
+    if (deliveredFilterSql.isEmpty()) return;
+
+    // Only the first page under the new ordering is fetched; the filter and
+    // its total are unchanged.
+    deliveredLastSortKey.clear();
+    deliveredLastId.clear();
+    deliveredHasMore = true;
+    deliveredTable->setRowCount(0);
+    fetchMoreDelivered();
+}
+
+void EPIApp::onDeliveredScrolled(int value) {
+    if (deliveredHasMore && value >= deliveredTable->verticalScrollBar()->maximum() - 10) {
+        fetchMoreDelivered();
     }
 }
 
 void EPIApp::generateLowStockReport() {
-    QVariantList items;
-    dbManager->executeQuery(
-        "SELECT i.nome, i.ca, i.tamanho, i.quantidade, i.estoque_minimo, c.nome "
-        "FROM itens i LEFT JOIN categorias c ON i.categoria_id = c.id "
-        "WHERE i.quantidade <= i.estoque_minimo", {}, true, &items);
+    EPI_TRACE_SCOPE("EPIApp::generateLowStockReport");
+    ColumnarResult items;
+    dbManager->fetchColumnar(kLowStockSql, {}, &items);
 
-    QString report = "<h2>Relatório de Estoque Baixo</h2>";
+    EPI_TRACE_SCOPE("EPIApp::generateLowStockReport/html");
+    QByteArray report = "<h2>Relatório de Estoque Baixo</h2>";
     report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
     report += "<tr><th>Nome</th><th>CA</th><th>Tamanho</th><th>Quantidade</th><th>Estoque Mínimo</th><th>Categoria</th></tr>";
-    for (const auto &item : items) {
-        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td><td>%5</td><td>%6</td></tr>")
-                     .arg(item[0].toString(), item[1].toString(), item[2].toString(),
-                          item[3].toString(), item[4].toString(), item[5].toString());
-    }
+    appendHtmlRows(report, items);
     report += "</table>";
-    reportDisplay->setHtml(report);
+    reportDisplay->setHtml(QString::fromUtf8(report));
     logAudit("generate_low_stock_report", "Gerou relatório de estoque baixo");
 }
 
 void EPIApp::generateInventoryReport() {
-    QVariantList items;
-    dbManager->executeQuery(
-        "SELECT i.nome, i.ca, i.tamanho, i.quantidade, i.estoque_minimo, i.preco, i.fornecedor, c.nome, i.data_adicao "
-        "FROM itens i LEFT JOIN categorias c ON i.categoria_id = c.id", {}, true, &items);
+    EPI_TRACE_SCOPE("EPIApp::generateInventoryReport");
+    ColumnarResult items;
+    dbManager->fetchColumnar(kInventorySql, {}, &items);
 
-    QString report = "<h2>Relatório Completo de EPIs</h2>";
+    EPI_TRACE_SCOPE("EPIApp::generateInventoryReport/html");
+    QByteArray report = "<h2>Relatório Completo de EPIs</h2>";
     report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
     report += "<tr><th>Nome</th><th>CA</th><th>Tamanho</th><th>Quantidade</th><th>Estoque Mínimo</th><th>Preço</th><th>Fornecedor</th><th>Categoria</th><th>Data de Adição</th></tr>";
-    for (const auto &item : items) {
-        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td><td>%5</td><td>%6</td><td>%7</td><td>%8</td><td>%9</td></tr>")
-                     .arg(item[0].toString(), item[1].toString(), item[2].toString(),
-                          item[3].toString(), item[4].toString(), item[5].toString(),
-                          item[7].toString(), item[8].toString());
-    }
+    appendHtmlRows(report, items);
     report += "</table>";
-    reportDisplay->setHtml(report);
+    reportDisplay->setHtml(QString::fromUtf8(report));
     logAudit("generate_inventory_report", "Gerou relatório completo de EPIs");
 }
 
 void EPIApp::generateCategoryReport() {
+    EPI_TRACE_SCOPE("EPIApp::generateCategoryReport");
     QVariantList categories;
     dbManager->executeQuery("SELECT id, nome FROM categorias", {}, true, &categories);
 
+    // Consumption per category over the report filters, from the cache.
+    QHash<int, FactTotals> consumption;
+    FactFilter filter = reportFilter();
+    filter.categoriaId = 0;
+    if (analyticsCache->refresh()) {
+        for (const auto &total : analyticsCache->aggregate(filter, AnalyticsCache::ByCategoria)) {
+            consumption.insert(total.key, total);
+        }
+    }
+
+    EPI_TRACE_SCOPE("EPIApp::generateCategoryReport/html");
     QString report = "<h2>Relatório por Categoria</h2>";
-    for (const auto &cat : categories) {
+    for (const auto &entry : categories) {
+        const QVariantList cat = entry.toList();
         int catId = cat[0].toInt();
         QString catName = cat[1].toString();
-        QVariantList items;
-        dbManager->executeQuery(
-            "SELECT nome, ca, tamanho, quantidade, estoque_minimo FROM itens WHERE categoria_id=?",
-            {catId}, true, &items);
+        QList<ItemRow> items;
+        dbManager->select("WHERE i.categoria_id=?", {catId}, &items);
+        const FactTotals used = consumption.value(catId);
         report += QString("<h3>%1</h3>").arg(catName);
+        report += QString("<p>No período: %1 retiradas, %2 unidades retiradas, %3 devolvidas</p>")
+                      .arg(used.withdrawals).arg(used.withdrawn).arg(used.returned);
         report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
         report += "<tr><th>Nome</th><th>CA</th><th>Tamanho</th><th>Quantidade</th><th>Estoque Mínimo</th></tr>";
         for (const auto &item : items) {
             report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td><td>%5</td></tr>")
-                         .arg(item[0].toString(), item[1].toString(), item[2].toString(),
-                              item[3].toString(), item[4].toString());
+                         .arg(item.nome, item.ca, item.tamanho, QString::number(item.quantidade),
+                              QString::number(item.estoqueMinimo));
         }
         report += "</table>";
     }
@@ -1359,55 +2369,335 @@ void EPIApp::generateCategoryReport() {
 }
 
 void EPIApp::showMostUsedGraph() {
+    EPI_TRACE_SCOPE("EPIApp::showMostUsedGraph");
+    if (!analyticsCache->refresh()) {
+        QMessageBox::critical(this, "Erro", "Falha ao atualizar o cache analítico!");
+        return;
+    }
+    const QVector<FactTotals> totals = analyticsCache->aggregate(reportFilter(), AnalyticsCache::ByItem);
+
+    // Sizes of the same EPI are counted together, by name.
+    QList<ItemRow> items;
+    dbManager->select("", {}, &items);
+    QHash<int, QString> names;
+    for (const auto &item : items) {
+        names.insert(item.id, item.nome);
+    }
+    QHash<QString, qint64> byName;
+    for (const auto &total : totals) {
+        if (total.withdrawals && names.contains(total.key)) {
+            byName[names.value(total.key)] += total.withdrawals;
+        }
+    }
+    QList<QPair<QString, qint64>> ranked;
+    for (auto it = byName.cbegin(); it != byName.cend(); ++it) {
+        ranked.append({it.key(), it.value()});
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const QPair<QString, qint64> &a, const QPair<QString, qint64> &b) {
+        return a.second > b.second;
+    });
+
+    EPI_TRACE_SCOPE("EPIApp::showMostUsedGraph/chart");
+    QStringList categories;
+    QList<qreal> values;
+    for (int i = 0; i < ranked.size() && i < 10; ++i) {
+        values << ranked[i].second;
+        categories << ranked[i].first;
+    }
+    updateBarChart(mostUsedSet, mostUsedAxisX, mostUsedAxisY, categories, values);
+    mostUsedChartView->show();
+    logAudit("show_most_used_graph", "Exibiu gráfico de EPIs mais usados");
+}
+
+void EPIApp::generateConsumptionReport() {
+    EPI_TRACE_SCOPE("EPIApp::generateConsumptionReport");
+    QElapsedTimer timer;
+    timer.start();
+    if (!analyticsCache->refresh()) {
+        QMessageBox::critical(this, "Erro", "Falha ao atualizar o cache analítico!");
+        return;
+    }
+    const qint64 refreshMs = timer.elapsed();
+    const FactFilter filter = reportFilter();
+    timer.restart();
+    QVector<FactTotals> totals = analyticsCache->aggregate(filter, AnalyticsCache::ByItem);
+    const double scanMs = timer.nsecsElapsed() / 1e6;
+    std::sort(totals.begin(), totals.end(), [](const FactTotals &a, const FactTotals &b) {
+        return a.withdrawn > b.withdrawn;
+    });
+
+    QList<ItemRow> items;
+    dbManager->select("", {}, &items);
+    QHash<int, ItemRow> byId;
+    for (const auto &item : items) {
+        byId.insert(item.id, item);
+    }
+
+    QString report = "<h2>Consumo Filtrado</h2>";
+    report += QString("<p>Período: %1 | Colaborador: %2 | Categoria: %3</p>")
+                  .arg(filter.start.isValid() ? QString("%1 a %2").arg(filter.start.toString("dd/MM/yyyy"),
+                                                                       filter.end.toString("dd/MM/yyyy"))
+                                              : QString("Todos os Períodos"),
+                       filter.colaboradorId ? collabFilter->currentText() : QString("Todos"),
+                       reportCategoryFilter->currentText());
+    report += QString("<p>%1 movimentações em cache (%2 MB), filtradas em %3 ms; atualização em %4 ms</p>")
+                  .arg(analyticsCache->rowCount())
+                  .arg(QString::number(analyticsCache->memoryUsage() / 1048576.0, 'f', 1))
+                  .arg(QString::number(scanMs, 'f', 2))
+                  .arg(refreshMs);
+    report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
+    report += "<tr><th>Nome</th><th>CA</th><th>Tamanho</th><th>Retiradas</th><th>Qtd. Retirada</th><th>Qtd. Devolvida</th><th>Saldo</th></tr>";
+    qint64 withdrawals = 0, withdrawn = 0, returned = 0;
+    for (const auto &total : totals) {
+        const ItemRow item = byId.value(total.key);
+        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td><td>%5</td><td>%6</td><td>%7</td></tr>")
+                      .arg(item.nome.isEmpty() ? QString("(excluído)") : item.nome.toHtmlEscaped(),
+                           item.ca.toHtmlEscaped(), item.tamanho.toHtmlEscaped(), QString::number(total.withdrawals),
+                           QString::number(total.withdrawn), QString::number(total.returned),
+                           QString::number(total.withdrawn - total.returned));
+        withdrawals += total.withdrawals;
+        withdrawn += total.withdrawn;
+        returned += total.returned;
+    }
+    report += QString("<tr><th colspan='3'>Total</th><th>%1</th><th>%2</th><th>%3</th><th>%4</th></tr>")
+                  .arg(withdrawals).arg(withdrawn).arg(returned).arg(withdrawn - returned);
+    report += "</table>";
+    reportDisplay->setHtml(report);
+    logAudit("generate_consumption_report", "Gerou relatório de consumo filtrado");
+}
+
+void EPIApp::updateExpirationPanel() {
+    EPI_TRACE_SCOPE("EPIApp::updateExpirationPanel");
+    expirationTracker->sync();
+
+    // The totals come from counts(); the table shows only the first lots
+    // of each set, the full lists are in the expiration report.
+    const int days = expirationDays->value();
+    int expiredCount = 0;
+    int expiringCount = 0;
+    expirationTracker->counts(days, &expiredCount, &expiringCount);
+    QVariantList expired, expiring;
+    expirationTracker->expired(&expired, kExpirationPanelRows);
+    expirationTracker->expiringWithin(days, &expiring, kExpirationPanelRows);
+    QString summary = QString("Vencidos: %1 | Vencendo em %2 dias: %3").arg(expiredCount).arg(days).arg(expiringCount);
+    if (expired.size() < expiredCount || expiring.size() < expiringCount) {
+        summary += QString(" (exibindo até %1 de cada)").arg(kExpirationPanelRows);
+    }
+    expirationSummary->setText(summary);
+
+    expirationTable->setRowCount(expired.size() + expiring.size());
+    int row = 0;
+    auto fill = [this, &row](const QVariantList &rows, const QString &status, const QColor &color) {
+        for (const auto &entry : rows) {
+            const QVariantList item = entry.toList();
+            expirationTable->setItem(row, 0, new QTableWidgetItem(status));
+            expirationTable->item(row, 0)->setBackground(color);
+            for (int col = 0; col < item.size(); ++col) {
+                expirationTable->setItem(row, col + 1, new QTableWidgetItem(item[col].toString()));
+            }
+            ++row;
+        }
+    };
+    fill(expired, "Vencido", QColor(255, 200, 200));
+    fill(expiring, "A vencer", QColor(255, 240, 200));
+}
+
+void EPIApp::generateExpirationReport() {
+    EPI_TRACE_SCOPE("EPIApp::generateExpirationReport");
+    if (!expirationTracker->sync()) {
+        QMessageBox::critical(this, "Erro", "Falha ao atualizar os vencimentos!");
+        return;
+    }
+
+    const int days = expirationDays->value();
+    QVariantList expired, expiring;
+    expirationTracker->expired(&expired);
+    expirationTracker->expiringWithin(days, &expiring);
+
+    QString report = "<h2>Relatório de Vencimentos</h2>";
+    const QList<QPair<QString, const QVariantList *>> sections = {
+        {"EPIs Vencidos", &expired},
+        {QString("EPIs Vencendo em %1 Dias").arg(days), &expiring}
+    };
+    for (const auto &section : sections) {
+        report += QString("<h3>%1 (%2)</h3>").arg(section.first).arg(section.second->size());
+        report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
+        report += "<tr><th>Colaborador</th><th>Nome EPI</th><th>CA</th><th>Tamanho</th><th>Quantidade</th><th>Data Entrega</th><th>Data Vencimento</th></tr>";
+        for (const auto &entry : *section.second) {
+            const QVariantList item = entry.toList();
+            report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td><td>%5</td><td>%6</td><td>%7</td></tr>")
+                         .arg(item[0].toString(), item[1].toString(), item[2].toString(), item[3].toString(),
+                              item[4].toString(), item[5].toString(), item[6].toString());
+        }
+        report += "</table>";
+    }
+    reportDisplay->setHtml(report);
+    logAudit("generate_expiration_report", "Gerou relatório de vencimentos");
+}
+
+void EPIApp::generateForecastReport() {
+    EPI_TRACE_SCOPE("EPIApp::generateForecastReport");
+    ForecastParams params;
+    if (!demandForecaster->refresh(params)) {
+        QMessageBox::critical(this, "Erro", "Falha ao calcular a previsão de demanda!");
+        return;
+    }
+
+    QList<ItemForecast> reorder;
+    for (const auto &forecast : demandForecaster->forecasts()) {
+        if (forecast.suggestedOrder > 0) {
+            reorder.append(forecast);
+        }
+    }
+    std::sort(reorder.begin(), reorder.end(), [](const ItemForecast &a, const ItemForecast &b) {
+        // Least days of cover first.
+        return a.quantidade / std::max(a.dailyRate, 1e-9) < b.quantidade / std::max(b.dailyRate, 1e-9);
+    });
+
+    QString report = "<h2>Previsão de Reposição</h2>";
+    report += QString("<p>Histórico: %1 dias | Prazo de entrega: %2 dias | Período de revisão: %3 dias | Nível de serviço (z): %4</p>")
+                  .arg(params.historyDays).arg(params.leadTimeDays).arg(params.reviewDays).arg(params.serviceZ);
+    report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
+    report += "<tr><th>Nome</th><th>CA</th><th>Tamanho</th><th>Quantidade</th><th>Estoque Mínimo</th><th>Consumo/Dia</th><th>Ponto de Pedido</th><th>Sugestão de Compra</th></tr>";
+    for (const auto &forecast : reorder) {
+        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td><td>%5</td><td>%6</td><td>%7</td><td>%8</td></tr>")
+                     .arg(forecast.nome, forecast.ca, forecast.tamanho, QString::number(forecast.quantidade),
+                          QString::number(forecast.estoqueMinimo), QString::number(forecast.dailyRate, 'f', 2),
+                          QString::number(std::ceil(forecast.reorderPoint)), QString::number(forecast.suggestedOrder));
+    }
+    report += "</table>";
+    reportDisplay->setHtml(report);
+    logAudit("generate_forecast_report", "Gerou previsão de reposição");
+}
+
+void EPIApp::generateInventoryAtDate() {
+    EPI_TRACE_SCOPE("EPIApp::generateInventoryAtDate");
+    bool ok;
+    const QString text = QInputDialog::getText(this, "Estoque em Data", "Data e hora (AAAA-MM-DD HH:MM):", QLineEdit::Normal,
+                                               QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm"), &ok).trimmed();
+    if (!ok || text.isEmpty()) return;
+    QDateTime moment = QDateTime::fromString(text, "yyyy-MM-dd hh:mm");
+    if (!moment.isValid()) {
+        // A bare date means the end of that day.
+        const QDate day = QDate::fromString(text, "yyyy-MM-dd");
+        moment = day.isValid() ? QDateTime(day, QTime(23, 59, 59)) : QDateTime();
+    }
+    if (!moment.isValid()) {
+        QMessageBox::warning(this, "Erro", "Data inválida! Use AAAA-MM-DD ou AAAA-MM-DD HH:MM.");
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QList<InventoryRow> rows;
+    QString basis, error;
+    if (!stockLedger->inventoryAt(moment, &rows, &basis, &error)) {
+        QMessageBox::warning(this, "Erro", error);
+        return;
+    }
+    qint64 total = 0;
+    QString report = QString("<h2>Estoque em %1</h2>").arg(moment.toString("dd/MM/yyyy hh:mm"));
+    report += QString("<p>Base: instantâneo de %1 mais movimentações seguintes (%2 ms)</p>").arg(basis).arg(timer.elapsed());
+    report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
+    report += "<tr><th>Nome</th><th>CA</th><th>Tamanho</th><th>Quantidade</th></tr>";
+    for (const auto &row : rows) {
+        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td></tr>")
+                      .arg(row.nome.toHtmlEscaped(), row.ca.toHtmlEscaped(), row.tamanho.toHtmlEscaped(),
+                           QString::number(row.quantidade));
+        total += row.quantidade;
+    }
+    report += QString("<tr><th colspan='3'>Total</th><th>%1</th></tr>").arg(total);
+    report += "</table>";
+    reportDisplay->setHtml(report);
+    logAudit("generate_inventory_at_date", QString("Gerou estoque em %1").arg(moment.toString("yyyy-MM-dd hh:mm")));
+}
+
+void EPIApp::generateAbcXyzReport() {
+    EPI_TRACE_SCOPE("EPIApp::generateAbcXyzReport");
+    QString startDate, endDate;
     QString dateRange = getDateRange();
-    QStringList conditions;
-    QVariantList params;
     if (!dateRange.isEmpty()) {
         QStringList dates = dateRange.split(" AND ");
-        conditions << "m.data >= ?" << "m.data <= ?";
-        params << dates[0] << dates[1];
+        startDate = dates[0];
+        endDate = dates[1];
     }
-    int colabId = collabFilter->currentData().toInt();
-    if (colabId != 0) {
-        conditions << "m.colaborador_id = ?";
-        params << colabId;
+
+    QList<AbcXyzRow> rows;
+    if (!abcXyzClassifier->classify(startDate, endDate, &rows)) {
+        QMessageBox::critical(this, "Erro", "Falha ao calcular a classificação ABC/XYZ!");
+        return;
     }
-    QString query = "SELECT i.nome, COUNT(*) as count "
-                    "FROM movimentacoes m JOIN itens i ON m.item_id = i.id "
-                    "WHERE m.alteracao_quantidade < 0";
-    if (!conditions.isEmpty()) {
-        query += " AND " + conditions.join(" AND ");
+
+    const QString classes[] = {"A", "B", "C"};
+    const QString variability[] = {"X", "Y", "Z"};
+    QHash<QString, QPair<int, double>> matrix;
+    double totalValue = 0;
+    for (const auto &row : rows) {
+        auto &cell = matrix[QString(row.abc) + row.xyz];
+        cell.first++;
+        cell.second += row.value;
+        totalValue += row.value;
     }
-    query += " GROUP BY i.nome ORDER BY count DESC LIMIT 10";
 
-    QVariantList result;
-    dbManager->executeQuery(query, params, true, &result);
+    QString report = "<h2>Classificação ABC/XYZ</h2>";
+    report += QString("<p>Período: %1 | Valor total consumido: R$ %2</p>")
+                  .arg(dateRange.isEmpty() ? "Todos os Períodos" : QString("%1 a %2").arg(startDate, endDate),
+                       QString::number(totalValue, 'f', 2));
+    report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
+    report += "<tr><th></th><th>X (demanda estável)</th><th>Y (demanda variável)</th><th>Z (demanda irregular)</th></tr>";
+    for (const auto &abc : classes) {
+        report += QString("<tr><th>%1</th>").arg(abc);
+        for (const auto &xyz : variability) {
+            const auto cell = matrix.value(abc + xyz);
+            report += QString("<td>%1 itens<br>R$ %2</td>").arg(cell.first).arg(QString::number(cell.second, 'f', 2));
+        }
+        report += "</tr>";
+    }
+    report += "</table>";
 
-    QtCharts::QBarSeries *series = new QtCharts::QBarSeries;
-    QtCharts::QBarSet *set = new QtCharts::QBarSet("Retiradas");
-    QStringList categories;
-    for (const auto &row : result) {
-        set->append(row[1].toInt());
-        categories << row[0].toString();
+    report += "<h3>Itens</h3>";
+    report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
+    report += "<tr><th>Classe</th><th>Nome</th><th>CA</th><th>Tamanho</th><th>Quantidade Consumida</th><th>Preço</th><th>Valor Consumido</th><th>% Acumulado</th><th>Coef. Variação</th></tr>";
+    for (const auto &row : rows) {
+        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td><td>%5</td><td>%6</td><td>%7</td><td>%8</td><td>%9</td></tr>")
+                     .arg(QString(row.abc) + row.xyz, row.nome, row.ca, row.tamanho, QString::number(row.quantity),
+                          QString::number(row.preco, 'f', 2), QString::number(row.value, 'f', 2),
+                          QString::number(row.cumulativeShare * 100, 'f', 1), QString::number(row.variation, 'f', 2));
     }
-    series->append(set);
+    report += "</table>";
+    reportDisplay->setHtml(report);
+    logAudit("generate_abc_xyz_report", "Gerou classificação ABC/XYZ");
+}
 
-    QtCharts::QChart *chart = new QtCharts::QChart;
-    chart->addSeries(series);
-    chart->setTitle("EPIs Mais Retirados");
-    QtCharts::QValueAxis *axisY = new QtCharts::QValueAxis;
-    axisY->setTitleText("Número de Retiradas");
-    chart->addAxis(axisY, Qt::AlignLeft);
-    series->attachAxis(axisY);
-    QtCharts::QBarCategoryAxis *axisX = new QtCharts::QBarCategoryAxis;
-    axisX->append(categories);
-    chart->addAxis(axisX, Qt::AlignBottom);
-    series->attachAxis(axisX);
-    chartView->setChart(chart);
-    logAudit("show_most_used_graph", "Exibiu gráfico de EPIs mais usados");
+void EPIApp::exportReport() {
+    if (reportDisplay->document()->isEmpty()) {
+        QMessageBox::warning(this, "Erro", "Gere um relatório antes de exportar!");
+        return;
+    }
+
+    QString fileName = QFileDialog::getSaveFileName(this, "Exportar Relatório", "", "PDF Files (*.pdf);;HTML Files (*.html)");
+    if (fileName.isEmpty()) return;
+
+    if (fileName.endsWith(".html", Qt::CaseInsensitive)) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            QMessageBox::critical(this, "Erro", "Não foi possível abrir o arquivo para escrita!");
+            return;
+        }
+        QTextStream out(&file);
+        out << reportDisplay->toHtml();
+        file.close();
+    } else {
+        QPdfWriter writer(fileName);
+        writer.setPageSize(QPageSize::A4);
+        reportDisplay->document()->print(&writer);
+    }
+    logAudit("export_report", QString("Exportou relatório: %1").arg(fileName));
+    QMessageBox::information(this, "Sucesso", "Relatório exportado com sucesso!");
 }
 
 void EPIApp::exportToCsv() {
+    EPI_TRACE_SCOPE("EPIApp::exportToCsv");
     QString fileName = QFileDialog::getSaveFileName(this, "Exportar para CSV", "", "CSV Files (*.csv)");
     if (fileName.isEmpty()) return;
 
@@ -1417,24 +2707,25 @@ void EPIApp::exportToCsv() {
         return;
     }
 
-    QTextStream out(&file);
-    out << "Nome,CA,Tamanho,Quantidade,Estoque Mínimo,Preço,Fornecedor,Categoria,Data de Adição\n";
-    QVariantList items;
-    dbManager->executeQuery(
-        "SELECT i.nome, i.ca, i.tamanho, i.quantidade, i.estoque_minimo, i.preco, i.fornecedor, c.nome, i.data_adicao "
-        "FROM itens i LEFT JOIN categorias c ON i.categoria_id = c.id", {}, true, &items);
-    for (const auto &item : items) {
-        out << QString("\"%1\",\"%2\",\"%3\",%4,%5,%6,\"%7\",\"%8\",\"%9\"\n")
-               .arg(item[0].toString(), item[1].toString(), item[2].toString(),
-                    item[3].toString(), item[4].toString(), item[5].toString(),
-                    item[6].toString(), item[7].toString(), item[8].toString());
+    ColumnarResult items;
+    dbManager->fetchColumnar(kInventorySql, {}, &items);
+    QByteArray out = "Nome,CA,Tamanho,Quantidade,Estoque Mínimo,Preço,Fornecedor,Categoria,Data de Adição\n";
+    out.reserve(kExportFlushBytes + 1024);
+    for (int row = 0; row < items.rowCount(); ++row) {
+        appendCsvRow(out, items, row);
+        if (out.size() >= kExportFlushBytes) {
+            file.write(out);
+            out.resize(0);
+        }
     }
+    file.write(out);
     file.close();
     logAudit("export_csv", QString("Exportou dados para CSV: %1").arg(fileName));
     QMessageBox::information(this, "Sucesso", "Dados exportados para CSV com sucesso!");
 }
 
 void EPIApp::exportToPdf() {
+    EPI_TRACE_SCOPE("EPIApp::exportToPdf");
     QString fileName = QFileDialog::getSaveFileName(this, "Exportar para PDF", "", "PDF Files (*.pdf)");
     if (fileName.isEmpty()) return;
 
@@ -1443,12 +2734,10 @@ void EPIApp::exportToPdf() {
     QPainter painter(&writer);
     painter.setRenderHint(QPainter::Antialiasing);
 
-    QVariantList items;
-    dbManager->executeQuery(
-        "SELECT i.nome, i.ca, i.tamanho, i.quantidade, i.estoque_minimo, c.nome "
-        "FROM itens i LEFT JOIN categorias c ON i.categoria_id = c.id "
-        "WHERE i.quantidade <= i.estoque_minimo", {}, true, &items);
+    ColumnarResult items;
+    dbManager->fetchColumnar(kLowStockSql, {}, &items);
 
+    EPI_TRACE_SCOPE("EPIApp::exportToPdf/render");
     painter.setFont(QFont("Segoe UI", 14, QFont::Bold));
     painter.drawText(100, 100, "Relatório de Estoque Baixo");
     painter.setFont(QFont("Segoe UI", 10));
@@ -1463,17 +2752,15 @@ void EPIApp::exportToPdf() {
     painter.drawLine(100, y, 1100, y);
     y += 20;
 
-    for (const auto &item : items) {
+    const int columnX[] = {100, 300, 500, 700, 900, 1100};
+    for (int row = 0; row < items.rowCount(); ++row) {
         if (y > 7500) {
             writer.newPage();
             y = 100;
         }
-        painter.drawText(100, y, item[0].toString());
-        painter.drawText(300, y, item[1].toString());
-        painter.drawText(500, y, item[2].toString());
-        painter.drawText(700, y, item[3].toString());
-        painter.drawText(900, y, item[4].toString());
-        painter.drawText(1100, y, item[5].toString());
+        for (int col = 0; col < items.columnCount(); ++col) {
+            painter.drawText(columnX[col], y, items.string(row, col));
+        }
         y += 30;
     }
 
@@ -1482,14 +2769,330 @@ void EPIApp::exportToPdf() {
     QMessageBox::information(this, "Sucesso", "Relatório exportado para PDF com sucesso!");
 }
 
+void EPIApp::generateCompanyCostReport() {
+    EPI_TRACE_SCOPE("EPIApp::generateCompanyCostReport");
+    QString startDate, endDate;
+    QString dateRange = getDateRange();
+    if (!dateRange.isEmpty()) {
+        QStringList dates = dateRange.split(" AND ");
+        startDate = dates[0];
+        endDate = dates[1];
+    }
+
+    QList<CostRow> companies;
+    if (!companyCostReport->companies(startDate, endDate, &companies)) {
+        QMessageBox::critical(this, "Erro", "Falha ao calcular os custos por empresa!");
+        return;
+    }
+
+    double totalValue = 0;
+    qint64 totalQuantity = 0;
+    QString report = "<h2>Custos de EPI por Empresa</h2>";
+    report += QString("<p>Período: %1</p>")
+                  .arg(dateRange.isEmpty() ? "Todos os Períodos" : QString("%1 a %2").arg(startDate, endDate));
+    report += "<table border='1' style='border-collapse: collapse; width: 100%;'>";
+    report += "<tr><th>Empresa</th><th>CNPJ</th><th>Quantidade</th><th>Valor (R$)</th></tr>";
+    for (const auto &row : companies) {
+        report += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td></tr>")
+                      .arg(row.nome, row.detalhe, QString::number(row.quantidade), QString::number(row.valor, 'f', 2));
+        totalQuantity += row.quantidade;
+        totalValue += row.valor;
+    }
+    report += QString("<tr><th>Total</th><th></th><th>%1</th><th>%2</th></tr>")
+                  .arg(totalQuantity).arg(QString::number(totalValue, 'f', 2));
+    report += "</table>";
+    reportDisplay->setHtml(report);
+    mostUsedChartView->hide();
+    logAudit("generate_company_cost_report", "Gerou relatório de custos por empresa");
+
+    // Drill-down: company -> category -> item -> collaborator, loaded on expand.
+    enum Level { CompanyLevel, CategoryLevel, ItemLevel, CollaboratorLevel };
+    QDialog dialog(this);
+    dialog.setWindowTitle("Detalhamento de Custos por Empresa");
+    dialog.resize(900, 600);
+    QVBoxLayout *layout = new QVBoxLayout(&dialog);
+    QTreeWidget *tree = new QTreeWidget;
+    tree->setHeaderLabels({"Empresa / Categoria / EPI / Colaborador", "Detalhe", "Quantidade", "Valor (R$)"});
+    tree->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+    layout->addWidget(tree);
+
+    auto addRows = [](QTreeWidgetItem *parent, QTreeWidget *owner, const QList<CostRow> &rows, int level,
+                      const QList<int> &path) {
+        for (const auto &row : rows) {
+            QTreeWidgetItem *node = parent ? new QTreeWidgetItem(parent) : new QTreeWidgetItem(owner);
+            node->setText(0, row.nome);
+            node->setText(1, row.detalhe);
+            node->setText(2, QString::number(row.quantidade));
+            node->setText(3, QString::number(row.valor, 'f', 2));
+            node->setTextAlignment(2, Qt::AlignRight);
+            node->setTextAlignment(3, Qt::AlignRight);
+            node->setData(0, Qt::UserRole, level);
+            node->setData(0, Qt::UserRole + 1, QVariant::fromValue(path + QList<int>{row.id}));
+            if (level != CollaboratorLevel) {
+                node->setChildIndicatorPolicy(QTreeWidgetItem::ShowIndicator);
+            }
+        }
+    };
+    addRows(nullptr, tree, companies, CompanyLevel, {});
+
+    connect(tree, &QTreeWidget::itemExpanded, &dialog, [this, addRows, startDate, endDate](QTreeWidgetItem *node) {
+        if (node->childCount() > 0) return;
+        const int level = node->data(0, Qt::UserRole).toInt();
+        const QList<int> path = node->data(0, Qt::UserRole + 1).value<QList<int>>();
+        QList<CostRow> rows;
+        bool ok = false;
+        if (level == CompanyLevel) {
+            ok = companyCostReport->categories(path[0], startDate, endDate, &rows);
+        } else if (level == CategoryLevel) {
+            ok = companyCostReport->items(path[0], path[1], startDate, endDate, &rows);
+        } else if (level == ItemLevel) {
+            ok = companyCostReport->collaborators(path[0], path[2], startDate, endDate, &rows);
+        }
+        if (!ok) {
+            QMessageBox::critical(this, "Erro", "Falha ao carregar o detalhamento!");
+            return;
+        }
+        addRows(node, nullptr, rows, level + 1, path);
+        if (rows.isEmpty()) {
+            node->setChildIndicatorPolicy(QTreeWidgetItem::DontShowIndicator);
+        }
+    });
+
+    QHBoxLayout *btnLayout = new QHBoxLayout;
+    QPushButton *exportBtn = new QPushButton("Exportar CSV");
+    exportBtn->setToolTip("Exportar empresa, categoria e EPI com quantidades e valores");
+    QPushButton *closeBtn = new QPushButton("Fechar");
+    btnLayout->addWidget(exportBtn);
+    btnLayout->addStretch();
+    btnLayout->addWidget(closeBtn);
+    layout->addLayout(btnLayout);
+    connect(exportBtn, &QPushButton::clicked, &dialog, [this, &dialog, startDate, endDate] {
+        QString fileName = QFileDialog::getSaveFileName(&dialog, "Exportar Custos por Empresa", "", "CSV Files (*.csv)");
+        if (fileName.isEmpty()) return;
+        if (companyCostReport->exportCsv(fileName, startDate, endDate)) {
+            logAudit("export_company_costs", QString("Exportou custos por empresa: %1").arg(fileName));
+            QMessageBox::information(&dialog, "Sucesso", "Custos exportados para CSV com sucesso!");
+        } else {
+            QMessageBox::critical(&dialog, "Erro", "Não foi possível exportar os custos!");
+        }
+    });
+    connect(closeBtn, &QPushButton::clicked, &dialog, &QDialog::accept);
+    dialog.exec();
+}
+
+void EPIApp::generateReportPack() {
+    QStringList months;
+    const QDate current = QDate::currentDate();
+    for (int i = 0; i < 12; ++i) {
+        months << current.addMonths(-i).toString("MM/yyyy");
+    }
+    bool ok;
+    const QString choice = QInputDialog::getItem(this, "Pacote Mensal", "Mês de referência:", months, 1, false, &ok);
+    if (!ok) return;
+
+    ReportPackOptions options;
+    options.databaseFile = QFileInfo(dbManager->databaseFile()).absoluteFilePath();
+    options.outputDir = QFileInfo(options.databaseFile).absoluteDir().filePath("relatorios");
+    options.archiveDir = archiveManager->directory();
+    options.month = QDate::fromString("01/" + choice, "dd/MM/yyyy");
+    statusBar()->showMessage("Gerando pacote de relatórios...");
+
+    auto *watcher = new QFutureWatcher<ReportPackResult>(this);
+    connect(watcher, &QFutureWatcher<ReportPackResult>::finished, this, [this, watcher, choice] {
+        const ReportPackResult result = watcher->result();
+        watcher->deleteLater();
+        statusBar()->clearMessage();
+        if (result.ok) {
+            logAudit("generate_report_pack", QString("Gerou pacote de relatórios de %1 (%2 arquivos, %3 ms)")
+                                                 .arg(choice).arg(result.files.size()).arg(result.elapsedMs));
+            QMessageBox::information(this, "Sucesso", QString("Pacote de %1 gerado em %2 ms:\n%3")
+                                                          .arg(choice).arg(result.elapsedMs).arg(result.files.join("\n")));
+        } else {
+            handleError("generate_report_pack", result.errors.join("; "),
+                        QString("Falha ao gerar o pacote de relatórios:\n%1").arg(result.errors.join("\n")));
+        }
+    });
+    watcher->setFuture(QtConcurrent::run([options] {
+        ReportPackRunner runner(options);
+        return runner.run();
+    }));
+}
+
+void EPIApp::createBackup() {
+    if (!checkWritable("criar backups")) return;
+    if (currentUserLevel != 2 && currentUserLevel != 3) {
+        QMessageBox::warning(this, "Erro", "Apenas almoxarifes ou administradores podem criar backups!");
+        return;
+    }
+
+    const QString databaseFile = QFileInfo(dbManager->databaseFile()).absoluteFilePath();
+    const QString backupDir = QFileInfo(databaseFile).absoluteDir().filePath("backups");
+    statusBar()->showMessage("Criando backup...");
+
+    // The copy runs on the thread pool with its own connection; progress is
+    // posted back to the status bar.
+    auto *watcher = new QFutureWatcher<BackupResult>(this);
+    connect(watcher, &QFutureWatcher<BackupResult>::finished, this, [this, watcher] {
+        const BackupResult result = watcher->result();
+        watcher->deleteLater();
+        if (result.ok) {
+            logAudit("create_backup", QString("Criou backup: %1 (%2 páginas, %3 ms)").arg(result.path).arg(result.pages).arg(result.elapsedMs));
+            statusBar()->showMessage(QString("Backup criado: %1").arg(result.path), 10000);
+            QMessageBox::information(this, "Sucesso", QString("Backup criado e verificado com sucesso!\n%1").arg(result.path));
+        } else {
+            statusBar()->clearMessage();
+            handleError("create_backup", result.error, QString("Falha ao criar backup: %1").arg(result.error));
+        }
+    });
+    watcher->setFuture(QtConcurrent::run([this, databaseFile, backupDir] {
+        BackupManager manager(databaseFile, backupDir);
+        return manager.createSnapshot([this](int remaining, int total) {
+            QMetaObject::invokeMethod(this, [this, remaining, total] {
+                if (total > 0) {
+                    statusBar()->showMessage(QString("Criando backup... %1%").arg(100 * (total - remaining) / total));
+                }
+            }, Qt::QueuedConnection);
+        });
+    }));
+}
+
+void EPIApp::archiveOldData() {
+    if (!checkWritable("arquivar dados")) return;
+    if (!checkAdmin("arquivar dados")) return;
+    if (archivingData) return;
+
+    bool ok;
+    const int currentYear = QDate::currentDate().year();
+    const int beforeYear = QInputDialog::getInt(this, "Arquivar Dados",
+                                                "Arquivar movimentações e auditoria anteriores ao ano:",
+                                                currentYear - 2, 2000, currentYear, 1, &ok);
+    if (!ok) return;
+    if (!confirmAction(QString("Mover os dados anteriores a %1 para os arquivos anuais?").arg(beforeYear))) {
+        return;
+    }
+
+    const QString databaseFile = QFileInfo(dbManager->databaseFile()).absoluteFilePath();
+    const QString archiveDir = archiveManager->directory();
+    archivingData = true;
+    statusBar()->showMessage("Arquivando dados...");
+
+    // The move runs on the thread pool with its own connection; progress is
+    // posted back to the status bar.
+    auto *watcher = new QFutureWatcher<QPair<bool, QString>>(this);
+    connect(watcher, &QFutureWatcher<QPair<bool, QString>>::finished, this, [this, watcher, beforeYear] {
+        const QPair<bool, QString> result = watcher->result();
+        watcher->deleteLater();
+        archivingData = false;
+        statusBar()->clearMessage();
+        if (result.first) {
+            logAudit("archive_data", QString("Arquivou dados anteriores a %1").arg(beforeYear));
+            QMessageBox::information(this, "Sucesso", QString("Dados anteriores a %1 arquivados com sucesso!").arg(beforeYear));
+        } else {
+            handleError("archive_data", result.second, QString("Falha ao arquivar dados: %1").arg(result.second));
+        }
+    });
+    watcher->setFuture(QtConcurrent::run([this, databaseFile, archiveDir, beforeYear] {
+        DatabaseManager writer(databaseFile, "arquivamento");
+        ArchiveManager archives(&writer, archiveDir);
+        QString error;
+        const bool ok = archives.archiveBefore(beforeYear, &error, [this](int year, qint64 moved) {
+            QMetaObject::invokeMethod(this, [this, year, moved] {
+                statusBar()->showMessage(QString("Arquivando %1... %2 registros movidos").arg(year).arg(moved));
+            }, Qt::QueuedConnection);
+        });
+        return qMakePair(ok, error);
+    }));
+}
+
+void EPIApp::showDiagnostics() {
+    if (!checkAdmin("visualizar o diagnóstico")) return;
+
+    QDialog dialog(this);
+    dialog.setWindowTitle("Diagnóstico de Consultas");
+    dialog.resize(1000, 600);
+    QVBoxLayout *layout = new QVBoxLayout(&dialog);
+
+    QHBoxLayout *thresholdLayout = new QHBoxLayout;
+    QSpinBox *threshold = new QSpinBox;
+    threshold->setRange(0, 60000);
+    threshold->setSuffix(" ms");
+    threshold->setValue(dbManager->slowQueryThreshold());
+    thresholdLayout->addWidget(new QLabel("Limite de consulta lenta:"));
+    thresholdLayout->addWidget(threshold);
+    thresholdLayout->addStretch();
+
+    QTextEdit *display = new QTextEdit;
+    display->setReadOnly(true);
+    display->setHtml(dbManager->queryStatsReport());
+
+    QHBoxLayout *btnLayout = new QHBoxLayout;
+    QPushButton *refreshBtn = new QPushButton("Atualizar");
+    QPushButton *saveBtn = new QPushButton("Salvar em Arquivo");
+    QPushButton *resetBtn = new QPushButton("Zerar Estatísticas");
+    resetBtn->setProperty("delete", true);
+    QPushButton *closeBtn = new QPushButton("Fechar");
+    btnLayout->addWidget(refreshBtn);
+    btnLayout->addWidget(saveBtn);
+    btnLayout->addWidget(resetBtn);
+#ifdef EPI_TRACING_ENABLED
+    QPushButton *traceBtn = new QPushButton("Exportar Trace");
+    traceBtn->setToolTip("Exportar os intervalos medidos no formato Chrome/Perfetto (JSON)");
+    btnLayout->addWidget(traceBtn);
+    connect(traceBtn, &QPushButton::clicked, &dialog, [this, &dialog] {
+        QString fileName = QFileDialog::getSaveFileName(&dialog, "Exportar Trace", "", "Trace JSON (*.json)");
+        if (fileName.isEmpty()) return;
+        if (Tracing::Recorder::instance().exportChromeTrace(fileName)) {
+            logAudit("export_trace", QString("Exportou trace de desempenho: %1").arg(fileName));
+            QMessageBox::information(&dialog, "Sucesso", "Trace exportado com sucesso!");
+        } else {
+            QMessageBox::critical(&dialog, "Erro", "Não foi possível exportar o trace!");
+        }
+    });
+#endif
+    btnLayout->addStretch();
+    btnLayout->addWidget(closeBtn);
+
+    connect(threshold, QOverload<int>::of(&QSpinBox::valueChanged), &dialog, [this](int ms) {
+        dbManager->setSlowQueryThreshold(ms);
+    });
+    connect(refreshBtn, &QPushButton::clicked, &dialog, [this, display] {
+        display->setHtml(dbManager->queryStatsReport());
+    });
+    connect(saveBtn, &QPushButton::clicked, &dialog, [this, &dialog] {
+        QString fileName = QFileDialog::getSaveFileName(&dialog, "Salvar Estatísticas", "", "CSV Files (*.csv)");
+        if (fileName.isEmpty()) return;
+        if (dbManager->dumpQueryStats(fileName)) {
+            logAudit("dump_query_stats", QString("Salvou estatísticas de consultas: %1").arg(fileName));
+            QMessageBox::information(&dialog, "Sucesso", "Estatísticas salvas com sucesso!");
+        } else {
+            QMessageBox::critical(&dialog, "Erro", "Não foi possível salvar as estatísticas!");
+        }
+    });
+    connect(resetBtn, &QPushButton::clicked, &dialog, [this, display] {
+        dbManager->resetQueryStats();
+        display->setHtml(dbManager->queryStatsReport());
+    });
+    connect(closeBtn, &QPushButton::clicked, &dialog, &QDialog::accept);
+
+    layout->addLayout(thresholdLayout);
+    layout->addWidget(display);
+    layout->addLayout(btnLayout);
+    dialog.exec();
+}
+
 void EPIApp::logout() {
     if (QMessageBox::question(this, "Sair", "Deseja realmente sair do sistema?") == QMessageBox::Yes) {
         logAudit("logout", "Usuário realizou logout");
+        if (!readOnlyMode) {
+            stockService->release(reservationOwner);
+        }
+        credentialService->forget();
         close();
     }
 }
 
 void EPIApp::refreshAllData() {
+    EPI_TRACE_SCOPE("EPIApp::refreshAllData");
     loadUsers();
     loadItems();
     loadCategories();
@@ -1499,39 +3102,35 @@ void EPIApp::refreshAllData() {
     loadEmpresas();
     loadEmpresasList();
     updateCompleters();
+    loadOpenOrders();
+    updateExpirationPanel();
     logAudit("refresh_data", "Atualizou todos os dados");
 }
 
 void EPIApp::loadUsers() {
     if (!checkAdmin("carregar usuários")) return;
 
-    QVariantList users;
-    dbManager->executeQuery(
-        "SELECT u.id, u.nome_completo, u.matricula, u.cpf, u.level, e.nome "
-        "FROM usuarios u LEFT JOIN empresas e ON u.empresa_id = e.id", {}, true, &users);
+    QList<UserRow> users;
+    dbManager->select("", {}, &users);
     usersTable->setRowCount(users.size());
     for (int row = 0; row < users.size(); ++row) {
-        const auto &user = users[row];
-        for (int col = 0; col < user.size(); ++col) {
-            usersTable->setItem(row, col, new QTableWidgetItem(user[col].toString()));
+        const UserRow &user = users[row];
+        const QStringList cells = {QString::number(user.id), user.nomeCompleto, user.matricula, user.cpf,
+                                   QString::number(user.level), user.empresa};
+        for (int col = 0; col < cells.size(); ++col) {
+            usersTable->setItem(row, col, new QTableWidgetItem(cells[col]));
         }
     }
 }
 
 void EPIApp::loadItems() {
-    QVariantList items;
-    dbManager->executeQuery(
-        "SELECT i.id, i.nome, i.ca, i.tamanho, i.marca, c.nome, i.quantidade, i.preco, i.estoque_minimo, i.fornecedor, i.data_adicao "
-        "FROM itens i LEFT JOIN categorias c ON i.categoria_id = c.id", {}, true, &items);
+    EPI_TRACE_SCOPE("EPIApp::loadItems");
+    QList<ItemRow> items;
+    dbManager->select("", {}, &items);
+    EPI_TRACE_SCOPE("EPIApp::loadItems/populate");
     itemsTable->setRowCount(items.size());
     for (int row = 0; row < items.size(); ++row) {
-        const auto &item = items[row];
-        for (int col = 0; col < item.size(); ++col) {
-            itemsTable->setItem(row, col, new QTableWidgetItem(item[col].toString()));
-            if (col == 6 && item[6].toInt() <= item[8].toInt()) {
-                itemsTable->item(row, col)->setBackground(QColor(255, 200, 200));
-            }
-        }
+        fillItemRow(itemsTable, row, items[row]);
     }
 }
 
@@ -1545,44 +3144,49 @@ void EPIApp::loadCategories() {
     movCategory->addItem("Selecionar Categoria");
     categoryFilter->clear();
     categoryFilter->addItem("Todas as Categorias");
-    for (const auto &cat : categories) {
+    reportCategoryFilter->clear();
+    reportCategoryFilter->addItem("Todas as Categorias", 0);
+    for (const auto &entry : categories) {
+        const QVariantList cat = entry.toList();
         categoriesList->addItem(cat[1].toString())->setData(Qt::UserRole, cat[0]);
         itemCategory->addItem(cat[1].toString(), cat[0]);
         movCategory->addItem(cat[1].toString());
         categoryFilter->addItem(cat[1].toString());
+        reportCategoryFilter->addItem(cat[1].toString(), cat[0]);
+        countCategory->addItem(cat[1].toString(), cat[0]);
     }
 }
 
 void EPIApp::loadColaboradores() {
-    QVariantList users;
-    dbManager->executeQuery("SELECT id, nome_completo FROM usuarios WHERE level IN (1, 2)", {}, true, &users);
+    QList<UserRow> users;
+    dbManager->select("WHERE u.level IN (1, 2)", {}, &users);
     colaboradorCombo->clear();
     returnColabCombo->clear();
     colaboradorCombo->addItem("Selecionar Colaborador", 0);
     returnColabCombo->addItem("Selecionar Colaborador", 0);
     for (const auto &user : users) {
-        colaboradorCombo->addItem(user[1].toString(), user[0]);
-        returnColabCombo->addItem(user[1].toString(), user[0]);
+        colaboradorCombo->addItem(user.nomeCompleto, user.id);
+        returnColabCombo->addItem(user.nomeCompleto, user.id);
     }
 }
 
 void EPIApp::loadDeliveredColab() {
-    QVariantList users;
-    dbManager->executeQuery("SELECT id, nome_completo FROM usuarios", {}, true, &users);
+    QList<UserRow> users;
+    dbManager->select("", {}, &users);
     deliveredColab->clear();
     deliveredColab->addItem("Todos", 0);
     for (const auto &user : users) {
-        deliveredColab->addItem(user[1].toString(), user[0]);
+        deliveredColab->addItem(user.nomeCompleto, user.id);
     }
 }
 
 void EPIApp::loadColabFilter() {
-    QVariantList users;
-    dbManager->executeQuery("SELECT id, nome_completo FROM usuarios", {}, true, &users);
+    QList<UserRow> users;
+    dbManager->select("", {}, &users);
     collabFilter->clear();
     collabFilter->addItem("Selecionar Colaborador", 0);
     for (const auto &user : users) {
-        collabFilter->addItem(user[1].toString(), user[0]);
+        collabFilter->addItem(user.nomeCompleto, user.id);
     }
 }
 
@@ -1591,7 +3195,8 @@ void EPIApp::loadEmpresas() {
     dbManager->executeQuery("SELECT id, nome FROM empresas", {}, true, &empresas);
     userEmpresa->clear();
     userEmpresa->addItem("Selecionar Empresa", 0);
-    for (const auto &emp : empresas) {
+    for (const auto &entry : empresas) {
+        const QVariantList emp = entry.toList();
         userEmpresa->addItem(emp[1].toString(), emp[0]);
     }
 }
@@ -1600,18 +3205,19 @@ void EPIApp::loadEmpresasList() {
     QVariantList empresas;
     dbManager->executeQuery("SELECT id, nome FROM empresas", {}, true, &empresas);
     empresasList->clear();
-    for (const auto &emp : empresas) {
+    for (const auto &entry : empresas) {
+        const QVariantList emp = entry.toList();
         empresasList->addItem(emp[1].toString())->setData(Qt::UserRole, emp[0]);
     }
 }
 
 void EPIApp::updateCompleters() {
     QStringList names, cas;
-    QVariantList items;
-    dbManager->executeQuery("SELECT nome, ca FROM itens WHERE quantidade > 0", {}, true, &items);
+    QList<ItemRow> items;
+    dbManager->select("WHERE i.quantidade > 0", {}, &items);
     for (const auto &item : items) {
-        names << item[0].toString();
-        cas << item[1].toString();
+        names << item.nome;
+        cas << item.ca;
     }
     QCompleter *nameCompleter = new QCompleter(names, this);
     nameCompleter->setCaseSensitivity(Qt::CaseInsensitive);
@@ -1619,6 +3225,36 @@ void EPIApp::updateCompleters() {
     QCompleter *caCompleter = new QCompleter(cas, this);
     caCompleter->setCaseSensitivity(Qt::CaseInsensitive);
     movName->setCompleter(caCompleter);
+    loadSuppliers();
+}
+
+void EPIApp::loadSuppliers() {
+    const QString current = purchaseSupplier->currentText();
+    purchaseSupplier->blockSignals(true);
+    purchaseSupplier->clear();
+    purchaseSupplier->addItems(purchaseService->suppliers());
+    purchaseSupplier->setCurrentText(current);
+    purchaseSupplier->blockSignals(false);
+}
+
+void EPIApp::loadOpenOrders() {
+    QList<PurchaseOrderRow> orders;
+    purchaseService->openOrders(&orders);
+    const int current = receiptOrderCombo->currentData().toInt();
+    receiptOrderCombo->blockSignals(true);
+    receiptOrderCombo->clear();
+    receiptOrderCombo->addItem("Selecionar Pedido", 0);
+    for (const PurchaseOrderRow &order : orders) {
+        receiptOrderCombo->addItem(QString("#%1 - %2 (%3, %4 itens%5)")
+                                       .arg(order.id)
+                                       .arg(order.fornecedor, order.criadoEm.left(10))
+                                       .arg(order.linhas)
+                                       .arg(order.status == "parcial" ? ", parcial" : ""),
+                                   order.id);
+    }
+    receiptOrderCombo->setCurrentIndex(qMax(0, receiptOrderCombo->findData(current)));
+    receiptOrderCombo->blockSignals(false);
+    onReceiptOrderSelected();
 }
 
 void EPIApp::loadCategoryDetails(QListWidgetItem *item) {
@@ -1626,8 +3262,9 @@ void EPIApp::loadCategoryDetails(QListWidgetItem *item) {
     QVariantList result;
     dbManager->executeQuery("SELECT nome, descricao FROM categorias WHERE id=?", {catId}, true, &result);
     if (!result.isEmpty()) {
-        categoryName->setText(result[0][0].toString());
-        categoryDescription->setPlainText(result[0][1].toString());
+        const QVariantList category = result[0].toList();
+        categoryName->setText(category[0].toString());
+        categoryDescription->setPlainText(category[1].toString());
     }
 }
 
@@ -1636,13 +3273,16 @@ void EPIApp::loadEmpresaDetails(QListWidgetItem *item) {
     QVariantList result;
     dbManager->executeQuery("SELECT nome, cnpj, logadouro FROM empresas WHERE id=?", {empId}, true, &result);
     if (!result.isEmpty()) {
-        empresaNome->setText(result[0][0].toString());
-        empresaCnpj->setText(result[0][1].toString());
-        empresaLogadouro->setText(result[0][2].toString());
+        const QVariantList empresa = result[0].toList();
+        empresaNome->setText(empresa[0].toString());
+        empresaCnpj->setText(empresa[1].toString());
+        empresaLogadouro->setText(empresa[2].toString());
     }
 }
 
 void EPIApp::logAudit(const QString &action, const QString &details) {
+    // A snapshot cannot be written to, and browsing it changes nothing.
+    if (readOnlyMode) return;
     dbManager->executeQuery(
         "INSERT INTO audit_logs (user_id, action, details, timestamp) VALUES (?, ?, ?, ?)",
         {currentUserId, action, details, QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss")});
@@ -1657,6 +3297,27 @@ bool EPIApp::confirmAction(const QString &message) {
     return QMessageBox::question(this, "Confirmação", message) == QMessageBox::Yes;
 }
 
+FactFilter EPIApp::reportFilter() {
+    FactFilter filter;
+    // Início and Fim, when both are filled in, take precedence over Período.
+    const QDate start = QDate::fromString(startDate->text().trimmed(), "yyyy-MM-dd");
+    const QDate end = QDate::fromString(endDate->text().trimmed(), "yyyy-MM-dd");
+    if (start.isValid() && end.isValid()) {
+        filter.start = start;
+        filter.end = end;
+    } else {
+        const QString dateRange = getDateRange();
+        if (!dateRange.isEmpty()) {
+            const QStringList dates = dateRange.split(" AND ");
+            filter.start = QDate::fromString(dates[0], "yyyy-MM-dd");
+            filter.end = QDate::fromString(dates[1], "yyyy-MM-dd");
+        }
+    }
+    filter.colaboradorId = collabFilter->currentData().toInt();
+    filter.categoriaId = reportCategoryFilter->currentData().toInt();
+    return filter;
+}
+
 QString EPIApp::getDateRange() {
     QString period = timeFilter->currentText();
     QDateTime end = QDateTime::currentDateTime();
@@ -12,13 +12,37 @@
 #include <QPushButton>
 #include <QToolBar>
 #include <QChartView>
+#include <QChart>
+#include <QBarSeries>
+#include <QBarSet>
+#include <QBarCategoryAxis>
+#include <QValueAxis>
+#include <QTimer>
+#include <QLabel>
+#include <QCheckBox>
+#include <QHash>
 #include "DatabaseManager.h"
 #include "LoginDialog.h"
+#include "ExpirationTracker.h"
+#include "ConsumptionRollup.h"
+#include "DemandForecaster.h"
+#include "AbcXyzClassifier.h"
+#include "ArchiveManager.h"
+#include "CompanyCostReport.h"
+#include "StockService.h"
+#include "StockLedger.h"
+#include "CredentialService.h"
+#include "AnalyticsCache.h"
+#include "CycleCount.h"
+#include "PurchaseService.h"
+#include "RowTypes.h"
 
 class EPIApp : public QMainWindow {
     Q_OBJECT
 public:
-    explicit EPIApp(QWidget *parent = nullptr);
+    // A non-empty snapshotFile opens that copy of the database read-only
+    // for browsing reports; every mutation is refused.
+    explicit EPIApp(const QString &snapshotFile = QString(), QWidget *parent = nullptr);
 
 private slots:
     void addUser();
@@ -38,19 +62,49 @@ private slots:
     void onMovNameChanged(const QString &text);
     void onMovSizeSelected();
     void addToPending();
+    void onScanModeToggled(bool enabled);
+    void onScanSubmitted();
     void removePending(int row);
     void confirmPending();
     void onReturnColabSelected();
     void addReturnsToPending();
     void removeReturnPending(int row);
     void confirmReturns();
+    void startCycleCount();
+    void cancelCycleCount();
+    void onCountScanSubmitted();
+    void importCycleCountCsv();
+    void postCycleCount();
+    void onPurchaseSupplierChanged();
+    void createPurchaseOrder();
+    void onReceiptOrderSelected();
+    void receivePurchaseOrder();
+    void cancelPurchaseOrder();
     void loadDelivered();
+    void fetchMoreDelivered();
+    void countDelivered();
+    void onDeliveredSortChanged(int column, Qt::SortOrder order);
+    void onDeliveredScrolled(int value);
     void generateLowStockReport();
     void generateInventoryReport();
     void generateCategoryReport();
     void showMostUsedGraph();
+    void generateExpirationReport();
+    void generateForecastReport();
+    void generateAbcXyzReport();
+    void generateInventoryAtDate();
+    void generateConsumptionReport();
+    void generateReportPack();
+    void generateCompanyCostReport();
+    void exportReport();
+    void updateExpirationPanel();
+    void updateDashboard();
+    void onDashboardTick();
     void exportToCsv();
     void exportToPdf();
+    void showDiagnostics();
+    void createBackup();
+    void archiveOldData();
     void logout();
     void refreshAllData();
     void loadCategoryDetails(QListWidgetItem *item);
@@ -60,9 +114,12 @@ private:
     void setupUi();
     QWidget* createManagementTab();
     QWidget* createDashboardTab();
+    void markDashboardDirty();
     QWidget* createItemsTab();
     QWidget* createWithdrawalTab();
     QWidget* createReturnTab();
+    QWidget* createCycleCountTab();
+    QWidget* createPurchasesTab();
     QWidget* createDeliveredTab();
     QWidget* createCategoriesTab();
     QWidget* createEmpresasTab();
@@ -70,6 +127,7 @@ private:
     QWidget* createAboutTab();
     QWidget* createRestrictedTab(const QString &message);
     void createToolbar();
+    bool checkWritable(const QString &action);
     bool checkAdmin(const QString &action);
     void loadItems();
     void loadCategories();
@@ -81,22 +139,67 @@ private:
     void loadEmpresasList();
     void updateCompleters();
     void updatePendingTable();
+    void commitPending(int colaboradorId);
+    void commitReturns(int colaboradorId);
+    void rebuildScanLookup();
+    bool addScannedCode(const QString &code, QString *message);
     void updateReturnPendingTable();
+    void setCountRow(const CountVariance &line);
+    void updateCountSummary();
+    void loadSuppliers();
+    void loadOpenOrders();
     void logAudit(const QString &action, const QString &details);
     void handleError(const QString &action, const QString &error, const QString &message = "Ocorreu um erro inesperado");
     bool confirmAction(const QString &message);
     QString getDateRange();
+    FactFilter reportFilter();
     void clearUserForm();
     void clearItemForm();
     void clearCategoryForm();
     void clearEmpresaForm();
 
     DatabaseManager *dbManager;
+    ExpirationTracker *expirationTracker;
+    ConsumptionRollup *consumptionRollup;
+    DemandForecaster *demandForecaster;
+    AbcXyzClassifier *abcXyzClassifier;
+    ArchiveManager *archiveManager;
+    CompanyCostReport *companyCostReport;
+    StockService *stockService;
+    CredentialService *credentialService;
+    StockLedger *stockLedger;
+    AnalyticsCache *analyticsCache;
+    CycleCount *cycleCount;
+    PurchaseService *purchaseService;
+    // Owner of this counter's stock reservations.
+    QString reservationOwner;
     int currentUserId;
     int currentUserLevel;
     QList<QVariantList> pendingWithdrawals;
     QList<QVariantList> pendingReturns;
 
+    // Scan mode: items in stock indexed by CA and by "EPI-<id>" label,
+    // rebuilt lazily after any change to itens.
+    QVector<ItemRow> scanItems;
+    QHash<QString, QList<int>> scanLookup;
+    bool scanLookupDirty;
+    bool verifyingCredentials;
+    bool addingUser;
+    bool archivingData;
+    bool readOnlyMode;
+
+    // Keyset paging state for the "EPIs Entregues" tab
+    QString deliveredStartDate;
+    QString deliveredSource;
+    QString deliveredFilterSql;
+    QVariantList deliveredFilterParams;
+    int deliveredSortColumn;
+    Qt::SortOrder deliveredSortOrder;
+    QVariant deliveredLastSortKey;
+    QVariant deliveredLastId;
+    bool deliveredHasMore;
+    int deliveredGeneration;
+
     // UI Components
     QTableWidget *usersTable;
     QLineEdit *userNomeCompleto;
@@ -125,15 +228,32 @@ private:
     QSpinBox *movWithdrawQty;
     QSpinBox *movValidDays;
     QTableWidget *pendingTable;
+    QCheckBox *scanModeCheck;
+    QLineEdit *scanInput;
+    QLabel *scanStatus;
     QComboBox *returnColabCombo;
     QTableWidget *withdrawnTable;
     QTableWidget *returnPendingTable;
+    QComboBox *countCategory;
+    QLineEdit *countScanInput;
+    QSpinBox *countQuantity;
+    QLabel *countStatus;
+    QLabel *countSummary;
+    QTableWidget *countTable;
+    // Row of each counted item in countTable.
+    QHash<int, int> countRows;
+    QComboBox *purchaseSupplier;
+    QTableWidget *purchaseDraftTable;
+    QComboBox *receiptOrderCombo;
+    QTableWidget *receiptTable;
+    QLineEdit *receiptInvoice;
     QComboBox *deliveredColab;
     QLineEdit *deliveredStartDel;
     QLineEdit *deliveredEndDel;
     QLineEdit *deliveredStartExp;
     QLineEdit *deliveredEndExp;
     QTableWidget *deliveredTable;
+    QLabel *deliveredCountLabel;
     QListWidget *categoriesList;
     QLineEdit *categoryName;
     QTextEdit *categoryDescription;
@@ -143,10 +263,27 @@ private:
     QLineEdit *empresaLogadouro;
     QComboBox *timeFilter;
     QComboBox *collabFilter;
+    QComboBox *reportCategoryFilter;
     QLineEdit *startDate;
     QLineEdit *endDate;
     QTextEdit *reportDisplay;
     QtCharts::QChartView *chartView;
+    QtCharts::QBarSet *stockSet;
+    QtCharts::QBarCategoryAxis *stockAxisX;
+    QtCharts::QValueAxis *stockAxisY;
+    QLabel *todayWithdrawalsLabel;
+    QLabel *lowStockLabel;
+    QTimer *dashboardTimer;
+    bool dashboardDirty;
+    int dashboardTicks;
+    qint64 lastDataVersion;
+    QtCharts::QChartView *mostUsedChartView;
+    QtCharts::QBarSet *mostUsedSet;
+    QtCharts::QBarCategoryAxis *mostUsedAxisX;
+    QtCharts::QValueAxis *mostUsedAxisY;
+    QLabel *expirationSummary;
+    QSpinBox *expirationDays;
+    QTableWidget *expirationTable;
 };
 
 #endif // EPIAPP_H
@@ -0,0 +1,175 @@
+#include "ExpirationTracker.h"
+#include "Tracing.h"
+#include <QDate>
+#include <QDebug>
+
+namespace {
+const char *const kWatermarkName = "vencimentos";
+const int kSyncBatchSize = 5000;
+const char *const kWatermarkSql =
+    "SELECT COALESCE((SELECT ultimo_id FROM controle_incremental WHERE nome = ?), 0)";
+// Moves the watermark only from the value the batch was read against.
+const char *const kAdvanceSql =
+    "INSERT INTO controle_incremental (nome, ultimo_id) VALUES (?, ?) "
+    "ON CONFLICT(nome) DO UPDATE SET ultimo_id = excluded.ultimo_id "
+    "WHERE COALESCE(controle_incremental.ultimo_id, 0) = ? RETURNING ultimo_id";
+
+QString today() {
+    return QDate::currentDate().toString("yyyy-MM-dd");
+}
+}
+
+ExpirationTracker::ExpirationTracker(DatabaseManager *dbManager) : dbManager(dbManager) {}
+
+bool ExpirationTracker::sync() {
+    EPI_TRACE_SCOPE("ExpirationTracker::sync");
+    QVariantList state;
+    if (!dbManager->executeQuery(
+            "SELECT (SELECT ultimo_id FROM controle_incremental WHERE nome=?), (SELECT MAX(id) FROM movimentacoes)",
+            {kWatermarkName}, true, &state) || state.isEmpty()) {
+        return false;
+    }
+    // Nothing to apply: return without taking the write lock, as read-only
+    // connections cannot.
+    const qint64 maxId = state[0].toList()[1].toLongLong();
+    if (state[0].toList()[0].toLongLong() >= maxId) {
+        return true;
+    }
+
+    for (;;) {
+        if (!dbManager->beginImmediateTransaction()) {
+            return false;
+        }
+        // Re-read under the write lock: a concurrent sync may already have
+        // applied these movements, and returns must not consume lots twice.
+        QVariantList current;
+        if (!dbManager->executeQuery(kWatermarkSql, {kWatermarkName}, true, &current) || current.isEmpty()) {
+            dbManager->rollbackTransaction();
+            return false;
+        }
+        const qint64 watermark = current[0].toList()[0].toLongLong();
+        if (watermark >= maxId) {
+            dbManager->rollbackTransaction();
+            return true;
+        }
+
+        QVariantList movements;
+        if (!dbManager->executeQuery(
+                "SELECT id, item_id, colaborador_id, alteracao_quantidade, expiration_date, data FROM movimentacoes "
+                "WHERE id > ? AND id <= ? AND colaborador_id IS NOT NULL "
+                "AND motivo IN ('Retirada por colaborador', 'Devolução por colaborador') "
+                "ORDER BY id LIMIT ?",
+                {watermark, maxId, kSyncBatchSize}, true, &movements)) {
+            dbManager->rollbackTransaction();
+            return false;
+        }
+        const bool last = movements.size() < kSyncBatchSize;
+
+        bool ok = true;
+        qint64 upper = watermark;
+        for (const auto &row : movements) {
+            const QVariantList movement = row.toList();
+            const qint64 movementId = movement[0].toLongLong();
+            const int itemId = movement[1].toInt();
+            const int colaboradorId = movement[2].toInt();
+            const int change = movement[3].toInt();
+            const QString expiration = movement[4].toString();
+            if (change < 0 && !expiration.isEmpty()) {
+                // The delivery date is copied in: the movement itself may
+                // later be archived out of movimentacoes.
+                ok = dbManager->executeQuery(
+                    "INSERT OR IGNORE INTO vencimentos_pendentes (movimentacao_id, colaborador_id, item_id, quantidade_restante, expiration_date, data_entrega) "
+                    "VALUES (?, ?, ?, ?, ?, ?)",
+                    {movementId, colaboradorId, itemId, -change, expiration, movement[5]});
+            } else if (change > 0) {
+                ok = applyReturn(colaboradorId, itemId, change);
+            }
+            if (!ok) break;
+            upper = movementId;
+        }
+        // Once the last batch is in, the watermark covers every movement
+        // read, relevant or not, so ArchiveManager can tell what is folded.
+        if (ok && last) {
+            upper = maxId;
+        }
+        QVariantList advanced;
+        ok = ok && dbManager->executeQuery(kAdvanceSql, {kWatermarkName, upper, watermark}, true, &advanced) &&
+             !advanced.isEmpty();
+        if (!ok) {
+            dbManager->rollbackTransaction();
+            return false;
+        }
+        if (!dbManager->commitTransaction()) {
+            return false;
+        }
+        if (last) {
+            return true;
+        }
+    }
+}
+
+bool ExpirationTracker::applyReturn(int colaboradorId, int itemId, int qty) {
+    QVariantList lots;
+    if (!dbManager->executeQuery(
+            "SELECT movimentacao_id, quantidade_restante FROM vencimentos_pendentes "
+            "WHERE colaborador_id=? AND item_id=? ORDER BY expiration_date, movimentacao_id",
+            {colaboradorId, itemId}, true, &lots)) {
+        return false;
+    }
+
+    for (const auto &row : lots) {
+        if (qty <= 0) break;
+        const QVariantList lot = row.toList();
+        const qint64 movementId = lot[0].toLongLong();
+        const int remaining = lot[1].toInt();
+        if (qty >= remaining) {
+            if (!dbManager->executeQuery("DELETE FROM vencimentos_pendentes WHERE movimentacao_id=?", {movementId})) {
+                return false;
+            }
+            qty -= remaining;
+        } else {
+            if (!dbManager->executeQuery(
+                    "UPDATE vencimentos_pendentes SET quantidade_restante = quantidade_restante - ? WHERE movimentacao_id=?",
+                    {qty, movementId})) {
+                return false;
+            }
+            qty = 0;
+        }
+    }
+    return true;
+}
+
+bool ExpirationTracker::querySet(const QString &condition, const QVariantList &params, int limit,
+                                 QVariantList *result) {
+    return dbManager->executeQuery(
+        "SELECT u.nome_completo, i.nome, i.ca, i.tamanho, v.quantidade_restante, v.data_entrega, v.expiration_date "
+        "FROM vencimentos_pendentes v "
+        "LEFT JOIN itens i ON v.item_id = i.id "
+        "LEFT JOIN usuarios u ON v.colaborador_id = u.id "
+        "WHERE " + condition + " ORDER BY v.expiration_date, v.movimentacao_id LIMIT " + QString::number(limit),
+        params, true, result);
+}
+
+bool ExpirationTracker::expired(QVariantList *result, int limit) {
+    return querySet("v.expiration_date < ?", {today()}, limit, result);
+}
+
+bool ExpirationTracker::expiringWithin(int days, QVariantList *result, int limit) {
+    return querySet("v.expiration_date >= ? AND v.expiration_date <= ?",
+                    {today(), QDate::currentDate().addDays(days).toString("yyyy-MM-dd")}, limit, result);
+}
+
+bool ExpirationTracker::counts(int days, int *expiredCount, int *expiringCount) {
+    QVariantList result;
+    if (!dbManager->executeQuery(
+            "SELECT "
+            "(SELECT COUNT(*) FROM vencimentos_pendentes WHERE expiration_date < ?), "
+            "(SELECT COUNT(*) FROM vencimentos_pendentes WHERE expiration_date >= ? AND expiration_date <= ?)",
+            {today(), today(), QDate::currentDate().addDays(days).toString("yyyy-MM-dd")}, true, &result) || result.isEmpty()) {
+        return false;
+    }
+    const QVariantList row = result[0].toList();
+    *expiredCount = row[0].toInt();
+    *expiringCount = row[1].toInt();
+    return true;
+}
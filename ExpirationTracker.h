@@ -0,0 +1,32 @@
+#ifndef EXPIRATIONTRACKER_H
+#define EXPIRATIONTRACKER_H
+
+#include <QString>
+#include <QVariant>
+#include "DatabaseManager.h"
+
+// Keeps vencimentos_pendentes in step with movimentacoes: each withdrawal
+// becomes an outstanding lot with its due date, and returns consume the
+// collaborator's lots of the same item, earliest due date first. Only
+// movements past the stored watermark are applied, so the due-soon queries
+// are index range scans instead of replays of the movement history. Each
+// batch is applied under BEGIN IMMEDIATE against a re-read watermark, so
+// concurrent syncs never apply a return twice.
+class ExpirationTracker {
+public:
+    explicit ExpirationTracker(DatabaseManager *dbManager);
+
+    bool sync();
+    // Rows in due-date order; limit < 0 returns them all.
+    bool expired(QVariantList *result, int limit = -1);
+    bool expiringWithin(int days, QVariantList *result, int limit = -1);
+    bool counts(int days, int *expiredCount, int *expiringCount);
+
+private:
+    bool applyReturn(int colaboradorId, int itemId, int qty);
+    bool querySet(const QString &condition, const QVariantList &params, int limit, QVariantList *result);
+
+    DatabaseManager *dbManager;
+};
+
+#endif // EXPIRATIONTRACKER_H
@@ -0,0 +1,277 @@
+#include "HeadlessCommands.h"
+#include <QCoreApplication>
+#include <QDate>
+#include <QDateTime>
+#include <QDir>
+#include <QGuiApplication>
+#include <QTextStream>
+#include <cstring>
+#include "BackupManager.h"
+#include "ArchiveManager.h"
+#include "DatabaseManager.h"
+#include "ReportPack.h"
+#include "ApiServer.h"
+#include "SyncManager.h"
+#include "AggregationBenchmark.h"
+
+namespace Headless {
+
+namespace {
+const char *const kHeadlessCommands[] = {"--backup",      "--archive",     "--report-pack", "--api",
+                                            "--sync-status", "--sync-export", "--sync-import", "--sync-serve",
+                                            "--sync-with",   "--bench-aggregation"};
+}
+
+bool isCommand(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        for (const char *command : kHeadlessCommands) {
+            if (std::strcmp(argv[i], command) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+QString argumentAfter(const QStringList &args, const QString &option, const QString &fallback) {
+    const int index = args.indexOf(option);
+    if (index < 0 || index + 1 >= args.size() || args[index + 1].startsWith("--")) {
+        return fallback;
+    }
+    return args[index + 1];
+}
+
+namespace {
+int runBackup(const QString &backupDir) {
+    BackupManager manager(QDir::current().absoluteFilePath("epi.db"), backupDir);
+    const BackupResult result = manager.createSnapshot();
+    if (!result.ok) {
+        QTextStream(stderr) << "Falha ao criar backup: " << result.error << "\n";
+        return 1;
+    }
+    QTextStream(stdout) << "Backup criado: " << result.path << " (" << result.pages << " páginas, " << result.elapsedMs << " ms)\n";
+    return 0;
+}
+
+int runArchive(int beforeYear) {
+    DatabaseManager dbManager;
+    ArchiveManager archiveManager(&dbManager, QDir::current().absoluteFilePath("arquivo"));
+    QString error;
+    if (!archiveManager.archiveBefore(beforeYear, &error, [](int year, qint64 moved) {
+            QTextStream(stdout) << "Arquivando " << year << ": " << moved << " registros\n";
+        })) {
+        QTextStream(stderr) << "Falha ao arquivar: " << error << "\n";
+        return 1;
+    }
+    QTextStream(stdout) << "Dados anteriores a " << beforeYear << " arquivados.\n";
+    return 0;
+}
+
+int runReportPack(const QString &month) {
+    ReportPackOptions options;
+    options.databaseFile = QDir::current().absoluteFilePath("epi.db");
+    options.outputDir = QDir::current().absoluteFilePath("relatorios");
+    options.month = month.isEmpty() ? QDate::currentDate().addMonths(-1) : QDate::fromString(month + "-01", "yyyy-MM-dd");
+    if (!options.month.isValid()) {
+        QTextStream(stderr) << "Uso: --report-pack [AAAA-MM]\n";
+        return 1;
+    }
+    ReportPackRunner runner(options);
+    const ReportPackResult result = runner.run();
+    for (const QString &file : result.files) {
+        QTextStream(stdout) << file << "\n";
+    }
+    if (!result.ok) {
+        QTextStream(stderr) << "Falha ao gerar relatórios: " << result.errors.join("; ") << "\n";
+        return 1;
+    }
+    QTextStream(stdout) << result.scans << " leituras, " << result.elapsedMs << " ms (relatório mais lento: "
+                        << result.slowestReportMs << " ms)\n";
+    return 0;
+}
+
+// Serves until killed. The token comes from EPIAPP_API_TOKEN so it stays
+// out of the process list; it is mandatory when binding beyond localhost.
+int runApi(const QStringList &args) {
+    ApiServerOptions options;
+    options.databaseFile = QDir::current().absoluteFilePath("epi.db");
+    options.port = quint16(argumentAfter(args, "--api", "8080").toUInt());
+    options.address = QHostAddress(argumentAfter(args, "--api-bind", "127.0.0.1"));
+    options.workers = qMax(1, argumentAfter(args, "--api-workers", "4").toInt());
+    options.token = qgetenv("EPIAPP_API_TOKEN");
+    if (options.port == 0 || options.address.isNull()) {
+        QTextStream(stderr) << "Uso: --api [porta] [--api-bind <endereço>] [--api-workers <n>]\n";
+        return 1;
+    }
+    ApiServer server(options);
+    QString error;
+    if (!server.listen(&error)) {
+        QTextStream(stderr) << "Falha ao iniciar API: " << error << "\n";
+        return 1;
+    }
+    QTextStream(stdout) << "API em http://" << options.address.toString() << ":" << server.serverPort() << "/api\n";
+    return QCoreApplication::exec();
+}
+
+// Site replication. The peer secret comes from EPIAPP_SYNC_TOKEN on both
+// sides; serving beyond localhost requires it.
+int runSync(const QStringList &args) {
+    DatabaseManager dbManager;
+    SyncManager sync(&dbManager);
+    sync.setSharedSecret(qgetenv("EPIAPP_SYNC_TOKEN"));
+    QString error;
+    auto report = [](const SyncStats &stats) {
+        QTextStream(stdout) << stats.applied << " alterações aplicadas, " << stats.skipped << " já conhecidas, "
+                            << stats.conflicts << " conflitos (ver sync_conflitos)\n";
+    };
+
+    if (args.contains("--sync-status")) {
+        QVariantList rows;
+        dbManager.executeQuery(
+            "SELECT p.par, p.enviado, (SELECT MAX(seq) FROM sync_log) - p.enviado, p.sincronizado_em FROM sync_pares p",
+            {}, true, &rows);
+        QTextStream out(stdout);
+        out << "Site: " << sync.siteId() << "\n";
+        for (const QVariant &row : rows) {
+            const QVariantList r = row.toList();
+            out << r[0].toString() << ": enviado até " << r[1].toLongLong() << ", " << r[2].toLongLong()
+                << " alterações pendentes, última sincronização " << r[3].toString() << "\n";
+        }
+        return 0;
+    }
+    if (args.contains("--sync-export")) {
+        const QString peer = argumentAfter(args, "--sync-export", QString());
+        if (peer.isEmpty()) {
+            QTextStream(stderr) << "Uso: --sync-export <site-destino>\n";
+            return 1;
+        }
+        QDir().mkpath("sincronizacao");
+        const QString fileName = QDir::current().absoluteFilePath(
+            QString("sincronizacao/%1-para-%2.episync").arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"), peer));
+        int changes = 0;
+        if (!sync.exportFile(peer, fileName, &changes, &error)) {
+            QTextStream(stderr) << "Falha ao exportar: " << error << "\n";
+            return 1;
+        }
+        QTextStream(stdout) << fileName << " (" << changes << " alterações)\n";
+        return 0;
+    }
+    if (args.contains("--sync-import")) {
+        SyncStats stats;
+        if (!sync.importFile(argumentAfter(args, "--sync-import", QString()), &stats, &error)) {
+            QTextStream(stderr) << "Falha ao importar: " << error << "\n";
+            return 1;
+        }
+        report(stats);
+        return 0;
+    }
+    if (args.contains("--sync-serve")) {
+        const QHostAddress address(argumentAfter(args, "--sync-bind", "0.0.0.0"));
+        if (address.isNull()) {
+            QTextStream(stderr) << "Uso: --sync-serve [porta] [--sync-bind <endereço>]\n";
+            return 1;
+        }
+        if (!sync.serve(address, quint16(argumentAfter(args, "--sync-serve", "8091").toUInt()), &error)) {
+            QTextStream(stderr) << "Falha ao iniciar sincronização: " << error << "\n";
+            return 1;
+        }
+        QTextStream(stdout) << "Site " << sync.siteId() << " aguardando sincronização\n";
+        return QCoreApplication::exec();
+    }
+    const QString target = argumentAfter(args, "--sync-with", QString());
+    const int colon = target.lastIndexOf(':');
+    if (colon <= 0) {
+        QTextStream(stderr) << "Uso: --sync-with <host:porta>\n";
+        return 1;
+    }
+    SyncStats stats;
+    int sent = 0;
+    if (!sync.syncWith(target.left(colon), quint16(target.mid(colon + 1).toUInt()), &stats, &sent, &error)) {
+        QTextStream(stderr) << "Falha ao sincronizar: " << error << "\n";
+        return 1;
+    }
+    QTextStream(stdout) << sent << " alterações enviadas\n";
+    report(stats);
+    return 0;
+}
+
+// Kernel vs SQLite GROUP BY timings on synthetic data; exits non-zero if
+// any case disagrees.
+int runAggregationBenchmark(const QStringList &args) {
+    const qint64 rows = argumentAfter(args, "--bench-aggregation", "5000000").toLongLong();
+    if (rows <= 0) {
+        QTextStream(stderr) << "Uso: --bench-aggregation [movimentações]\n";
+        return 1;
+    }
+    AggregationBenchmark benchmark(rows);
+    QList<BenchmarkCase> cases;
+    QString error;
+    if (!benchmark.run(&cases, &error)) {
+        QTextStream(stderr) << "Falha no benchmark: " << error << "\n";
+        return 1;
+    }
+    QTextStream out(stdout);
+    out << rows << " movimentações sintéticas (geração " << benchmark.generationMs() << " ms, carga SQLite "
+        << benchmark.sqliteLoadMs() << " ms); melhor de " << AggregationBenchmark::kRepeats << " execuções\n";
+    bool allMatch = true;
+    for (const BenchmarkCase &c : cases) {
+        out << c.name << " (" << c.groups << " grupos)\n"
+            << "  SQLite " << QString::number(c.sqliteMs, 'f', 2) << " ms | direto "
+            << QString::number(c.directMs, 'f', 2) << " ms (" << QString::number(c.sqliteMs / c.directMs, 'f', 1)
+            << "x) | hash " << QString::number(c.hashMs, 'f', 2) << " ms ("
+            << QString::number(c.sqliteMs / c.hashMs, 'f', 1) << "x) | "
+            << (c.matches ? "resultados iguais" : "RESULTADOS DIFERENTES") << "\n";
+        allMatch = allMatch && c.matches;
+    }
+    return allMatch ? 0 : 1;
+}
+
+}
+
+int run(const QStringList &args) {
+    if (args.contains("--backup")) {
+        return runBackup(argumentAfter(args, "--backup", QDir::current().absoluteFilePath("backups")));
+    }
+    if (args.contains("--archive")) {
+        const int beforeYear = argumentAfter(args, "--archive", QString()).toInt();
+        if (beforeYear <= 0) {
+            QTextStream(stderr) << "Uso: --archive <ano>\n";
+            return 1;
+        }
+        return runArchive(beforeYear);
+    }
+    if (args.contains("--report-pack")) {
+        return runReportPack(argumentAfter(args, "--report-pack", QString()));
+    }
+    if (args.contains("--api")) {
+        return runApi(args);
+    }
+    if (args.contains("--bench-aggregation")) {
+        return runAggregationBenchmark(args);
+    }
+    for (const QString &arg : args) {
+        if (arg.startsWith("--sync-")) {
+            return runSync(args);
+        }
+    }
+    return 1;
+}
+
+int exec(int argc, char *argv[]) {
+    // PDF rendering needs fonts, hence a (display-less) GUI application.
+    bool needsGui = false;
+    for (int i = 1; i < argc; ++i) {
+        needsGui = needsGui || std::strcmp(argv[i], "--report-pack") == 0;
+    }
+    if (needsGui) {
+        if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        }
+        QGuiApplication app(argc, argv);
+        return run(app.arguments());
+    }
+    QCoreApplication app(argc, argv);
+    return run(app.arguments());
+}
+
+}
@@ -0,0 +1,21 @@
+#ifndef HEADLESSCOMMANDS_H
+#define HEADLESSCOMMANDS_H
+
+#include <QString>
+#include <QStringList>
+
+// Commands that run without a display or a login, e.g. from a scheduled
+// task: backups, archiving, report packs, the API server, site
+// replication and benchmarks. Shared by EPIApp and the widget-free
+// epi-cli.
+namespace Headless {
+
+bool isCommand(int argc, char *argv[]);
+QString argumentAfter(const QStringList &args, const QString &option, const QString &fallback);
+int run(const QStringList &args);
+// Creates the application object the command needs and runs it.
+int exec(int argc, char *argv[]);
+
+}
+
+#endif // HEADLESSCOMMANDS_H
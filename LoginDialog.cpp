@@ -1,9 +1,8 @@
 #include "LoginDialog.h"
 #include <QMessageBox>
-#include <QCryptographicHash>
 
-LoginDialog::LoginDialog(DatabaseManager *dbManager, QWidget *parent)
-    : QDialog(parent), dbManager(dbManager), userId(-1), userLevel(-1) {
+LoginDialog::LoginDialog(CredentialService *credentials, QWidget *parent)
+    : QDialog(parent), credentials(credentials), userId(-1), userLevel(-1) {
     setWindowTitle("Gerenciamento de EPI - Login");
     setFixedSize(400, 300);
     setStyleSheet(
@@ -31,27 +30,26 @@ LoginDialog::LoginDialog(DatabaseManager *dbManager, QWidget *parent)
     form->addRow("Senha:", passwordEdit);
     layout->addLayout(form);
 
-    QPushButton *loginBtn = new QPushButton("Entrar");
+    loginBtn = new QPushButton("Entrar");
     loginBtn->setToolTip("Fazer login no sistema");
     connect(loginBtn, &QPushButton::clicked, this, &LoginDialog::login);
     layout->addWidget(loginBtn);
 }
 
 void LoginDialog::login() {
-    QString username = usernameEdit->text();
-    QString password = QString(QCryptographicHash::hash(passwordEdit->text().toUtf8(), QCryptographicHash::Sha256).toHex());
-    QVariantList result;
-    if (dbManager->executeQuery(
-            "SELECT id, level FROM usuarios WHERE nome_usuario = ? AND senha = ?",
-            {username, password}, true, &result)) {
-        if (!result.isEmpty()) {
-            userId = result[0][0].toInt();
-            userLevel = result[0][1].toInt();
+    // The check runs off the GUI thread; the button stays disabled until
+    // it answers.
+    loginBtn->setEnabled(false);
+    loginBtn->setText("Verificando...");
+    credentials->login(usernameEdit->text(), passwordEdit->text(), this, [this](bool ok, int id, int level) {
+        loginBtn->setEnabled(true);
+        loginBtn->setText("Entrar");
+        if (ok) {
+            userId = id;
+            userLevel = level;
             accept();
         } else {
             QMessageBox::warning(this, "Erro", "Credenciais inválidas!");
         }
-    } else {
-        QMessageBox::critical(this, "Erro", "Erro ao autenticar usuário!");
-    }
+    });
 }
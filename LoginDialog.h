@@ -7,12 +7,12 @@
 #include <QLabel>
 #include <QVBoxLayout>
 #include <QFormLayout>
-#include "DatabaseManager.h"
+#include "CredentialService.h"
 
 class LoginDialog : public QDialog {
     Q_OBJECT
 public:
-    explicit LoginDialog(DatabaseManager *dbManager, QWidget *parent = nullptr);
+    explicit LoginDialog(CredentialService *credentials, QWidget *parent = nullptr);
     int getUserId() const { return userId; }
     int getUserLevel() const { return userLevel; }
 
@@ -20,9 +20,10 @@ private slots:
     void login();
 
 private:
-    DatabaseManager *dbManager;
+    CredentialService *credentials;
     QLineEdit *usernameEdit;
     QLineEdit *passwordEdit;
+    QPushButton *loginBtn;
     int userId;
     int userLevel;
 };
@@ -0,0 +1,273 @@
+#include "PurchaseService.h"
+#include "Tracing.h"
+#include <QDateTime>
+#include <QHash>
+
+namespace {
+const char *const kMomentFormat = "yyyy-MM-dd hh:mm:ss";
+
+// Sums quantities per item; the cost becomes the quantity-weighted mean.
+QList<PurchaseLine> mergeLines(const QList<PurchaseLine> &lines) {
+    QList<PurchaseLine> merged;
+    QHash<int, int> position;
+    for (const PurchaseLine &line : lines) {
+        const auto it = position.constFind(line.itemId);
+        if (it == position.constEnd()) {
+            position.insert(line.itemId, merged.size());
+            merged.append(line);
+            continue;
+        }
+        PurchaseLine &into = merged[it.value()];
+        const int total = into.quantidade + line.quantidade;
+        into.custoUnitario = (into.custoUnitario * into.quantidade + line.custoUnitario * line.quantidade) / total;
+        into.quantidade = total;
+    }
+    return merged;
+}
+}
+
+PurchaseService::PurchaseService(DatabaseManager *dbManager) : dbManager(dbManager) {}
+
+QStringList PurchaseService::suppliers() {
+    QVariantList result;
+    dbManager->executeQuery(
+        "SELECT DISTINCT TRIM(fornecedor) FROM itens WHERE TRIM(COALESCE(fornecedor, '')) <> '' ORDER BY 1", {}, true,
+        &result);
+    QStringList names;
+    names.reserve(result.size());
+    for (const QVariant &row : result) {
+        names << row.toList()[0].toString();
+    }
+    return names;
+}
+
+bool PurchaseService::createOrder(const QString &fornecedor, const QList<PurchaseLine> &lines, int operatorId,
+                                  int *orderId, QString *error) {
+    EPI_TRACE_SCOPE("PurchaseService::createOrder");
+    if (fornecedor.trimmed().isEmpty()) {
+        *error = "Informe o fornecedor";
+        return false;
+    }
+    if (lines.isEmpty()) {
+        *error = "Nenhum item informado";
+        return false;
+    }
+    for (const PurchaseLine &line : lines) {
+        if (line.quantidade <= 0 || line.custoUnitario < 0) {
+            *error = QString("Quantidade ou custo inválido para o item %1").arg(line.itemId);
+            return false;
+        }
+    }
+    const QList<PurchaseLine> merged = mergeLines(lines);
+
+    if (!dbManager->beginTransaction()) {
+        *error = "Falha ao iniciar transação";
+        return false;
+    }
+    auto fail = [this, error](const QString &message) {
+        dbManager->rollbackTransaction();
+        *error = message;
+        return false;
+    };
+
+    const QString now = QDateTime::currentDateTime().toString(kMomentFormat);
+    QVariantList inserted;
+    if (!dbManager->executeQuery(
+            "INSERT INTO pedidos_compra (fornecedor, criado_em, usuario_id, status) VALUES (?, ?, ?, 'aberto') "
+            "RETURNING id",
+            {fornecedor.trimmed(), now, operatorId}, true, &inserted) ||
+        inserted.isEmpty()) {
+        return fail("Falha ao criar pedido");
+    }
+    const int id = inserted[0].toList()[0].toInt();
+    QVariantList values;
+    values.reserve(merged.size() * 4);
+    for (const PurchaseLine &line : merged) {
+        values << id << line.itemId << line.quantidade << line.custoUnitario;
+    }
+    QVariantList missing;
+    if (!dbManager->insertRows("pedido_compra_itens", {"pedido_id", "item_id", "quantidade", "custo_unitario"},
+                               values) ||
+        !dbManager->executeQuery(
+            "SELECT l.item_id FROM pedido_compra_itens l LEFT JOIN itens i ON i.id = l.item_id "
+            "WHERE l.pedido_id = ? AND i.id IS NULL LIMIT 1",
+            {id}, true, &missing)) {
+        return fail("Falha ao registrar os itens do pedido");
+    }
+    if (!missing.isEmpty()) {
+        return fail(QString("EPI inexistente (item %1)").arg(missing[0].toList()[0].toInt()));
+    }
+    if (!dbManager->executeQuery(
+            "INSERT INTO audit_logs (user_id, action, details, timestamp) VALUES (?, ?, ?, ?)",
+            {operatorId, "create_purchase_order",
+             QString("Criou pedido de compra #%1 para '%2' com %3 itens").arg(id).arg(fornecedor.trimmed()).arg(merged.size()),
+             now})) {
+        return fail("Falha ao criar pedido");
+    }
+    if (!dbManager->commitTransaction()) {
+        *error = "Falha ao gravar pedido";
+        return false;
+    }
+    *orderId = id;
+    return true;
+}
+
+bool PurchaseService::openOrders(QList<PurchaseOrderRow> *rows) {
+    return dbManager->select("WHERE p.status IN ('aberto', 'parcial') ORDER BY p.id", {}, rows);
+}
+
+bool PurchaseService::orderLines(int orderId, QList<OrderLineRow> *rows) {
+    return dbManager->select("WHERE l.pedido_id = ? ORDER BY 2, 4", {orderId}, rows);
+}
+
+bool PurchaseService::cancelOrder(int orderId, int operatorId, QString *error) {
+    QVariantList cancelled;
+    if (!dbManager->executeQuery(
+            "UPDATE pedidos_compra SET status = 'cancelado' WHERE id = ? AND status IN ('aberto', 'parcial') "
+            "RETURNING fornecedor",
+            {orderId}, true, &cancelled)) {
+        *error = "Falha ao cancelar pedido";
+        return false;
+    }
+    if (cancelled.isEmpty()) {
+        *error = QString("Pedido #%1 não está em aberto").arg(orderId);
+        return false;
+    }
+    dbManager->executeQuery(
+        "INSERT INTO audit_logs (user_id, action, details, timestamp) VALUES (?, ?, ?, ?)",
+        {operatorId, "cancel_purchase_order",
+         QString("Cancelou pedido de compra #%1 de '%2'").arg(orderId).arg(cancelled[0].toList()[0].toString()),
+         QDateTime::currentDateTime().toString(kMomentFormat)});
+    return true;
+}
+
+bool PurchaseService::receive(int orderId, const QString &notaFiscal, const QList<PurchaseLine> &lines,
+                              int operatorId, int *receiptId, int *units, QString *error) {
+    EPI_TRACE_SCOPE("PurchaseService::receive");
+    QList<PurchaseLine> merged;
+    for (const PurchaseLine &line : lines) {
+        if (line.quantidade < 0 || line.custoUnitario < 0) {
+            *error = QString("Quantidade ou custo inválido para o item %1").arg(line.itemId);
+            return false;
+        }
+        if (line.quantidade > 0) {
+            merged.append(line);
+        }
+    }
+    merged = mergeLines(merged);
+    if (merged.isEmpty()) {
+        *error = "Nenhuma quantidade recebida";
+        return false;
+    }
+
+    if (!dbManager->beginTransaction()) {
+        *error = "Falha ao iniciar transação";
+        return false;
+    }
+    auto fail = [this, error](const QString &message) {
+        dbManager->rollbackTransaction();
+        *error = message;
+        return false;
+    };
+
+    // The write comes first so the transaction holds the write lock
+    // before the outstanding quantities are read: two counters receiving
+    // the same order cannot both take the last units.
+    QVariantList order;
+    if (!dbManager->executeQuery(
+            "UPDATE pedidos_compra SET status = status WHERE id = ? AND status IN ('aberto', 'parcial') "
+            "RETURNING fornecedor",
+            {orderId}, true, &order)) {
+        return fail("Falha ao consultar pedido");
+    }
+    if (order.isEmpty()) {
+        return fail(QString("Pedido #%1 não está em aberto").arg(orderId));
+    }
+    QList<OrderLineRow> ordered;
+    if (!orderLines(orderId, &ordered)) {
+        return fail("Falha ao consultar os itens do pedido");
+    }
+    QHash<int, const OrderLineRow *> outstanding;
+    for (const OrderLineRow &line : ordered) {
+        outstanding.insert(line.itemId, &line);
+    }
+    int total = 0;
+    for (const PurchaseLine &line : merged) {
+        const OrderLineRow *orderedLine = outstanding.value(line.itemId);
+        if (!orderedLine) {
+            return fail(QString("Item %1 não consta do pedido #%2").arg(line.itemId).arg(orderId));
+        }
+        const int left = orderedLine->quantidade - orderedLine->recebido;
+        if (line.quantidade > left) {
+            return fail(QString("Recebimento de '%1' excede o pendente do pedido (%2)").arg(orderedLine->nome).arg(left));
+        }
+        total += line.quantidade;
+    }
+
+    const QString now = QDateTime::currentDateTime().toString(kMomentFormat);
+    QVariantList inserted;
+    if (!dbManager->executeQuery(
+            "INSERT INTO recebimentos (pedido_id, nota_fiscal, data, usuario_id) VALUES (?, ?, ?, ?) RETURNING id",
+            {orderId, notaFiscal.trimmed(), now, operatorId}, true, &inserted) ||
+        inserted.isEmpty()) {
+        return fail("Falha ao registrar recebimento");
+    }
+    const int id = inserted[0].toList()[0].toInt();
+    QVariantList values;
+    values.reserve(merged.size() * 4);
+    for (const PurchaseLine &line : merged) {
+        values << id << line.itemId << line.quantidade << line.custoUnitario;
+    }
+    if (!dbManager->insertRows("recebimento_itens", {"recebimento_id", "item_id", "quantidade", "custo_unitario"},
+                               values)) {
+        return fail("Falha ao registrar os itens recebidos");
+    }
+
+    // SET expressions all see the row before the update, so preco is
+    // averaged over the stock on hand before this receipt. Negative stock
+    // carries no cost.
+    QVariantList updated;
+    if (!dbManager->executeQuery(
+            "UPDATE itens SET "
+            "preco = ROUND((MAX(COALESCE(itens.quantidade, 0), 0) * COALESCE(itens.preco, 0) + "
+            "r.quantidade * r.custo_unitario) / (MAX(COALESCE(itens.quantidade, 0), 0) + r.quantidade), 4), "
+            "quantidade = COALESCE(itens.quantidade, 0) + r.quantidade "
+            "FROM recebimento_itens r WHERE r.recebimento_id = ? AND r.item_id = itens.id RETURNING id",
+            {id}, true, &updated)) {
+        return fail("Falha ao atualizar o estoque");
+    }
+    if (updated.size() != merged.size()) {
+        return fail("Um dos EPIs do pedido foi excluído");
+    }
+    const QString motivo = notaFiscal.trimmed().isEmpty()
+                               ? QString("Recebimento do pedido #%1").arg(orderId)
+                               : QString("Recebimento do pedido #%1 (NF %2)").arg(orderId).arg(notaFiscal.trimmed());
+    if (!dbManager->executeQuery(
+            "INSERT INTO movimentacoes (item_id, alteracao_quantidade, data, motivo, colaborador_id, expiration_date) "
+            "SELECT r.item_id, r.quantidade, ?, ?, NULL, '' FROM recebimento_itens r WHERE r.recebimento_id = ?",
+            {now, motivo, id}) ||
+        !dbManager->executeQuery(
+            "UPDATE pedido_compra_itens SET recebido = recebido + r.quantidade FROM recebimento_itens r "
+            "WHERE r.recebimento_id = ? AND pedido_compra_itens.pedido_id = ? AND pedido_compra_itens.item_id = r.item_id",
+            {id, orderId}) ||
+        !dbManager->executeQuery(
+            "UPDATE pedidos_compra SET status = CASE WHEN EXISTS (SELECT 1 FROM pedido_compra_itens "
+            "WHERE pedido_id = pedidos_compra.id AND recebido < quantidade) THEN 'parcial' ELSE 'recebido' END "
+            "WHERE id = ?",
+            {orderId}) ||
+        !dbManager->executeQuery(
+            "INSERT INTO audit_logs (user_id, action, details, timestamp) VALUES (?, ?, ?, ?)",
+            {operatorId, "receive_purchase_order",
+             QString("%1: %2 itens, %3 unidades de '%4'")
+                 .arg(motivo).arg(merged.size()).arg(total).arg(order[0].toList()[0].toString()),
+             now})) {
+        return fail("Falha ao registrar recebimento");
+    }
+    if (!dbManager->commitTransaction()) {
+        *error = "Falha ao gravar recebimento";
+        return false;
+    }
+    *receiptId = id;
+    *units = total;
+    return true;
+}
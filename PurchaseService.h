@@ -0,0 +1,91 @@
+#ifndef PURCHASESERVICE_H
+#define PURCHASESERVICE_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include "DatabaseManager.h"
+#include "TypedQuery.h"
+
+struct PurchaseLine {
+    int itemId = 0;
+    int quantidade = 0;
+    double custoUnitario = 0;
+};
+
+struct PurchaseOrderRow {
+    int id = 0;
+    QString fornecedor;
+    QString criadoEm;
+    QString status;
+    int linhas = 0;
+};
+
+struct OrderLineRow {
+    int itemId = 0;
+    QString nome;
+    QString ca;
+    QString tamanho;
+    int quantidade = 0;
+    int recebido = 0;
+    double custoUnitario = 0;
+};
+
+// Purchase orders and goods receipts, keyed by the free-text fornecedor
+// that itens already carry. An order is 'aberto' until its first
+// receipt, 'parcial' while any line is short and 'recebido' once every
+// line is in; receipts beyond what was ordered are refused.
+//
+// A receipt is one transaction however many lines it has: its lines are
+// written to recebimento_itens in multi-row inserts, and from there a
+// few set-based statements raise stock, fold the unit cost into the
+// moving-average preco, write the inbound movimentacoes and advance the
+// order. Repeated items are merged first, at their weighted cost.
+class PurchaseService {
+public:
+    explicit PurchaseService(DatabaseManager *dbManager);
+
+    QStringList suppliers();
+    bool createOrder(const QString &fornecedor, const QList<PurchaseLine> &lines, int operatorId, int *orderId,
+                     QString *error);
+    // Orders still waiting for goods, oldest first.
+    bool openOrders(QList<PurchaseOrderRow> *rows);
+    bool orderLines(int orderId, QList<OrderLineRow> *rows);
+    bool cancelOrder(int orderId, int operatorId, QString *error);
+    // *units receives the total quantity received.
+    bool receive(int orderId, const QString &notaFiscal, const QList<PurchaseLine> &lines, int operatorId,
+                 int *receiptId, int *units, QString *error);
+
+private:
+    DatabaseManager *dbManager;
+};
+
+namespace TypedQuery {
+
+template <>
+struct RowMapping<PurchaseOrderRow> {
+    static constexpr const char *source = "pedidos_compra p";
+    static constexpr auto columns = std::make_tuple(
+        column("p.id", &PurchaseOrderRow::id),
+        column("p.fornecedor", &PurchaseOrderRow::fornecedor),
+        column("p.criado_em", &PurchaseOrderRow::criadoEm),
+        column("p.status", &PurchaseOrderRow::status),
+        column("(SELECT COUNT(*) FROM pedido_compra_itens l WHERE l.pedido_id = p.id)", &PurchaseOrderRow::linhas));
+};
+
+template <>
+struct RowMapping<OrderLineRow> {
+    static constexpr const char *source = "pedido_compra_itens l LEFT JOIN itens i ON i.id = l.item_id";
+    static constexpr auto columns = std::make_tuple(
+        column("l.item_id", &OrderLineRow::itemId),
+        column("COALESCE(i.nome, '(excluído)')", &OrderLineRow::nome),
+        column("i.ca", &OrderLineRow::ca),
+        column("i.tamanho", &OrderLineRow::tamanho),
+        column("l.quantidade", &OrderLineRow::quantidade),
+        column("l.recebido", &OrderLineRow::recebido),
+        column("l.custo_unitario", &OrderLineRow::custoUnitario));
+};
+
+}
+
+#endif // PURCHASESERVICE_H
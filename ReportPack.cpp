@@ -0,0 +1,358 @@
+#include "ReportPack.h"
+#include "ArchiveManager.h"
+#include "ColumnarResult.h"
+#include "DatabaseManager.h"
+#include "Tracing.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QPageSize>
+#include <QPdfWriter>
+#include <QSet>
+#include <QTextDocument>
+#include <QtConcurrent>
+#include <algorithm>
+#include <array>
+
+namespace {
+enum Scan { ItemScan, DeliveryScan, ScanCount };
+
+const char *const kScanSql[ScanCount] = {
+    "SELECT i.nome, i.ca, i.tamanho, i.quantidade, i.estoque_minimo, i.preco, i.fornecedor, "
+    "COALESCE(c.nome, 'Sem categoria'), i.data_adicao "
+    "FROM itens i LEFT JOIN categorias c ON i.categoria_id = c.id "
+    "ORDER BY 8, i.nome",
+    "SELECT COALESCE(e.nome, 'Sem empresa'), COALESCE(u.nome_completo, ''), i.nome, i.ca, i.tamanho, "
+    "-m.alteracao_quantidade, COALESCE(i.preco, 0), m.data, m.item_id "
+    "FROM %1 m JOIN itens i ON m.item_id = i.id "
+    "LEFT JOIN usuarios u ON m.colaborador_id = u.id "
+    "LEFT JOIN empresas e ON u.empresa_id = e.id "
+    "WHERE m.motivo = 'Retirada por colaborador' AND m.data >= ? AND m.data < ? "
+    "ORDER BY 1, m.data"
+};
+
+enum ItemColumn { ItemNome, ItemCa, ItemTamanho, ItemQuantidade, ItemEstoqueMinimo, ItemPreco, ItemFornecedor,
+                  ItemCategoria, ItemDataAdicao };
+enum DeliveryColumn { DelEmpresa, DelColaborador, DelItem, DelCa, DelTamanho, DelQuantidade, DelPreco, DelData,
+                      DelItemId };
+
+Scan scanFor(PackReport report) {
+    switch (report) {
+    case PackReport::CompanyDeliveries:
+    case PackReport::TopConsumed:
+        return DeliveryScan;
+    default:
+        return ItemScan;
+    }
+}
+
+QString fileStem(PackReport report) {
+    switch (report) {
+    case PackReport::LowStock: return "estoque-baixo";
+    case PackReport::Inventory: return "inventario";
+    case PackReport::Category: return "por-categoria";
+    case PackReport::CompanyDeliveries: return "entregas-por-empresa";
+    case PackReport::TopConsumed: return "mais-consumidos";
+    }
+    return "relatorio";
+}
+
+// Writes the same tables as HTML and CSV in one pass over the scan.
+class PackWriter {
+public:
+    explicit PackWriter(const QString &title) {
+        html = "<html><head><meta charset='utf-8'></head><body><h2>" + title.toUtf8() + "</h2>";
+    }
+
+    void section(const QString &title) {
+        closeTable();
+        html += "<h3>" + title.toUtf8() + "</h3>";
+        if (!csv.isEmpty()) csv += '\n';
+        csv += quoted(title.toUtf8()) + '\n';
+    }
+
+    void header(const QStringList &columns) {
+        closeTable();
+        html += "<table border='1' style='border-collapse: collapse; width: 100%;'><tr>";
+        for (int i = 0; i < columns.size(); ++i) {
+            html += "<th>" + columns[i].toUtf8() + "</th>";
+            if (i > 0) csv += ',';
+            csv += quoted(columns[i].toUtf8());
+        }
+        html += "</tr>";
+        csv += '\n';
+        tableOpen = true;
+    }
+
+    template <std::size_t N>
+    void row(const ColumnarResult &result, int row, const std::array<int, N> &columns) {
+        html += "<tr>";
+        for (std::size_t i = 0; i < N; ++i) {
+            html += "<td>";
+            result.appendTo(html, row, columns[i]);
+            html += "</td>";
+            if (i > 0) csv += ',';
+            result.appendCsv(csv, row, columns[i]);
+        }
+        html += "</tr>";
+        csv += '\n';
+    }
+
+    void row(const QStringList &cells, bool emphasis = false) {
+        html += "<tr>";
+        for (int i = 0; i < cells.size(); ++i) {
+            html += emphasis ? "<td><b>" + cells[i].toUtf8() + "</b></td>" : "<td>" + cells[i].toUtf8() + "</td>";
+            if (i > 0) csv += ',';
+            csv += quoted(cells[i].toUtf8());
+        }
+        html += "</tr>";
+        csv += '\n';
+    }
+
+    QByteArray finishHtml() {
+        closeTable();
+        html += "</body></html>";
+        return html;
+    }
+
+    QByteArray csv;
+
+private:
+    static QByteArray quoted(QByteArray text) {
+        return '"' + text.replace('"', "\"\"") + '"';
+    }
+
+    void closeTable() {
+        if (tableOpen) {
+            html += "</table>";
+            tableOpen = false;
+        }
+    }
+
+    QByteArray html;
+    bool tableOpen = false;
+};
+
+void renderLowStock(PackWriter &out, const ColumnarResult &items) {
+    out.header({"Nome", "CA", "Tamanho", "Quantidade", "Estoque Mínimo", "Categoria"});
+    for (int row = 0; row < items.rowCount(); ++row) {
+        if (items.integer(row, ItemQuantidade) <= items.integer(row, ItemEstoqueMinimo)) {
+            out.row(items, row, std::array<int, 6>{ItemNome, ItemCa, ItemTamanho, ItemQuantidade, ItemEstoqueMinimo,
+                                                   ItemCategoria});
+        }
+    }
+}
+
+void renderInventory(PackWriter &out, const ColumnarResult &items) {
+    out.header({"Nome", "CA", "Tamanho", "Quantidade", "Estoque Mínimo", "Preço", "Fornecedor", "Categoria",
+                "Data de Adição"});
+    for (int row = 0; row < items.rowCount(); ++row) {
+        out.row(items, row, std::array<int, 9>{ItemNome, ItemCa, ItemTamanho, ItemQuantidade, ItemEstoqueMinimo,
+                                               ItemPreco, ItemFornecedor, ItemCategoria, ItemDataAdicao});
+    }
+}
+
+void renderCategory(PackWriter &out, const ColumnarResult &items) {
+    // The scan is ordered by category, so each one is a contiguous run.
+    QUtf8StringView current;
+    for (int row = 0; row < items.rowCount(); ++row) {
+        const QUtf8StringView category = items.text(row, ItemCategoria);
+        if (row == 0 || category != current) {
+            current = category;
+            out.section(items.string(row, ItemCategoria));
+            out.header({"Nome", "CA", "Tamanho", "Quantidade", "Estoque Mínimo"});
+        }
+        out.row(items, row, std::array<int, 5>{ItemNome, ItemCa, ItemTamanho, ItemQuantidade, ItemEstoqueMinimo});
+    }
+}
+
+void renderCompanyDeliveries(PackWriter &out, const ColumnarResult &deliveries) {
+    qint64 quantity = 0;
+    double value = 0;
+    auto closeCompany = [&] {
+        out.row({"Total", "", "", "", QString::number(quantity), QString::number(value, 'f', 2)}, true);
+    };
+    QUtf8StringView current;
+    for (int row = 0; row < deliveries.rowCount(); ++row) {
+        const QUtf8StringView company = deliveries.text(row, DelEmpresa);
+        if (row == 0 || company != current) {
+            if (row > 0) closeCompany();
+            current = company;
+            quantity = 0;
+            value = 0;
+            out.section(deliveries.string(row, DelEmpresa));
+            out.header({"Colaborador", "EPI", "CA", "Tamanho", "Quantidade", "Data"});
+        }
+        out.row(deliveries, row, std::array<int, 6>{DelColaborador, DelItem, DelCa, DelTamanho, DelQuantidade, DelData});
+        quantity += deliveries.integer(row, DelQuantidade);
+        value += deliveries.integer(row, DelQuantidade) * deliveries.real(row, DelPreco);
+    }
+    if (deliveries.rowCount() > 0) closeCompany();
+}
+
+void renderTopConsumed(PackWriter &out, const ColumnarResult &deliveries, int limit) {
+    struct Total {
+        int firstRow;
+        qint64 quantity;
+    };
+    QHash<qint64, Total> totals;
+    for (int row = 0; row < deliveries.rowCount(); ++row) {
+        auto it = totals.find(deliveries.integer(row, DelItemId));
+        if (it == totals.end()) {
+            totals.insert(deliveries.integer(row, DelItemId), {row, deliveries.integer(row, DelQuantidade)});
+        } else {
+            it->quantity += deliveries.integer(row, DelQuantidade);
+        }
+    }
+    QList<Total> ranked = totals.values();
+    std::sort(ranked.begin(), ranked.end(), [](const Total &a, const Total &b) { return a.quantity > b.quantity; });
+
+    out.header({"EPI", "CA", "Tamanho", "Quantidade", "Valor"});
+    for (int i = 0; i < std::min<int>(limit, ranked.size()); ++i) {
+        const int row = ranked[i].firstRow;
+        out.row({deliveries.string(row, DelItem), deliveries.string(row, DelCa), deliveries.string(row, DelTamanho),
+                 QString::number(ranked[i].quantity),
+                 QString::number(ranked[i].quantity * deliveries.real(row, DelPreco), 'f', 2)});
+    }
+}
+
+bool writeFile(const QString &path, const QByteArray &data) {
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+// QTextDocument layout and the PDF engine share font state that is not
+// safe to drive from several threads at once, so PDFs print one at a time.
+QMutex pdfMutex;
+
+bool writePdf(const QString &path, const QByteArray &html) {
+    QMutexLocker locker(&pdfMutex);
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    {
+        QTextDocument document;
+        document.setHtml(QString::fromUtf8(html));
+        QPdfWriter writer(&file);
+        writer.setPageSize(QPageSize::A4);
+        document.print(&writer);
+    }
+    file.close();
+    return file.error() == QFileDevice::NoError && QFileInfo(path).size() > 0;
+}
+}
+
+ReportPackRunner::ReportPackRunner(const ReportPackOptions &options) : options(options) {}
+
+QString ReportPackRunner::reportTitle(PackReport report) {
+    switch (report) {
+    case PackReport::LowStock: return "Relatório de Estoque Baixo";
+    case PackReport::Inventory: return "Relatório Completo de EPIs";
+    case PackReport::Category: return "Relatório por Categoria";
+    case PackReport::CompanyDeliveries: return "Entregas por Empresa";
+    case PackReport::TopConsumed: return "EPIs Mais Consumidos";
+    }
+    return QString();
+}
+
+ReportPackResult ReportPackRunner::run() {
+    EPI_TRACE_SCOPE("ReportPackRunner::run");
+    ReportPackResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    const QDate month = QDate(options.month.year(), options.month.month(), 1);
+    const QString monthDir = QDir(options.outputDir).filePath(month.toString("yyyy-MM"));
+    if (!QDir().mkpath(monthDir)) {
+        result.errors << QString("Não foi possível criar %1").arg(monthDir);
+        return result;
+    }
+
+    // Plan: each distinct scan runs once, however many reports read it.
+    QSet<int> planned;
+    for (PackReport report : options.reports) {
+        planned.insert(scanFor(report));
+    }
+    QList<int> scans(planned.begin(), planned.end());
+    result.scans = scans.size();
+
+    std::array<ColumnarResult, ScanCount> scanResults;
+    std::array<bool, ScanCount> scanOk{};
+    QList<int> missingYears;
+    const QVariantList deliveryParams{month.toString("yyyy-MM-dd"), month.addMonths(1).toString("yyyy-MM-dd")};
+    const QString connectionPrefix = QString("report-pack-%1-").arg(quintptr(this));
+    const QString archiveDir = options.archiveDir.isEmpty()
+        ? QFileInfo(options.databaseFile).absoluteDir().filePath("arquivo")
+        : options.archiveDir;
+    QtConcurrent::blockingMap(scans, [&](int scan) {
+        EPI_TRACE_SCOPE("ReportPackRunner::scan");
+        DatabaseManager reader(options.databaseFile, connectionPrefix + QString::number(scan),
+                               DatabaseManager::OpenMode::ReadOnly);
+        if (scan == DeliveryScan) {
+            // Months before the hot horizon live in the yearly archives.
+            ArchiveManager archives(&reader, archiveDir);
+            const QString source = archives.movementsSource(deliveryParams[0].toString());
+            missingYears = archives.missingYears();
+            scanOk[scan] = reader.fetchColumnar(QString(kScanSql[scan]).arg(source), deliveryParams, &scanResults[scan]);
+        } else {
+            scanOk[scan] = reader.fetchColumnar(kScanSql[scan], QVariantList(), &scanResults[scan]);
+        }
+    });
+
+    for (int year : missingYears) {
+        result.errors << QString("Arquivo de %1 indisponível; entregas desse ano ficaram de fora").arg(year);
+    }
+
+    QMutex mutex;
+    QtConcurrent::blockingMap(options.reports, [&](PackReport report) {
+        EPI_TRACE_SCOPE("ReportPackRunner::render");
+        QElapsedTimer reportTimer;
+        reportTimer.start();
+        const QString title = reportTitle(report);
+        const int scan = scanFor(report);
+        if (!scanOk[scan]) {
+            QMutexLocker locker(&mutex);
+            result.errors << QString("%1: falha ao ler o banco de dados").arg(title);
+            return;
+        }
+
+        PackWriter out(report == PackReport::CompanyDeliveries || report == PackReport::TopConsumed
+                           ? QString("%1 - %2").arg(title, month.toString("MM/yyyy"))
+                           : title);
+        const ColumnarResult &data = scanResults[scan];
+        switch (report) {
+        case PackReport::LowStock: renderLowStock(out, data); break;
+        case PackReport::Inventory: renderInventory(out, data); break;
+        case PackReport::Category: renderCategory(out, data); break;
+        case PackReport::CompanyDeliveries: renderCompanyDeliveries(out, data); break;
+        case PackReport::TopConsumed: renderTopConsumed(out, data, options.topItems); break;
+        }
+        const QByteArray html = out.finishHtml();
+
+        const QString stem = QDir(monthDir).filePath(fileStem(report));
+        QStringList written, failed;
+        if (options.html) {
+            (writeFile(stem + ".html", html) ? written : failed) << stem + ".html";
+        }
+        if (options.csv) {
+            (writeFile(stem + ".csv", out.csv) ? written : failed) << stem + ".csv";
+        }
+        if (options.pdf) {
+            (writePdf(stem + ".pdf", html) ? written : failed) << stem + ".pdf";
+        }
+
+        QMutexLocker locker(&mutex);
+        result.files << written;
+        for (const QString &path : failed) {
+            result.errors << QString("Não foi possível gravar %1").arg(path);
+        }
+        result.slowestReportMs = std::max(result.slowestReportMs, reportTimer.elapsed());
+    });
+
+    result.files.sort();
+    result.elapsedMs = timer.elapsed();
+    result.ok = result.errors.isEmpty();
+    return result;
+}
@@ -0,0 +1,61 @@
+#ifndef REPORTPACK_H
+#define REPORTPACK_H
+
+#include <QDate>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+enum class PackReport {
+    LowStock,
+    Inventory,
+    Category,
+    CompanyDeliveries,
+    TopConsumed
+};
+
+struct ReportPackOptions {
+    QString databaseFile;
+    QString outputDir;
+    // Yearly archives; defaults to arquivo/ next to databaseFile.
+    QString archiveDir;
+    QDate month;
+    QList<PackReport> reports = {PackReport::LowStock, PackReport::Inventory, PackReport::Category,
+                                 PackReport::CompanyDeliveries, PackReport::TopConsumed};
+    bool html = true;
+    bool pdf = true;
+    bool csv = true;
+    int topItems = 20;
+};
+
+struct ReportPackResult {
+    bool ok = false;
+    QStringList files;
+    QStringList errors;
+    int scans = 0;
+    qint64 elapsedMs = 0;
+    qint64 slowestReportMs = 0;
+};
+
+// Builds the monthly management pack in two parallel phases. First the
+// reports are planned into the distinct table scans they need (the stock
+// reports share one item scan, the delivery reports one scan of the
+// month's withdrawals); each scan runs once on the thread pool over its own
+// read-only connection. Then every report renders from the shared results
+// concurrently and writes its HTML, PDF and CSV files to
+// outputDir/AAAA-MM. PDF printing is serialized across renders, and a
+// month before the hot horizon reads the archived years as well.
+//
+// Never touches the GUI connection; run it from a worker thread.
+class ReportPackRunner {
+public:
+    explicit ReportPackRunner(const ReportPackOptions &options);
+
+    ReportPackResult run();
+    static QString reportTitle(PackReport report);
+
+private:
+    ReportPackOptions options;
+};
+
+#endif // REPORTPACK_H
@@ -0,0 +1,60 @@
+#include "ReportSnapshot.h"
+#include "BackupManager.h"
+#include "CompanyCostReport.h"
+#include "ConsumptionRollup.h"
+#include "DatabaseManager.h"
+#include "ExpirationTracker.h"
+#include "Tracing.h"
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+
+ReportSnapshot::ReportSnapshot(const QString &databaseFile, const QString &snapshotDir)
+    : databaseFile(databaseFile), snapshotDir(snapshotDir) {}
+
+ReportSnapshotResult ReportSnapshot::prepare() const {
+    EPI_TRACE_SCOPE("ReportSnapshot::prepare");
+    ReportSnapshotResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    BackupManager manager(databaseFile, snapshotDir);
+    manager.setRetention(2);
+    const QStringList existing = manager.snapshots();
+    if (!existing.isEmpty()) {
+        const QDateTime taken = QDateTime::fromString(existing.first().mid(4, 15), "yyyyMMdd-hhmmss");
+        if (taken.isValid() && taken.secsTo(QDateTime::currentDateTime()) < qint64(kMaxAgeMinutes) * 60) {
+            result.ok = true;
+            result.reused = true;
+            result.path = QDir(snapshotDir).filePath(existing.first());
+            result.elapsedMs = timer.elapsed();
+            return result;
+        }
+    }
+
+    const BackupResult backup = manager.createSnapshot();
+    if (!backup.ok) {
+        result.error = backup.error;
+        return result;
+    }
+    bool warmed;
+    {
+        // The copy is private to this workstation, so catching up its
+        // derived tables takes no lock on the live database.
+        DatabaseManager copy(backup.path, QString("report-snapshot-%1").arg(quintptr(this)));
+        ConsumptionRollup rollup(&copy);
+        CompanyCostReport costs(&copy);
+        ExpirationTracker expirations(&copy);
+        warmed = rollup.refresh() && costs.refresh() && expirations.sync();
+    }
+    if (!warmed) {
+        QFile::remove(backup.path);
+        result.error = "Falha ao preparar as tabelas de relatório do instantâneo";
+        return result;
+    }
+    result.ok = true;
+    result.path = backup.path;
+    result.elapsedMs = timer.elapsed();
+    return result;
+}
@@ -0,0 +1,33 @@
+#ifndef REPORTSNAPSHOT_H
+#define REPORTSNAPSHOT_H
+
+#include <QString>
+
+struct ReportSnapshotResult {
+    bool ok = false;
+    bool reused = false;
+    QString path;
+    QString error;
+    qint64 elapsedMs = 0;
+};
+
+// Point-in-time copies of epi.db for reporting workstations. The copy is
+// taken with BackupManager into a local directory, and the incremental
+// report tables (consumo_diario, consumo_empresa, vencimentos_pendentes)
+// are brought up to date in the copy before it is handed out, so that
+// reports opened on it as an immutable database never need to write. A
+// copy younger than kMaxAgeMinutes is reused instead of taking a new one.
+class ReportSnapshot {
+public:
+    static const int kMaxAgeMinutes = 60;
+
+    ReportSnapshot(const QString &databaseFile, const QString &snapshotDir);
+
+    ReportSnapshotResult prepare() const;
+
+private:
+    QString databaseFile;
+    QString snapshotDir;
+};
+
+#endif // REPORTSNAPSHOT_H
@@ -0,0 +1,102 @@
+#ifndef ROWTYPES_H
+#define ROWTYPES_H
+
+#include <QString>
+#include "TypedQuery.h"
+
+struct ItemRow {
+    int id = 0;
+    QString nome;
+    QString ca;
+    QString tamanho;
+    QString marca;
+    QString categoria;
+    int quantidade = 0;
+    double preco = 0;
+    int estoqueMinimo = 0;
+    QString fornecedor;
+    QString dataAdicao;
+    int categoriaId = 0;
+};
+
+struct UserRow {
+    int id = 0;
+    QString nomeUsuario;
+    QString nomeCompleto;
+    QString matricula;
+    QString cpf;
+    int level = 0;
+    int empresaId = 0;
+    QString empresa;
+};
+
+struct MovementRow {
+    qint64 id = 0;
+    int itemId = 0;
+    QString item;
+    QString ca;
+    QString tamanho;
+    int alteracaoQuantidade = 0;
+    QString data;
+    QString motivo;
+    int colaboradorId = 0;
+    QString colaborador;
+    QString expirationDate;
+};
+
+namespace TypedQuery {
+
+template <>
+struct RowMapping<ItemRow> {
+    static constexpr const char *source = "itens i LEFT JOIN categorias c ON i.categoria_id = c.id";
+    static constexpr auto columns = std::make_tuple(
+        column("i.id", &ItemRow::id),
+        column("i.nome", &ItemRow::nome),
+        column("i.ca", &ItemRow::ca),
+        column("i.tamanho", &ItemRow::tamanho),
+        column("i.marca", &ItemRow::marca),
+        column("c.nome", &ItemRow::categoria),
+        column("i.quantidade", &ItemRow::quantidade),
+        column("i.preco", &ItemRow::preco),
+        column("i.estoque_minimo", &ItemRow::estoqueMinimo),
+        column("i.fornecedor", &ItemRow::fornecedor),
+        column("i.data_adicao", &ItemRow::dataAdicao),
+        column("i.categoria_id", &ItemRow::categoriaId));
+};
+
+// The password hash is deliberately not mapped; callers filter on it.
+template <>
+struct RowMapping<UserRow> {
+    static constexpr const char *source = "usuarios u LEFT JOIN empresas e ON u.empresa_id = e.id";
+    static constexpr auto columns = std::make_tuple(
+        column("u.id", &UserRow::id),
+        column("u.nome_usuario", &UserRow::nomeUsuario),
+        column("u.nome_completo", &UserRow::nomeCompleto),
+        column("u.matricula", &UserRow::matricula),
+        column("u.cpf", &UserRow::cpf),
+        column("u.level", &UserRow::level),
+        column("u.empresa_id", &UserRow::empresaId),
+        column("e.nome", &UserRow::empresa));
+};
+
+template <>
+struct RowMapping<MovementRow> {
+    static constexpr const char *source =
+        "movimentacoes m LEFT JOIN itens i ON m.item_id = i.id LEFT JOIN usuarios u ON m.colaborador_id = u.id";
+    static constexpr auto columns = std::make_tuple(
+        column("m.id", &MovementRow::id),
+        column("m.item_id", &MovementRow::itemId),
+        column("i.nome", &MovementRow::item),
+        column("i.ca", &MovementRow::ca),
+        column("i.tamanho", &MovementRow::tamanho),
+        column("m.alteracao_quantidade", &MovementRow::alteracaoQuantidade),
+        column("m.data", &MovementRow::data),
+        column("m.motivo", &MovementRow::motivo),
+        column("m.colaborador_id", &MovementRow::colaboradorId),
+        column("u.nome_completo", &MovementRow::colaborador),
+        column("m.expiration_date", &MovementRow::expirationDate));
+};
+
+}
+
+#endif // ROWTYPES_H
@@ -0,0 +1,82 @@
+#include "StockLedger.h"
+#include "Tracing.h"
+
+namespace {
+const char *const kMomentFormat = "yyyy-MM-dd hh:mm:ss";
+}
+
+StockLedger::StockLedger(DatabaseManager *dbManager) : dbManager(dbManager) {}
+
+bool StockLedger::snapshot() {
+    EPI_TRACE_SCOPE("StockLedger::snapshot");
+    if (!dbManager->beginTransaction()) {
+        return false;
+    }
+    // Written first, so the quantities below and the ledger position are
+    // read under the same write lock.
+    QVariantList inserted;
+    const bool ok =
+        dbManager->executeQuery(
+            "INSERT INTO estoque_snapshots (momento, ultimo_ledger_id) "
+            "SELECT ?, COALESCE(MAX(id), 0) FROM estoque_ledger RETURNING id",
+            {QDateTime::currentDateTime().toString(kMomentFormat)}, true, &inserted) &&
+        !inserted.isEmpty() &&
+        dbManager->executeQuery(
+            "INSERT INTO estoque_snapshot_itens (snapshot_id, item_id, quantidade) "
+            "SELECT ?, id, quantidade FROM itens WHERE COALESCE(quantidade, 0) <> 0",
+            {inserted[0].toList()[0]});
+    if (!ok) {
+        dbManager->rollbackTransaction();
+        return false;
+    }
+    return dbManager->commitTransaction();
+}
+
+bool StockLedger::snapshotIfDue() {
+    QVariantList last;
+    if (!dbManager->executeQuery("SELECT MAX(momento) FROM estoque_snapshots", {}, true, &last) || last.isEmpty()) {
+        return false;
+    }
+    const QDateTime lastMoment = QDateTime::fromString(last[0].toList()[0].toString(), kMomentFormat);
+    if (lastMoment.isValid() &&
+        lastMoment.secsTo(QDateTime::currentDateTime()) < qint64(kSnapshotIntervalHours) * 3600) {
+        return true;
+    }
+    return snapshot();
+}
+
+bool StockLedger::inventoryAt(const QDateTime &moment, QList<InventoryRow> *rows, QString *basis, QString *error) {
+    EPI_TRACE_SCOPE("StockLedger::inventoryAt");
+    const QString at = moment.toString(kMomentFormat);
+    QVariantList base;
+    if (!dbManager->executeQuery(
+            "SELECT id, momento, ultimo_ledger_id FROM estoque_snapshots WHERE momento <= ? "
+            "ORDER BY momento DESC LIMIT 1",
+            {at}, true, &base)) {
+        *error = "Falha ao consultar os instantâneos de estoque";
+        return false;
+    }
+    if (base.isEmpty()) {
+        QVariantList first;
+        dbManager->executeQuery("SELECT MIN(momento) FROM estoque_snapshots", {}, true, &first);
+        const QString since = first.isEmpty() ? QString() : first[0].toList()[0].toString();
+        *error = since.isEmpty() ? "Nenhum instantâneo de estoque registrado ainda"
+                                 : QString("Histórico de estoque disponível a partir de %1").arg(since);
+        return false;
+    }
+    const QVariantList snapshot = base[0].toList();
+    *basis = snapshot[1].toString();
+
+    if (!dbManager->fetch(
+            "SELECT q.item_id, COALESCE(i.nome, '(excluído)'), COALESCE(i.ca, ''), COALESCE(i.tamanho, ''), "
+            "SUM(q.quantidade) "
+            "FROM (SELECT item_id, quantidade FROM estoque_snapshot_itens WHERE snapshot_id = ? "
+            "UNION ALL SELECT item_id, delta FROM estoque_ledger WHERE id > ? AND data <= ?) q "
+            "LEFT JOIN itens i ON i.id = q.item_id "
+            "GROUP BY q.item_id HAVING SUM(q.quantidade) <> 0 ORDER BY 2, 4",
+            {snapshot[0], snapshot[2], at}, rows)) {
+        *error = "Falha ao calcular o estoque na data";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef STOCKLEDGER_H
+#define STOCKLEDGER_H
+
+#include <QDateTime>
+#include <QList>
+#include <QString>
+#include "DatabaseManager.h"
+#include "TypedQuery.h"
+
+struct InventoryRow {
+    int itemId = 0;
+    QString nome;
+    QString ca;
+    QString tamanho;
+    qint64 quantidade = 0;
+};
+
+// Point-in-time inventory. Triggers on itens append every quantity change,
+// from whatever path, to estoque_ledger, which refuses updates and
+// deletes. Snapshots of all quantities are taken at most once a day and
+// remember the last ledger entry they include, so stock at any moment is
+// the latest snapshot before it plus the ledger entries after that
+// snapshot up to the moment: at most a day of changes, never a replay.
+class StockLedger {
+public:
+    static const int kSnapshotIntervalHours = 24;
+
+    explicit StockLedger(DatabaseManager *dbManager);
+
+    bool snapshot();
+    bool snapshotIfDue();
+
+    // basis receives the time of the snapshot used. Fails for moments
+    // before the first snapshot, when the ledger did not exist yet.
+    bool inventoryAt(const QDateTime &moment, QList<InventoryRow> *rows, QString *basis, QString *error);
+
+private:
+    DatabaseManager *dbManager;
+};
+
+namespace TypedQuery {
+
+template <>
+struct RowMapping<InventoryRow> {
+    static constexpr const char *source = "itens i";
+    static constexpr auto columns = std::make_tuple(
+        column("i.id", &InventoryRow::itemId),
+        column("i.nome", &InventoryRow::nome),
+        column("i.ca", &InventoryRow::ca),
+        column("i.tamanho", &InventoryRow::tamanho),
+        column("i.quantidade", &InventoryRow::quantidade));
+};
+
+}
+
+#endif // STOCKLEDGER_H
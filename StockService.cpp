@@ -0,0 +1,240 @@
+#include "StockService.h"
+#include "CredentialService.h"
+#include "Tracing.h"
+#include <QDateTime>
+
+namespace {
+QString sizeLabel(const QString &size) {
+    return size.isEmpty() ? "N/A" : size;
+}
+}
+
+StockService::StockService(DatabaseManager *dbManager) : dbManager(dbManager) {}
+
+bool StockService::verifyCollaborator(int colaboradorId, const QString &password) {
+    EPI_TRACE_SCOPE("StockService::verifyCollaborator");
+    QVariantList result;
+    if (!dbManager->executeQuery("SELECT senha FROM usuarios WHERE id = ?", {colaboradorId}, true, &result) ||
+        result.isEmpty()) {
+        return false;
+    }
+    const QString stored = result[0].toList()[0].toString();
+    if (!CredentialService::matches(stored, password)) {
+        return false;
+    }
+    if (CredentialService::isLegacy(stored)) {
+        dbManager->executeQuery("UPDATE usuarios SET senha = ? WHERE id = ? AND senha = ?",
+                                {CredentialService::hashPassword(password), colaboradorId, stored});
+    }
+    return true;
+}
+
+bool StockService::balance(int colaboradorId, QList<BalanceRow> *rows) {
+    return dbManager->fetch(
+        "SELECT i.id, i.nome, i.ca, i.tamanho, -SUM(m.quantidade) "
+        "FROM (SELECT item_id, alteracao_quantidade AS quantidade FROM movimentacoes WHERE colaborador_id = ? "
+        "UNION ALL SELECT item_id, quantidade FROM saldos_arquivados WHERE colaborador_id = ?) m "
+        "JOIN itens i ON m.item_id = i.id "
+        "GROUP BY i.id HAVING SUM(m.quantidade) < 0",
+        {colaboradorId, colaboradorId}, rows);
+}
+
+int StockService::available(int itemId, const QString &owner) {
+    QVariantList result;
+    if (!dbManager->executeQuery(
+            "SELECT i.quantidade - (SELECT COALESCE(SUM(r.quantidade), 0) FROM reservas r "
+            "WHERE r.item_id = i.id AND r.expira_em > ? AND r.dono <> ?) FROM itens i WHERE i.id = ?",
+            {QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss"), owner, itemId}, true, &result) ||
+        result.isEmpty()) {
+        return 0;
+    }
+    return qMax(0, result[0].toList()[0].toInt());
+}
+
+bool StockService::reserve(const QString &owner, int itemId, int quantity, int *available) {
+    EPI_TRACE_SCOPE("StockService::reserve");
+    const QDateTime now = QDateTime::currentDateTime();
+    const QString nowText = now.toString("yyyy-MM-dd hh:mm:ss");
+    const QString expires = now.addSecs(kReservationMinutes * 60).toString("yyyy-MM-dd hh:mm:ss");
+    dbManager->executeQuery("DELETE FROM reservas WHERE expira_em <= ?", {nowText});
+
+    // Check and claim in one statement: no transaction, no lock held
+    // beyond the insert itself.
+    QVariantList reserved;
+    if (dbManager->executeQuery(
+            "INSERT INTO reservas (item_id, quantidade, dono, expira_em) "
+            "SELECT i.id, ?, ?, ? FROM itens i WHERE i.id = ? AND i.quantidade - "
+            "(SELECT COALESCE(SUM(r.quantidade), 0) FROM reservas r WHERE r.item_id = i.id AND r.expira_em > ?) >= ? "
+            "RETURNING id",
+            {quantity, owner, expires, itemId, nowText, quantity}, true, &reserved) &&
+        !reserved.isEmpty()) {
+        // The owner's batch lives as long as it keeps growing.
+        dbManager->executeQuery("UPDATE reservas SET expira_em = ? WHERE dono = ?", {expires, owner});
+        return true;
+    }
+    *available = this->available(itemId);
+    return false;
+}
+
+void StockService::release(const QString &owner, int itemId) {
+    if (itemId) {
+        dbManager->executeQuery("DELETE FROM reservas WHERE dono = ? AND item_id = ?", {owner, itemId});
+    } else {
+        dbManager->executeQuery("DELETE FROM reservas WHERE dono = ?", {owner});
+    }
+}
+
+void StockService::renew(const QString &owner) {
+    dbManager->executeQuery(
+        "UPDATE reservas SET expira_em = ? WHERE dono = ?",
+        {QDateTime::currentDateTime().addSecs(kReservationMinutes * 60).toString("yyyy-MM-dd hh:mm:ss"), owner});
+}
+
+bool StockService::withdraw(int colaboradorId, const QList<StockLine> &lines, int operatorId, const QString &owner,
+                            QString *error) {
+    EPI_TRACE_SCOPE("StockService::withdraw");
+    if (lines.isEmpty()) {
+        *error = "Nenhum item informado";
+        return false;
+    }
+    if (!dbManager->beginTransaction()) {
+        *error = "Falha ao iniciar transação";
+        return false;
+    }
+    auto fail = [this, error](const QString &message) {
+        dbManager->rollbackTransaction();
+        *error = message;
+        return false;
+    };
+
+    const QDateTime now = QDateTime::currentDateTime();
+    for (const StockLine &line : lines) {
+        if (line.quantidade <= 0) {
+            return fail(QString("Quantidade inválida para o item %1").arg(line.itemId));
+        }
+        // The write comes first so the transaction takes the write lock
+        // before reading anything. Other owners' live reservations are
+        // not available to this batch.
+        QVariantList updated;
+        if (!dbManager->executeQuery(
+                "UPDATE itens SET quantidade = quantidade - ? WHERE id = ? AND quantidade - "
+                "(SELECT COALESCE(SUM(r.quantidade), 0) FROM reservas r "
+                "WHERE r.item_id = itens.id AND r.expira_em > ? AND r.dono <> ?) >= ? "
+                "RETURNING nome, tamanho",
+                {line.quantidade, line.itemId, now.toString("yyyy-MM-dd hh:mm:ss"), owner, line.quantidade}, true,
+                &updated)) {
+            return fail(QString("Falha ao confirmar retirada do item %1").arg(line.itemId));
+        }
+        if (updated.isEmpty()) {
+            const int left = available(line.itemId, owner);
+            return fail(QString("Estoque insuficiente para o item %1: disponível %2, solicitado %3")
+                            .arg(line.itemId).arg(left).arg(line.quantidade));
+        }
+        const QVariantList item = updated[0].toList();
+        if (!owner.isEmpty() &&
+            !dbManager->executeQuery("DELETE FROM reservas WHERE dono = ? AND item_id = ?", {owner, line.itemId})) {
+            return fail(QString("Falha ao liberar reserva de '%1'").arg(item[0].toString()));
+        }
+        if (!dbManager->executeQuery(
+                "INSERT INTO movimentacoes (item_id, alteracao_quantidade, data, motivo, colaborador_id, expiration_date) "
+                "VALUES (?, ?, ?, ?, ?, ?)",
+                {line.itemId, -line.quantidade, now.toString("yyyy-MM-dd hh:mm:ss"), "Retirada por colaborador",
+                 colaboradorId, now.addDays(line.validadeDias).toString("yyyy-MM-dd")}) ||
+            !dbManager->executeQuery(
+                "INSERT INTO audit_logs (user_id, action, details, timestamp) VALUES (?, ?, ?, ?)",
+                {operatorId, "confirm_withdrawal",
+                 QString("Confirmou retirada: %1 '%2' (Tamanho: %3)")
+                     .arg(line.quantidade).arg(item[0].toString(), sizeLabel(item[1].toString())),
+                 now.toString("yyyy-MM-dd hh:mm:ss")})) {
+            return fail(QString("Falha ao confirmar retirada de '%1'").arg(item[0].toString()));
+        }
+    }
+    if (!dbManager->commitTransaction()) {
+        *error = "Falha ao gravar retiradas";
+        return false;
+    }
+    return true;
+}
+
+bool StockService::returnItems(int colaboradorId, const QList<StockLine> &lines, int operatorId, QString *error) {
+    EPI_TRACE_SCOPE("StockService::returnItems");
+    if (lines.isEmpty()) {
+        *error = "Nenhum item informado";
+        return false;
+    }
+    if (!dbManager->beginTransaction()) {
+        *error = "Falha ao iniciar transação";
+        return false;
+    }
+    auto fail = [this, error](const QString &message) {
+        dbManager->rollbackTransaction();
+        *error = message;
+        return false;
+    };
+
+    const QString now = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+    for (const StockLine &line : lines) {
+        if (line.quantidade <= 0) {
+            return fail(QString("Quantidade inválida para o item %1").arg(line.itemId));
+        }
+        QVariantList updated;
+        if (!dbManager->executeQuery(
+                "UPDATE itens SET quantidade = quantidade + ? WHERE id = ? RETURNING nome, tamanho",
+                {line.quantidade, line.itemId}, true, &updated)) {
+            return fail(QString("Falha ao confirmar devolução do item %1").arg(line.itemId));
+        }
+        if (updated.isEmpty()) {
+            return fail(QString("EPI inexistente (item %1)").arg(line.itemId));
+        }
+        const QVariantList item = updated[0].toList();
+
+        QVariantList owed;
+        if (!dbManager->executeQuery(
+                "SELECT -COALESCE(SUM(quantidade), 0) FROM ("
+                "SELECT alteracao_quantidade AS quantidade FROM movimentacoes WHERE colaborador_id = ? AND item_id = ? "
+                "UNION ALL SELECT quantidade FROM saldos_arquivados WHERE colaborador_id = ? AND item_id = ?)",
+                {colaboradorId, line.itemId, colaboradorId, line.itemId}, true, &owed) ||
+            owed.isEmpty()) {
+            return fail(QString("Falha ao consultar saldo de '%1'").arg(item[0].toString()));
+        }
+        if (line.quantidade > owed[0].toList()[0].toInt()) {
+            return fail(QString("Devolução de '%1' excede o saldo do colaborador (%2)")
+                            .arg(item[0].toString()).arg(owed[0].toList()[0].toInt()));
+        }
+
+        if (!dbManager->executeQuery(
+                "INSERT INTO movimentacoes (item_id, alteracao_quantidade, data, motivo, colaborador_id, expiration_date) "
+                "VALUES (?, ?, ?, ?, ?, ?)",
+                {line.itemId, line.quantidade, now, "Devolução por colaborador", colaboradorId, ""}) ||
+            !dbManager->executeQuery(
+                "INSERT INTO audit_logs (user_id, action, details, timestamp) VALUES (?, ?, ?, ?)",
+                {operatorId, "confirm_return",
+                 QString("Confirmou devolução: %1 '%2' (Tamanho: %3)")
+                     .arg(line.quantidade).arg(item[0].toString(), sizeLabel(item[1].toString())),
+                 now})) {
+            return fail(QString("Falha ao confirmar devolução de '%1'").arg(item[0].toString()));
+        }
+    }
+    if (!dbManager->commitTransaction()) {
+        *error = "Falha ao gravar devoluções";
+        return false;
+    }
+    return true;
+}
+
+bool StockService::adjustTo(int itemId, int quantity, const QString &motivo) {
+    QVariantList current;
+    if (!dbManager->executeQuery("SELECT COALESCE(quantidade, 0) FROM itens WHERE id = ?", {itemId}, true, &current) ||
+        current.isEmpty()) {
+        return false;
+    }
+    const int delta = quantity - current[0].toList()[0].toInt();
+    if (delta == 0) {
+        return true;
+    }
+    return dbManager->executeQuery("UPDATE itens SET quantidade = ? WHERE id = ?", {quantity, itemId}) &&
+           dbManager->executeQuery(
+               "INSERT INTO movimentacoes (item_id, alteracao_quantidade, data, motivo, colaborador_id, expiration_date) "
+               "VALUES (?, ?, ?, ?, NULL, '')",
+               {itemId, delta, QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss"), motivo});
+}
@@ -0,0 +1,84 @@
+#ifndef STOCKSERVICE_H
+#define STOCKSERVICE_H
+
+#include <QList>
+#include <QString>
+#include "DatabaseManager.h"
+#include "RowTypes.h"
+
+struct StockLine {
+    int itemId = 0;
+    int quantidade = 0;
+    int validadeDias = 0;
+};
+
+// What a collaborator still holds of one item: withdrawals minus returns,
+// archived years included.
+struct BalanceRow {
+    int itemId = 0;
+    QString nome;
+    QString ca;
+    QString tamanho;
+    int quantidade = 0;
+};
+
+// Withdrawal and return commits shared by the Retirada/Devolução tabs and
+// the API server. A batch is one transaction: every line is applied or
+// none is. Stock is decremented only while enough is left, so concurrent
+// clients cannot take an item below zero.
+//
+// Lines still being assembled (pending lists, scan batches) hold
+// reservations in reservas, keyed by an owner string per counter. They
+// are optimistic: each is a single conditional INSERT against
+// available-to-promise (stock minus live reservations), they expire on
+// their own so an abandoned counter never blocks stock for long, and a
+// commit does not need one. A commit only sees its own owner's
+// reservations as available; everyone else's are held back.
+class StockService {
+public:
+    static const int kReservationMinutes = 15;
+
+    explicit StockService(DatabaseManager *dbManager);
+
+    // Blocking: runs the password KDF on the calling thread. The GUI goes
+    // through CredentialService::verify instead.
+    bool verifyCollaborator(int colaboradorId, const QString &password);
+    bool balance(int colaboradorId, QList<BalanceRow> *rows);
+
+    // Stock not held by live reservations of other owners.
+    int available(int itemId, const QString &owner = QString());
+    // On conflict, *available is what could still be reserved.
+    bool reserve(const QString &owner, int itemId, int quantity, int *available);
+    // itemId 0 releases everything the owner holds.
+    void release(const QString &owner, int itemId = 0);
+    void renew(const QString &owner);
+
+    // operatorId is recorded in audit_logs as the user who confirmed; the
+    // owner's reservations for committed items are consumed.
+    bool withdraw(int colaboradorId, const QList<StockLine> &lines, int operatorId, const QString &owner,
+                  QString *error);
+    bool returnItems(int colaboradorId, const QList<StockLine> &lines, int operatorId, QString *error);
+    // Sets an item's stock to a counted value and records the difference
+    // as a movement with motivo. Runs inside the caller's transaction.
+    bool adjustTo(int itemId, int quantity, const QString &motivo);
+
+private:
+    DatabaseManager *dbManager;
+};
+
+namespace TypedQuery {
+
+template <>
+struct RowMapping<BalanceRow> {
+    static constexpr const char *source = "itens i";
+    static constexpr auto columns = std::make_tuple(
+        column("i.id", &BalanceRow::itemId),
+        column("i.nome", &BalanceRow::nome),
+        column("i.ca", &BalanceRow::ca),
+        column("i.tamanho", &BalanceRow::tamanho),
+        column("quantidade", &BalanceRow::quantidade));
+};
+
+}
+
+#endif // STOCKSERVICE_H
@@ -0,0 +1,649 @@
+#include "SyncManager.h"
+#include "Tracing.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QtEndian>
+
+namespace {
+const quint32 kBatchMagic = 0x45505359;  // "EPSY"
+const quint16 kBatchVersion = 2;
+const quint32 kMaxFrameBytes = 256 * 1024 * 1024;
+const int kSocketTimeoutMs = 30000;
+
+enum SyncTable : quint8 { Itens, Usuarios, Movimentacoes };
+const char *const kTableNames[] = {"itens", "usuarios", "movimentacoes"};
+
+enum FrameType : quint8 { Hello = 1, Batch, Ack, Error };
+
+QByteArray frame(FrameType type, const QByteArray &payload) {
+    QByteArray out(5, '\0');
+    out[0] = char(type);
+    qToBigEndian<quint32>(quint32(payload.size()), out.data() + 1);
+    return out + payload;
+}
+
+// 1 when a whole frame was taken off buffer, 0 when more bytes are
+// needed, -1 when the length is implausible.
+int takeFrame(QByteArray &buffer, quint8 *type, QByteArray *payload) {
+    if (buffer.size() < 5) {
+        return 0;
+    }
+    const quint32 length = qFromBigEndian<quint32>(buffer.constData() + 1);
+    if (length > kMaxFrameBytes) {
+        return -1;
+    }
+    if (buffer.size() < 5 + qint64(length)) {
+        return 0;
+    }
+    *type = quint8(buffer[0]);
+    *payload = buffer.mid(5, length);
+    buffer.remove(0, 5 + length);
+    return 1;
+}
+
+bool readFrame(QTcpSocket &socket, QByteArray &buffer, quint8 *type, QByteArray *payload) {
+    for (;;) {
+        const int taken = takeFrame(buffer, type, payload);
+        if (taken != 0) {
+            return taken > 0;
+        }
+        if (!socket.waitForReadyRead(kSocketTimeoutMs)) {
+            return false;
+        }
+        buffer += socket.readAll();
+    }
+}
+
+QByteArray helloPayload(const QString &site, const QByteArray &secret) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out << site << secret;
+    return payload;
+}
+
+// Compares every byte, so a wrong secret takes as long to reject wherever
+// it differs.
+bool sameSecret(const QByteArray &a, const QByteArray &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    char diff = 0;
+    for (int i = 0; i < a.size(); ++i) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+QString now() {
+    return QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+}
+}
+
+SyncManager::SyncManager(DatabaseManager *dbManager) : dbManager(dbManager) {}
+
+SyncManager::~SyncManager() = default;
+
+QString SyncManager::siteId() {
+    if (site.isEmpty()) {
+        QVariantList result;
+        if (dbManager->executeQuery("SELECT site FROM sync_site WHERE id = 1", {}, true, &result) && !result.isEmpty()) {
+            site = result[0].toList()[0].toString();
+        }
+    }
+    return site;
+}
+
+qint64 SyncManager::lookupId(const QString &queryStr, const QVariantList &params) {
+    QVariantList result;
+    if (!dbManager->executeQuery(queryStr, params, true, &result) || result.isEmpty()) {
+        return 0;
+    }
+    return result[0].toList()[0].toLongLong();
+}
+
+SyncManager::RowRef SyncManager::globalRef(const QString &table, qint64 localId) {
+    QVariantList result;
+    dbManager->executeQuery("SELECT origem, origem_id FROM sync_ids WHERE tabela = ? AND local_id = ? AND criado = 1",
+                            {table, localId}, true, &result);
+    if (!result.isEmpty()) {
+        const QVariantList row = result[0].toList();
+        return {row[0].toString(), row[1].toLongLong()};
+    }
+    return {siteId(), localId};
+}
+
+qint64 SyncManager::localId(const QString &table, const RowRef &ref) {
+    if (ref.id <= 0) {
+        return 0;
+    }
+    if (ref.origem == siteId()) {
+        return lookupId(QString("SELECT id FROM %1 WHERE id = ?").arg(table), {ref.id});
+    }
+    return lookupId("SELECT local_id FROM sync_ids WHERE tabela = ? AND origem = ? AND origem_id = ?",
+                    {table, ref.origem, ref.id});
+}
+
+bool SyncManager::mapRow(const QString &table, const RowRef &ref, qint64 localId, bool created) {
+    return dbManager->executeQuery(
+        "INSERT OR REPLACE INTO sync_ids (tabela, origem, origem_id, local_id, criado) VALUES (?, ?, ?, ?, ?)",
+        {table, ref.origem, ref.id, localId, created ? 1 : 0});
+}
+
+void SyncManager::recordConflict(const QString &table, const RowRef &ref, const QString &description, SyncStats *stats) {
+    ++stats->conflicts;
+    dbManager->executeQuery(
+        "INSERT INTO sync_conflitos (data, tabela, origem, origem_id, descricao) VALUES (?, ?, ?, ?, ?)",
+        {now(), table, ref.origem, ref.id, description});
+}
+
+bool SyncManager::exportBatch(const QString &peer, QByteArray *batch, qint64 *upTo, int *changes, QString *error) {
+    EPI_TRACE_SCOPE("SyncManager::exportBatch");
+    QVariantList bounds;
+    if (!dbManager->executeQuery(
+            "SELECT COALESCE((SELECT enviado FROM sync_pares WHERE par = ?), 0), COALESCE((SELECT MAX(seq) FROM sync_log), 0), "
+            "COALESCE((SELECT recebido FROM sync_pares WHERE par = ?), 0)",
+            {peer, peer}, true, &bounds) || bounds.isEmpty()) {
+        *error = "Falha ao ler o registro de alterações";
+        return false;
+    }
+    const qint64 from = bounds[0].toList()[0].toLongLong();
+    *upTo = bounds[0].toList()[1].toLongLong();
+    const qint64 acknowledged = bounds[0].toList()[2].toLongLong();
+
+    // One entry per row and origin: the last operation decides delete vs
+    // upsert, stock deltas add up, and rows are sent in order of first
+    // change so referenced items and users precede their movements.
+    QVariantList groups;
+    if (!dbManager->executeQuery(
+            "SELECT tabela, row_id, COALESCE(origem, ''), MAX(COALESCE(origem_seq, seq)), SUM(delta), "
+            "MAX(CASE WHEN op = 'D' THEN seq ELSE 0 END) = MAX(seq), MAX(op = 'I') "
+            "FROM sync_log WHERE seq > ? AND seq <= ? AND (origem IS NULL OR origem <> ?) "
+            "GROUP BY tabela, row_id, COALESCE(origem, '') ORDER BY MIN(seq)",
+            {from, *upTo, peer}, true, &groups)) {
+        *error = "Falha ao ler o registro de alterações";
+        return false;
+    }
+
+    QByteArray raw;
+    QDataStream out(&raw, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_6_0);
+    // upTo lets the peer acknowledge this batch in its next one to us;
+    // acknowledged does the same for the last batch we applied from it.
+    out << kBatchMagic << kBatchVersion << siteId() << peer << *upTo << acknowledged;
+    *changes = 0;
+    QByteArray body;
+    QDataStream entries(&body, QIODevice::WriteOnly);
+    entries.setVersion(QDataStream::Qt_6_0);
+    for (const QVariant &group : groups) {
+        const QVariantList g = group.toList();
+        const QString table = g[0].toString();
+        const qint64 rowId = g[1].toLongLong();
+        const QString origem = g[2].toString().isEmpty() ? siteId() : g[2].toString();
+        const bool deleted = g[5].toBool();
+        if (deleted && g[6].toBool()) {
+            continue;  // created and removed since the last batch
+        }
+        const quint8 code = table == "itens" ? Itens : table == "usuarios" ? Usuarios : Movimentacoes;
+
+        QVariantList fields;
+        if (!deleted) {
+            QVariantList row;
+            if (code == Itens) {
+                dbManager->executeQuery(
+                    "SELECT i.nome, i.ca, i.tamanho, i.marca, c.nome, i.preco, i.estoque_minimo, i.fornecedor, i.data_adicao, "
+                    "COALESCE(i.quantidade, 0) "
+                    "FROM itens i LEFT JOIN categorias c ON c.id = i.categoria_id WHERE i.id = ?",
+                    {rowId}, true, &row);
+            } else if (code == Usuarios) {
+                dbManager->executeQuery(
+                    "SELECT u.nome_usuario, u.nome_completo, u.matricula, u.cpf, u.senha, u.level, e.nome, e.cnpj "
+                    "FROM usuarios u LEFT JOIN empresas e ON e.id = u.empresa_id WHERE u.id = ?",
+                    {rowId}, true, &row);
+            } else {
+                dbManager->executeQuery(
+                    "SELECT item_id, colaborador_id, alteracao_quantidade, data, motivo, expiration_date "
+                    "FROM movimentacoes WHERE id = ?",
+                    {rowId}, true, &row);
+            }
+            if (row.isEmpty()) {
+                continue;  // gone since (e.g. archived); its delete follows or never replicates
+            }
+            fields = row[0].toList();
+            if (code == Movimentacoes) {
+                const RowRef item = globalRef("itens", fields[0].toLongLong());
+                const RowRef colaborador = fields[1].isNull() ? RowRef() : globalRef("usuarios", fields[1].toLongLong());
+                fields = {item.origem, item.id, colaborador.origem, colaborador.id, fields[2], fields[3], fields[4], fields[5]};
+            }
+        }
+        const RowRef ref = globalRef(table, rowId);
+        entries << code << deleted << origem << g[3].toLongLong() << ref.origem << ref.id << qint32(g[4].toInt())
+                << fields;
+        ++*changes;
+    }
+    out << qint32(*changes);
+    raw += body;
+    *batch = qCompress(raw, 9);
+    return true;
+}
+
+bool SyncManager::markSent(const QString &peer, qint64 upTo) {
+    return dbManager->executeQuery(
+        "INSERT INTO sync_pares (par, enviado, sincronizado_em) VALUES (?, ?, ?) "
+        "ON CONFLICT(par) DO UPDATE SET enviado = MAX(enviado, excluded.enviado), sincronizado_em = excluded.sincronizado_em",
+        {peer, upTo, now()});
+}
+
+bool SyncManager::applyBatch(const QByteArray &batch, SyncStats *stats, QString *error) {
+    EPI_TRACE_SCOPE("SyncManager::applyBatch");
+    const QByteArray raw = qUncompress(batch);
+    QDataStream in(raw);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0;
+    quint16 version = 0;
+    QString sender;
+    QString target;
+    qint64 senderUpTo = 0;
+    qint64 acknowledged = 0;
+    qint32 count = 0;
+    in >> magic >> version >> sender >> target >> senderUpTo >> acknowledged >> count;
+    if (in.status() != QDataStream::Ok || magic != kBatchMagic || version != kBatchVersion) {
+        *error = "Lote de sincronização inválido";
+        return false;
+    }
+    if (target != siteId()) {
+        *error = QString("Lote destinado a outro site (%1)").arg(target);
+        return false;
+    }
+    stats->origem = sender;
+
+    QHash<QString, qint64> received;
+    QVariantList rows;
+    dbManager->executeQuery("SELECT origem, ultimo_seq FROM sync_recebidos", {}, true, &rows);
+    for (const QVariant &row : rows) {
+        received.insert(row.toList()[0].toString(), row.toList()[1].toLongLong());
+    }
+
+    if (!dbManager->beginTransaction()) {
+        *error = "Falha ao iniciar transação";
+        return false;
+    }
+    auto fail = [this, error](const QString &message) {
+        dbManager->rollbackTransaction();
+        *error = message;
+        return false;
+    };
+
+    QHash<QString, qint64> highest;
+    for (qint32 i = 0; i < count; ++i) {
+        quint8 code = 0;
+        bool deleted = false;
+        QString origem;
+        qint64 origemSeq = 0;
+        RowRef ref;
+        qint32 delta = 0;
+        QVariantList fields;
+        in >> code >> deleted >> origem >> origemSeq >> ref.origem >> ref.id >> delta >> fields;
+        if (in.status() != QDataStream::Ok || code > Movimentacoes) {
+            return fail("Lote de sincronização corrompido");
+        }
+        if (origem == siteId() || origemSeq <= received.value(origem, 0)) {
+            ++stats->skipped;
+            continue;
+        }
+        const QString table = kTableNames[code];
+        const qint64 before = lookupId("SELECT COALESCE(MAX(seq), 0) FROM sync_log", {});
+        bool ok;
+        if (code == Itens) {
+            ok = applyItem(ref, deleted, delta, fields, stats);
+        } else if (code == Usuarios) {
+            ok = applyUser(ref, deleted, fields, stats);
+        } else {
+            ok = deleted || applyMovement(ref, fields, stats);
+        }
+        // What the triggers just logged is relayed with its origin and
+        // never echoed back there.
+        if (!ok || !dbManager->executeQuery("UPDATE sync_log SET origem = ?, origem_seq = ? WHERE seq > ?",
+                                            {origem, origemSeq, before})) {
+            return fail(QString("Falha ao aplicar alteração de %1 %2").arg(table).arg(ref.id));
+        }
+        highest[origem] = qMax(highest.value(origem), origemSeq);
+        ++stats->applied;
+    }
+
+    for (auto it = highest.cbegin(); it != highest.cend(); ++it) {
+        if (!dbManager->executeQuery(
+                "INSERT INTO sync_recebidos (origem, ultimo_seq) VALUES (?, ?) "
+                "ON CONFLICT(origem) DO UPDATE SET ultimo_seq = MAX(ultimo_seq, excluded.ultimo_seq)",
+                {it.key(), it.value()})) {
+            return fail("Falha ao gravar a posição de sincronização");
+        }
+    }
+    // Both directions' watermarks move here: what we now hold from the
+    // sender, and what the sender confirms it holds from us.
+    if (!dbManager->executeQuery(
+            "INSERT INTO sync_pares (par, enviado, recebido, sincronizado_em) VALUES (?, ?, ?, ?) "
+            "ON CONFLICT(par) DO UPDATE SET enviado = MAX(enviado, excluded.enviado), "
+            "recebido = MAX(recebido, excluded.recebido), sincronizado_em = excluded.sincronizado_em",
+            {sender, acknowledged, senderUpTo, now()})) {
+        return fail("Falha ao registrar o site de origem");
+    }
+    if (!dbManager->commitTransaction()) {
+        *error = "Falha ao gravar o lote";
+        return false;
+    }
+    return true;
+}
+
+bool SyncManager::applyItem(const RowRef &ref, bool deleted, int delta, const QVariantList &fields, SyncStats *stats) {
+    qint64 id = localId("itens", ref);
+    if (deleted) {
+        return (!id || dbManager->executeQuery("DELETE FROM itens WHERE id = ?", {id})) &&
+               dbManager->executeQuery("DELETE FROM sync_ids WHERE tabela = 'itens' AND origem = ? AND origem_id = ?",
+                                       {ref.origem, ref.id});
+    }
+    if (fields.size() != 10) {
+        return false;
+    }
+    const QVariant &nome = fields[0];
+    const QVariant &ca = fields[1];
+    const QVariant &tamanho = fields[2];
+    QVariant categoriaId;
+    if (!fields[4].toString().isEmpty()) {
+        if (!dbManager->executeQuery("INSERT OR IGNORE INTO categorias (nome) VALUES (?)", {fields[4]})) {
+            return false;
+        }
+        categoriaId = lookupId("SELECT id FROM categorias WHERE nome = ?", {fields[4]});
+    }
+
+    const bool mapped = id != 0;
+    if (!id) {
+        id = lookupId("SELECT id FROM itens WHERE nome IS ? AND ca IS ? AND tamanho IS ? ORDER BY id LIMIT 1",
+                      {nome, ca, tamanho});
+        if (id && !mapRow("itens", ref, id, false)) {
+            return false;
+        }
+    }
+    // A row new to this site starts from the sender's stock and one it
+    // already had keeps its own; only rows mapped by an earlier batch take
+    // the deltas, so one site's stock is never added to another's.
+    qint64 quantity = fields[9].toLongLong();
+    if (id) {
+        quantity = lookupId("SELECT COALESCE(quantidade, 0) FROM itens WHERE id = ?", {id}) + (mapped ? delta : 0);
+    }
+    if (quantity < 0) {
+        recordConflict("itens", ref,
+                       QString("Estoque de '%1' ficaria em %2 após somar as retiradas dos sites; ajustado para 0")
+                           .arg(nome.toString()).arg(quantity),
+                       stats);
+        quantity = 0;
+    }
+
+    const QVariantList values = {nome, categoriaId, quantity, fields[5], fields[6], fields[7], fields[8], ca, tamanho, fields[3]};
+    if (id) {
+        return dbManager->executeQuery(
+            "UPDATE itens SET nome = ?, categoria_id = ?, quantidade = ?, preco = ?, estoque_minimo = ?, "
+            "fornecedor = ?, data_adicao = ?, ca = ?, tamanho = ?, marca = ? WHERE id = ?",
+            values + QVariantList{id});
+    }
+    QVariantList inserted;
+    if (!dbManager->executeQuery(
+            "INSERT INTO itens (nome, categoria_id, quantidade, preco, estoque_minimo, fornecedor, data_adicao, ca, tamanho, marca) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?) RETURNING id",
+            values, true, &inserted) || inserted.isEmpty()) {
+        return false;
+    }
+    // The insert trigger logged the whole stock; relay only the delta, as
+    // sites further on take their stock from the fields too.
+    id = inserted[0].toList()[0].toLongLong();
+    return dbManager->executeQuery(
+               "UPDATE sync_log SET delta = ? WHERE seq = (SELECT MAX(seq) FROM sync_log WHERE tabela = 'itens' AND row_id = ?)",
+               {delta, id}) &&
+           mapRow("itens", ref, id, true);
+}
+
+bool SyncManager::applyUser(const RowRef &ref, bool deleted, const QVariantList &fields, SyncStats *stats) {
+    qint64 id = localId("usuarios", ref);
+    if (deleted) {
+        return (!id || dbManager->executeQuery("DELETE FROM usuarios WHERE id = ?", {id})) &&
+               dbManager->executeQuery("DELETE FROM sync_ids WHERE tabela = 'usuarios' AND origem = ? AND origem_id = ?",
+                                       {ref.origem, ref.id});
+    }
+    if (fields.size() != 8) {
+        return false;
+    }
+    QVariant empresaId;
+    if (!fields[6].toString().isEmpty()) {
+        if (!dbManager->executeQuery("INSERT OR IGNORE INTO empresas (nome, cnpj) VALUES (?, ?)", {fields[6], fields[7]})) {
+            return false;
+        }
+        empresaId = lookupId("SELECT id FROM empresas WHERE nome = ? OR cnpj = ? ORDER BY nome = ? DESC LIMIT 1",
+                             {fields[6], fields[7], fields[6]});
+    }
+
+    if (!id) {
+        // Same login, or same registration/CPF for collaborators without one.
+        for (int key : {0, 2, 3}) {
+            if (id || fields[key].toString().isEmpty()) continue;
+            id = lookupId(QString("SELECT id FROM usuarios WHERE %1 = ? ORDER BY id LIMIT 1")
+                              .arg(key == 0 ? "nome_usuario" : key == 2 ? "matricula" : "cpf"),
+                          {fields[key]});
+        }
+        if (id && !mapRow("usuarios", ref, id, false)) {
+            return false;
+        }
+    }
+
+    const QVariantList values = {fields[0], fields[1], fields[2], fields[3], fields[4], fields[5], empresaId};
+    QVariantList written;
+    const bool ok =
+        id ? dbManager->executeQuery(
+                 "UPDATE OR IGNORE usuarios SET nome_usuario = ?, nome_completo = ?, matricula = ?, cpf = ?, senha = ?, "
+                 "level = ?, empresa_id = ? WHERE id = ? RETURNING id",
+                 values + QVariantList{id}, true, &written)
+           : dbManager->executeQuery(
+                 "INSERT OR IGNORE INTO usuarios (nome_usuario, nome_completo, matricula, cpf, senha, level, empresa_id) "
+                 "VALUES (?, ?, ?, ?, ?, ?, ?) RETURNING id",
+                 values, true, &written);
+    if (!ok) {
+        return false;
+    }
+    if (written.isEmpty()) {
+        recordConflict("usuarios", ref,
+                       QString("Usuário '%1' não aplicado: login, matrícula ou CPF já pertence a outro cadastro")
+                           .arg(fields[1].toString()),
+                       stats);
+        return true;
+    }
+    return id || mapRow("usuarios", ref, written[0].toList()[0].toLongLong(), true);
+}
+
+bool SyncManager::applyMovement(const RowRef &ref, const QVariantList &fields, SyncStats *stats) {
+    if (fields.size() != 8) {
+        return false;
+    }
+    if (localId("movimentacoes", ref)) {
+        return true;
+    }
+    const qint64 itemId = localId("itens", {fields[0].toString(), fields[1].toLongLong()});
+    if (!itemId) {
+        recordConflict("movimentacoes", ref, "Movimentação de EPI ausente neste site; ignorada", stats);
+        return true;
+    }
+    QVariant colaboradorId;
+    if (fields[3].toLongLong() > 0) {
+        const qint64 id = localId("usuarios", {fields[2].toString(), fields[3].toLongLong()});
+        if (id) {
+            colaboradorId = id;
+        } else {
+            recordConflict("movimentacoes", ref, "Colaborador da movimentação ausente neste site", stats);
+        }
+    }
+    // Stock already moved with the item's delta; this is the history row.
+    QVariantList inserted;
+    return dbManager->executeQuery(
+               "INSERT INTO movimentacoes (item_id, colaborador_id, alteracao_quantidade, data, motivo, expiration_date) "
+               "VALUES (?, ?, ?, ?, ?, ?) RETURNING id",
+               {itemId, colaboradorId, fields[4], fields[5], fields[6], fields[7]}, true, &inserted) &&
+           !inserted.isEmpty() && mapRow("movimentacoes", ref, inserted[0].toList()[0].toLongLong(), true);
+}
+
+bool SyncManager::exportFile(const QString &peer, const QString &fileName, int *changes, QString *error) {
+    QByteArray batch;
+    qint64 upTo = 0;
+    if (!exportBatch(peer, &batch, &upTo, changes, error)) {
+        return false;
+    }
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(batch) != batch.size() || !file.commit()) {
+        *error = QString("Falha ao gravar %1").arg(fileName);
+        return false;
+    }
+    // The watermark stays put until a batch from the peer acknowledges
+    // this one, so each export repeats what may not have arrived yet;
+    // importing a change twice is harmless.
+    return true;
+}
+
+bool SyncManager::importFile(const QString &fileName, SyncStats *stats, QString *error) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *error = QString("Falha ao abrir %1").arg(fileName);
+        return false;
+    }
+    return applyBatch(file.readAll(), stats, error);
+}
+
+bool SyncManager::serve(const QHostAddress &address, quint16 port, QString *error) {
+    if (sharedSecret.isEmpty() && !address.isLoopback()) {
+        *error = "Defina um segredo de sincronização para aceitar conexões fora do localhost";
+        return false;
+    }
+    server = std::make_unique<QTcpServer>();
+    QObject::connect(server.get(), &QTcpServer::newConnection, server.get(), [this] {
+        while (QTcpSocket *socket = server->nextPendingConnection()) {
+            // Per peer: hello, its batch (answered with ours), then its ack.
+            struct Session {
+                QByteArray buffer;
+                QString peer;
+                qint64 upTo = -1;
+            };
+            auto session = std::make_shared<Session>();
+            QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+            QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, socket, session] {
+                session->buffer += socket->readAll();
+                quint8 type = 0;
+                QByteArray payload;
+                int taken;
+                while ((taken = takeFrame(session->buffer, &type, &payload)) > 0) {
+                    QString message;
+                    if (type == Hello && session->peer.isEmpty()) {
+                        QDataStream in(payload);
+                        QByteArray secret;
+                        in >> session->peer >> secret;
+                        if (session->peer.isEmpty() || !sameSecret(secret, sharedSecret)) {
+                            message = "Site não autorizado";
+                        } else {
+                            socket->write(frame(Hello, helloPayload(siteId(), QByteArray())));
+                            continue;
+                        }
+                    } else if (type == Batch && !session->peer.isEmpty() && session->upTo < 0) {
+                        SyncStats stats;
+                        QByteArray reply;
+                        int changes = 0;
+                        if (applyBatch(payload, &stats, &message) &&
+                            exportBatch(session->peer, &reply, &session->upTo, &changes, &message)) {
+                            qDebug() << "Sync:" << stats.applied << "alterações de" << session->peer
+                                     << "aplicadas," << changes << "enviadas";
+                            socket->write(frame(Batch, reply));
+                            continue;
+                        }
+                    } else if (type == Ack && session->upTo >= 0) {
+                        markSent(session->peer, session->upTo);
+                        socket->disconnectFromHost();
+                        return;
+                    } else if (type == Error) {
+                        qDebug() << "Sync Error from" << session->peer << ":" << QString::fromUtf8(payload);
+                        socket->disconnectFromHost();
+                        return;
+                    } else {
+                        message = "Sequência de sincronização inválida";
+                    }
+                    socket->write(frame(Error, message.toUtf8()));
+                    socket->disconnectFromHost();
+                    return;
+                }
+                if (taken < 0) {
+                    socket->abort();
+                }
+            });
+        }
+    });
+    if (!server->listen(address, port)) {
+        *error = server->errorString();
+        return false;
+    }
+    return true;
+}
+
+bool SyncManager::syncWith(const QString &host, quint16 port, SyncStats *received, int *sent, QString *error) {
+    EPI_TRACE_SCOPE("SyncManager::syncWith");
+    QTcpSocket socket;
+    socket.connectToHost(host, port);
+    if (!socket.waitForConnected(kSocketTimeoutMs)) {
+        *error = socket.errorString();
+        return false;
+    }
+    QByteArray buffer;
+    quint8 type = 0;
+    QByteArray payload;
+    auto expect = [&](FrameType wanted) {
+        if (!readFrame(socket, buffer, &type, &payload)) {
+            *error = "Conexão interrompida: " + socket.errorString();
+            return false;
+        }
+        if (type == Error) {
+            *error = QString::fromUtf8(payload);
+            return false;
+        }
+        if (type != wanted) {
+            *error = "Resposta inesperada do site remoto";
+            return false;
+        }
+        return true;
+    };
+
+    socket.write(frame(Hello, helloPayload(siteId(), sharedSecret)));
+    if (!expect(Hello)) {
+        return false;
+    }
+    QString peer;
+    QDataStream hello(payload);
+    hello >> peer;
+
+    QByteArray batch;
+    qint64 upTo = 0;
+    if (!exportBatch(peer, &batch, &upTo, sent, error)) {
+        return false;
+    }
+    socket.write(frame(Batch, batch));
+    if (!expect(Batch)) {
+        return false;
+    }
+    // The peer only answers with its batch after committing ours.
+    markSent(peer, upTo);
+    if (!applyBatch(payload, received, error)) {
+        socket.write(frame(Error, error->toUtf8()));
+        socket.waitForBytesWritten(kSocketTimeoutMs);
+        return false;
+    }
+    socket.write(frame(Ack, QByteArray()));
+    socket.waitForBytesWritten(kSocketTimeoutMs);
+    socket.disconnectFromHost();
+    return true;
+}
@@ -0,0 +1,88 @@
+#ifndef SYNCMANAGER_H
+#define SYNCMANAGER_H
+
+#include <QByteArray>
+#include <QHostAddress>
+#include <QString>
+#include <memory>
+#include "DatabaseManager.h"
+
+class QTcpServer;
+
+struct SyncStats {
+    QString origem;       // site that produced the batch
+    int applied = 0;
+    int skipped = 0;      // already applied earlier (re-sent batch)
+    int conflicts = 0;
+};
+
+// Replicates itens, usuarios and movimentacoes between sites. Triggers log
+// each change in sync_log with a local sequence number; a batch for a peer
+// carries the log past that peer's watermark, folded to one entry per row
+// (latest field values, summed stock delta) and compressed, so a sync
+// costs what changed since the last one.
+//
+// Rows are identified across sites by (origin site, id at origin), mapped
+// to local ids in sync_ids; items and users first seen from another site
+// are matched by nome/CA/tamanho and nome_usuario before being inserted.
+// Applying is idempotent: each origin's highest applied sequence is kept
+// in sync_recebidos and older changes are skipped.
+//
+// Conflict rules: item fields and users are last-writer-wins in arrival
+// order. Stock is merged by adding deltas, so withdrawals at two sites
+// both count; a sum that would go below zero is clamped to zero and
+// recorded in sync_conflitos for review. An item a site first learns of
+// takes the sender's quantity instead, and an item it already had keeps
+// its own, so stock that existed before the first sync is never summed. Changes are relayed with their
+// origin, so sites may sync through a hub, as long as any two sites are
+// linked by a single path.
+class SyncManager {
+public:
+    explicit SyncManager(DatabaseManager *dbManager);
+    ~SyncManager();
+
+    QString siteId();
+
+    // Batch of the changes the peer has not acknowledged; upTo is the last
+    // local sequence included, to pass to markSent() once it is applied.
+    // Every batch also acknowledges the last one applied from the peer, so
+    // applyBatch() advances the watermark of the site that sent it.
+    bool exportBatch(const QString &peer, QByteArray *batch, qint64 *upTo, int *changes, QString *error);
+    bool markSent(const QString &peer, qint64 upTo);
+    bool applyBatch(const QByteArray &batch, SyncStats *stats, QString *error);
+
+    // File transport; the watermark advances when the peer's next file
+    // acknowledges this one, and until then each export repeats it.
+    bool exportFile(const QString &peer, const QString &fileName, int *changes, QString *error);
+    bool importFile(const QString &fileName, SyncStats *stats, QString *error);
+
+    // Socket transport: serve() answers peers from the event loop;
+    // syncWith() runs one exchange in both directions, blocking. The
+    // serving side rejects peers that do not send the secret, and without
+    // one it only binds to a loopback address.
+    void setSharedSecret(const QByteArray &secret) { sharedSecret = secret; }
+    bool serve(const QHostAddress &address, quint16 port, QString *error);
+    bool syncWith(const QString &host, quint16 port, SyncStats *received, int *sent, QString *error);
+
+private:
+    struct RowRef {
+        QString origem;
+        qint64 id = 0;
+    };
+
+    RowRef globalRef(const QString &table, qint64 localId);
+    qint64 localId(const QString &table, const RowRef &ref);
+    bool mapRow(const QString &table, const RowRef &ref, qint64 localId, bool created);
+    bool applyItem(const RowRef &ref, bool deleted, int delta, const QVariantList &fields, SyncStats *stats);
+    bool applyUser(const RowRef &ref, bool deleted, const QVariantList &fields, SyncStats *stats);
+    bool applyMovement(const RowRef &ref, const QVariantList &fields, SyncStats *stats);
+    void recordConflict(const QString &table, const RowRef &ref, const QString &description, SyncStats *stats);
+    qint64 lookupId(const QString &queryStr, const QVariantList &params);
+
+    DatabaseManager *dbManager;
+    QString site;
+    QByteArray sharedSecret;
+    std::unique_ptr<QTcpServer> server;
+};
+
+#endif // SYNCMANAGER_H
@@ -0,0 +1,99 @@
+#include "Tracing.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+namespace Tracing {
+
+namespace {
+quint64 currentThreadId() {
+    thread_local const quint64 id = quint64(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+    return id;
+}
+}
+
+Recorder &Recorder::instance() {
+    static Recorder recorder;
+    return recorder;
+}
+
+Recorder::Recorder() {
+    clock.start();
+}
+
+void Recorder::record(const char *name, qint64 startNs, qint64 durationNs) {
+    const quint64 index = writeIndex.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = ring[index % kCapacity];
+
+    // Odd sequence marks the slot as being written; readers skip it.
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.event.name = name;
+    slot.event.startNs = startNs;
+    slot.event.durationNs = durationNs;
+    slot.event.threadId = currentThreadId();
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+QList<Event> Recorder::snapshot() const {
+    const quint64 end = writeIndex.load(std::memory_order_acquire);
+    quint64 begin = firstIndex.load(std::memory_order_relaxed);
+    if (end - begin > kCapacity) {
+        begin = end - kCapacity;
+    }
+
+    QList<Event> events;
+    events.reserve(int(end - begin));
+    for (quint64 index = begin; index < end; ++index) {
+        const Slot &slot = ring[index % kCapacity];
+        const quint64 before = slot.sequence.load(std::memory_order_acquire);
+        if (before != 2 * index + 2) {
+            continue;
+        }
+        Event event = slot.event;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == before) {
+            events.append(event);
+        }
+    }
+    return events;
+}
+
+bool Recorder::exportChromeTrace(const QString &fileName) const {
+    QJsonArray traceEvents;
+    const qint64 pid = QCoreApplication::applicationPid();
+    for (const auto &event : snapshot()) {
+        QJsonObject entry;
+        entry["name"] = QString::fromLatin1(event.name);
+        entry["cat"] = "epi";
+        entry["ph"] = "X";
+        entry["ts"] = event.startNs / 1000.0;
+        entry["dur"] = event.durationNs / 1000.0;
+        entry["pid"] = pid;
+        entry["tid"] = qint64(event.threadId);
+        traceEvents.append(entry);
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = traceEvents;
+    root["displayTimeUnit"] = "ms";
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Trace Export Error:" << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    file.close();
+    return true;
+}
+
+void Recorder::clear() {
+    firstIndex.store(writeIndex.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+} // namespace Tracing
@@ -0,0 +1,71 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <QString>
+#include <QList>
+#include <QElapsedTimer>
+#include <atomic>
+
+namespace Tracing {
+
+struct Event {
+    const char *name = nullptr;
+    qint64 startNs = 0;
+    qint64 durationNs = 0;
+    quint64 threadId = 0;
+};
+
+// Fixed-size ring of completed spans. A writer claims a slot with a single
+// atomic increment and publishes it through the slot's sequence number, so
+// recording never takes a lock; once the ring is full the oldest spans are
+// overwritten. Span names must be string literals.
+class Recorder {
+public:
+    static Recorder &instance();
+
+    qint64 now() const { return clock.nsecsElapsed(); }
+    void record(const char *name, qint64 startNs, qint64 durationNs);
+    QList<Event> snapshot() const;
+    bool exportChromeTrace(const QString &fileName) const;
+    void clear();
+
+private:
+    Recorder();
+
+    static constexpr quint64 kCapacity = 16384;
+    struct Slot {
+        std::atomic<quint64> sequence{0};
+        Event event;
+    };
+    Slot ring[kCapacity];
+    std::atomic<quint64> writeIndex{0};
+    std::atomic<quint64> firstIndex{0};
+    QElapsedTimer clock;
+};
+
+class Span {
+public:
+    explicit Span(const char *name) : name(name), startNs(Recorder::instance().now()) {}
+    ~Span() {
+        Recorder &recorder = Recorder::instance();
+        recorder.record(name, startNs, recorder.now() - startNs);
+    }
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+private:
+    const char *name;
+    qint64 startNs;
+};
+
+} // namespace Tracing
+
+#ifdef EPI_TRACING_ENABLED
+#define EPI_TRACE_CONCAT_(a, b) a##b
+#define EPI_TRACE_CONCAT(a, b) EPI_TRACE_CONCAT_(a, b)
+#define EPI_TRACE_SCOPE(name) Tracing::Span EPI_TRACE_CONCAT(epiTraceSpan_, __LINE__)(name)
+#else
+#define EPI_TRACE_SCOPE(name) ((void)0)
+#endif
+
+#endif // TRACING_H
@@ -0,0 +1,147 @@
+#ifndef TYPEDQUERY_H
+#define TYPEDQUERY_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QSqlQuery>
+#include <QString>
+#include <QStringList>
+#include <sqlite3.h>
+#include <tuple>
+#include <utility>
+#include "DatabaseManager.h"
+#include "Tracing.h"
+
+// Compile-time row mapping for DatabaseManager::select/fetch. Each row type
+// specializes RowMapping with the FROM clause it reads and a tuple of
+// columns; a column binds a SQL expression to a struct member, and the
+// member's type picks the sqlite3_column_* reader at compile time.
+namespace TypedQuery {
+
+template <typename Row, typename T>
+struct Column {
+    const char *expr;
+    T Row::*member;
+};
+
+template <typename Row, typename T>
+constexpr Column<Row, T> column(const char *expr, T Row::*member) {
+    return {expr, member};
+}
+
+template <typename Row>
+struct RowMapping;
+
+inline void read(sqlite3_stmt *stmt, int col, int &out) {
+    out = sqlite3_column_int(stmt, col);
+}
+
+inline void read(sqlite3_stmt *stmt, int col, qint64 &out) {
+    out = sqlite3_column_int64(stmt, col);
+}
+
+inline void read(sqlite3_stmt *stmt, int col, double &out) {
+    out = sqlite3_column_double(stmt, col);
+}
+
+inline void read(sqlite3_stmt *stmt, int col, QString &out) {
+    const char *text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, col));
+    out = text ? QString::fromUtf8(text, sqlite3_column_bytes(stmt, col)) : QString();
+}
+
+// QtSql fallback, used when the driver's SQLite is not the one linked here.
+inline void read(const QSqlQuery &query, int col, int &out) {
+    out = query.value(col).toInt();
+}
+
+inline void read(const QSqlQuery &query, int col, qint64 &out) {
+    out = query.value(col).toLongLong();
+}
+
+inline void read(const QSqlQuery &query, int col, double &out) {
+    out = query.value(col).toDouble();
+}
+
+inline void read(const QSqlQuery &query, int col, QString &out) {
+    out = query.value(col).toString();
+}
+
+template <typename Row>
+constexpr int columnCount() {
+    return int(std::tuple_size_v<std::decay_t<decltype(RowMapping<Row>::columns)>>);
+}
+
+template <typename Source, typename Row, std::size_t... I>
+void decode(const Source &source, Row &row, std::index_sequence<I...>) {
+    (read(source, int(I), row.*(std::get<I>(RowMapping<Row>::columns).member)), ...);
+}
+
+template <typename Source, typename Row>
+void decode(const Source &source, Row &row) {
+    decode(source, row, std::make_index_sequence<std::size_t(columnCount<Row>())>());
+}
+
+template <typename Row, std::size_t... I>
+QString buildSelectList(std::index_sequence<I...>) {
+    return QStringList{QString::fromLatin1(std::get<I>(RowMapping<Row>::columns).expr)...}.join(", ");
+}
+
+// "i.id, i.nome, ..." in mapping order, for queries that need their own FROM.
+template <typename Row>
+const QString &selectList() {
+    static const QString list = buildSelectList<Row>(std::make_index_sequence<std::size_t(columnCount<Row>())>());
+    return list;
+}
+
+}
+
+template <typename Row>
+bool DatabaseManager::fetch(const QString &queryStr, const QVariantList &params, QList<Row> *rows) {
+    EPI_TRACE_SCOPE("DatabaseManager::fetch");
+    if (!rawDb) {
+        QSqlQuery query(db);
+        qint64 prepareNs = 0;
+        qint64 execNs = 0;
+        if (!execForwardOnly(query, queryStr, params, TypedQuery::columnCount<Row>(), &prepareNs, &execNs)) {
+            return false;
+        }
+        QElapsedTimer fetchTimer;
+        fetchTimer.start();
+        rows->clear();
+        while (query.next()) {
+            rows->emplaceBack();
+            TypedQuery::decode(query, rows->last());
+        }
+        recordQuery(queryStr, params, prepareNs, execNs, fetchTimer.nsecsElapsed(), rows->size(), true);
+        return true;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    sqlite3_stmt *stmt = prepareTyped(queryStr, params, TypedQuery::columnCount<Row>());
+    const qint64 prepareNs = timer.nsecsElapsed();
+    if (!stmt) {
+        recordQuery(queryStr, params, prepareNs, 0, 0, 0, false);
+        return false;
+    }
+
+    rows->clear();
+    int rc = sqlite3_step(stmt);
+    const qint64 execNs = timer.nsecsElapsed() - prepareNs;
+    while (rc == SQLITE_ROW) {
+        rows->emplaceBack();
+        TypedQuery::decode(stmt, rows->last());
+        rc = sqlite3_step(stmt);
+    }
+    return finishTyped(stmt, rc, queryStr, params, prepareNs, execNs,
+                       timer.nsecsElapsed() - prepareNs - execNs, rows->size());
+}
+
+template <typename Row>
+bool DatabaseManager::select(const QString &clause, const QVariantList &params, QList<Row> *rows) {
+    static const QString base = QString("SELECT %1 FROM %2 ")
+                                    .arg(TypedQuery::selectList<Row>(),
+                                         QString::fromLatin1(TypedQuery::RowMapping<Row>::source));
+    return fetch(base + clause, params, rows);
+}
+
+#endif // TYPEDQUERY_H
@@ -1,9 +1,39 @@
 #include <QApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QMessageBox>
+#include <QStandardPaths>
 #include "EPIApp.h"
+#include "HeadlessCommands.h"
+#include "ReportSnapshot.h"
 
 int main(int argc, char *argv[]) {
+    if (Headless::isCommand(argc, argv)) {
+        return Headless::exec(argc, argv);
+    }
+
     QApplication app(argc, argv);
-    EPIApp window;
+    // --read-only [arquivo.db] browses reports on a point-in-time copy: the
+    // given file, or a fresh local snapshot of epi.db.
+    QString snapshotFile;
+    const QStringList args = app.arguments();
+    if (args.contains("--read-only")) {
+        snapshotFile = Headless::argumentAfter(args, "--read-only", QString());
+        if (snapshotFile.isEmpty()) {
+            const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+            ReportSnapshot snapshot(QDir::current().absoluteFilePath("epi.db"), QDir(cacheDir).filePath("instantaneos"));
+            const ReportSnapshotResult result = snapshot.prepare();
+            if (!result.ok) {
+                QMessageBox::critical(nullptr, "Erro", QString("Falha ao preparar o instantâneo: %1").arg(result.error));
+                return 1;
+            }
+            snapshotFile = result.path;
+        } else if (!QFileInfo::exists(snapshotFile)) {
+            QMessageBox::critical(nullptr, "Erro", QString("Arquivo não encontrado: %1").arg(snapshotFile));
+            return 1;
+        }
+    }
+    EPIApp window(snapshotFile);
     window.show();
     return app.exec();
 }
@@ -0,0 +1,77 @@
+#ifndef TESTDATABASE_H
+#define TESTDATABASE_H
+
+#include <QDateTime>
+#include <QString>
+#include <QVariant>
+#include "DatabaseManager.h"
+
+// A private in-memory database with the full schema and seed rows (admin
+// user, default categories). Every instance opens its own connection, so
+// test functions never see each other's data. Engines that open their own
+// connections or attach archive files get a file (in a QTemporaryDir).
+class TestDatabase {
+public:
+    explicit TestDatabase(const QString &fileName = ":memory:")
+        : db(fileName, QString("teste-%1").arg(nextConnection())) {}
+
+    DatabaseManager *manager() { return &db; }
+
+    int addItem(const QString &nome, const QString &ca, int quantidade, double preco = 0,
+                const QString &fornecedor = QString(), const QString &tamanho = QString(), int categoriaId = 1) {
+        return insert("INSERT INTO itens (nome, ca, tamanho, categoria_id, quantidade, preco, estoque_minimo, "
+                      "fornecedor, data_adicao) VALUES (?, ?, ?, ?, ?, ?, 0, ?, ?) RETURNING id",
+                      {nome, ca, tamanho, categoriaId, quantidade, preco, fornecedor,
+                       QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss")});
+    }
+
+    int addCollaborator(const QString &nome, int empresaId = 0) {
+        return insert("INSERT INTO usuarios (nome_usuario, nome_completo, matricula, cpf, level, empresa_id) "
+                      "VALUES (?, ?, ?, ?, 1, ?) RETURNING id",
+                      {nome, nome, nome, nome, empresaId ? QVariant(empresaId) : QVariant()});
+    }
+
+    int addCompany(const QString &nome) {
+        return insert("INSERT INTO empresas (nome, cnpj) VALUES (?, ?) RETURNING id", {nome, nome});
+    }
+
+    // A collaborator withdrawal (negative quantidade) or return, written
+    // directly so it can be dated in the past.
+    int addMovement(int itemId, int colaboradorId, int quantidade, const QString &data,
+                    const QString &expiration = QString()) {
+        return insert("INSERT INTO movimentacoes (item_id, alteracao_quantidade, data, motivo, colaborador_id, "
+                      "expiration_date) VALUES (?, ?, ?, ?, ?, ?) RETURNING id",
+                      {itemId, quantidade, data,
+                       quantidade < 0 ? "Retirada por colaborador" : "Devolução por colaborador", colaboradorId,
+                       expiration.isEmpty() ? QVariant() : QVariant(expiration)});
+    }
+
+    // First column of the first row, or an invalid QVariant.
+    QVariant value(const QString &sql, const QVariantList &params = QVariantList()) {
+        QVariantList result;
+        if (!db.executeQuery(sql, params, true, &result) || result.isEmpty()) {
+            return QVariant();
+        }
+        return result[0].toList().value(0);
+    }
+
+    int quantity(int itemId) { return value("SELECT quantidade FROM itens WHERE id = ?", {itemId}).toInt(); }
+
+private:
+    static int nextConnection() {
+        static int counter = 0;
+        return ++counter;
+    }
+
+    int insert(const QString &sql, const QVariantList &params) {
+        QVariantList result;
+        if (!db.executeQuery(sql, params, true, &result) || result.isEmpty()) {
+            return 0;
+        }
+        return result[0].toList()[0].toInt();
+    }
+
+    DatabaseManager db;
+};
+
+#endif // TESTDATABASE_H
@@ -0,0 +1,110 @@
+#include <QMap>
+#include <QRandomGenerator>
+#include <QtTest>
+#include <algorithm>
+#include <vector>
+#include "AggregationBenchmark.h"
+#include "AggregationKernels.h"
+
+class TestAggregation : public QObject {
+    Q_OBJECT
+
+private slots:
+    void filtersMatchScalarLoops();
+    void directAndHashGroupsAgree();
+    void benchmarkCasesMatchSqlite();
+};
+
+namespace {
+// Odd length, so the vector paths also run their scalar tails.
+const int kRows = 10007;
+
+std::vector<qint32> randomColumn(quint32 seed, qint32 low, qint32 high) {
+    QRandomGenerator random(seed);
+    std::vector<qint32> values(kRows);
+    for (qint32 &value : values) {
+        value = random.bounded(low, high);
+    }
+    return values;
+}
+}
+
+void TestAggregation::filtersMatchScalarLoops() {
+    const std::vector<qint32> values = randomColumn(1, -50, 50);
+    const std::vector<qint32> keys = randomColumn(2, 0, 8);
+    std::vector<quint8> mask(kRows);
+    Aggregation::selectRange(values.data(), kRows, -10, 20, mask.data());
+    Aggregation::andEqual(keys.data(), kRows, 3, mask.data());
+    Aggregation::andLess(values.data(), kRows, 15, mask.data());
+    Aggregation::andGreater(values.data(), kRows, -5, mask.data());
+
+    qint64 expected = 0;
+    for (int i = 0; i < kRows; ++i) {
+        const bool selected = values[i] >= -10 && values[i] <= 20 && keys[i] == 3 && values[i] < 15 && values[i] > -5;
+        QCOMPARE(mask[i], quint8(selected ? 1 : 0));
+        expected += selected;
+    }
+    QCOMPARE(Aggregation::countSelected(mask.data(), kRows), expected);
+
+    const quint8 allowed[4] = {0, 1, 0, 1};
+    std::fill(mask.begin(), mask.end(), quint8(1));
+    Aggregation::andLookup(keys.data(), kRows, allowed, 4, mask.data());
+    for (int i = 0; i < kRows; ++i) {
+        QCOMPARE(mask[i], quint8(keys[i] == 1 || keys[i] == 3 ? 1 : 0));
+    }
+}
+
+void TestAggregation::directAndHashGroupsAgree() {
+    const std::vector<qint32> keys = randomColumn(3, 0, 500);
+    const std::vector<qint32> values = randomColumn(4, -20, 100);
+    std::vector<quint8> mask(kRows);
+    Aggregation::selectRange(values.data(), kRows, 0, 80, mask.data());
+
+    QMap<qint32, QPair<qint64, qint64>> reference;
+    for (int i = 0; i < kRows; ++i) {
+        if (mask[i]) {
+            reference[keys[i]].first += 1;
+            reference[keys[i]].second += values[i];
+        }
+    }
+
+    const qint32 keyLimit = 500;
+    std::vector<qint64> counts(keyLimit, 0);
+    std::vector<qint64> sums(keyLimit, 0);
+    // Two slices accumulate like one pass.
+    const int half = kRows / 2;
+    Aggregation::groupDirect(keys.data(), values.data(), mask.data(), half, keyLimit, counts.data(), sums.data());
+    Aggregation::groupDirect(keys.data() + half, values.data() + half, mask.data() + half, kRows - half, keyLimit,
+                             counts.data(), sums.data());
+    const Aggregation::Groups direct = Aggregation::collectDirect(counts.data(), sums.data(), keyLimit);
+
+    Aggregation::HashGroups hash(4);
+    hash.add(keys.data(), values.data(), mask.data(), kRows);
+    const Aggregation::Groups hashed = hash.result();
+
+    QCOMPARE(direct.keys.size(), reference.size());
+    QCOMPARE(hash.size(), reference.size());
+    int index = 0;
+    for (auto it = reference.constBegin(); it != reference.constEnd(); ++it, ++index) {
+        QCOMPARE(direct.keys[index], it.key());
+        QCOMPARE(direct.counts[index], it.value().first);
+        QCOMPARE(direct.sums[index], it.value().second);
+        QCOMPARE(hashed.keys[index], it.key());
+        QCOMPARE(hashed.counts[index], it.value().first);
+        QCOMPARE(hashed.sums[index], it.value().second);
+    }
+}
+
+void TestAggregation::benchmarkCasesMatchSqlite() {
+    AggregationBenchmark benchmark(20000);
+    QList<BenchmarkCase> cases;
+    QString error;
+    QVERIFY2(benchmark.run(&cases, &error), qPrintable(error));
+    QVERIFY(!cases.isEmpty());
+    for (const BenchmarkCase &result : cases) {
+        QVERIFY2(result.matches, qPrintable(result.name));
+    }
+}
+
+QTEST_GUILESS_MAIN(TestAggregation)
+#include "tst_aggregation.moc"
@@ -0,0 +1,116 @@
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+#include "AnalyticsCache.h"
+#include "ArchiveManager.h"
+#include "TestDatabase.h"
+
+class TestAnalyticsCache : public QObject {
+    Q_OBJECT
+
+private slots:
+    void aggregatesWithdrawalsAndReturns();
+    void refreshOnlyAppendsNewMovements();
+    void firstLoadReadsArchivedYears();
+};
+
+void TestAnalyticsCache::aggregatesWithdrawalsAndReturns() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDatabase db;
+    ArchiveManager archives(db.manager(), dir.filePath("arquivo"));
+    AnalyticsCache cache(db.manager(), &archives);
+    const int acme = db.addCompany("Acme");
+    const int gloves = db.addItem("Luva", "111", 100, 0, QString(), QString(), 1);
+    const int helmet = db.addItem("Capacete", "222", 100, 0, QString(), QString(), 2);
+    const int ana = db.addCollaborator("ana", acme);
+    const int bruno = db.addCollaborator("bruno");
+    db.addMovement(gloves, ana, -4, "2024-05-02 08:00:00");
+    db.addMovement(gloves, ana, 1, "2024-05-03 08:00:00");
+    db.addMovement(gloves, bruno, -2, "2024-06-01 08:00:00");
+    db.addMovement(helmet, ana, -1, "2024-05-02 09:00:00");
+
+    QVERIFY(cache.refresh());
+    QCOMPARE(cache.rowCount(), qint64(4));
+
+    QVector<FactTotals> totals = cache.aggregate(FactFilter(), AnalyticsCache::ByItem);
+    QCOMPARE(totals.size(), 2);
+    QCOMPARE(totals[0].key, gloves);
+    QCOMPARE(totals[0].withdrawals, qint64(2));
+    QCOMPARE(totals[0].withdrawn, qint64(6));
+    QCOMPARE(totals[0].returned, qint64(1));
+    QCOMPARE(totals[1].key, helmet);
+    QCOMPARE(totals[1].withdrawn, qint64(1));
+
+    FactFilter filter;
+    filter.colaboradorId = ana;
+    filter.end = QDate(2024, 5, 31);
+    totals = cache.aggregate(filter, AnalyticsCache::ByCategoria);
+    QCOMPARE(totals.size(), 2);
+    QCOMPARE(totals[0].key, 1);
+    QCOMPARE(totals[0].withdrawn, qint64(4));
+    QCOMPARE(totals[1].key, 2);
+
+    filter = FactFilter();
+    filter.start = QDate(2024, 6, 1);
+    totals = cache.aggregate(filter, AnalyticsCache::ByEmpresa);
+    QCOMPARE(totals.size(), 1);
+    QCOMPARE(totals[0].key, 0);
+    QCOMPARE(totals[0].withdrawn, qint64(2));
+}
+
+void TestAnalyticsCache::refreshOnlyAppendsNewMovements() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDatabase db;
+    ArchiveManager archives(db.manager(), dir.filePath("arquivo"));
+    AnalyticsCache cache(db.manager(), &archives);
+    const int gloves = db.addItem("Luva", "111", 100);
+    const int ana = db.addCollaborator("ana");
+    db.addMovement(gloves, ana, -1, "2024-05-02 08:00:00");
+    QVERIFY(cache.refresh());
+    QVERIFY(cache.refresh());
+    QCOMPARE(cache.rowCount(), qint64(1));
+
+    db.addMovement(gloves, ana, -2, "2024-05-03 08:00:00");
+    QVERIFY(cache.refresh());
+    QCOMPARE(cache.rowCount(), qint64(2));
+    QCOMPARE(cache.aggregate(FactFilter(), AnalyticsCache::ByColaborador).value(0).withdrawn, qint64(3));
+
+    cache.clear();
+    QCOMPARE(cache.rowCount(), qint64(0));
+    QVERIFY(cache.refresh());
+    QCOMPARE(cache.rowCount(), qint64(2));
+}
+
+void TestAnalyticsCache::firstLoadReadsArchivedYears() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDatabase db(dir.filePath("epi.db"));
+    ArchiveManager archives(db.manager(), dir.filePath("arquivo"));
+    const int gloves = db.addItem("Luva", "111", 100);
+    const int ana = db.addCollaborator("ana");
+    db.addMovement(gloves, ana, -3, "2020-03-01 08:00:00");
+    db.addMovement(gloves, ana, -2, "2021-06-01 08:00:00");
+    QString error;
+    QVERIFY2(archives.archiveBefore(2021, &error), qPrintable(error));
+
+    AnalyticsCache cache(db.manager(), &archives);
+    QVERIFY(cache.refresh());
+    QCOMPARE(cache.rowCount(), qint64(2));
+    FactFilter filter;
+    filter.end = QDate(2020, 12, 31);
+    QCOMPARE(cache.aggregate(filter, AnalyticsCache::ByItem).value(0).withdrawn, qint64(3));
+
+    // A missing archive fails the first build instead of leaving 2020 out.
+    QVERIFY(QFile::copy(dir.filePath("epi.db"), dir.filePath("copia.db")));
+    QVERIFY(QDir(dir.filePath("arquivo")).removeRecursively());
+    DatabaseManager snapshot(dir.filePath("copia.db"), "analitico-copia", DatabaseManager::OpenMode::Snapshot);
+    ArchiveManager detached(&snapshot, dir.filePath("arquivo"));
+    AnalyticsCache incomplete(&snapshot, &detached);
+    QVERIFY(!incomplete.refresh());
+}
+
+QTEST_GUILESS_MAIN(TestAnalyticsCache)
+#include "tst_analyticscache.moc"
@@ -0,0 +1,108 @@
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtTest>
+#include "ApiServer.h"
+#include "CredentialService.h"
+#include "TestDatabase.h"
+
+namespace {
+ApiRequest request(const QByteArray &method, const QString &path, const QString &query = QString(),
+                   const QJsonObject &body = QJsonObject()) {
+    ApiRequest request;
+    request.method = method;
+    request.path = path;
+    request.query = QUrlQuery(query);
+    if (!body.isEmpty()) {
+        request.body = QJsonDocument(body).toJson(QJsonDocument::Compact);
+    }
+    return request;
+}
+
+QJsonObject json(const ApiResponse &response) {
+    return QJsonDocument::fromJson(response.body).object();
+}
+}
+
+class TestApiHandler : public QObject {
+    Q_OBJECT
+
+private slots:
+    void itemLookupAndRouting();
+    void withdrawalNeedsTheCollaboratorPassword();
+    void companyCostsReport();
+};
+
+void TestApiHandler::itemLookupAndRouting() {
+    TestDatabase db;
+    ApiHandler handler(db.manager());
+    const int gloves = db.addItem("Luva Nitrílica", "111", 10);
+    db.addItem("Capacete", "222", 3);
+
+    ApiResponse response = handler.handle(request("GET", "/api/itens", "busca=Luva"));
+    QCOMPARE(response.status, 200);
+    const QJsonArray items = json(response).value("itens").toArray();
+    QCOMPARE(items.size(), 1);
+    QCOMPARE(items[0].toObject().value("id").toInt(), gloves);
+
+    response = handler.handle(request("GET", QString("/api/itens/%1").arg(gloves)));
+    QCOMPARE(response.status, 200);
+    QCOMPARE(json(response).value("quantidade").toInt(), 10);
+
+    QCOMPARE(handler.handle(request("GET", "/api/itens/9999")).status, 404);
+    QCOMPARE(handler.handle(request("GET", "/api/desconhecido")).status, 404);
+    QCOMPARE(handler.handle(request("DELETE", "/api/itens")).status, 405);
+    QCOMPARE(handler.handle(request("GET", "/api/retiradas")).status, 405);
+}
+
+void TestApiHandler::withdrawalNeedsTheCollaboratorPassword() {
+    TestDatabase db;
+    ApiHandler handler(db.manager());
+    const int gloves = db.addItem("Luva", "111", 10);
+    const int ana = db.addCollaborator("ana");
+    QVERIFY(db.manager()->executeQuery("UPDATE usuarios SET senha = ? WHERE id = ?",
+                                       {CredentialService::hashPassword("1234"), ana}));
+    const QJsonArray lines{QJsonObject{{"item_id", gloves}, {"quantidade", 3}}};
+
+    ApiResponse response = handler.handle(
+        request("POST", "/api/retiradas", QString(), {{"colaborador_id", ana}, {"senha", "0000"}, {"itens", lines}}));
+    QCOMPARE(response.status, 403);
+    QCOMPARE(db.quantity(gloves), 10);
+
+    response = handler.handle(
+        request("POST", "/api/retiradas", QString(), {{"colaborador_id", ana}, {"senha", "1234"}, {"itens", lines}}));
+    QCOMPARE(response.status, 201);
+    QCOMPARE(db.quantity(gloves), 7);
+
+    const QJsonArray tooMany{QJsonObject{{"item_id", gloves}, {"quantidade", 50}}};
+    response = handler.handle(
+        request("POST", "/api/retiradas", QString(), {{"colaborador_id", ana}, {"senha", "1234"}, {"itens", tooMany}}));
+    QCOMPARE(response.status, 409);
+
+    response = handler.handle(request("GET", QString("/api/colaboradores/%1/saldo").arg(ana)));
+    QCOMPARE(response.status, 200);
+    const QJsonArray balance = json(response).value("itens").toArray();
+    QCOMPARE(balance.size(), 1);
+    QCOMPARE(balance[0].toObject().value("quantidade").toInt(), 3);
+
+    QCOMPARE(handler.handle(request("POST", "/api/retiradas", QString(), {{"itens", lines}})).status, 400);
+}
+
+void TestApiHandler::companyCostsReport() {
+    TestDatabase db;
+    ApiHandler handler(db.manager());
+    const int acme = db.addCompany("Acme");
+    const int gloves = db.addItem("Luva", "111", 10, 4.0);
+    db.addMovement(gloves, db.addCollaborator("ana", acme), -2, "2024-05-02 08:00:00");
+
+    const ApiResponse response =
+        handler.handle(request("GET", "/api/relatorios/custos-empresa", "inicio=2024-05-01&fim=2024-05-31"));
+    QCOMPARE(response.status, 200);
+    const QJsonArray companies = json(response).value("empresas").toArray();
+    QCOMPARE(companies.size(), 1);
+    QCOMPARE(companies[0].toObject().value("empresa_id").toInt(), acme);
+    QCOMPARE(companies[0].toObject().value("valor").toDouble(), 8.0);
+}
+
+QTEST_GUILESS_MAIN(TestApiHandler)
+#include "tst_apihandler.moc"
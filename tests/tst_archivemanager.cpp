@@ -0,0 +1,115 @@
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+#include "ArchiveManager.h"
+#include "ConsumptionRollup.h"
+#include "TestDatabase.h"
+
+class TestArchiveManager : public QObject {
+    Q_OBJECT
+
+private slots:
+    void archivedMovementsStayInTheRollups();
+    void movementsSourceUnionsArchivedYears();
+    void snapshotReadsArchivesFromTheirRecordedPath();
+};
+
+namespace {
+// Two years of movements for one collaborator; nothing refreshed yet.
+struct History {
+    int item = 0;
+    int colaborador = 0;
+};
+
+History seed(TestDatabase &db) {
+    History history;
+    history.item = db.addItem("Luva", "111", 100, 2.0);
+    history.colaborador = db.addCollaborator("ana", db.addCompany("Acme"));
+    db.addMovement(history.item, history.colaborador, -3, "2020-03-01 08:00:00", "2020-09-01");
+    db.addMovement(history.item, history.colaborador, 1, "2020-04-01 08:00:00");
+    db.addMovement(history.item, history.colaborador, -2, "2021-06-01 08:00:00", "2021-12-01");
+    return history;
+}
+}
+
+void TestArchiveManager::archivedMovementsStayInTheRollups() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDatabase db(dir.filePath("epi.db"));
+    ArchiveManager archives(db.manager(), dir.filePath("arquivo"));
+    const History history = seed(db);
+
+    QString error;
+    QVERIFY2(archives.archiveBefore(2021, &error), qPrintable(error));
+    QCOMPARE(archives.archivedYears(), QList<int>{2020});
+    QCOMPARE(db.value("SELECT COUNT(*) FROM movimentacoes").toInt(), 1);
+    QVERIFY(QFile::exists(db.value("SELECT caminho FROM arquivos WHERE ano = 2020").toString()));
+
+    // Every rollup folded 2020 before it left the hot table.
+    QCOMPARE(db.value("SELECT retirado FROM consumo_diario WHERE dia = '2020-03-01'").toInt(), 3);
+    QCOMPARE(db.value("SELECT devolvido FROM consumo_diario WHERE dia = '2020-04-01'").toInt(), 1);
+    QCOMPARE(db.value("SELECT SUM(quantidade) FROM consumo_empresa WHERE dia < '2021-01-01'").toInt(), 2);
+    QCOMPARE(db.value("SELECT SUM(quantidade_restante) FROM vencimentos_pendentes").toInt(), 4);
+    QCOMPARE(db.value("SELECT quantidade FROM saldos_arquivados WHERE colaborador_id = ? AND item_id = ?",
+                      {history.colaborador, history.item}).toInt(),
+             -2);
+
+    // Later refreshes only see what is still hot.
+    db.addMovement(history.item, history.colaborador, -1, "2021-07-01 08:00:00");
+    QVERIFY(ConsumptionRollup(db.manager()).refresh());
+    QCOMPARE(db.value("SELECT SUM(retirado) FROM consumo_diario").toInt(), 6);
+}
+
+void TestArchiveManager::movementsSourceUnionsArchivedYears() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDatabase db(dir.filePath("epi.db"));
+    ArchiveManager archives(db.manager(), dir.filePath("arquivo"));
+    seed(db);
+    QString error;
+    QVERIFY2(archives.archiveBefore(2021, &error), qPrintable(error));
+
+    QCOMPARE(archives.hotHorizon(), QString("2021-01-01"));
+    QCOMPARE(archives.movementsSource("2021-02-01"), QString("movimentacoes"));
+    const QString source = archives.movementsSource("2020-01-01");
+    QCOMPARE(db.value("SELECT COUNT(*) FROM " + source + " m").toInt(), 3);
+    QVERIFY(archives.missingYears().isEmpty());
+}
+
+void TestArchiveManager::snapshotReadsArchivesFromTheirRecordedPath() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString file = dir.filePath("epi.db");
+    {
+        TestDatabase db(file);
+        ArchiveManager archives(db.manager(), dir.filePath("arquivo"));
+        seed(db);
+        QString error;
+        QVERIFY2(archives.archiveBefore(2021, &error), qPrintable(error));
+    }
+    QVERIFY(QDir(dir.path()).mkpath("instantaneo"));
+    const QString snapshotFile = dir.filePath("instantaneo/epi.db");
+    QVERIFY(QFile::copy(file, snapshotFile));
+
+    {
+        DatabaseManager snapshot(snapshotFile, "instantaneo", DatabaseManager::OpenMode::Snapshot);
+        ArchiveManager archives(&snapshot, dir.filePath("instantaneo/arquivo"));
+        const QString source = archives.movementsSource("2020-01-01");
+        QVERIFY(archives.missingYears().isEmpty());
+        QVariantList result;
+        QVERIFY(snapshot.executeQuery("SELECT COUNT(*) FROM " + source + " m", {}, true, &result));
+        QCOMPARE(result[0].toList()[0].toInt(), 3);
+        QVERIFY(!QDir(dir.filePath("instantaneo")).exists("arquivo"));
+    }
+
+    // Without the archive file the year is reported, not silently dropped.
+    QVERIFY(QDir(dir.filePath("arquivo")).removeRecursively());
+    DatabaseManager snapshot(snapshotFile, "instantaneo-sem-arquivo", DatabaseManager::OpenMode::Snapshot);
+    ArchiveManager archives(&snapshot, dir.filePath("instantaneo/arquivo"));
+    archives.movementsSource("2020-01-01");
+    QCOMPARE(archives.missingYears(), QList<int>{2020});
+}
+
+QTEST_GUILESS_MAIN(TestArchiveManager)
+#include "tst_archivemanager.moc"
@@ -0,0 +1,93 @@
+#include <QTemporaryDir>
+#include <QtConcurrent>
+#include <QtTest>
+#include "CompanyCostReport.h"
+#include "TestDatabase.h"
+
+class TestCompanyCostReport : public QObject {
+    Q_OBJECT
+
+private slots:
+    void costsFollowTheCompanyAtFoldTime();
+    void drillDownReachesTheCollaborator();
+    void concurrentRefreshesFoldEachMovementOnce();
+};
+
+void TestCompanyCostReport::costsFollowTheCompanyAtFoldTime() {
+    TestDatabase db;
+    CompanyCostReport report(db.manager());
+    const int acme = db.addCompany("Acme");
+    const int beta = db.addCompany("Beta");
+    const int gloves = db.addItem("Luva", "111", 100, 2.5);
+    const int ana = db.addCollaborator("ana", acme);
+    db.addMovement(gloves, ana, -4, "2024-05-02 08:00:00");
+    db.addMovement(gloves, ana, 1, "2024-05-03 08:00:00");
+
+    QList<CostRow> rows;
+    QVERIFY(report.companies(QString(), QString(), &rows));
+    QCOMPARE(rows.size(), 1);
+    QCOMPARE(rows[0].id, acme);
+    QCOMPARE(rows[0].quantidade, qint64(3));
+    QCOMPARE(rows[0].valor, 7.5);
+
+    // Folded movements keep their company; later ones take the new one.
+    QVERIFY(db.manager()->executeQuery("UPDATE usuarios SET empresa_id = ? WHERE id = ?", {beta, ana}));
+    db.addMovement(gloves, ana, -2, "2024-05-04 08:00:00");
+    QVERIFY(report.companies("2024-05-01", "2024-05-31", &rows));
+    QCOMPARE(rows.size(), 2);
+    QCOMPARE(rows[0].id, acme);
+    QCOMPARE(rows[1].id, beta);
+    QCOMPARE(rows[1].valor, 5.0);
+}
+
+void TestCompanyCostReport::drillDownReachesTheCollaborator() {
+    TestDatabase db;
+    CompanyCostReport report(db.manager());
+    const int acme = db.addCompany("Acme");
+    const int gloves = db.addItem("Luva", "111", 100, 2.0, QString(), QString(), 1);
+    const int ana = db.addCollaborator("ana", acme);
+    const int bruno = db.addCollaborator("bruno", acme);
+    db.addMovement(gloves, ana, -3, "2024-05-02 08:00:00");
+    db.addMovement(gloves, bruno, -1, "2024-05-02 09:00:00");
+
+    QList<CostRow> rows;
+    QVERIFY(report.companies(QString(), QString(), &rows));
+    QVERIFY(report.categories(acme, QString(), QString(), &rows));
+    QCOMPARE(rows.size(), 1);
+    QCOMPARE(rows[0].id, 1);
+    QVERIFY(report.items(acme, 1, QString(), QString(), &rows));
+    QCOMPARE(rows.size(), 1);
+    QCOMPARE(rows[0].id, gloves);
+    QCOMPARE(rows[0].quantidade, qint64(4));
+    QVERIFY(report.collaborators(acme, gloves, "2024-05-01", "2024-05-31", &rows));
+    QCOMPARE(rows.size(), 2);
+    QCOMPARE(rows[0].id, ana);
+    QCOMPARE(rows[0].valor, 6.0);
+}
+
+void TestCompanyCostReport::concurrentRefreshesFoldEachMovementOnce() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString file = dir.filePath("epi.db");
+    TestDatabase db(file);
+    const int acme = db.addCompany("Acme");
+    const int item = db.addItem("Luva", "111", 0, 1.0);
+    const int colaborador = db.addCollaborator("ana", acme);
+    QVERIFY(db.manager()->beginTransaction());
+    for (int i = 0; i < 2000; ++i) {
+        db.addMovement(item, colaborador, -1, QString("2024-05-%1 08:00:00").arg(1 + i % 28, 2, 10, QChar('0')));
+    }
+    QVERIFY(db.manager()->commitTransaction());
+
+    QList<int> workers{1, 2, 3, 4};
+    const QList<bool> results = QtConcurrent::blockingMapped(workers, [file](int worker) {
+        DatabaseManager connection(file, QString("custos-%1").arg(worker));
+        return CompanyCostReport(&connection).refresh();
+    });
+    QCOMPARE(results, QList<bool>({true, true, true, true}));
+    QCOMPARE(db.value("SELECT SUM(quantidade) FROM consumo_empresa").toInt(), 2000);
+    QCOMPARE(db.value("SELECT SUM(valor) FROM consumo_empresa").toDouble(), 2000.0);
+}
+
+QTEST_GUILESS_MAIN(TestCompanyCostReport)
+#include "tst_companycostreport.moc"
@@ -0,0 +1,68 @@
+#include <QTemporaryDir>
+#include <QtConcurrent>
+#include <QtTest>
+#include "ConsumptionRollup.h"
+#include "TestDatabase.h"
+
+class TestConsumptionRollup : public QObject {
+    Q_OBJECT
+
+private slots:
+    void foldsOnlyNewMovements();
+    void concurrentRefreshesFoldEachMovementOnce();
+};
+
+void TestConsumptionRollup::foldsOnlyNewMovements() {
+    TestDatabase db;
+    ConsumptionRollup rollup(db.manager());
+    const int gloves = db.addItem("Luva", "111", 100);
+    const int mask = db.addItem("Máscara", "222", 100);
+    const int colaborador = db.addCollaborator("ana");
+    db.addMovement(gloves, colaborador, -3, "2024-05-02 08:00:00");
+    db.addMovement(gloves, colaborador, -2, "2024-05-02 17:00:00");
+    db.addMovement(gloves, colaborador, 1, "2024-05-02 18:00:00");
+
+    QSet<int> touched;
+    QVERIFY(rollup.refresh(&touched));
+    QCOMPARE(touched, QSet<int>{gloves});
+    QCOMPARE(db.value("SELECT retirado FROM consumo_diario WHERE item_id = ? AND dia = '2024-05-02'", {gloves}).toInt(), 5);
+    QCOMPARE(db.value("SELECT devolvido FROM consumo_diario WHERE item_id = ? AND dia = '2024-05-02'", {gloves}).toInt(), 1);
+
+    // A second refresh reads only what came after the watermark.
+    touched.clear();
+    QVERIFY(rollup.refresh(&touched));
+    QVERIFY(touched.isEmpty());
+    db.addMovement(mask, colaborador, -4, "2024-05-03 09:00:00");
+    QVERIFY(rollup.refresh(&touched));
+    QCOMPARE(touched, QSet<int>{mask});
+    QCOMPARE(db.value("SELECT SUM(retirado) FROM consumo_diario").toInt(), 9);
+    QCOMPARE(db.value("SELECT ultimo_id FROM controle_incremental WHERE nome = 'consumo_diario'").toLongLong(),
+             db.value("SELECT MAX(id) FROM movimentacoes").toLongLong());
+}
+
+void TestConsumptionRollup::concurrentRefreshesFoldEachMovementOnce() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString file = dir.filePath("epi.db");
+    TestDatabase db(file);
+    const int item = db.addItem("Luva", "111", 0);
+    const int colaborador = db.addCollaborator("ana");
+    QVERIFY(db.manager()->beginTransaction());
+    for (int i = 0; i < 2000; ++i) {
+        db.addMovement(item, colaborador, -1, QString("2024-05-%1 08:00:00").arg(1 + i % 28, 2, 10, QChar('0')));
+    }
+    QVERIFY(db.manager()->commitTransaction());
+
+    // Each refresh runs on its own connection, as the GUI, the API workers
+    // and the archiver do.
+    QList<int> workers{1, 2, 3, 4};
+    const QList<bool> results = QtConcurrent::blockingMapped(workers, [file](int worker) {
+        DatabaseManager connection(file, QString("rollup-%1").arg(worker));
+        return ConsumptionRollup(&connection).refresh();
+    });
+    QCOMPARE(results, QList<bool>({true, true, true, true}));
+    QCOMPARE(db.value("SELECT SUM(retirado) FROM consumo_diario").toInt(), 2000);
+}
+
+QTEST_GUILESS_MAIN(TestConsumptionRollup)
+#include "tst_consumptionrollup.moc"
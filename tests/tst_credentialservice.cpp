@@ -0,0 +1,71 @@
+#include <QCryptographicHash>
+#include <QtTest>
+#include "CredentialService.h"
+#include "StockService.h"
+#include "TestDatabase.h"
+
+class TestCredentialService : public QObject {
+    Q_OBJECT
+
+private slots:
+    void hashedPasswordsMatchOnlyThemselves();
+    void legacyDigestsStillMatch();
+    void blockingVerificationUpgradesLegacyRecords();
+    void asyncVerificationCallsBack();
+};
+
+void TestCredentialService::hashedPasswordsMatchOnlyThemselves() {
+    const QString stored = CredentialService::hashPassword("1234");
+    QVERIFY(stored.startsWith("pbkdf2-sha256$"));
+    QVERIFY(!CredentialService::isLegacy(stored));
+    QVERIFY(CredentialService::matches(stored, "1234"));
+    QVERIFY(!CredentialService::matches(stored, "4321"));
+    // Salted: the same password never produces the same record.
+    QVERIFY(CredentialService::hashPassword("1234") != stored);
+}
+
+void TestCredentialService::legacyDigestsStillMatch() {
+    const QString legacy = QString(QCryptographicHash::hash("1234", QCryptographicHash::Sha256).toHex());
+    QVERIFY(CredentialService::isLegacy(legacy));
+    QVERIFY(CredentialService::matches(legacy, "1234"));
+    QVERIFY(!CredentialService::matches(legacy, "0000"));
+    QVERIFY(!CredentialService::matches("lixo", "1234"));
+}
+
+void TestCredentialService::blockingVerificationUpgradesLegacyRecords() {
+    // The seeded admin user carries a legacy digest of "admin".
+    TestDatabase db;
+    StockService service(db.manager());
+    QVERIFY(CredentialService::isLegacy(db.value("SELECT senha FROM usuarios WHERE id = 1").toString()));
+
+    QVERIFY(!service.verifyCollaborator(1, "errada"));
+    QVERIFY(CredentialService::isLegacy(db.value("SELECT senha FROM usuarios WHERE id = 1").toString()));
+    QVERIFY(service.verifyCollaborator(1, "admin"));
+    const QString upgraded = db.value("SELECT senha FROM usuarios WHERE id = 1").toString();
+    QVERIFY(upgraded.startsWith("pbkdf2-sha256$"));
+    QVERIFY(service.verifyCollaborator(1, "admin"));
+}
+
+void TestCredentialService::asyncVerificationCallsBack() {
+    TestDatabase db;
+    CredentialService credentials(db.manager());
+    int calls = 0;
+    bool accepted = false;
+    credentials.verify(1, "admin", this, [&](bool ok) {
+        ++calls;
+        accepted = ok;
+    });
+    QTRY_COMPARE(calls, 1);
+    QVERIFY(accepted);
+
+    calls = 0;
+    credentials.verify(1, "errada", this, [&](bool ok) {
+        ++calls;
+        accepted = ok;
+    });
+    QTRY_COMPARE(calls, 1);
+    QVERIFY(!accepted);
+}
+
+QTEST_GUILESS_MAIN(TestCredentialService)
+#include "tst_credentialservice.moc"
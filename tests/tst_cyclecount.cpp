@@ -0,0 +1,127 @@
+#include <QTemporaryFile>
+#include <QtTest>
+#include "CycleCount.h"
+#include "StockService.h"
+#include "TestDatabase.h"
+
+class TestCycleCount : public QObject {
+    Q_OBJECT
+
+private slots:
+    void postingKeepsWithdrawalsAfterTheCount();
+    void withdrawalsBeforeTheCountAreNotVariance();
+    void csvLinesForOneItemAddUp();
+    void sharedCaNeedsTheSizeLabel();
+};
+
+void TestCycleCount::postingKeepsWithdrawalsAfterTheCount() {
+    TestDatabase db;
+    StockService service(db.manager());
+    const int counted = db.addItem("Luva", "111", 10);
+    const int untouched = db.addItem("Botina", "222", 6);
+    const int colaborador = db.addCollaborator("ana");
+
+    CycleCount count(db.manager());
+    QString error;
+    QVERIFY2(count.start(0, &error), qPrintable(error));
+    QCOMPARE(count.itemCount(), 2);
+    int itemId = 0;
+    QString message;
+    QVERIFY2(count.addCount(QString("EPI-%1").arg(counted), 7, &itemId, &message), qPrintable(message));
+    QCOMPARE(itemId, counted);
+    QVERIFY(!count.addCount("EPI-999999", 1, &itemId, &message));
+    QVERIFY(!count.addCount(QString("EPI-%1").arg(counted), -8, &itemId, &message));
+
+    // Taken off the shelf after it was counted: already out of the 7.
+    QVERIFY2(service.withdraw(colaborador, {StockLine{counted, 2, 30}}, 1, QString(), &error), qPrintable(error));
+
+    QList<CountVariance> rows;
+    QVERIFY2(count.variances(&rows, &error), qPrintable(error));
+    QCOMPARE(rows.size(), 1);
+    QCOMPARE(rows[0].esperado, 10);
+    QCOMPARE(rows[0].moved, 0);
+    QCOMPARE(rows[0].variacao, -3);
+
+    int adjusted = 0;
+    QVERIFY2(count.post(1, &adjusted, &error), qPrintable(error));
+    QCOMPARE(adjusted, 1);
+    QVERIFY(!count.isOpen());
+    QCOMPARE(db.quantity(counted), 5);
+    QCOMPARE(db.quantity(untouched), 6);
+    QCOMPARE(db.value("SELECT alteracao_quantidade FROM movimentacoes WHERE item_id = ? AND colaborador_id IS NULL",
+                      {counted})
+                 .toInt(),
+             -3);
+}
+
+void TestCycleCount::withdrawalsBeforeTheCountAreNotVariance() {
+    TestDatabase db;
+    StockService service(db.manager());
+    const int item = db.addItem("Luva", "111", 10);
+    const int colaborador = db.addCollaborator("bruno");
+
+    CycleCount count(db.manager());
+    QString error;
+    QVERIFY2(count.start(0, &error), qPrintable(error));
+    QVERIFY2(service.withdraw(colaborador, {StockLine{item, 2, 30}}, 1, QString(), &error), qPrintable(error));
+    int itemId = 0;
+    QString message;
+    QVERIFY(count.addCount("111", 8, &itemId, &message));
+
+    QList<CountVariance> rows;
+    QVERIFY2(count.variances(&rows, &error), qPrintable(error));
+    QCOMPARE(rows.size(), 1);
+    QCOMPARE(rows[0].moved, -2);
+    QCOMPARE(rows[0].variacao, 0);
+
+    int adjusted = -1;
+    QVERIFY2(count.post(1, &adjusted, &error), qPrintable(error));
+    QCOMPARE(adjusted, 0);
+    QCOMPARE(db.quantity(item), 8);
+}
+
+void TestCycleCount::csvLinesForOneItemAddUp() {
+    TestDatabase db;
+    const int item = db.addItem("Máscara", "333", 3);
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write("codigo;quantidade\n333;4\n\n333,1\nnada;2\n333;x\n");
+    file.close();
+
+    CycleCount count(db.manager());
+    QString error;
+    QVERIFY2(count.start(0, &error), qPrintable(error));
+    QStringList errors;
+    QCOMPARE(count.importCsv(file.fileName(), &errors), 2);
+    QCOMPARE(errors.size(), 2);
+    QCOMPARE(count.countedItems(), QList<int>{item});
+
+    CountVariance line;
+    QVERIFY(count.item(item, &line));
+    QCOMPARE(line.contado, 5);
+    QCOMPARE(line.variacao, 2);
+}
+
+void TestCycleCount::sharedCaNeedsTheSizeLabel() {
+    TestDatabase db;
+    const int small = db.addItem("Botina", "444", 2, 0, QString(), "38");
+    db.addItem("Botina", "444", 2, 0, QString(), "40");
+
+    CycleCount count(db.manager());
+    QString error;
+    QVERIFY2(count.start(0, &error), qPrintable(error));
+    int itemId = 0;
+    QString message;
+    QVERIFY(!count.addCount("444", 1, &itemId, &message));
+    QVERIFY(count.addCount(QString("EPI-%1").arg(small), 1, &itemId, &message));
+    QVERIFY(count.addCount("444", 1, &itemId, &message));
+    QCOMPARE(itemId, small);
+
+    CountVariance line;
+    QVERIFY(count.item(small, &line));
+    QCOMPARE(line.contado, 2);
+}
+
+QTEST_GUILESS_MAIN(TestCycleCount)
+#include "tst_cyclecount.moc"
@@ -0,0 +1,110 @@
+#include <QDate>
+#include <QTemporaryDir>
+#include <QtConcurrent>
+#include <QtTest>
+#include "ExpirationTracker.h"
+#include "TestDatabase.h"
+
+namespace {
+QString daysFromToday(int days) {
+    return QDate::currentDate().addDays(days).toString("yyyy-MM-dd");
+}
+}
+
+class TestExpirationTracker : public QObject {
+    Q_OBJECT
+
+private slots:
+    void withdrawalsBecomeLotsWithTheirDeliveryDate();
+    void returnsConsumeTheEarliestLotFirst();
+    void limitBoundsTheRows();
+    void concurrentSyncsApplyEachReturnOnce();
+};
+
+void TestExpirationTracker::withdrawalsBecomeLotsWithTheirDeliveryDate() {
+    TestDatabase db;
+    ExpirationTracker tracker(db.manager());
+    const int gloves = db.addItem("Luva", "111", 100);
+    const int ana = db.addCollaborator("ana");
+    db.addMovement(gloves, ana, -2, "2024-01-10 08:00:00", daysFromToday(-3));
+    db.addMovement(gloves, ana, -1, "2024-02-10 08:00:00", daysFromToday(10));
+    db.addMovement(gloves, ana, -5, "2024-03-10 08:00:00", daysFromToday(90));
+
+    QVERIFY(tracker.sync());
+    int expired = -1, expiring = -1;
+    QVERIFY(tracker.counts(30, &expired, &expiring));
+    QCOMPARE(expired, 1);
+    QCOMPARE(expiring, 1);
+
+    QVariantList rows;
+    QVERIFY(tracker.expired(&rows));
+    QCOMPARE(rows.size(), 1);
+    const QVariantList lot = rows[0].toList();
+    QCOMPARE(lot[0].toString(), QString("ana"));
+    QCOMPARE(lot[4].toInt(), 2);
+    QCOMPARE(lot[5].toString(), QString("2024-01-10 08:00:00"));
+    QCOMPARE(db.value("SELECT ultimo_id FROM controle_incremental WHERE nome = 'vencimentos'").toLongLong(),
+             db.value("SELECT MAX(id) FROM movimentacoes").toLongLong());
+}
+
+void TestExpirationTracker::returnsConsumeTheEarliestLotFirst() {
+    TestDatabase db;
+    ExpirationTracker tracker(db.manager());
+    const int gloves = db.addItem("Luva", "111", 100);
+    const int ana = db.addCollaborator("ana");
+    db.addMovement(gloves, ana, -2, "2024-01-10 08:00:00", daysFromToday(20));
+    db.addMovement(gloves, ana, -3, "2024-01-11 08:00:00", daysFromToday(5));
+    QVERIFY(tracker.sync());
+
+    db.addMovement(gloves, ana, 4, "2024-01-12 08:00:00");
+    QVERIFY(tracker.sync());
+    QVariantList rows;
+    QVERIFY(tracker.expiringWithin(30, &rows));
+    QCOMPARE(rows.size(), 1);
+    QCOMPARE(rows[0].toList()[4].toInt(), 1);
+    QCOMPARE(rows[0].toList()[6].toString(), daysFromToday(20));
+}
+
+void TestExpirationTracker::limitBoundsTheRows() {
+    TestDatabase db;
+    ExpirationTracker tracker(db.manager());
+    const int gloves = db.addItem("Luva", "111", 100);
+    const int ana = db.addCollaborator("ana");
+    for (int i = 1; i <= 5; ++i) {
+        db.addMovement(gloves, ana, -1, "2024-01-10 08:00:00", daysFromToday(-i));
+    }
+    QVERIFY(tracker.sync());
+
+    QVariantList rows;
+    QVERIFY(tracker.expired(&rows, 2));
+    QCOMPARE(rows.size(), 2);
+    QCOMPARE(rows[0].toList()[6].toString(), daysFromToday(-5));
+    QVERIFY(tracker.expired(&rows));
+    QCOMPARE(rows.size(), 5);
+}
+
+void TestExpirationTracker::concurrentSyncsApplyEachReturnOnce() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString file = dir.filePath("epi.db");
+    TestDatabase db(file);
+    const int gloves = db.addItem("Luva", "111", 0);
+    const int ana = db.addCollaborator("ana");
+    QVERIFY(db.manager()->beginTransaction());
+    for (int i = 0; i < 1000; ++i) {
+        db.addMovement(gloves, ana, -2, "2024-01-10 08:00:00", daysFromToday(10));
+        db.addMovement(gloves, ana, 1, "2024-01-11 08:00:00");
+    }
+    QVERIFY(db.manager()->commitTransaction());
+
+    QList<int> workers{1, 2, 3, 4};
+    const QList<bool> results = QtConcurrent::blockingMapped(workers, [file](int worker) {
+        DatabaseManager connection(file, QString("vencimentos-%1").arg(worker));
+        return ExpirationTracker(&connection).sync();
+    });
+    QCOMPARE(results, QList<bool>({true, true, true, true}));
+    QCOMPARE(db.value("SELECT SUM(quantidade_restante) FROM vencimentos_pendentes").toInt(), 1000);
+}
+
+QTEST_GUILESS_MAIN(TestExpirationTracker)
+#include "tst_expirationtracker.moc"
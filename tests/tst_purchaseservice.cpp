@@ -0,0 +1,88 @@
+#include <QtTest>
+#include "PurchaseService.h"
+#include "TestDatabase.h"
+
+class TestPurchaseService : public QObject {
+    Q_OBJECT
+
+private slots:
+    void receiptAveragesCostAndAdvancesStatus();
+    void overReceiptIsRefused();
+    void cancelledOrdersCannotBeReceived();
+};
+
+void TestPurchaseService::receiptAveragesCostAndAdvancesStatus() {
+    TestDatabase db;
+    PurchaseService service(db.manager());
+    const int item = db.addItem("Luva", "111", 10, 2.0, "Fornecedor A");
+    QCOMPARE(service.suppliers(), QStringList{"Fornecedor A"});
+
+    int orderId = 0;
+    QString error;
+    QVERIFY2(service.createOrder("Fornecedor A", {PurchaseLine{item, 20, 4.0}}, 1, &orderId, &error),
+             qPrintable(error));
+    QList<PurchaseOrderRow> orders;
+    QVERIFY(service.openOrders(&orders));
+    QCOMPARE(orders.size(), 1);
+    QCOMPARE(orders[0].status, QString("aberto"));
+
+    int receiptId = 0;
+    int units = 0;
+    QVERIFY2(service.receive(orderId, "123", {PurchaseLine{item, 6, 4.0}, PurchaseLine{item, 4, 4.0}}, 1,
+                             &receiptId, &units, &error),
+             qPrintable(error));
+    QCOMPARE(units, 10);
+    QCOMPARE(db.quantity(item), 20);
+    QCOMPARE(db.value("SELECT preco FROM itens WHERE id = ?", {item}).toDouble(), 3.0);
+    QCOMPARE(db.value("SELECT status FROM pedidos_compra WHERE id = ?", {orderId}).toString(), QString("parcial"));
+    QCOMPARE(db.value("SELECT motivo FROM movimentacoes WHERE item_id = ?", {item}).toString(),
+             QString("Recebimento do pedido #%1 (NF 123)").arg(orderId));
+
+    QVERIFY2(service.receive(orderId, QString(), {PurchaseLine{item, 10, 4.0}}, 1, &receiptId, &units, &error),
+             qPrintable(error));
+    QCOMPARE(db.quantity(item), 30);
+    QCOMPARE(db.value("SELECT status FROM pedidos_compra WHERE id = ?", {orderId}).toString(), QString("recebido"));
+    QVERIFY(service.openOrders(&orders));
+    QVERIFY(orders.isEmpty());
+}
+
+void TestPurchaseService::overReceiptIsRefused() {
+    TestDatabase db;
+    PurchaseService service(db.manager());
+    const int item = db.addItem("Botina", "222", 0, 50.0, "Fornecedor B");
+    const int other = db.addItem("Capacete", "333", 0, 30.0, "Fornecedor B");
+
+    int orderId = 0;
+    QString error;
+    QVERIFY2(service.createOrder("Fornecedor B", {PurchaseLine{item, 5, 50.0}}, 1, &orderId, &error),
+             qPrintable(error));
+    int receiptId = 0;
+    int units = 0;
+    QVERIFY(!service.receive(orderId, QString(), {PurchaseLine{item, 6, 50.0}}, 1, &receiptId, &units, &error));
+    QVERIFY(!service.receive(orderId, QString(), {PurchaseLine{other, 1, 30.0}}, 1, &receiptId, &units, &error));
+    QCOMPARE(db.quantity(item), 0);
+    QCOMPARE(db.value("SELECT COUNT(*) FROM recebimentos").toInt(), 0);
+    QCOMPARE(db.value("SELECT status FROM pedidos_compra WHERE id = ?", {orderId}).toString(), QString("aberto"));
+}
+
+void TestPurchaseService::cancelledOrdersCannotBeReceived() {
+    TestDatabase db;
+    PurchaseService service(db.manager());
+    const int item = db.addItem("Óculos", "444", 0, 10.0, "Fornecedor C");
+
+    int orderId = 0;
+    QString error;
+    QVERIFY(!service.createOrder("Fornecedor C", {PurchaseLine{999999, 1, 1.0}}, 1, &orderId, &error));
+    QCOMPARE(db.value("SELECT COUNT(*) FROM pedidos_compra").toInt(), 0);
+    QVERIFY2(service.createOrder("Fornecedor C", {PurchaseLine{item, 3, 10.0}}, 1, &orderId, &error),
+             qPrintable(error));
+    QVERIFY2(service.cancelOrder(orderId, 1, &error), qPrintable(error));
+    QVERIFY(!service.cancelOrder(orderId, 1, &error));
+    int receiptId = 0;
+    int units = 0;
+    QVERIFY(!service.receive(orderId, QString(), {PurchaseLine{item, 3, 10.0}}, 1, &receiptId, &units, &error));
+    QCOMPARE(db.quantity(item), 0);
+}
+
+QTEST_GUILESS_MAIN(TestPurchaseService)
+#include "tst_purchaseservice.moc"
@@ -0,0 +1,94 @@
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+#include "ArchiveManager.h"
+#include "ReportPack.h"
+#include "TestDatabase.h"
+
+namespace {
+QByteArray contents(const QString &path) {
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+}
+
+class TestReportPack : public QObject {
+    Q_OBJECT
+
+private slots:
+    void writesEveryReportOfTheMonth();
+    void archivedMonthsReadTheArchive();
+};
+
+void TestReportPack::writesEveryReportOfTheMonth() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDatabase db(dir.filePath("epi.db"));
+    const int gloves = db.addItem("Luva", "111", 2, 3.0);
+    db.addItem("Capacete", "222", 40, 50.0);
+    QVERIFY(db.manager()->executeQuery("UPDATE itens SET estoque_minimo = 5 WHERE id = ?", {gloves}));
+    const int ana = db.addCollaborator("ana", db.addCompany("Acme"));
+    db.addMovement(gloves, ana, -4, "2024-05-02 08:00:00");
+    db.addMovement(gloves, ana, -1, "2024-06-02 08:00:00");
+
+    ReportPackOptions options;
+    options.databaseFile = dir.filePath("epi.db");
+    options.outputDir = dir.filePath("relatorios");
+    options.month = QDate(2024, 5, 17);
+    options.pdf = false;
+    const ReportPackResult result = ReportPackRunner(options).run();
+    QVERIFY2(result.ok, qPrintable(result.errors.join('\n')));
+    QCOMPARE(result.scans, 2);
+    QCOMPARE(result.files.size(), 10);
+
+    const QString month = dir.filePath("relatorios/2024-05/");
+    for (const QString &stem : {"estoque-baixo", "inventario", "por-categoria", "entregas-por-empresa",
+                                "mais-consumidos"}) {
+        QVERIFY2(result.files.contains(month + stem + ".html"), qPrintable(stem));
+        QVERIFY2(result.files.contains(month + stem + ".csv"), qPrintable(stem));
+    }
+    const QByteArray lowStock = contents(month + "estoque-baixo.csv");
+    QVERIFY(lowStock.contains("Luva"));
+    QVERIFY(!lowStock.contains("Capacete"));
+    // Only May's withdrawal.
+    const QByteArray deliveries = contents(month + "entregas-por-empresa.csv");
+    QVERIFY(deliveries.contains("Acme"));
+    QVERIFY(deliveries.contains("2024-05-02"));
+    QVERIFY(!deliveries.contains("2024-06-02"));
+}
+
+void TestReportPack::archivedMonthsReadTheArchive() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDatabase db(dir.filePath("epi.db"));
+    ArchiveManager archives(db.manager(), dir.filePath("arquivo"));
+    const int gloves = db.addItem("Luva", "111", 100, 3.0);
+    const int ana = db.addCollaborator("ana", db.addCompany("Acme"));
+    db.addMovement(gloves, ana, -4, "2020-03-02 08:00:00");
+    db.addMovement(gloves, ana, -1, "2021-06-02 08:00:00");
+    QString error;
+    QVERIFY2(archives.archiveBefore(2021, &error), qPrintable(error));
+
+    ReportPackOptions options;
+    options.databaseFile = dir.filePath("epi.db");
+    options.outputDir = dir.filePath("relatorios");
+    options.month = QDate(2020, 3, 1);
+    options.reports = {PackReport::CompanyDeliveries};
+    options.pdf = false;
+    ReportPackResult result = ReportPackRunner(options).run();
+    QVERIFY2(result.ok, qPrintable(result.errors.join('\n')));
+    QVERIFY(contents(dir.filePath("relatorios/2020-03/entregas-por-empresa.csv")).contains("2020-03-02"));
+
+    // Without the archive the month is reported incomplete.
+    QVERIFY(QDir(dir.filePath("arquivo")).removeRecursively());
+    options.outputDir = dir.filePath("sem-arquivo");
+    options.archiveDir = dir.filePath("outro");
+    result = ReportPackRunner(options).run();
+    QVERIFY(!result.ok);
+    QCOMPARE(result.errors.size(), 1);
+    QVERIFY(result.errors[0].contains("2020"));
+}
+
+QTEST_GUILESS_MAIN(TestReportPack)
+#include "tst_reportpack.moc"
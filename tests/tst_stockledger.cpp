@@ -0,0 +1,67 @@
+#include <QHash>
+#include <QtTest>
+#include "StockLedger.h"
+#include "StockService.h"
+#include "TestDatabase.h"
+
+class TestStockLedger : public QObject {
+    Q_OBJECT
+
+private slots:
+    void inventoryReplaysChangesAfterTheSnapshot();
+    void momentsBeforeTheFirstSnapshotFail();
+    void ledgerRefusesRewrites();
+};
+
+void TestStockLedger::inventoryReplaysChangesAfterTheSnapshot() {
+    TestDatabase db;
+    StockLedger ledger(db.manager());
+    StockService service(db.manager());
+    const int gloves = db.addItem("Luva", "111", 10);
+    const int boots = db.addItem("Botina", "222", 4);
+    const int colaborador = db.addCollaborator("ana");
+    QVERIFY(ledger.snapshot());
+
+    QString error;
+    QVERIFY2(service.withdraw(colaborador, {StockLine{gloves, 4, 30}}, 1, QString(), &error), qPrintable(error));
+    QVERIFY(service.adjustTo(boots, 0, "Ajuste de estoque"));
+    const int helmet = db.addItem("Capacete", "333", 2);
+
+    QList<InventoryRow> rows;
+    QString basis;
+    QVERIFY2(ledger.inventoryAt(QDateTime::currentDateTime(), &rows, &basis, &error), qPrintable(error));
+    QVERIFY(!basis.isEmpty());
+    QHash<int, qint64> stock;
+    for (const InventoryRow &row : rows) {
+        stock.insert(row.itemId, row.quantidade);
+    }
+    QCOMPARE(stock.value(gloves), qint64(6));
+    QVERIFY(!stock.contains(boots));
+    QCOMPARE(stock.value(helmet), qint64(2));
+}
+
+void TestStockLedger::momentsBeforeTheFirstSnapshotFail() {
+    TestDatabase db;
+    StockLedger ledger(db.manager());
+    QList<InventoryRow> rows;
+    QString basis;
+    QString error;
+    QVERIFY(!ledger.inventoryAt(QDateTime::currentDateTime(), &rows, &basis, &error));
+    QVERIFY(!error.isEmpty());
+
+    QVERIFY(ledger.snapshot());
+    QVERIFY(!ledger.inventoryAt(QDateTime::currentDateTime().addDays(-1), &rows, &basis, &error));
+    QVERIFY(error.contains("a partir de"));
+}
+
+void TestStockLedger::ledgerRefusesRewrites() {
+    TestDatabase db;
+    db.addItem("Luva", "111", 10);
+    QCOMPARE(db.value("SELECT COUNT(*) FROM estoque_ledger").toInt(), 1);
+    QVERIFY(!db.manager()->executeQuery("UPDATE estoque_ledger SET delta = 0"));
+    QVERIFY(!db.manager()->executeQuery("DELETE FROM estoque_ledger"));
+    QCOMPARE(db.value("SELECT delta FROM estoque_ledger").toInt(), 10);
+}
+
+QTEST_GUILESS_MAIN(TestStockLedger)
+#include "tst_stockledger.moc"
@@ -0,0 +1,104 @@
+#include <QtTest>
+#include "StockService.h"
+#include "TestDatabase.h"
+
+class TestStockService : public QObject {
+    Q_OBJECT
+
+private slots:
+    void withdrawDecrementsStockAndLogsMovement();
+    void failedLineRollsBackTheWholeBatch();
+    void reservationsHoldStockFromOtherOwners();
+    void returnCannotExceedBalance();
+    void adjustToRecordsTheDifference();
+};
+
+void TestStockService::withdrawDecrementsStockAndLogsMovement() {
+    TestDatabase db;
+    StockService service(db.manager());
+    const int item = db.addItem("Luva Nitrílica", "12345", 10);
+    const int colaborador = db.addCollaborator("ana");
+
+    QString error;
+    QVERIFY2(service.withdraw(colaborador, {StockLine{item, 3, 30}}, 1, "balcao-1", &error), qPrintable(error));
+    QCOMPARE(db.quantity(item), 7);
+    QCOMPARE(db.value("SELECT alteracao_quantidade FROM movimentacoes WHERE item_id = ? AND colaborador_id = ?",
+                      {item, colaborador})
+                 .toInt(),
+             -3);
+
+    QList<BalanceRow> balance;
+    QVERIFY(service.balance(colaborador, &balance));
+    QCOMPARE(balance.size(), 1);
+    QCOMPARE(balance[0].itemId, item);
+    QCOMPARE(balance[0].quantidade, 3);
+}
+
+void TestStockService::failedLineRollsBackTheWholeBatch() {
+    TestDatabase db;
+    StockService service(db.manager());
+    const int gloves = db.addItem("Luva", "111", 10);
+    const int mask = db.addItem("Máscara PFF2", "222", 2);
+    const int colaborador = db.addCollaborator("bruno");
+
+    QString error;
+    QVERIFY(!service.withdraw(colaborador, {StockLine{gloves, 1, 30}, StockLine{mask, 5, 30}}, 1, "balcao-1", &error));
+    QVERIFY(error.contains("Estoque insuficiente"));
+    QCOMPARE(db.quantity(gloves), 10);
+    QCOMPARE(db.quantity(mask), 2);
+    QCOMPARE(db.value("SELECT COUNT(*) FROM movimentacoes WHERE colaborador_id = ?", {colaborador}).toInt(), 0);
+}
+
+void TestStockService::reservationsHoldStockFromOtherOwners() {
+    TestDatabase db;
+    StockService service(db.manager());
+    const int item = db.addItem("Capacete", "333", 5);
+    const int colaborador = db.addCollaborator("carla");
+
+    int available = -1;
+    QVERIFY(service.reserve("balcao-a", item, 4, &available));
+    QCOMPARE(service.available(item, "balcao-b"), 1);
+    QCOMPARE(service.available(item, "balcao-a"), 5);
+    QVERIFY(!service.reserve("balcao-b", item, 2, &available));
+    QCOMPARE(available, 1);
+
+    QString error;
+    QVERIFY(!service.withdraw(colaborador, {StockLine{item, 2, 30}}, 1, "balcao-b", &error));
+    QVERIFY2(service.withdraw(colaborador, {StockLine{item, 4, 30}}, 1, "balcao-a", &error), qPrintable(error));
+    QCOMPARE(db.quantity(item), 1);
+    QCOMPARE(db.value("SELECT COUNT(*) FROM reservas WHERE dono = 'balcao-a'").toInt(), 0);
+}
+
+void TestStockService::returnCannotExceedBalance() {
+    TestDatabase db;
+    StockService service(db.manager());
+    const int item = db.addItem("Óculos", "444", 5);
+    const int colaborador = db.addCollaborator("diego");
+
+    QString error;
+    QVERIFY2(service.withdraw(colaborador, {StockLine{item, 2, 30}}, 1, QString(), &error), qPrintable(error));
+    QVERIFY(!service.returnItems(colaborador, {StockLine{item, 3, 0}}, 1, &error));
+    QCOMPARE(db.quantity(item), 3);
+    QVERIFY2(service.returnItems(colaborador, {StockLine{item, 2, 0}}, 1, &error), qPrintable(error));
+    QCOMPARE(db.quantity(item), 5);
+
+    QList<BalanceRow> balance;
+    QVERIFY(service.balance(colaborador, &balance));
+    QVERIFY(balance.isEmpty());
+}
+
+void TestStockService::adjustToRecordsTheDifference() {
+    TestDatabase db;
+    StockService service(db.manager());
+    const int item = db.addItem("Botina", "555", 10);
+
+    QVERIFY(service.adjustTo(item, 15, "Ajuste de estoque"));
+    QCOMPARE(db.quantity(item), 15);
+    QCOMPARE(db.value("SELECT alteracao_quantidade FROM movimentacoes WHERE item_id = ?", {item}).toInt(), 5);
+
+    QVERIFY(service.adjustTo(item, 15, "Ajuste de estoque"));
+    QCOMPARE(db.value("SELECT COUNT(*) FROM movimentacoes WHERE item_id = ?", {item}).toInt(), 1);
+}
+
+QTEST_GUILESS_MAIN(TestStockService)
+#include "tst_stockservice.moc"
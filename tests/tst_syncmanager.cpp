@@ -0,0 +1,139 @@
+#include <QHostAddress>
+#include <QTemporaryDir>
+#include <QtTest>
+#include "StockService.h"
+#include "SyncManager.h"
+#include "TestDatabase.h"
+
+class TestSyncManager : public QObject {
+    Q_OBJECT
+
+private slots:
+    void firstSyncNeverSumsExistingStock();
+    void laterChangesMergeByDelta();
+    void fileExportWaitsForAcknowledgement();
+    void serveNeedsASecretBeyondLoopback();
+};
+
+namespace {
+// Exports everything site has for peer into dir and applies it there.
+bool ship(SyncManager &from, SyncManager &to, const QTemporaryDir &dir, SyncStats *stats, int *changes = nullptr) {
+    static int sequence = 0;
+    const QString fileName = dir.filePath(QString("lote-%1.episync").arg(++sequence));
+    int exported = 0;
+    QString error;
+    if (!from.exportFile(to.siteId(), fileName, &exported, &error) || !to.importFile(fileName, stats, &error)) {
+        qWarning() << error;
+        return false;
+    }
+    if (changes) *changes = exported;
+    return true;
+}
+}
+
+void TestSyncManager::firstSyncNeverSumsExistingStock() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDatabase a, b;
+    SyncManager siteA(a.manager()), siteB(b.manager());
+    QVERIFY(siteA.siteId() != siteB.siteId());
+    a.addItem("Luva", "111", 10);
+    const int gloves = b.addItem("Luva", "111", 10);
+    a.addItem("Capacete", "222", 5);
+
+    SyncStats stats;
+    QVERIFY(ship(siteA, siteB, dir, &stats));
+    QCOMPARE(stats.origem, siteA.siteId());
+    QCOMPARE(stats.conflicts, 0);
+    // The item both sites had keeps B's own stock; the new one copies A's.
+    QCOMPARE(b.quantity(gloves), 10);
+    QCOMPARE(b.value("SELECT quantidade FROM itens WHERE nome = 'Capacete'").toInt(), 5);
+    QCOMPARE(b.value("SELECT COUNT(*) FROM itens WHERE nome = 'Luva'").toInt(), 1);
+
+    // Nor does the way back.
+    QVERIFY(ship(siteB, siteA, dir, &stats));
+    QCOMPARE(a.value("SELECT quantidade FROM itens WHERE nome = 'Luva'").toInt(), 10);
+    QCOMPARE(a.value("SELECT quantidade FROM itens WHERE nome = 'Capacete'").toInt(), 5);
+}
+
+void TestSyncManager::laterChangesMergeByDelta() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDatabase a, b;
+    SyncManager siteA(a.manager()), siteB(b.manager());
+    const int gloves = a.addItem("Luva", "111", 10);
+    const int ana = a.addCollaborator("ana");
+    SyncStats stats;
+    QVERIFY(ship(siteA, siteB, dir, &stats));
+    QVERIFY(ship(siteB, siteA, dir, &stats));
+    const int glovesAtB = b.value("SELECT id FROM itens WHERE nome = 'Luva'").toInt();
+    const int anaAtB = b.value("SELECT id FROM usuarios WHERE nome_usuario = 'ana'").toInt();
+    QVERIFY(glovesAtB > 0);
+    QVERIFY(anaAtB > 0);
+
+    // A withdrawal at each site: both count everywhere.
+    QString error;
+    QVERIFY2(StockService(a.manager()).withdraw(ana, {StockLine{gloves, 2, 30}}, 1, QString(), &error),
+             qPrintable(error));
+    QVERIFY2(StockService(b.manager()).withdraw(anaAtB, {StockLine{glovesAtB, 3, 30}}, 1, QString(), &error),
+             qPrintable(error));
+    QVERIFY(ship(siteA, siteB, dir, &stats));
+    QVERIFY(ship(siteB, siteA, dir, &stats));
+    QCOMPARE(a.quantity(gloves), 5);
+    QCOMPARE(b.quantity(glovesAtB), 5);
+    QCOMPARE(a.value("SELECT COUNT(*) FROM movimentacoes").toInt(), 2);
+    QCOMPARE(b.value("SELECT COUNT(*) FROM movimentacoes").toInt(), 2);
+}
+
+void TestSyncManager::fileExportWaitsForAcknowledgement() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    TestDatabase a, b;
+    SyncManager siteA(a.manager()), siteB(b.manager());
+    a.addItem("Luva", "111", 10);
+    const QString peerB = siteB.siteId();
+    auto sent = [&a, &peerB] {
+        return a.value("SELECT COALESCE((SELECT enviado FROM sync_pares WHERE par = ?), 0)", {peerB}).toLongLong();
+    };
+
+    // Written but unconfirmed: the next export repeats it.
+    int changes = 0;
+    QString error;
+    QVERIFY(siteA.exportFile(peerB, dir.filePath("perdido.episync"), &changes, &error));
+    QVERIFY(changes > 0);
+    QCOMPARE(sent(), qint64(0));
+    SyncStats stats;
+    int repeated = 0;
+    QVERIFY(ship(siteA, siteB, dir, &stats, &repeated));
+    QCOMPARE(repeated, changes);
+    QCOMPARE(sent(), qint64(0));
+
+    // B's next file acknowledges it, and A stops resending.
+    QVERIFY(ship(siteB, siteA, dir, &stats));
+    QVERIFY(sent() > 0);
+    QVERIFY(siteA.exportFile(peerB, dir.filePath("vazio.episync"), &changes, &error));
+    QCOMPARE(changes, 0);
+
+    // Re-importing an old file applies nothing twice.
+    SyncStats again;
+    QVERIFY(siteB.importFile(dir.filePath("perdido.episync"), &again, &error));
+    QCOMPARE(again.applied, 0);
+    QCOMPARE(again.skipped, repeated);
+    QCOMPARE(b.value("SELECT quantidade FROM itens WHERE nome = 'Luva'").toInt(), 10);
+}
+
+void TestSyncManager::serveNeedsASecretBeyondLoopback() {
+    TestDatabase db;
+    SyncManager site(db.manager());
+    QString error;
+    QVERIFY(!site.serve(QHostAddress::Any, 0, &error));
+    QVERIFY(!error.isEmpty());
+    QVERIFY2(site.serve(QHostAddress::LocalHost, 0, &error), qPrintable(error));
+
+    SyncManager secured(db.manager());
+    secured.setSharedSecret("segredo");
+    QVERIFY2(secured.serve(QHostAddress::Any, 0, &error), qPrintable(error));
+}
+
+QTEST_GUILESS_MAIN(TestSyncManager)
+#include "tst_syncmanager.moc"